@@ -17,7 +17,10 @@
 #include <digestgenerator.h>
 #include <env.h>
 #include <fileutils.h>
+#include <localpreprocessor.h>
+#include <pathtable.h>
 #include <reccdefaults.h>
+#include <responsefile.h>
 #include <threadutils.h>
 
 #include <buildboxcommon_logging.h>
@@ -120,24 +123,40 @@ ActionBuilder::prefixWorkingDirectory(const std::string &workingDirectory,
     return prefix + "/" + workingDirectory;
 }
 
-void addFileToMerkleTreeHelper(const PathRewritePair &dep_paths,
-                               const std::string &cwd,
-                               NestedDirectory *nestedDirectory,
-                               digest_string_umap *digest_to_filecontents)
+void ActionBuilder::addGeneratedFile(
+    const std::string &fileName, const std::string &contents,
+    const std::string &workingDirectory, NestedDirectory *nestedDirectory,
+    digest_string_umap *digest_to_filecontents)
 {
-    // If this path is relative, prepend the remote cwd to it
-    // and normalize it, getting rid of any '../' present
-    std::string merklePath(dep_paths.second);
-    if (merklePath[0] != '/' && !cwd.empty()) {
-        merklePath = cwd + "/" + merklePath;
+    std::string merklePath = fileName;
+    if (!workingDirectory.empty()) {
+        merklePath = workingDirectory + "/" + merklePath;
     }
     merklePath = buildboxcommon::FileUtils::normalizePath(merklePath.c_str());
 
+    const auto digest = DigestGenerator::make_digest(contents);
+    const auto file = std::make_shared<ReccFile>(fileName, fileName, contents,
+                                                 digest, false);
+    nestedDirectory->add(file, merklePath.c_str(), true);
+    (*digest_to_filecontents)[digest] = file->getFileContents();
+}
+
+void addFileToMerkleTreeHelper(const PathRewritePair &dep_paths,
+                               const PathTable &merklePaths,
+                               PathTable::PathId merklePath,
+                               NestedDirectory *nestedDirectory,
+                               digest_string_umap *digest_to_filecontents)
+{
     // don't include a dependency if it's exclusion is requested
-    if (FileUtils::hasPathPrefixes(merklePath, RECC_DEPS_EXCLUDE_PATHS)) {
-        const std::lock_guard<std::mutex> lock(LogWriteMutex);
-        BUILDBOX_LOG_DEBUG("Skipping \"" << merklePath << "\"");
-        return;
+    const PathPrefixMatcher &excludedPaths = Env::deps_exclude_paths_matcher();
+    if (excludedPaths.size() > 0) {
+        static thread_local std::string merklePathString;
+        merklePaths.toString(merklePath, &merklePathString);
+        if (excludedPaths.matches(merklePathString)) {
+            const std::lock_guard<std::mutex> lock(LogWriteMutex);
+            BUILDBOX_LOG_DEBUG("Skipping \"" << merklePathString << "\"");
+            return;
+        }
     }
 
     std::shared_ptr<ReccFile> file =
@@ -153,7 +172,7 @@ void addFileToMerkleTreeHelper(const PathRewritePair &dep_paths,
         const std::lock_guard<std::mutex> lock(ContainerWriteMutex);
         // All necessary merkle path path transformations have already been
         // applied, don't have nestedDirectory apply any additional ones.
-        nestedDirectory->add(file, merklePath.c_str(), true);
+        nestedDirectory->add(file, merklePaths, merklePath);
         (*digest_to_filecontents)[file->getDigest()] = file->getFileContents();
     }
 }
@@ -169,11 +188,24 @@ void ActionBuilder::buildMerkleTree(DependencyPairs &dependency_paths,
 
     BUILDBOX_LOG_DEBUG("Building Merkle tree");
 
+    // Normalize every Merkle path once, up front: relative paths are
+    // prefixed with the remote cwd and any '../' is resolved. The table
+    // is only read from the worker threads.
+    PathTable merklePaths;
+    merklePaths.reserve(dependency_paths.size());
+    for (const auto &dep_paths : dependency_paths) {
+        merklePaths.add(dep_paths.second, cwd);
+    }
+
+    const auto begin = dependency_paths.begin();
     std::function<void(DependencyPairs::iterator, DependencyPairs::iterator)>
         createMerkleTreeFromIterators = [&](DependencyPairs::iterator start,
                                             DependencyPairs::iterator end) {
             for (; start != end; ++start) {
-                addFileToMerkleTreeHelper(*start, cwd, nestedDirectory,
+                const auto merklePath =
+                    static_cast<PathTable::PathId>(start - begin);
+                addFileToMerkleTreeHelper(*start, merklePaths, merklePath,
+                                          nestedDirectory,
                                           digest_to_filecontents);
             }
         };
@@ -182,6 +214,7 @@ void ActionBuilder::buildMerkleTree(DependencyPairs &dependency_paths,
 }
 
 void ActionBuilder::getDependencies(const ParsedCommand &command,
+                                    const std::string &cwd,
                                     std::set<std::string> *dependencies,
                                     std::set<std::string> *products)
 {
@@ -189,7 +222,7 @@ void ActionBuilder::getDependencies(const ParsedCommand &command,
     BUILDBOX_LOG_DEBUG("Getting dependencies using the command:");
     if (RECC_VERBOSE == true) {
         std::ostringstream dep_command;
-        for (auto &depc : command.get_dependencies_command()) {
+        for (const auto &depc : command.get_dependencies_command()) {
             dep_command << depc << " ";
         }
         BUILDBOX_LOG_DEBUG(dep_command.str());
@@ -200,7 +233,7 @@ void ActionBuilder::getDependencies(const ParsedCommand &command,
         buildboxcommon::buildboxcommonmetrics::MetricGuard<
             buildboxcommon::buildboxcommonmetrics::DurationMetricTimer>
             mt(TIMER_NAME_COMPILER_DEPS);
-        fileInfo = Deps::get_file_info(command);
+        fileInfo = Deps::get_file_info(command, cwd);
     }
 
     *dependencies = fileInfo.d_dependencies;
@@ -225,7 +258,7 @@ ActionBuilder::BuildAction(const ParsedCommand &command,
     // "[...] the path to the executable [...] must be either a relative
     // path, in which case it is evaluated with respect to the input root,
     // or an absolute path."
-    const auto executableName = command.get_command().front();
+    const auto &executableName = command.get_command().front();
     if (executableName.find('/') == std::string::npos) {
         throw std::invalid_argument("Command does not contain a relative or "
                                     "absolute path to an executable");
@@ -233,22 +266,54 @@ ActionBuilder::BuildAction(const ParsedCommand &command,
 
     std::string commandWorkingDirectory;
     NestedDirectory nestedDirectory;
+    std::vector<std::string> remoteCommand = command.get_command();
 
     std::set<std::string> products = RECC_OUTPUT_FILES_OVERRIDE;
     if (!RECC_DEPS_DIRECTORY_OVERRIDE.empty()) {
         BUILDBOX_LOG_DEBUG("Building Merkle tree using directory override");
         // when RECC_DEPS_DIRECTORY_OVERRIDE is set, we will not follow
         // symlinks to help us avoid getting into endless loop
-        nestedDirectory =
-            make_nesteddirectory(RECC_DEPS_DIRECTORY_OVERRIDE.c_str(),
-                                 digest_to_filecontents, false);
+        const std::string directoryOverride =
+            RECC_DEPS_DIRECTORY_OVERRIDE.front() == '/'
+                ? RECC_DEPS_DIRECTORY_OVERRIDE
+                : cwd + "/" + RECC_DEPS_DIRECTORY_OVERRIDE;
+        nestedDirectory = make_nesteddirectory(
+            directoryOverride.c_str(), digest_to_filecontents, false);
         commandWorkingDirectory = RECC_WORKING_DIR_PREFIX;
     }
+    else if (RECC_PREPROCESS_LOCALLY && RECC_DEPS_OVERRIDE.empty() &&
+             !RECC_FORCE_REMOTE && LocalPreprocessor::supports(command)) {
+        PreprocessedSource preprocessed;
+        try {
+            preprocessed = LocalPreprocessor::preprocess(command, cwd);
+        }
+        catch (const subprocess_failed_error &) {
+            BUILDBOX_LOG_DEBUG("Running locally to display the error.");
+            return nullptr;
+        }
+
+        if (RECC_OUTPUT_DIRECTORIES_OVERRIDE.empty() &&
+            RECC_OUTPUT_FILES_OVERRIDE.empty()) {
+            products = preprocessed.d_products;
+        }
+        remoteCommand = preprocessed.d_command;
+
+        // The preprocessed file is the only input, and lives in the working
+        // directory.
+        const auto commonAncestor =
+            commonAncestorPath(DependencyPairs(), products, cwd);
+        commandWorkingDirectory =
+            prefixWorkingDirectory(commonAncestor, RECC_WORKING_DIR_PREFIX);
+
+        addGeneratedFile(preprocessed.d_fileName, preprocessed.d_contents,
+                         commandWorkingDirectory, &nestedDirectory,
+                         digest_to_filecontents);
+    }
     else {
         std::set<std::string> deps;
         if (RECC_DEPS_OVERRIDE.empty() && !RECC_FORCE_REMOTE) {
             try {
-                getDependencies(command, &deps, &products);
+                getDependencies(command, cwd, &deps, &products);
             }
             catch (const subprocess_failed_error &) {
                 BUILDBOX_LOG_DEBUG("Running locally to display the error.");
@@ -260,11 +325,17 @@ ActionBuilder::BuildAction(const ParsedCommand &command,
         }
         // Go through all the dependencies and apply any required path
         // transformations, constructing DependencyParis
-        // corresponding to filesystem path -> transformed merkle tree path
+        // corresponding to filesystem path -> transformed merkle tree path.
+        // Relative paths are read from `cwd`, which needn't be the current
+        // directory.
         DependencyPairs dep_path_pairs;
         for (const auto &dep : deps) {
             std::string modifiedDep(dep);
-            if (modifiedDep[0] == '/') {
+            std::string localPath(dep);
+            if (modifiedDep[0] != '/') {
+                localPath = cwd + "/" + dep;
+            }
+            else {
                 modifiedDep = FileUtils::resolvePathFromPrefixMap(modifiedDep);
                 modifiedDep =
                     FileUtils::makePathRelative(modifiedDep, cwd.c_str());
@@ -272,7 +343,7 @@ ActionBuilder::BuildAction(const ParsedCommand &command,
                                    << dep << "] to remote path: ["
                                    << modifiedDep << "]");
             }
-            dep_path_pairs.push_back(std::make_pair(dep, modifiedDep));
+            dep_path_pairs.push_back(std::make_pair(localPath, modifiedDep));
         }
 
         const auto commonAncestor =
@@ -292,6 +363,21 @@ ActionBuilder::BuildAction(const ParsedCommand &command,
         nestedDirectory.addDirectory(commandWorkingDirectory.c_str(), true);
     }
 
+    if (command.uses_response_files() && remoteCommand.size() > 1) {
+        // Pass the arguments, with their paths rewritten, in a response file
+        // as they were given. It is named after its contents so that it
+        // can't clash with other inputs.
+        const std::string contents = ResponseFile::serialize(
+            std::vector<std::string>(remoteCommand.begin() + 1,
+                                     remoteCommand.end()));
+        const std::string fileName =
+            "recc-" + DigestGenerator::make_digest(contents).hash() + ".rsp";
+        addGeneratedFile(fileName, contents, commandWorkingDirectory,
+                         &nestedDirectory, digest_to_filecontents);
+        remoteCommand.resize(1);
+        remoteCommand.push_back("@" + fileName);
+    }
+
     for (const auto &product : products) {
         if (!product.empty() && product[0] == '/') {
             BUILDBOX_LOG_DEBUG(
@@ -307,7 +393,7 @@ ActionBuilder::BuildAction(const ParsedCommand &command,
     const auto directoryDigest = nestedDirectory.to_digest(blobs);
 
     const proto::Command commandProto = generateCommandProto(
-        command.get_command(), products, RECC_OUTPUT_DIRECTORIES_OVERRIDE,
+        remoteCommand, products, RECC_OUTPUT_DIRECTORIES_OVERRIDE,
         RECC_REMOTE_ENV, RECC_REMOTE_PLATFORM, commandWorkingDirectory);
     BUILDBOX_LOG_DEBUG("Command: " << commandProto.ShortDebugString());
 
@@ -88,11 +88,22 @@ struct ActionBuilder {
                                 digest_string_umap *digest_to_filecontents);
 
     /**
-     * Gathers the `CommandFileInfo` belonging to the given `command` and
-     * populates its dependency and product list (the latter only if no
-     * overrides are set).
+     * Add a file with the given name and contents to the given working
+     * directory of the Merkle tree, and to `digest_to_filecontents`.
+     */
+    static void addGeneratedFile(const std::string &fileName,
+                                 const std::string &contents,
+                                 const std::string &workingDirectory,
+                                 NestedDirectory *nestedDirectory,
+                                 digest_string_umap *digest_to_filecontents);
+
+    /**
+     * Gathers the `CommandFileInfo` belonging to the given `command`, run
+     * in `cwd`, and populates its dependency and product list (the latter
+     * only if no overrides are set).
      */
     static void getDependencies(const ParsedCommand &command,
+                                const std::string &cwd,
                                 std::set<std::string> *dependencies,
                                 std::set<std::string> *products);
 
@@ -0,0 +1,395 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <batch.h>
+
+#include <actionbuilder.h>
+#include <circuitbreaker.h>
+#include <deps.h>
+#include <digestgenerator.h>
+#include <env.h>
+#include <fileutils.h>
+#include <parsedcommandfactory.h>
+#include <reccfile.h>
+#include <subprocess.h>
+
+#include <buildboxcommon_logging.h>
+#include <buildboxcommonmetrics_countingmetricutil.h>
+
+#include <google/protobuf/struct.pb.h>
+#include <google/protobuf/util/json_util.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#define COUNTER_NAME_BATCH_ACTION_CACHE_HITS "recc.batch.action_cache_hits"
+#define COUNTER_NAME_BATCH_REMOTE_EXECUTIONS "recc.batch.remote_executions"
+#define COUNTER_NAME_BATCH_LOCAL_EXECUTIONS "recc.batch.local_executions"
+
+namespace BloombergLP {
+namespace recc {
+
+namespace {
+
+/**
+ * Call `function` with every index in [0, count), from up to `jobs`
+ * threads at once. `function` must not throw.
+ */
+void forEachConcurrently(size_t count, int jobs,
+                         const std::function<void(size_t)> &function)
+{
+    std::atomic<size_t> next(0);
+    const auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            function(i);
+        }
+    };
+
+    const size_t threadCount =
+        std::min(count, static_cast<size_t>(std::max(jobs, 1)));
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+std::string stringField(const google::protobuf::Struct &entry,
+                        const std::string &name, bool required)
+{
+    const auto it = entry.fields().find(name);
+    if (it == entry.fields().end() && !required) {
+        return "";
+    }
+    if (it == entry.fields().end() ||
+        it->second.kind_case() != google::protobuf::Value::kStringValue) {
+        throw std::runtime_error("Entry without a \"" + name +
+                                 "\" string: " + entry.ShortDebugString());
+    }
+    return it->second.string_value();
+}
+
+std::string describe(const BatchCommand &command)
+{
+    return command.d_file.empty() ? command.d_arguments.front()
+                                  : command.d_file;
+}
+
+void recordCounter(const std::string &name)
+{
+    buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+        recordCounterMetric(name, 1);
+}
+
+} // namespace
+
+std::vector<BatchCommand>
+Batch::parseCompilationDatabase(const std::string &json)
+{
+    google::protobuf::ListValue entries;
+    const auto status =
+        google::protobuf::util::JsonStringToMessage(json, &entries);
+    if (!status.ok()) {
+        throw std::runtime_error("Not a JSON array: " + status.ToString());
+    }
+
+    std::vector<BatchCommand> result;
+    for (const auto &value : entries.values()) {
+        if (value.kind_case() != google::protobuf::Value::kStructValue) {
+            throw std::runtime_error("Entry is not an object: " +
+                                     value.ShortDebugString());
+        }
+        const auto &entry = value.struct_value();
+
+        BatchCommand command;
+        command.d_directory = stringField(entry, "directory", true);
+        command.d_file = stringField(entry, "file", false);
+
+        const auto arguments = entry.fields().find("arguments");
+        if (arguments != entry.fields().end()) {
+            if (arguments->second.kind_case() !=
+                google::protobuf::Value::kListValue) {
+                throw std::runtime_error("\"arguments\" is not an array: " +
+                                         entry.ShortDebugString());
+            }
+            for (const auto &argument :
+                 arguments->second.list_value().values()) {
+                if (argument.kind_case() !=
+                    google::protobuf::Value::kStringValue) {
+                    throw std::runtime_error(
+                        "\"arguments\" contains a non-string: " +
+                        entry.ShortDebugString());
+                }
+                command.d_arguments.push_back(argument.string_value());
+            }
+        }
+        else {
+            command.d_arguments =
+                splitCommandLine(stringField(entry, "command", true));
+        }
+
+        if (command.d_arguments.empty()) {
+            throw std::runtime_error("Entry with an empty command: " +
+                                     entry.ShortDebugString());
+        }
+        result.push_back(command);
+    }
+    return result;
+}
+
+std::vector<std::string>
+Batch::splitCommandLine(const std::string &commandLine)
+{
+    std::vector<std::string> result;
+    std::string current;
+    bool inArgument = false;
+    char quote = '\0';
+
+    for (size_t i = 0; i < commandLine.size(); ++i) {
+        const char c = commandLine[i];
+        if (quote == '\'') {
+            if (c == '\'') {
+                quote = '\0';
+            }
+            else {
+                current += c;
+            }
+        }
+        else if (c == '\\' && i + 1 < commandLine.size() &&
+                 (quote == '\0' ||
+                  strchr("\"\\$`", commandLine[i + 1]) != nullptr)) {
+            current += commandLine[++i];
+            inArgument = true;
+        }
+        else if (quote == '"') {
+            if (c == '"') {
+                quote = '\0';
+            }
+            else {
+                current += c;
+            }
+        }
+        else if (c == '\'' || c == '"') {
+            quote = c;
+            inArgument = true;
+        }
+        else if (isspace(static_cast<unsigned char>(c))) {
+            if (inArgument) {
+                result.push_back(current);
+                current.clear();
+                inArgument = false;
+            }
+        }
+        else {
+            current += c;
+            inArgument = true;
+        }
+    }
+
+    if (quote != '\0') {
+        throw std::runtime_error("Unterminated quote in command: " +
+                                 commandLine);
+    }
+    if (inArgument) {
+        result.push_back(current);
+    }
+    return result;
+}
+
+std::vector<BatchResult>
+Batch::run(const std::vector<BatchCommand> &commands,
+           RemoteExecutionClient *client, int jobs)
+{
+    std::vector<BatchResult> results(commands.size());
+    std::vector<ParsedCommand> parsedCommands(commands.size());
+
+    CircuitBreaker *breaker = CircuitBreaker::instance();
+    const auto serversUnavailable = [breaker]() {
+        return breaker != nullptr && !breaker->allowRequests();
+    };
+
+    if (RECC_CAS_GET_CAPABILITIES) {
+        try {
+            client->setUpFromServerCapabilities();
+        }
+        catch (const std::exception &e) {
+            BUILDBOX_LOG_WARNING("Could not get the capabilities of \""
+                                 << RECC_CAS_SERVER << "\": " << e.what());
+        }
+    }
+
+    // Each command is handled from start to finish by one worker: its
+    // Action is built from its directory, looked up in the action cache,
+    // and, if needed, its inputs are uploaded and it is executed. Only the
+    // blobs of one Action are held in memory at a time per worker. Headers
+    // shared between the commands are only read and hashed once, and blobs
+    // that were uploaded for an earlier command are not uploaded again.
+    std::mutex uploadedMutex;
+    digest_uset uploaded;
+    ReccFileFactory::setCacheEnabled(true);
+    forEachConcurrently(commands.size(), jobs, [&](size_t i) {
+        const BatchCommand &command = commands[i];
+        BatchResult &result = results[i];
+        if (serversUnavailable()) {
+            return;
+        }
+
+        try {
+            parsedCommands[i] = ParsedCommandFactory::createParsedCommand(
+                command.d_arguments, command.d_directory);
+            const ParsedCommand &parsedCommand = parsedCommands[i];
+            if (!parsedCommand.is_compiler_command() && !RECC_FORCE_REMOTE) {
+                return;
+            }
+
+            digest_string_umap blobs;
+            digest_string_umap files;
+            const auto action = ActionBuilder::BuildAction(
+                parsedCommand, command.d_directory, &files, &blobs);
+            if (!action) {
+                return;
+            }
+            const auto actionDigest = DigestGenerator::make_digest(*action);
+
+            ActionResult actionResult;
+            if (!RECC_SKIP_CACHE) {
+                try {
+                    if (client->fetch_from_action_cache(
+                            actionDigest, parsedCommand.get_products(),
+                            RECC_INSTANCE, &actionResult)) {
+                        result.d_origin = BatchResult::ActionCache;
+                    }
+                }
+                catch (const std::exception &e) {
+                    BUILDBOX_LOG_ERROR(
+                        "Error while querying action cache at \""
+                        << RECC_ACTION_CACHE_SERVER << "\": " << e.what());
+                }
+            }
+
+            if (result.d_origin == BatchResult::NotRun) {
+                blobs[actionDigest] = action->SerializeAsString();
+                {
+                    const std::lock_guard<std::mutex> lock(uploadedMutex);
+                    for (auto *blobMap : {&blobs, &files}) {
+                        for (auto it = blobMap->begin();
+                             it != blobMap->end();) {
+                            it = uploaded.count(it->first) == 0
+                                     ? std::next(it)
+                                     : blobMap->erase(it);
+                        }
+                    }
+                }
+
+                BUILDBOX_LOG_DEBUG("Uploading resources...");
+                client->upload_resources(blobs, files);
+                {
+                    const std::lock_guard<std::mutex> lock(uploadedMutex);
+                    for (const auto *blobMap : {&blobs, &files}) {
+                        for (const auto &blob : *blobMap) {
+                            uploaded.insert(blob.first);
+                        }
+                    }
+                }
+                blobs.clear();
+                files.clear();
+
+                actionResult =
+                    client->execute_action(actionDigest, RECC_SKIP_CACHE);
+                result.d_origin = BatchResult::Remote;
+            }
+
+            result.d_stdOut = client->get_outputblob(actionResult.d_stdOut);
+            result.d_stdErr = client->get_outputblob(actionResult.d_stdErr);
+            if (!RECC_DONT_SAVE_OUTPUT) {
+                client->write_files_to_disk(actionResult,
+                                            command.d_directory.c_str());
+                if (actionResult.d_exitCode == 0) {
+                    Deps::record_depfile(parsedCommand, command.d_directory);
+                }
+            }
+            result.d_exitCode = actionResult.d_exitCode;
+        }
+        catch (const std::exception &e) {
+            BUILDBOX_LOG_ERROR("Error while running \""
+                               << describe(command)
+                               << "\" remotely, running it locally: "
+                               << e.what());
+            result = BatchResult();
+        }
+    });
+    ReccFileFactory::setCacheEnabled(false);
+
+    // Whatever couldn't be run remotely is run locally, in its directory,
+    // a few at a time:
+    std::vector<size_t> localCommands;
+    std::vector<std::vector<std::string>> localArguments;
+    std::vector<std::string> localDirectories;
+    for (size_t i = 0; i < commands.size(); ++i) {
+        const BatchResult &result = results[i];
+        if (result.d_origin != BatchResult::NotRun) {
+            recordCounter(result.d_origin == BatchResult::ActionCache
+                              ? COUNTER_NAME_BATCH_ACTION_CACHE_HITS
+                              : COUNTER_NAME_BATCH_REMOTE_EXECUTIONS);
+            continue;
+        }
+        localCommands.push_back(i);
+        localArguments.push_back(commands[i].d_arguments);
+        localDirectories.push_back(commands[i].d_directory);
+    }
+
+    const unsigned int cores = std::thread::hardware_concurrency();
+    const int localJobs =
+        cores > 0 ? std::min(jobs, static_cast<int>(cores)) : 1;
+    try {
+        const auto localResults = Subprocess::executeAll(
+            localArguments, localDirectories, localJobs);
+        for (size_t j = 0; j < localCommands.size(); ++j) {
+            const size_t i = localCommands[j];
+            BatchResult &result = results[i];
+            result.d_origin = BatchResult::Local;
+            result.d_exitCode = localResults[j].d_exitCode;
+            result.d_stdOut = localResults[j].d_stdOut;
+            result.d_stdErr = localResults[j].d_stdErr;
+            recordCounter(COUNTER_NAME_BATCH_LOCAL_EXECUTIONS);
+            if (result.d_exitCode == 0) {
+                Deps::record_depfile(parsedCommands[i],
+                                     commands[i].d_directory);
+            }
+        }
+    }
+    catch (const std::exception &e) {
+        for (const size_t i : localCommands) {
+            results[i].d_exitCode = 1;
+            results[i].d_stdErr = std::string("recc: Error running command "
+                                              "locally: ") +
+                                  e.what() + "\n";
+        }
+    }
+
+    return results;
+}
+
+} // namespace recc
+} // namespace BloombergLP
@@ -0,0 +1,89 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_BATCH
+#define INCLUDED_BATCH
+
+#include <remoteexecutionclient.h>
+
+#include <string>
+#include <vector>
+
+namespace BloombergLP {
+namespace recc {
+
+/**
+ * An entry of a compilation database (`compile_commands.json`).
+ */
+struct BatchCommand {
+    std::string d_directory;
+    std::vector<std::string> d_arguments;
+    // The source file, only used in messages
+    std::string d_file;
+};
+
+/**
+ * The outcome of running a `BatchCommand`.
+ */
+struct BatchResult {
+    enum Origin { NotRun, ActionCache, Remote, Local };
+
+    Origin d_origin = NotRun;
+    int d_exitCode = 0;
+    std::string d_stdOut;
+    std::string d_stdErr;
+};
+
+struct Batch {
+    /**
+     * Parse a compilation database, as described in
+     * https://clang.llvm.org/docs/JSONCompilationDatabase.html. Entries can
+     * give their command as `arguments` or as a shell-escaped `command`.
+     *
+     * Throws `std::runtime_error` if the data is not a valid compilation
+     * database.
+     */
+    static std::vector<BatchCommand>
+    parseCompilationDatabase(const std::string &json);
+
+    /**
+     * Split a command line into arguments the way a POSIX shell would,
+     * honoring single and double quotes and backslash escapes.
+     */
+    static std::vector<std::string>
+    splitCommandLine(const std::string &commandLine);
+
+    /**
+     * Run all the given commands using the given client, with up to `jobs`
+     * requests in flight at once, and return their results in the same
+     * order.
+     *
+     * Each command's Action is built from the command's directory, without
+     * changing the current directory, and looked up in the action cache.
+     * If it is not cached, its inputs are uploaded, skipping blobs that
+     * another command of the batch already uploaded, and it is executed.
+     * Outputs are written relative to each command's directory.
+     *
+     * Commands that are not compile commands, or whose remote execution
+     * fails, are run locally, up to `jobs` or the number of cores at once.
+     */
+    static std::vector<BatchResult>
+    run(const std::vector<BatchCommand> &commands,
+        RemoteExecutionClient *client, int jobs);
+};
+
+} // namespace recc
+} // namespace BloombergLP
+
+#endif
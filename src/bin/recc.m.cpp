@@ -18,26 +18,38 @@
 // it's actually run locally.
 
 #include <actionbuilder.h>
+#include <batch.h>
+#include <circuitbreaker.h>
 #include <deps.h>
 #include <digestgenerator.h>
 #include <env.h>
+#include <executionhistory.h>
 #include <fileutils.h>
 #include <grpcchannels.h>
 #include <grpccontext.h>
+#include <jobserver.h>
+#include <localexecution.h>
 #include <metricsconfig.h>
 #include <parsedcommandfactory.h>
+#include <race.h>
 #include <reccdefaults.h>
 #include <remoteexecutionclient.h>
 #include <requestmetadata.h>
+#include <scheduler.h>
+#include <subprocess.h>
 
+#include <chrono>
 #include <cstdio>
 #include <cstring>
 #include <grpcpp/create_channel.h>
 #include <grpcpp/security/credentials.h>
 #include <iostream>
+#include <map>
+#include <sstream>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <buildboxcommon_fileutils.h>
 #include <buildboxcommon_logging.h>
 #include <buildboxcommonmetrics_durationmetrictimer.h>
 #include <buildboxcommonmetrics_durationmetricvalue.h>
@@ -48,6 +60,7 @@
 
 #define TIMER_NAME_EXECUTE_ACTION "recc.execute_action"
 #define TIMER_NAME_QUERY_ACTION_CACHE "recc.query_action_cache"
+#define TIMER_NAME_UPDATE_ACTION_CACHE "recc.update_action_cache"
 
 using namespace BloombergLP::recc;
 
@@ -66,6 +79,15 @@ const std::string HELP(
     "If the command is to be executed remotely, it must specify either a \n"
     "relative or absolute path to an executable.\n"
     "\n"
+    "USAGE: recc --batch <compile_commands.json>\n"
+    "\n"
+    "Runs all the commands of a compilation database (\"-\" to read it\n"
+    "from stdin) in a single process, looking up and executing their\n"
+    "actions concurrently. The output and exit code of each command are\n"
+    "reported in order, followed by the throughput. Returns the exit code\n"
+    "of the first command that failed. RECC_PROJECT_ROOT defaults to the\n"
+    "directory recc is started in, not to each command's directory.\n"
+    "\n"
     "The following environment variables can be used to change recc's\n"
     "behavior. To set them in a recc.conf file, omit the \"RECC_\" prefix.\n"
     "\n"
@@ -115,12 +137,86 @@ const std::string HELP(
     "RECC_SKIP_CACHE - sets `skip_cache_lookup` flag to re-run the build\n"
     "                  action instead of looking it up in the cache\n"
     "\n"
+    "RECC_CACHE_ONLY - never use the execution service: on an action cache\n"
+    "                  miss, run the command locally and upload its\n"
+    "                  results to the action cache\n"
+    "\n"
+    "RECC_RACE_LOCALLY - on an action cache miss, also compile locally\n"
+    "                    while the action executes remotely and use\n"
+    "                    whichever result is available first\n"
+    "\n"
+    "RECC_RACE_LOCAL_SLOTS - maximum number of local compiles that\n"
+    "                        RECC_RACE_LOCALLY runs at once on this host\n"
+    "                        (default 0: one per CPU)\n"
+    "\n"
+    "RECC_SCHEDULE_FROM_HISTORY - on an action cache miss, run the command\n"
+    "                             locally or remotely depending on which\n"
+    "                             was faster in the past. Timings are kept\n"
+    "                             in RECC_CACHE_DIR; run `recchistory` to\n"
+    "                             see them\n"
+    "\n"
+    "RECC_HEDGE_PERCENTILE - if a remote execution takes longer than this\n"
+    "                        percentile (e.g. 95) of the recent executions\n"
+    "                        of the same command, start it a second time\n"
+    "                        and use whichever finishes first. Needs\n"
+    "                        RECC_CACHE_DIR, and isn't done for actions\n"
+    "                        marked uncacheable (default 0: disabled)\n"
+    "\n"
+    "RECC_JOBSERVER - when run by GNU make with a jobserver, let make start\n"
+    "                 another job while waiting on the remote servers,\n"
+    "                 so that `make -j` only limits local work\n"
+    "\n"
+    "RECC_DIGEST_TABLE_SLOTS - number of entries of a table in TMPDIR,\n"
+    "                          shared by the recc processes on this host,\n"
+    "                          of the digests of the files they read, so\n"
+    "                          that each file is only hashed once (e.g.\n"
+    "                          65536; default 0: disabled)\n"
+    "\n"
+    "RECC_UPLOAD_WAIT_TIMEOUT - when another recc process on this host is\n"
+    "                           uploading a blob that is also needed\n"
+    "                           here, wait up to this many milliseconds\n"
+    "                           for it instead of uploading it again\n"
+    "                           (default 0: disabled)\n"
+    "\n"
+    "RECC_BATCH_JOBS - maximum number of actions that `recc --batch` looks\n"
+    "                  up or executes at once (default 64)\n"
+    "\n"
     "RECC_DONT_SAVE_OUTPUT - prevent build output from being saved to\n"
     "                        local disk\n"
     "\n"
+    "RECC_PRESERVE_UNCHANGED_MTIME - leave the modification time of\n"
+    "                                outputs that are already on disk with\n"
+    "                                the right contents alone, instead of\n"
+    "                                updating it (make will consider them\n"
+    "                                out of date)\n"
+    "\n"
     "RECC_DEPS_GLOBAL_PATHS - report all entries returned by the dependency\n"
     "                         command, even if they are absolute paths\n"
     "\n"
+    "RECC_CACHE_DIR - directory to persist information in between runs,\n"
+    "                 such as the include paths and crtbegin.o location of\n"
+    "                 each compiler and, if set in the environment, the\n"
+    "                 parsed configuration (by default, nothing is\n"
+    "                 persisted)\n"
+    "\n"
+    "RECC_CACHE_TOOLCHAINS - probe each compiler once for its include\n"
+    "                        paths and crtbegin.o location, and keep the\n"
+    "                        result in RECC_CACHE_DIR (default 0)\n"
+    "\n"
+    "RECC_DEPS_DEPEND_MODE - if the command writes a dependency file\n"
+    "                        (-MD/-MMD), reuse the one left by the previous\n"
+    "                        compile instead of running the dependency\n"
+    "                        command, as long as that compile was run by\n"
+    "                        recc with the same compiler and arguments and\n"
+    "                        none of the files it lists are newer than it.\n"
+    "                        Requires RECC_CACHE_DIR\n"
+    "\n"
+    "RECC_PREPROCESS_LOCALLY - run the preprocessor locally and send only\n"
+    "                          its output to the build server, instead of\n"
+    "                          the source and all the headers it includes.\n"
+    "                          Paths in line markers are rewritten using\n"
+    "                          RECC_PREFIX_MAP and RECC_PROJECT_ROOT\n"
+    "\n"
     "RECC_DEPS_OVERRIDE - comma-separated list of files to send to the\n"
     "                     build server (by default, run `deps` to\n"
     "                     determine this)\n"
@@ -152,6 +248,16 @@ const std::string HELP(
     "RECC_RETRY_LIMIT - number of times to retry failed requests (default "
     "0).\n"
     "\n"
+    "RECC_CIRCUIT_BREAKER_THRESHOLD - after this many consecutive RPCs\n"
+    "                                 fail to reach the servers, all recc\n"
+    "                                 processes on the host run commands\n"
+    "                                 locally and stop retrying, until one\n"
+    "                                 of them reaches the servers again\n"
+    "                                 (default 0: disabled)\n"
+    "\n"
+    "RECC_CIRCUIT_BREAKER_COOLDOWN - seconds to wait before trying the\n"
+    "                                servers again (default 30)\n"
+    "\n"
     "RECC_RETRY_DELAY - base delay (in ms) between retries\n"
     "                   grows exponentially (default 100ms)\n"
     "\n"
@@ -167,6 +273,18 @@ const std::string HELP(
     "                           Supported values: " +
     DigestGenerator::supportedDigestFunctionsList() +
     "\n\n"
+    "RECC_CAS_CHUNKING_THRESHOLD - split blobs of at least this many bytes\n"
+    "                              into content-defined chunks, and only\n"
+    "                              transfer the chunks that are missing,\n"
+    "                              if the CAS server supports it. Chunks\n"
+    "                              downloaded are kept in RECC_CACHE_DIR.\n"
+    "                              (Default: 0, disabled)\n"
+    "\n"
+    "RECC_CAS_CHUNK_CACHE_MB - size in megabytes above which the least\n"
+    "                          recently used chunks are removed from\n"
+    "                          RECC_CACHE_DIR. 0 disables the chunk cache.\n"
+    "                          (Default: 1024)\n"
+    "\n"
     "RECC_WORKING_DIR_PREFIX - directory to prefix the command's working\n"
     "                          directory, and input paths relative to it\n"
     "RECC_MAX_THREADS -   Allow some operations to utilize multiple cores."
@@ -177,6 +295,13 @@ const std::string HELP(
     "                     Supported values: " +
     proto::reapiSupportedVersionsList());
 
+double millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+}
+
 enum ReturnCode {
     RC_OK = 0,
     RC_USAGE = 100,
@@ -188,10 +313,151 @@ enum ReturnCode {
     RC_METRICS_PUBLISHER_INIT_FAILURE = 106
 };
 
+/**
+ * Let make start another job while this one waits on the remote servers.
+ */
+void lend_job_slot()
+{
+    JobServer *jobServer = JobServer::instance();
+    if (jobServer != nullptr) {
+        jobServer->releaseSlot();
+    }
+}
+
+/**
+ * Take back the job slot lent by `lend_job_slot()`, before doing work
+ * locally or exiting.
+ */
+void reclaim_job_slot()
+{
+    JobServer *jobServer = JobServer::instance();
+    if (jobServer != nullptr) {
+        jobServer->acquireSlot();
+    }
+}
+
+struct JobSlotReclaimer {
+    ~JobSlotReclaimer() { reclaim_job_slot(); }
+};
+
+/**
+ * Replace this process with the given command. Only returns if that fails.
+ */
+int exec_locally(char *argv[])
+{
+    reclaim_job_slot();
+    execvp(argv[0], argv);
+    const std::string errorReason = strerror(errno);
+    BUILDBOX_LOG_ERROR("Error executing argv[1]: " << errorReason);
+    return RC_EXEC_FAILURE;
+}
+
+/**
+ * Returns true if the circuit breaker says that the remote servers are
+ * down, in which case the command should be run locally.
+ */
+bool servers_unavailable()
+{
+    CircuitBreaker *breaker = CircuitBreaker::instance();
+    return breaker != nullptr && !breaker->allowRequests();
+}
+
+/**
+ * Run the commands of the compilation database at `path` (stdin if "-")
+ * with `Batch::run()` and report their results.
+ */
+int run_batch(const std::string &path)
+{
+    std::vector<BatchCommand> commands;
+    try {
+        std::string json;
+        if (path == "-") {
+            std::ostringstream input;
+            input << std::cin.rdbuf();
+            json = input.str();
+        }
+        else {
+            json = buildboxcommon::FileUtils::getFileContents(path.c_str());
+        }
+        commands = Batch::parseCompilationDatabase(json);
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_ERROR("Could not read compilation database \""
+                           << path << "\": " << e.what());
+        return RC_USAGE;
+    }
+
+    std::unique_ptr<GrpcChannels> returnChannels;
+    try {
+        returnChannels = std::make_unique<GrpcChannels>(
+            GrpcChannels::get_channels_from_config());
+    }
+    catch (const std::runtime_error &e) {
+        BUILDBOX_LOG_ERROR("Invalid argument in channel config: " << e.what());
+        return RC_INVALID_GRPC_CHANNELS;
+    }
+
+    GrpcContext grpcContext;
+    RemoteExecutionClient client(
+        returnChannels->server(), returnChannels->cas(),
+        returnChannels->action_cache(), RECC_INSTANCE, &grpcContext);
+
+    const auto start = std::chrono::steady_clock::now();
+    const std::vector<BatchResult> results =
+        Batch::run(commands, &client, RECC_BATCH_JOBS);
+    const double seconds = millisecondsSince(start) / 1000;
+
+    const std::map<BatchResult::Origin, std::string> originNames = {
+        {BatchResult::NotRun, "not run"},
+        {BatchResult::ActionCache, "action cache"},
+        {BatchResult::Remote, "remote"},
+        {BatchResult::Local, "local"}};
+
+    int exitCode = RC_OK;
+    std::map<BatchResult::Origin, int> origins;
+    int failed = 0;
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BatchResult &result = results[i];
+
+        /* These don't use logging macros because they are compiler output
+         */
+        std::cout << result.d_stdOut << std::flush;
+        std::cerr << result.d_stdErr;
+        std::cerr << "recc: ["
+                  << (commands[i].d_file.empty()
+                          ? commands[i].d_arguments.front()
+                          : commands[i].d_file)
+                  << "] exit code " << result.d_exitCode << " ("
+                  << originNames.at(result.d_origin) << ")" << std::endl;
+
+        origins[result.d_origin]++;
+        if (result.d_exitCode != 0) {
+            failed++;
+            if (exitCode == RC_OK) {
+                exitCode = result.d_exitCode;
+            }
+        }
+    }
+
+    std::cerr << "recc: " << results.size() << " commands in " << seconds
+              << " s, "
+              << (seconds > 0 ? static_cast<double>(results.size()) / seconds
+                              : 0)
+              << " actions/s (" << origins[BatchResult::ActionCache]
+              << " from the action cache, " << origins[BatchResult::Remote]
+              << " executed remotely, " << origins[BatchResult::Local]
+              << " run locally, " << failed << " failed)" << std::endl;
+    return exitCode;
+}
+
 } // namespace
 
 int main(int argc, char *argv[])
 {
+    // Before anything else opens a file and possibly reuses the jobserver's
+    // file descriptors:
+    JobServer::inheritFromMake();
+
     buildboxcommon::logging::Logger::getLoggerInstance().initialize(argv[0]);
 
     Env::set_config_locations();
@@ -231,19 +497,49 @@ int main(int argc, char *argv[])
     buildboxcommon::buildboxcommonmetrics::PublisherGuard<StatsDPublisherType>
         statsDPublisherGuard(RECC_ENABLE_METRICS, *statsDPublisher);
 
+    if (argc == 3 && strcmp(argv[1], "--batch") == 0) {
+        return run_batch(argv[2]);
+    }
+
     const std::string cwd = FileUtils::getCurrentWorkingDirectory();
     const auto command =
         ParsedCommandFactory::createParsedCommand(&argv[1], cwd.c_str());
 
+    // Timings of this command are kept to decide where to run it and when
+    // to hedge its execution:
+    const bool useHistory =
+        (RECC_SCHEDULE_FROM_HISTORY || RECC_HEDGE_PERCENTILE > 0) &&
+        !RECC_CACHE_DIR.empty() && command.is_compiler_command();
+    const std::vector<std::string> originalCommand(&argv[1], &argv[argc]);
+    std::string historyPath;
+    ExecutionHistory history;
+    if (useHistory) {
+        historyPath = ExecutionHistory::path(originalCommand, cwd);
+        history = ExecutionHistory::load(historyPath);
+        history.d_workingDirectory = cwd;
+        history.d_command.clear();
+        for (const auto &argument : originalCommand) {
+            history.d_command +=
+                (history.d_command.empty() ? "" : " ") + argument;
+        }
+    }
+
     digest_string_umap blobs;
     digest_string_umap digest_to_filecontents;
 
     std::shared_ptr<proto::Action> actionPtr;
-    if (command.is_compiler_command() || RECC_FORCE_REMOTE) {
+    if ((command.is_compiler_command() || RECC_FORCE_REMOTE) &&
+        servers_unavailable()) {
+        BUILDBOX_LOG_DEBUG(
+            "The remote servers are unavailable, so running locally.");
+    }
+    else if (command.is_compiler_command() || RECC_FORCE_REMOTE) {
         // Trying to build an `Action`:
         try {
+            const auto buildStart = std::chrono::steady_clock::now();
             actionPtr = ActionBuilder::BuildAction(command, cwd, &blobs,
                                                    &digest_to_filecontents);
+            history.d_dependencies.add(millisecondsSince(buildStart));
         }
         catch (const std::invalid_argument &) {
             BUILDBOX_LOG_ERROR(
@@ -263,10 +559,7 @@ int main(int argc, char *argv[])
     // If we don't need to build an `Action` or if the process fails, we defer
     // to running the command locally:
     if (!actionPtr) {
-        execvp(argv[1], &argv[1]);
-        const std::string errorReason = strerror(errno);
-        BUILDBOX_LOG_ERROR("Error executing argv[1]: " << errorReason);
-        return RC_EXEC_FAILURE;
+        return exec_locally(&argv[1]);
     }
 
     const proto::Action action = *actionPtr;
@@ -295,6 +588,11 @@ int main(int argc, char *argv[])
         returnChannels->server(), returnChannels->cas(),
         returnChannels->action_cache(), RECC_INSTANCE, &grpcContext);
 
+    // Finding the dependencies was the CPU-heavy part; from here on this
+    // process mostly waits on the servers:
+    const JobSlotReclaimer jobSlotReclaimer;
+    lend_job_slot();
+
     bool action_in_cache = false;
     ActionResult result;
 
@@ -323,11 +621,128 @@ int main(int argc, char *argv[])
         }
     }
 
+    // In cache-only mode, actions that are not cached are run locally and
+    // their results published to the action cache for others to reuse:
+    if (!action_in_cache && RECC_CACHE_ONLY) {
+        BUILDBOX_LOG_DEBUG("Running command locally");
+        proto::Command commandProto;
+        commandProto.ParseFromString(blobs.at(action.command_digest()));
+
+        const std::vector<std::string> localCommand(&argv[1], &argv[argc]);
+        proto::ActionResult resultProto;
+        digest_string_umap outputBlobs;
+        bool complete = false;
+        reclaim_job_slot();
+        try {
+            complete = LocalExecution::execute(localCommand, commandProto,
+                                               &resultProto, &outputBlobs);
+        }
+        catch (const std::exception &e) {
+            BUILDBOX_LOG_ERROR("Error running command locally: " << e.what());
+            return RC_EXEC_FAILURE;
+        }
+
+        /* These don't use logging macros because they are compiler output
+         */
+        std::cout << outputBlobs.at(resultProto.stdout_digest());
+        std::cerr << outputBlobs.at(resultProto.stderr_digest());
+        if (resultProto.exit_code() == 0) {
+            Deps::record_depfile(command, cwd);
+        }
+
+        if (resultProto.exit_code() != 0 || !complete ||
+            action.do_not_cache()) {
+            BUILDBOX_LOG_DEBUG("Not publishing the result of "
+                               << actionDigest.hash());
+            return resultProto.exit_code();
+        }
+
+        // The input files are not needed to use the result, so only the
+        // Action, the Command and the outputs are uploaded:
+        outputBlobs[actionDigest] = action.SerializeAsString();
+        outputBlobs[action.command_digest()] =
+            blobs.at(action.command_digest());
+        try {
+            if (RECC_CAS_GET_CAPABILITIES) {
+                client.setUpFromServerCapabilities();
+            }
+            client.upload_resources(outputBlobs, {});
+
+            { // Timed block
+                buildboxcommon::buildboxcommonmetrics::MetricGuard<
+                    buildboxcommon::buildboxcommonmetrics::DurationMetricTimer>
+                    mt(TIMER_NAME_UPDATE_ACTION_CACHE);
+
+                client.update_action_cache(actionDigest, resultProto);
+            }
+            BUILDBOX_LOG_DEBUG("Published result of "
+                               << actionDigest.hash() << "/"
+                               << actionDigest.size_bytes());
+        }
+        catch (const std::exception &e) {
+            BUILDBOX_LOG_WARNING("Error while publishing result to \""
+                                 << RECC_ACTION_CACHE_SERVER
+                                 << "\": " << e.what());
+        }
+        return resultProto.exit_code();
+    }
+
+    if (!action_in_cache && useHistory && RECC_SCHEDULE_FROM_HISTORY) {
+        const auto decision = Scheduler::decide(
+            history, Scheduler::currentLoad(),
+            !servers_unavailable());
+        history.d_lastDecision =
+            (decision.d_runLocally ? "local: " : "remote: ") +
+            decision.d_reason;
+        BUILDBOX_LOG_DEBUG("Running " << history.d_lastDecision);
+
+        if (decision.d_runLocally) {
+            reclaim_job_slot();
+            const auto localStart = std::chrono::steady_clock::now();
+            Subprocess::SubprocessResult localResult;
+            try {
+                localResult = Subprocess::execute(originalCommand, true, true);
+            }
+            catch (const std::exception &e) {
+                BUILDBOX_LOG_ERROR(
+                    "Error running command locally: " << e.what());
+                return RC_EXEC_FAILURE;
+            }
+            history.d_localExecution.add(millisecondsSince(localStart));
+            history.save(historyPath);
+
+            /* These don't use logging macros because they are compiler
+             * output */
+            std::cout << localResult.d_stdOut;
+            std::cerr << localResult.d_stdErr;
+            if (localResult.d_exitCode == 0) {
+                Deps::record_depfile(command, cwd);
+            }
+            return localResult.d_exitCode;
+        }
+    }
+
     // If the results for the action are not cached, we upload the
     // necessary resources to CAS:
     if (!action_in_cache) {
         blobs[actionDigest] = action.SerializeAsString();
 
+        // If the action takes much longer than it usually does, it may have
+        // landed on a slow worker, so it is executed a second time. The
+        // salt keeps the server from merging the two executions. If the
+        // second one wins, its result is cached as the first one's.
+        const double hedgeDelay =
+            useHistory && RECC_HEDGE_PERCENTILE > 0 && !action.do_not_cache()
+                ? history.executeTimePercentile(RECC_HEDGE_PERCENTILE)
+                : 0;
+        proto::Digest hedgeActionDigest;
+        if (hedgeDelay > 0) {
+            proto::Action hedgeAction = action;
+            hedgeAction.set_salt(action.salt() + "recc-hedge");
+            hedgeActionDigest = DigestGenerator::make_digest(hedgeAction);
+            blobs[hedgeActionDigest] = hedgeAction.SerializeAsString();
+        }
+
         BUILDBOX_LOG_DEBUG("Uploading resources...");
         try {
             // We are going to make a batch request to the CAS, setting up
@@ -337,11 +752,18 @@ int main(int argc, char *argv[])
                 client.setUpFromServerCapabilities();
             }
 
-            client.upload_resources(blobs, digest_to_filecontents);
+            const auto uploadStart = std::chrono::steady_clock::now();
+            const int64_t uploadedBytes =
+                client.upload_resources(blobs, digest_to_filecontents);
+            history.d_upload.add(millisecondsSince(uploadStart));
+            history.d_uploadBytes.add(static_cast<double>(uploadedBytes));
         }
         catch (const std::exception &e) {
             BUILDBOX_LOG_ERROR("Error while uploading resources to CAS at \""
                                << RECC_CAS_SERVER << "\": " << e.what());
+            if (servers_unavailable()) {
+                return exec_locally(&argv[1]);
+            }
             return RC_INVALID_SERVER_CAPABILITIES;
         }
 
@@ -350,23 +772,57 @@ int main(int argc, char *argv[])
             BUILDBOX_LOG_DEBUG("Executing action... actionDigest: "
                                << actionDigest.hash() << "/"
                                << actionDigest.size_bytes());
+            const auto executeStart = std::chrono::steady_clock::now();
             { // Timed block
                 buildboxcommon::buildboxcommonmetrics::MetricGuard<
                     buildboxcommon::buildboxcommonmetrics::DurationMetricTimer>
                     mt(TIMER_NAME_EXECUTE_ACTION);
 
-                result = client.execute_action(actionDigest, RECC_SKIP_CACHE);
+                if (RECC_RACE_LOCALLY && !RECC_DONT_SAVE_OUTPUT &&
+                    Race::supports(command)) {
+                    reclaim_job_slot();
+                    int localExitCode = 0;
+                    if (Race::run(&client, command, actionDigest, &result,
+                                  &localExitCode)) {
+                        if (localExitCode == 0) {
+                            Deps::record_depfile(command, cwd);
+                        }
+                        return localExitCode;
+                    }
+                }
+                else if (hedgeDelay > 0) {
+                    result = client.execute_action_hedged(
+                        actionDigest, hedgeActionDigest,
+                        std::chrono::milliseconds(
+                            static_cast<int64_t>(hedgeDelay)),
+                        RECC_SKIP_CACHE);
+                }
+                else {
+                    result =
+                        client.execute_action(actionDigest, RECC_SKIP_CACHE);
+                }
+            }
+            if (useHistory) {
+                history.addRemoteTimings(result.d_executionMetadata,
+                                         millisecondsSince(executeStart));
             }
         }
         catch (const std::exception &e) {
             BUILDBOX_LOG_ERROR("Error while calling `Execute()` on \""
                                << RECC_SERVER << "\": " << e.what());
+            if (useHistory) {
+                history.save(historyPath);
+            }
+            if (servers_unavailable()) {
+                return exec_locally(&argv[1]);
+            }
             return RC_EXEC_ACTIONS_FAILURE;
         }
     }
 
     const int exitCode = result.d_exitCode;
     try {
+        const auto downloadStart = std::chrono::steady_clock::now();
         /* These don't use logging macros because they are compiler output
          */
         std::cout << client.get_outputblob(result.d_stdOut);
@@ -374,6 +830,14 @@ int main(int argc, char *argv[])
 
         if (!RECC_DONT_SAVE_OUTPUT) {
             client.write_files_to_disk(result);
+            if (exitCode == 0) {
+                Deps::record_depfile(command, cwd);
+            }
+        }
+
+        if (useHistory && !action_in_cache) {
+            history.d_download.add(millisecondsSince(downloadStart));
+            history.save(historyPath);
         }
 
         return exitCode;
@@ -0,0 +1,108 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <circuitbreaker.h>
+#include <env.h>
+#include <executionhistory.h>
+#include <scheduler.h>
+
+#include <buildboxcommon_logging.h>
+
+#include <cstring>
+#include <iostream>
+
+using namespace BloombergLP::recc;
+
+const std::string HELP(
+    "USAGE: recchistory\n"
+    "\n"
+    "Prints the timings that recc keeps in RECC_CACHE_DIR when\n"
+    "RECC_SCHEDULE_FROM_HISTORY is set, where it ran each command last\n"
+    "and where it would run it now, and why.");
+
+namespace {
+
+void printAverage(const std::string &name, const RunningAverage &average,
+                  const std::string &unit = "ms")
+{
+    if (average.d_count > 0) {
+        std::cout << "    " << name << ": "
+                  << static_cast<int64_t>(average.d_mean) << " " << unit
+                  << " (" << average.d_count << " samples)\n";
+    }
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    buildboxcommon::logging::Logger::getLoggerInstance().initialize(argv[0]);
+
+    Env::set_config_locations();
+    Env::parse_config_variables();
+
+    if (argc > 1 &&
+        (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0)) {
+        BUILDBOX_LOG_WARNING(HELP);
+        return 0;
+    }
+    if (RECC_CACHE_DIR.empty()) {
+        BUILDBOX_LOG_ERROR("RECC_CACHE_DIR is not set");
+        return 1;
+    }
+
+    const double load = Scheduler::currentLoad();
+    const CircuitBreaker *breaker = CircuitBreaker::instance();
+    const bool remoteAvailable = breaker == nullptr || !breaker->isOpen();
+    std::cout << "Load: " << load << " per CPU\n"
+              << "Remote servers: "
+              << (remoteAvailable ? "available" : "unavailable");
+    if (breaker != nullptr) {
+        std::cout << " (" << breaker->consecutiveFailures()
+                  << " consecutive failures)";
+    }
+    std::cout << "\n";
+
+    for (const auto &history : ExecutionHistory::loadAll()) {
+        std::cout << "\n"
+                  << history.d_workingDirectory << "$ " << history.d_command
+                  << "\n";
+        printAverage("local execution", history.d_localExecution);
+        printAverage("dependencies", history.d_dependencies);
+        printAverage("upload", history.d_upload);
+        printAverage("upload size", history.d_uploadBytes, "bytes");
+        printAverage("remote queue", history.d_remoteQueue);
+        printAverage("remote execution", history.d_remoteExecution);
+        printAverage("download", history.d_download);
+        if (!history.d_recentExecuteTimes.empty()) {
+            std::cout << "    recent executions: "
+                      << history.d_recentExecuteTimes.size()
+                      << ", 95th percentile "
+                      << static_cast<int64_t>(
+                             history.executeTimePercentile(95))
+                      << " ms\n";
+        }
+        if (!history.d_lastDecision.empty()) {
+            std::cout << "    last run " << history.d_lastDecision << "\n";
+        }
+
+        const auto decision =
+            Scheduler::decide(history, load, remoteAvailable);
+        std::cout << "    would run "
+                  << (decision.d_runLocally ? "local: " : "remote: ")
+                  << decision.d_reason << "\n";
+    }
+    return 0;
+}
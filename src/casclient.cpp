@@ -13,23 +13,158 @@
 // limitations under the License.
 
 #include <casclient.h>
+#include <chunker.h>
 #include <digestgenerator.h>
+#include <env.h>
+#include <fileutils.h>
+#include <uploadcoordinator.h>
 
 #include <buildboxcommon_logging.h>
+#include <buildboxcommonmetrics_countingmetricutil.h>
 #include <buildboxcommonmetrics_durationmetrictimer.h>
 #include <buildboxcommonmetrics_metricguard.h>
 #include <grpcretry.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
 #include <random>
 #include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <unordered_set>
+#include <vector>
 
 #define TIMER_NAME_FIND_MISSING_BLOBS "recc.find_missing_blobs"
 #define TIMER_NAME_UPLOAD_MISSING_BLOBS "recc.upload_missing_blobs"
+#define TIMER_NAME_UPLOAD_CHUNKED_BLOB "recc.upload_chunked_blob"
+#define TIMER_NAME_FETCH_CHUNKED_BLOB "recc.fetch_chunked_blob"
+#define COUNTER_NAME_UPLOADS_DEDUPLICATED "recc.uploads_deduplicated"
 
 namespace BloombergLP {
 namespace recc {
 
+namespace {
+
+// When the chunk cache is trimmed, it is brought down to this fraction of
+// RECC_CAS_CHUNK_CACHE_MB, so that it isn't trimmed on every fetch.
+const double ChunkCacheTrimTarget = 0.9;
+
+bool chunkCacheEnabled()
+{
+    return !RECC_CACHE_DIR.empty() && RECC_CAS_CHUNK_CACHE_MB > 0;
+}
+
+std::string chunkCacheDirectory() { return RECC_CACHE_DIR + "/chunks"; }
+
+std::string cachedChunkPath(const proto::Digest &digest)
+{
+    return chunkCacheDirectory() + "/" + digest.hash() + "_" +
+           std::to_string(digest.size_bytes());
+}
+
+bool readCachedChunk(const proto::Digest &digest, std::string *data)
+{
+    if (!chunkCacheEnabled()) {
+        return false;
+    }
+
+    const std::string path = cachedChunkPath(digest);
+    struct stat statResult;
+    if (stat(path.c_str(), &statResult) != 0 ||
+        statResult.st_size != digest.size_bytes()) {
+        return false;
+    }
+
+    try {
+        *data = FileUtils::getFileContents(path, statResult);
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_DEBUG("Could not read " << path << ": " << e.what());
+        return false;
+    }
+    // The modification time tells which chunks were used last, even on
+    // filesystems mounted with `noatime`
+    utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+    return true;
+}
+
+void writeCachedChunk(const proto::Digest &digest, const std::string &data)
+{
+    if (!chunkCacheEnabled()) {
+        return;
+    }
+
+    const std::string path = cachedChunkPath(digest);
+    try {
+        FileUtils::writeFileAtomically(path, data);
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_WARNING("Could not write chunk to " << path << ": "
+                                                         << e.what());
+    }
+}
+
+/**
+ * If the chunk cache is larger than RECC_CAS_CHUNK_CACHE_MB, remove the
+ * least recently used chunks. Concurrent recc processes may trim it at
+ * the same time, which at worst removes a few more chunks than needed.
+ */
+void trimChunkCache()
+{
+    const std::string directory = chunkCacheDirectory();
+    DIR *dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+        return;
+    }
+
+    struct CachedChunk {
+        time_t d_mtime;
+        off_t d_size;
+        std::string d_path;
+    };
+    std::vector<CachedChunk> chunks;
+    int64_t totalSize = 0;
+    while (const struct dirent *entry = readdir(dir)) {
+        const std::string path = directory + "/" + entry->d_name;
+        struct stat statResult;
+        if (stat(path.c_str(), &statResult) == 0 &&
+            S_ISREG(statResult.st_mode)) {
+            chunks.push_back(
+                {statResult.st_mtime, statResult.st_size, path});
+            totalSize += statResult.st_size;
+        }
+    }
+    closedir(dir);
+
+    const int64_t limit =
+        static_cast<int64_t>(RECC_CAS_CHUNK_CACHE_MB) * 1024 * 1024;
+    if (totalSize <= limit) {
+        return;
+    }
+
+    std::sort(chunks.begin(), chunks.end(),
+              [](const CachedChunk &a, const CachedChunk &b) {
+                  return a.d_mtime < b.d_mtime;
+              });
+    const auto target = static_cast<int64_t>(limit * ChunkCacheTrimTarget);
+    size_t removed = 0;
+    for (const auto &chunk : chunks) {
+        if (totalSize <= target) {
+            break;
+        }
+        if (unlink(chunk.d_path.c_str()) == 0 || errno == ENOENT) {
+            totalSize -= chunk.d_size;
+            ++removed;
+        }
+    }
+    BUILDBOX_LOG_DEBUG("Removed " << removed << " chunks from "
+                                  << directory);
+}
+
+} // namespace
+
 const std::string CASClient::s_guid = generate_guid();
 
 const int CASClient::s_byteStreamChunkSizeBytes = 1 * 1024 * 1024;
@@ -127,6 +262,11 @@ void CASClient::setUpFromServerCapabilities()
         d_maxTotalBatchSizeBytes = serverMaxBatchTotalSizeBytes;
     }
 
+#ifdef RECC_HAVE_SPLIT_SPLICE_BLOB
+    d_splitBlobSupported = cache_capabilities.split_blob_support();
+    d_spliceBlobSupported = cache_capabilities.splice_blob_support();
+#endif
+
     // Checking that the function that we are using is supported by the server:
     const auto configured_digest_function =
         DigestGenerator::stringToDigestFunctionMap().at(
@@ -189,6 +329,11 @@ std::string CASClient::downloadResourceName(const proto::Digest &digest) const
 void CASClient::upload_blob(const proto::Digest &digest,
                             const std::string &blob) const
 {
+    if (d_spliceBlobSupported && shouldChunk(digest) &&
+        uploadChunked(digest, blob)) {
+        return;
+    }
+
     const auto resourceName = uploadResourceName(digest);
 
     google::bytestream::WriteResponse response;
@@ -238,9 +383,13 @@ void CASClient::upload_blob(const proto::Digest &digest,
 
 std::string CASClient::fetch_blob(const proto::Digest &digest) const
 {
-    const auto resourceName = downloadResourceName(digest);
-
     std::string result;
+    if (d_splitBlobSupported && shouldChunk(digest) &&
+        fetchChunked(digest, &result)) {
+        return result;
+    }
+
+    const auto resourceName = downloadResourceName(digest);
 
     auto fetch_lambda = [&](grpc::ClientContext &context) {
         google::bytestream::ReadRequest request;
@@ -289,10 +438,9 @@ proto::FindMissingBlobsResponse CASClient::findMissingBlobs(
     return response;
 }
 
-std::unordered_set<proto::Digest> CASClient::findMissingBlobs(
-    const std::unordered_set<proto::Digest> &digests) const
+digest_uset CASClient::findMissingBlobs(const digest_uset &digests) const
 {
-    std::unordered_set<proto::Digest> missingDigests;
+    digest_uset missingDigests;
 
     auto digestIter = digests.cbegin();
     while (digestIter != digests.cend()) {
@@ -303,7 +451,7 @@ std::unordered_set<proto::Digest> CASClient::findMissingBlobs(
         while (missingBlobsRequest.blob_digests_size() <
                    s_maxMissingBlobsRequestItems &&
                digestIter != digests.cend()) {
-            *missingBlobsRequest.add_blob_digests() = *digestIter;
+            *missingBlobsRequest.add_blob_digests() = digestIter->toProto();
             ++digestIter;
         }
 
@@ -337,8 +485,7 @@ proto::BatchUpdateBlobsResponse CASClient::batchUpdateBlobs(
 }
 
 void CASClient::batchUpdateBlobs(
-    const std::unordered_set<proto::Digest> &digests,
-    const digest_string_umap &blobs,
+    const digest_uset &digests, const digest_string_umap &blobs,
     const digest_string_umap &digest_to_filecontents) const
 {
     proto::BatchUpdateBlobsRequest batchUpdateRequest;
@@ -349,23 +496,23 @@ void CASClient::batchUpdateBlobs(
         mt(TIMER_NAME_UPLOAD_MISSING_BLOBS);
 
     size_t batchSize = 0;
-    for (const auto &digest : digests) {
+    for (const auto &compactDigest : digests) {
         // Finding the data in one of the source maps:
-        std::string blob;
-        if (blobs.count(digest)) {
-            blob = blobs.at(digest);
-        }
-        else if (digest_to_filecontents.count(digest)) {
-            blob = digest_to_filecontents.at(digest);
-        }
-        else {
-            throw std::runtime_error(
-                "CAS server requested non-existent digest");
+        auto blobIter = blobs.find(compactDigest);
+        if (blobIter == blobs.end()) {
+            blobIter = digest_to_filecontents.find(compactDigest);
+            if (blobIter == digest_to_filecontents.end()) {
+                throw std::runtime_error(
+                    "CAS server requested non-existent digest");
+            }
         }
+        const std::string &blob = blobIter->second;
+        const proto::Digest digest = compactDigest.toProto();
 
-        // If the blob is too large to batch we must upload it individually
-        // using the ByteStream API:
-        if (digest.size_bytes() > s_maxTotalBatchSizeBytes) {
+        // If the blob is too large to batch, or is large enough to be
+        // chunked, we must upload it individually:
+        if (digest.size_bytes() > s_maxTotalBatchSizeBytes ||
+            (d_spliceBlobSupported && shouldChunk(digest))) {
             upload_blob(digest, blob);
             continue;
         }
@@ -394,11 +541,210 @@ void CASClient::batchUpdateBlobs(
     }
 }
 
-void CASClient::upload_resources(
+digest_string_umap
+CASClient::batchReadBlobs(const digest_uset &digests) const
+{
+    digest_string_umap result;
+
+    proto::BatchReadBlobsRequest request;
+    request.set_instance_name(d_instanceName);
+    int64_t batchSize = 0;
+
+    const auto flush = [&]() {
+        proto::BatchReadBlobsResponse response;
+        auto batch_read_lambda = [&](grpc::ClientContext &context) {
+            response.Clear();
+            return d_executionStub->BatchReadBlobs(&context, request,
+                                                   &response);
+        };
+        grpc_retry(batch_read_lambda, d_grpcContext);
+
+        for (const auto &blobResponse : response.responses()) {
+            ensure_ok(blobResponse.status());
+            result[blobResponse.digest()] = blobResponse.data();
+        }
+
+        request.clear_digests();
+        batchSize = 0;
+    };
+
+    for (const auto &digest : digests) {
+        if (digest.size_bytes() > d_maxTotalBatchSizeBytes) {
+            result[digest] = fetch_blob(digest.toProto());
+            continue;
+        }
+
+        if (digest.size_bytes() + batchSize > d_maxTotalBatchSizeBytes) {
+            flush();
+        }
+        *request.add_digests() = digest.toProto();
+        batchSize += digest.size_bytes();
+    }
+
+    if (!request.digests().empty()) {
+        flush();
+    }
+
+    return result;
+}
+
+bool CASClient::shouldChunk(const proto::Digest &digest)
+{
+    // Blobs that fit in a single chunk have nothing to gain.
+    return RECC_CAS_CHUNKING_THRESHOLD > 0 &&
+           digest.size_bytes() >= RECC_CAS_CHUNKING_THRESHOLD &&
+           digest.size_bytes() >
+               static_cast<int64_t>(Chunker::s_maxChunkSize);
+}
+
+#ifdef RECC_HAVE_SPLIT_SPLICE_BLOB
+bool CASClient::uploadChunked(const proto::Digest &digest,
+                              const std::string &blob) const
+{
+    buildboxcommon::buildboxcommonmetrics::MetricGuard<
+        buildboxcommon::buildboxcommonmetrics::DurationMetricTimer>
+        mt(TIMER_NAME_UPLOAD_CHUNKED_BLOB);
+
+    proto::SpliceBlobRequest request;
+    request.set_instance_name(d_instanceName);
+    *request.mutable_blob_digest() = digest;
+
+    digest_string_umap chunks;
+    digest_uset chunkDigests;
+    for (auto &chunk : Chunker::split(blob)) {
+        const auto chunkDigest = DigestGenerator::make_digest(chunk);
+        *request.add_chunk_digests() = chunkDigest;
+        chunkDigests.insert(chunkDigest);
+        chunks.emplace(chunkDigest, std::move(chunk));
+    }
+
+    try {
+        const auto missingDigests = findMissingBlobs(chunkDigests);
+        BUILDBOX_LOG_DEBUG("Uploading " << missingDigests.size() << " of "
+                                        << request.chunk_digests_size()
+                                        << " chunks of blob "
+                                        << digest.hash());
+        batchUpdateBlobs(missingDigests, chunks, {});
+
+        proto::SpliceBlobResponse response;
+        auto splice_lambda = [&](grpc::ClientContext &context) {
+            return d_executionStub->SpliceBlob(&context, request, &response);
+        };
+        grpc_retry(splice_lambda, d_grpcContext);
+    }
+    catch (const std::runtime_error &e) {
+        BUILDBOX_LOG_WARNING("Could not upload blob "
+                             << digest.hash()
+                             << " in chunks, uploading it whole: "
+                             << e.what());
+        return false;
+    }
+    return true;
+}
+
+bool CASClient::fetchChunked(const proto::Digest &digest,
+                             std::string *blob) const
+{
+    buildboxcommon::buildboxcommonmetrics::MetricGuard<
+        buildboxcommon::buildboxcommonmetrics::DurationMetricTimer>
+        mt(TIMER_NAME_FETCH_CHUNKED_BLOB);
+
+    proto::SplitBlobRequest request;
+    request.set_instance_name(d_instanceName);
+    *request.mutable_blob_digest() = digest;
+
+    proto::SplitBlobResponse response;
+    auto split_lambda = [&](grpc::ClientContext &context) {
+        response.Clear();
+        return d_executionStub->SplitBlob(&context, request, &response);
+    };
+
+    std::string result;
+    std::vector<bool> cached;
+    try {
+        grpc_retry(split_lambda, d_grpcContext);
+        if (response.chunk_digests_size() < 2) {
+            return false;
+        }
+
+        std::vector<std::string> chunks(
+            static_cast<size_t>(response.chunk_digests_size()));
+        digest_uset missingDigests;
+        for (int i = 0; i < response.chunk_digests_size(); ++i) {
+            const auto &chunkDigest = response.chunk_digests(i);
+            cached.push_back(readCachedChunk(
+                chunkDigest, &chunks[static_cast<size_t>(i)]));
+            if (!cached.back()) {
+                missingDigests.insert(chunkDigest);
+            }
+        }
+
+        BUILDBOX_LOG_DEBUG("Downloading " << missingDigests.size() << " of "
+                                          << chunks.size()
+                                          << " chunks of blob "
+                                          << digest.hash());
+        const auto fetchedChunks = batchReadBlobs(missingDigests);
+        for (const auto &fetchedChunk : fetchedChunks) {
+            writeCachedChunk(fetchedChunk.first.toProto(),
+                             fetchedChunk.second);
+        }
+        if (!fetchedChunks.empty() && chunkCacheEnabled()) {
+            trimChunkCache();
+        }
+
+        result.reserve(static_cast<size_t>(digest.size_bytes()));
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            result += cached[i]
+                          ? chunks[i]
+                          : fetchedChunks.at(response.chunk_digests(
+                                static_cast<int>(i)));
+        }
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_WARNING("Could not fetch blob "
+                             << digest.hash()
+                             << " in chunks, fetching it whole: "
+                             << e.what());
+        return false;
+    }
+
+    if (DigestGenerator::make_digest(result) != digest) {
+        BUILDBOX_LOG_WARNING("Blob "
+                             << digest.hash()
+                             << " assembled from chunks has the wrong "
+                                "digest, fetching it whole");
+        // A corrupted cached chunk would otherwise break every fetch.
+        for (size_t i = 0; i < cached.size(); ++i) {
+            if (cached[i]) {
+                unlink(cachedChunkPath(
+                           response.chunk_digests(static_cast<int>(i)))
+                           .c_str());
+            }
+        }
+        return false;
+    }
+
+    *blob = std::move(result);
+    return true;
+}
+#else
+bool CASClient::uploadChunked(const proto::Digest &,
+                              const std::string &) const
+{
+    return false;
+}
+
+bool CASClient::fetchChunked(const proto::Digest &, std::string *) const
+{
+    return false;
+}
+#endif
+
+int64_t CASClient::upload_resources(
     const digest_string_umap &blobs,
     const digest_string_umap &digest_to_filecontents) const
 {
-    std::unordered_set<proto::Digest> digestsToUpload;
+    digest_uset digestsToUpload;
     for (const auto &i : blobs) {
         digestsToUpload.insert(i.first);
     }
@@ -406,8 +752,49 @@ void CASClient::upload_resources(
         digestsToUpload.insert(i.first);
     }
 
+    const auto totalSize = [](const digest_uset &digests) {
+        int64_t size = 0;
+        for (const auto &digest : digests) {
+            size += digest.size_bytes();
+        }
+        return size;
+    };
+
     const auto missingDigests = findMissingBlobs(digestsToUpload);
-    batchUpdateBlobs(missingDigests, blobs, digest_to_filecontents);
+    UploadCoordinator *coordinator = UploadCoordinator::instance();
+    if (coordinator == nullptr || missingDigests.empty()) {
+        batchUpdateBlobs(missingDigests, blobs, digest_to_filecontents);
+        return totalSize(missingDigests);
+    }
+
+    // Blobs that other recc processes on the host are already uploading
+    // are left to them, and only uploaded here if they are still missing
+    // once those processes are done.
+    int64_t uploadedBytes = 0;
+    digest_uset inFlightDigests;
+    {
+        const auto claims = coordinator->claim(missingDigests);
+        batchUpdateBlobs(claims->claimed(), blobs, digest_to_filecontents);
+        uploadedBytes += totalSize(claims->claimed());
+        inFlightDigests = claims->inFlight();
+    }
+
+    if (!inFlightDigests.empty()) {
+        BUILDBOX_LOG_DEBUG("Waiting for other processes to upload "
+                           << inFlightDigests.size() << " blobs");
+        coordinator->waitFor(inFlightDigests);
+
+        const auto stillMissingDigests = findMissingBlobs(inFlightDigests);
+        batchUpdateBlobs(stillMissingDigests, blobs, digest_to_filecontents);
+        uploadedBytes += totalSize(stillMissingDigests);
+
+        buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+            recordCounterMetric(
+                COUNTER_NAME_UPLOADS_DEDUPLICATED,
+                static_cast<int64_t>(inFlightDigests.size() -
+                                     stillMissingDigests.size()));
+    }
+    return uploadedBytes;
 }
 
 } // namespace recc
@@ -15,6 +15,7 @@
 #ifndef INCLUDED_CASCLIENT
 #define INCLUDED_CASCLIENT
 
+#include <compactdigest.h>
 #include <grpccontext.h>
 #include <grpcpp/channel.h>
 #include <merklize.h>
@@ -68,6 +69,10 @@ class CASClient {
     // Unless overridden, we'll use the default batch size.
     int64_t d_maxTotalBatchSizeBytes = s_maxTotalBatchSizeBytes;
 
+    // Whether the server advertises the SplitBlob and SpliceBlob RPCs.
+    bool d_splitBlobSupported = false;
+    bool d_spliceBlobSupported = false;
+
     static const std::string s_guid;
 
   protected:
@@ -89,12 +94,20 @@ class CASClient {
                        GrpcContext *grpcContext);
     /**
      * Unconditionally upload a blob using the ByteStream API.
+     *
+     * If the blob is at least `RECC_CAS_CHUNKING_THRESHOLD` bytes and the
+     * server supports SpliceBlob, only the chunks of the blob that the
+     * server is missing are uploaded and the server reassembles it.
      */
     void upload_blob(const proto::Digest &digest,
                      const std::string &blob) const;
 
     /**
      * Fetch a blob using the ByteStream API.
+     *
+     * If the blob is at least `RECC_CAS_CHUNKING_THRESHOLD` bytes and the
+     * server supports SplitBlob, it is assembled from its chunks instead,
+     * only downloading the chunks that aren't in `RECC_CACHE_DIR`.
      */
     std::string fetch_blob(const proto::Digest &digest) const;
 
@@ -116,8 +129,10 @@ class CASClient {
      * FindMissingBlobsRequest to determine which resources need to be
      * uploaded, then uses the ByteStream and BatchUpdateBlobs APIs to upload
      * them.
+     *
+     * Returns the number of bytes that were missing and had to be uploaded.
      */
-    void
+    int64_t
     upload_resources(const digest_string_umap &blobs,
                      const digest_string_umap &digest_to_filecontents) const;
 
@@ -133,20 +148,46 @@ class CASClient {
     std::string uploadResourceName(const proto::Digest &digest) const;
     std::string downloadResourceName(const proto::Digest &digest) const;
 
-    std::unordered_set<proto::Digest>
-    findMissingBlobs(const std::unordered_set<proto::Digest> &digests) const;
+    digest_uset findMissingBlobs(const digest_uset &digests) const;
 
     proto::FindMissingBlobsResponse
     findMissingBlobs(const proto::FindMissingBlobsRequest &request) const;
 
     void
-    batchUpdateBlobs(const std::unordered_set<proto::Digest> &digests,
+    batchUpdateBlobs(const digest_uset &digests,
                      const digest_string_umap &blobs,
                      const digest_string_umap &digest_to_filecontents) const;
 
     proto::BatchUpdateBlobsResponse
     batchUpdateBlobs(const proto::BatchUpdateBlobsRequest &request) const;
 
+    /**
+     * Fetch the given blobs, using the BatchReadBlobs API for the ones that
+     * fit in a batch.
+     */
+    digest_string_umap batchReadBlobs(const digest_uset &digests) const;
+
+    /**
+     * Returns true if a blob with the given digest is large enough to be
+     * transferred in chunks.
+     */
+    static bool shouldChunk(const proto::Digest &digest);
+
+    /**
+     * Upload the missing chunks of the given blob and have the server
+     * splice them together with SpliceBlob. Returns false if the blob
+     * wasn't uploaded.
+     */
+    bool uploadChunked(const proto::Digest &digest,
+                       const std::string &blob) const;
+
+    /**
+     * Ask the server how the given blob is chunked with SplitBlob and
+     * assemble it from the cached and downloaded chunks. Returns false if
+     * the blob couldn't be fetched that way.
+     */
+    bool fetchChunked(const proto::Digest &digest, std::string *blob) const;
+
     static std::string generate_guid();
 
     /**
@@ -0,0 +1,107 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <chunker.h>
+
+#include <array>
+#include <cstdint>
+
+namespace BloombergLP {
+namespace recc {
+
+namespace {
+
+typedef std::array<uint64_t, 256> GearTable;
+
+/**
+ * Fill the table with pseudo-random values. The values must never change,
+ * or blobs chunked by different versions of recc would no longer share
+ * chunks.
+ */
+GearTable makeGearTable()
+{
+    // SplitMix64, with a fixed seed
+    GearTable table;
+    uint64_t state = 0x7265636343444321;
+    for (auto &entry : table) {
+        state += 0x9e3779b97f4a7c15;
+        uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        entry = z ^ (z >> 31);
+    }
+    return table;
+}
+
+const GearTable Gear = makeGearTable();
+
+// The fingerprint is shifted left for every byte, so its top bits depend on
+// the most bytes. A boundary is found when all the bits in the mask are
+// zero: before the average size is reached, two more bits than
+// log2(average) must match, and after it two fewer, which keeps chunk sizes
+// close to the average.
+const uint64_t MaskSmall = ~uint64_t(0) << (64 - 18);
+const uint64_t MaskLarge = ~uint64_t(0) << (64 - 14);
+
+} // namespace
+
+const size_t Chunker::s_minChunkSize = 16 * 1024;
+const size_t Chunker::s_averageChunkSize = 64 * 1024;
+const size_t Chunker::s_maxChunkSize = 256 * 1024;
+
+size_t Chunker::cutPoint(const char *data, size_t size)
+{
+    if (size <= s_minChunkSize) {
+        return size;
+    }
+    if (size > s_maxChunkSize) {
+        size = s_maxChunkSize;
+    }
+    const size_t normalSize =
+        size < s_averageChunkSize ? size : s_averageChunkSize;
+
+    const auto bytes = reinterpret_cast<const unsigned char *>(data);
+    uint64_t fingerprint = 0;
+    size_t i = s_minChunkSize;
+    for (; i < normalSize; ++i) {
+        fingerprint = (fingerprint << 1) + Gear[bytes[i]];
+        if ((fingerprint & MaskSmall) == 0) {
+            return i + 1;
+        }
+    }
+    for (; i < size; ++i) {
+        fingerprint = (fingerprint << 1) + Gear[bytes[i]];
+        if ((fingerprint & MaskLarge) == 0) {
+            return i + 1;
+        }
+    }
+    return size;
+}
+
+std::vector<std::string> Chunker::split(const std::string &blob)
+{
+    std::vector<std::string> chunks;
+    size_t offset = 0;
+    while (offset < blob.size()) {
+        const size_t length =
+            cutPoint(blob.data() + offset, blob.size() - offset);
+        chunks.emplace_back(blob, offset, length);
+        offset += length;
+    }
+    return chunks;
+}
+
+} // namespace recc
+} // namespace BloombergLP
@@ -0,0 +1,53 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef INCLUDED_CHUNKER
+#define INCLUDED_CHUNKER
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace BloombergLP {
+namespace recc {
+
+/**
+ * Splits blobs into content-defined chunks using the FastCDC algorithm with
+ * normalized chunking (Xia et al., "FastCDC: a Fast and Efficient
+ * Content-Defined Chunking Approach for Data Deduplication", USENIX ATC '16).
+ *
+ * Chunk boundaries depend only on the bytes around them, so a local edit to
+ * a blob only changes the chunks that overlap it and the ones next to them.
+ */
+struct Chunker {
+    static const size_t s_minChunkSize;
+    static const size_t s_averageChunkSize;
+    static const size_t s_maxChunkSize;
+
+    /**
+     * Return the length of the first chunk of the `size` bytes at `data`.
+     */
+    static size_t cutPoint(const char *data, size_t size);
+
+    /**
+     * Split the given blob into chunks whose concatenation is the blob.
+     */
+    static std::vector<std::string> split(const std::string &blob);
+};
+
+} // namespace recc
+} // namespace BloombergLP
+
+#endif
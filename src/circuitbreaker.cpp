@@ -0,0 +1,206 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <circuitbreaker.h>
+
+#include <env.h>
+
+#include <buildboxcommon_logging.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace BloombergLP {
+namespace recc {
+
+namespace {
+
+// A process that starts probing the servers but doesn't report back
+// within this time is assumed to have died, and another one may probe.
+const int64_t ProbeTimeoutMilliseconds = 60000;
+
+// The retry budget, in tenths of a retry: each retry costs 10, and each
+// successful RPC pays back 1. At most this much can be owed.
+const int64_t RetryCost = 10;
+const int64_t SuccessCredit = 1;
+const int64_t MaxRetryDebt = 20 * RetryCost;
+
+int64_t nowMilliseconds()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+} // namespace
+
+// Shared by all the processes that map the file. A new file is zero-filled,
+// which is a closed breaker with an unused retry budget.
+struct CircuitBreaker::State {
+    std::atomic<int64_t> d_consecutiveFailures;
+    // When the breaker was last opened, 0 if it is closed
+    std::atomic<int64_t> d_openedAt;
+    // When a process started probing the servers, 0 if none is
+    std::atomic<int64_t> d_probeStartedAt;
+    std::atomic<int64_t> d_retryDebt;
+};
+
+CircuitBreaker *CircuitBreaker::instance()
+{
+    static const std::unique_ptr<CircuitBreaker> s_instance = []() {
+        std::unique_ptr<CircuitBreaker> result;
+        if (RECC_CIRCUIT_BREAKER_THRESHOLD <= 0) {
+            return result;
+        }
+
+        // Processes talking to different servers don't share a breaker.
+        std::ostringstream path;
+        path << TMPDIR << "/recc-circuit-" << getuid() << "-" << std::hex
+             << std::hash<std::string>()(RECC_SERVER + "\n" +
+                                         RECC_CAS_SERVER + "\n" +
+                                         RECC_ACTION_CACHE_SERVER);
+        try {
+            result = std::make_unique<CircuitBreaker>(
+                path.str(), RECC_CIRCUIT_BREAKER_THRESHOLD,
+                std::chrono::seconds(RECC_CIRCUIT_BREAKER_COOLDOWN));
+        }
+        catch (const std::exception &e) {
+            BUILDBOX_LOG_WARNING("Not using a circuit breaker: " << e.what());
+        }
+        return result;
+    }();
+    return s_instance.get();
+}
+
+CircuitBreaker::CircuitBreaker(const std::string &path, int threshold,
+                               std::chrono::milliseconds cooldown)
+    : d_state(nullptr), d_threshold(threshold), d_cooldown(cooldown),
+      d_probing(false)
+{
+    if (!std::atomic<int64_t>().is_lock_free()) {
+        throw std::runtime_error("64-bit atomics are not lock-free");
+    }
+
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        throw std::system_error(errno, std::system_category(),
+                                "Could not open " + path);
+    }
+
+    struct stat statResult;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &statResult) == 0 &&
+        (statResult.st_size >= static_cast<off_t>(sizeof(State)) ||
+         ftruncate(fd, sizeof(State)) == 0)) {
+        mapping = mmap(nullptr, sizeof(State), PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+    }
+    const int error = errno;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::system_error(error, std::system_category(),
+                                "Could not map " + path);
+    }
+    d_state = static_cast<State *>(mapping);
+}
+
+CircuitBreaker::~CircuitBreaker() { munmap(d_state, sizeof(State)); }
+
+bool CircuitBreaker::allowRequests()
+{
+    const int64_t openedAt = d_state->d_openedAt;
+    if (openedAt == 0 || d_probing) {
+        return true;
+    }
+
+    const int64_t now = nowMilliseconds();
+    if (now - openedAt < d_cooldown.count()) {
+        return false;
+    }
+
+    int64_t probeStartedAt = d_state->d_probeStartedAt;
+    if (probeStartedAt != 0 &&
+        now - probeStartedAt < ProbeTimeoutMilliseconds) {
+        return false;
+    }
+    if (d_state->d_probeStartedAt.compare_exchange_strong(probeStartedAt,
+                                                          now)) {
+        BUILDBOX_LOG_INFO("Checking whether the remote servers are back");
+        d_probing = true;
+    }
+    return d_probing;
+}
+
+void CircuitBreaker::recordSuccess()
+{
+    d_state->d_consecutiveFailures = 0;
+    if (d_state->d_openedAt.exchange(0) != 0) {
+        BUILDBOX_LOG_INFO("The remote servers are reachable again");
+    }
+    d_state->d_probeStartedAt = 0;
+    d_probing = false;
+
+    int64_t debt = d_state->d_retryDebt;
+    while (debt > 0 && !d_state->d_retryDebt.compare_exchange_weak(
+                           debt, std::max<int64_t>(0, debt - SuccessCredit))) {
+    }
+}
+
+void CircuitBreaker::recordFailure()
+{
+    const int64_t failures = ++d_state->d_consecutiveFailures;
+    if (d_probing || failures >= d_threshold) {
+        if (d_state->d_openedAt.exchange(nowMilliseconds()) == 0) {
+            BUILDBOX_LOG_WARNING("The remote servers failed "
+                                 << failures
+                                 << " times in a row, running commands "
+                                    "locally for now");
+        }
+        d_state->d_probeStartedAt = 0;
+        d_probing = false;
+    }
+}
+
+bool CircuitBreaker::tryRetry()
+{
+    int64_t debt = d_state->d_retryDebt;
+    do {
+        if (debt + RetryCost > MaxRetryDebt) {
+            return false;
+        }
+    } while (
+        !d_state->d_retryDebt.compare_exchange_weak(debt, debt + RetryCost));
+    return true;
+}
+
+bool CircuitBreaker::isOpen() const { return d_state->d_openedAt != 0; }
+
+int64_t CircuitBreaker::consecutiveFailures() const
+{
+    return d_state->d_consecutiveFailures;
+}
+
+} // namespace recc
+} // namespace BloombergLP
@@ -0,0 +1,101 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef INCLUDED_CIRCUITBREAKER
+#define INCLUDED_CIRCUITBREAKER
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace BloombergLP {
+namespace recc {
+
+/**
+ * Tracks whether the remote servers are reachable, in a small file that
+ * every recc process on the host using the same servers maps into memory.
+ * This way, when the servers go down, the processes stop waiting for them
+ * after a few failures instead of each finding out on its own.
+ *
+ * The breaker opens after `threshold` consecutive failed RPCs. While it is
+ * open, recc runs commands locally. After `cooldown`, a single process is
+ * allowed to use the servers again (the breaker is half-open) and the
+ * outcome of its RPCs closes or reopens the breaker.
+ *
+ * The file also holds a host-wide budget for retrying failed RPCs: each
+ * retry takes from it and each successful RPC adds a fraction of a retry
+ * back, so that an outage doesn't cause a storm of retries.
+ */
+class CircuitBreaker {
+  public:
+    /**
+     * Return the breaker for the servers in the configuration, or null if
+     * `RECC_CIRCUIT_BREAKER_THRESHOLD` is 0 or the breaker's file can't be
+     * used.
+     */
+    static CircuitBreaker *instance();
+
+    /**
+     * Use the breaker stored in the given file, creating it if needed.
+     * Throws `std::system_error` if the file can't be mapped.
+     */
+    CircuitBreaker(const std::string &path, int threshold,
+                   std::chrono::milliseconds cooldown);
+    ~CircuitBreaker();
+
+    CircuitBreaker(const CircuitBreaker &) = delete;
+    CircuitBreaker &operator=(const CircuitBreaker &) = delete;
+
+    /**
+     * Returns true if RPCs may be sent: the breaker is closed, or it is
+     * half-open and this process is the one that tries the servers.
+     */
+    bool allowRequests();
+
+    /**
+     * Record the outcome of an RPC. Only failures that mean the server
+     * couldn't be reached, and replies that show it is working, should be
+     * recorded.
+     */
+    void recordSuccess();
+    void recordFailure();
+
+    /**
+     * Take one retry from the budget. Returns false if there is none left.
+     */
+    bool tryRetry();
+
+    /**
+     * Return whether the breaker is open or half-open, and the number of
+     * consecutive failed RPCs, without trying the servers.
+     */
+    bool isOpen() const;
+    int64_t consecutiveFailures() const;
+
+  private:
+    struct State;
+
+    State *d_state;
+    int d_threshold;
+    std::chrono::milliseconds d_cooldown;
+    // Whether this process is the one trying the servers while half-open
+    std::atomic_bool d_probing;
+};
+
+} // namespace recc
+} // namespace BloombergLP
+
+#endif
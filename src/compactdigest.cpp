@@ -0,0 +1,125 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <compactdigest.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace BloombergLP {
+namespace recc {
+
+namespace {
+
+int hexValue(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+} // namespace
+
+bool CompactDigest::decodeHex(const std::string &hex, unsigned char *bytes)
+{
+    if (hex.size() % 2 != 0) {
+        return false;
+    }
+    for (size_t i = 0; i < hex.size() / 2; ++i) {
+        const int high = hexValue(hex[2 * i]);
+        const int low = hexValue(hex[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        bytes[i] = static_cast<unsigned char>(high * 16 + low);
+    }
+    return true;
+}
+
+std::string CompactDigest::encodeHex(const unsigned char *bytes,
+                                     size_t length)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+    std::string hex(2 * length, '0');
+    for (size_t i = 0; i < length; ++i) {
+        hex[2 * i] = hexDigits[bytes[i] >> 4];
+        hex[2 * i + 1] = hexDigits[bytes[i] & 0xf];
+    }
+    return hex;
+}
+
+CompactDigest::CompactDigest() : d_sizeBytes(0), d_hashBytes(0), d_hash() {}
+
+CompactDigest::CompactDigest(const proto::Digest &digest)
+    : d_sizeBytes(digest.size_bytes()), d_hashBytes(0), d_hash()
+{
+    const std::string &hex = digest.hash();
+    if (hex.size() % 2 != 0 || hex.size() > 2 * s_maxHashBytes) {
+        d_unpackedHash = hex;
+        return;
+    }
+
+    if (!decodeHex(hex, d_hash.data())) {
+        d_hash.fill(0);
+        d_unpackedHash = hex;
+        return;
+    }
+    d_hashBytes = static_cast<uint8_t>(hex.size() / 2);
+}
+
+proto::Digest CompactDigest::toProto() const
+{
+    proto::Digest digest;
+    digest.set_hash(hash());
+    digest.set_size_bytes(d_sizeBytes);
+    return digest;
+}
+
+std::string CompactDigest::hash() const
+{
+    if (!d_unpackedHash.empty()) {
+        return d_unpackedHash;
+    }
+    return encodeHex(d_hash.data(), d_hashBytes);
+}
+
+size_t CompactDigest::hashCode() const
+{
+    if (!d_unpackedHash.empty()) {
+        return std::hash<std::string>()(d_unpackedHash) ^
+               static_cast<size_t>(d_sizeBytes);
+    }
+
+    // The bytes of a cryptographic hash are already evenly distributed
+    size_t result = 0;
+    std::memcpy(&result, d_hash.data(),
+                std::min(sizeof(result), static_cast<size_t>(d_hashBytes)));
+    return result ^ static_cast<size_t>(d_sizeBytes);
+}
+
+bool CompactDigest::operator==(const CompactDigest &other) const
+{
+    return d_sizeBytes == other.d_sizeBytes &&
+           d_hashBytes == other.d_hashBytes &&
+           std::memcmp(d_hash.data(), other.d_hash.data(), d_hashBytes) ==
+               0 &&
+           d_unpackedHash == other.d_unpackedHash;
+}
+
+} // namespace recc
+} // namespace BloombergLP
@@ -0,0 +1,99 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_COMPACTDIGEST
+#define INCLUDED_COMPACTDIGEST
+
+#include <protos.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace BloombergLP {
+namespace recc {
+
+/**
+ * A Digest as it is kept in memory: the hash as raw bytes instead of a
+ * hex string. It can be copied without allocating, and hashed and
+ * compared without going through 64-character strings, which matters for
+ * the containers of thousands of digests built for every Action.
+ *
+ * Converting from a `proto::Digest` is implicit, so containers keyed on
+ * `CompactDigest` can be looked up with either. Converting back is done
+ * explicitly with `toProto()` where digests go into messages.
+ */
+class CompactDigest {
+  public:
+    CompactDigest();
+    CompactDigest(const proto::Digest &digest); // NOLINT: implicit
+
+    proto::Digest toProto() const;
+
+    // The hash as a hex string, as in `proto::Digest`
+    std::string hash() const;
+    int64_t size_bytes() const { return d_sizeBytes; }
+
+    size_t hashCode() const;
+
+    bool operator==(const CompactDigest &other) const;
+    bool operator!=(const CompactDigest &other) const
+    {
+        return !(*this == other);
+    }
+
+    // Enough for a SHA-512 hash
+    static const size_t s_maxHashBytes = 64;
+
+    /**
+     * Decode a lowercase hex string into `hex.size() / 2` bytes. Returns
+     * false if it has an odd length or other characters, in which case
+     * `bytes` may have been partly written.
+     */
+    static bool decodeHex(const std::string &hex, unsigned char *bytes);
+
+    /**
+     * Encode the given bytes as a lowercase hex string.
+     */
+    static std::string encodeHex(const unsigned char *bytes, size_t length);
+
+  private:
+    int64_t d_sizeBytes;
+    uint8_t d_hashBytes;
+    std::array<unsigned char, s_maxHashBytes> d_hash;
+    // Hashes that are not lowercase hex (or too long), kept as they are.
+    // Only expected from tests and misbehaving servers.
+    std::string d_unpackedHash;
+};
+
+typedef std::unordered_map<CompactDigest, std::string> digest_string_umap;
+typedef std::unordered_set<CompactDigest> digest_uset;
+
+} // namespace recc
+} // namespace BloombergLP
+
+namespace std {
+template <> struct hash<BloombergLP::recc::CompactDigest> {
+    size_t operator()(const BloombergLP::recc::CompactDigest &digest) const
+    {
+        return digest.hashCode();
+    }
+};
+} // namespace std
+
+#endif
@@ -0,0 +1,202 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <configsnapshot.h>
+
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace BloombergLP {
+namespace recc {
+
+ConfigSnapshotWriter::ConfigSnapshotWriter(const std::string &key)
+{
+    write(key);
+}
+
+void ConfigSnapshotWriter::writeLength(size_t length)
+{
+    const uint32_t value = static_cast<uint32_t>(length);
+    d_data.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void ConfigSnapshotWriter::write(const std::string &value)
+{
+    writeLength(value.size());
+    d_data.append(value);
+}
+
+void ConfigSnapshotWriter::write(bool value)
+{
+    d_data.push_back(value ? 1 : 0);
+}
+
+void ConfigSnapshotWriter::write(int value)
+{
+    const int32_t encoded = static_cast<int32_t>(value);
+    d_data.append(reinterpret_cast<const char *>(&encoded), sizeof(encoded));
+}
+
+void ConfigSnapshotWriter::write(const std::set<std::string> &value)
+{
+    writeLength(value.size());
+    for (const auto &element : value) {
+        write(element);
+    }
+}
+
+void ConfigSnapshotWriter::write(
+    const std::map<std::string, std::string> &value)
+{
+    writeLength(value.size());
+    for (const auto &element : value) {
+        write(element.first);
+        write(element.second);
+    }
+}
+
+ConfigSnapshotReader::ConfigSnapshotReader(const std::string &path,
+                                           const std::string &key)
+    : d_mapping(MAP_FAILED), d_mappingSize(0), d_position(nullptr),
+      d_end(nullptr), d_valid(false)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return;
+    }
+
+    struct stat statResult;
+    if (fstat(fd, &statResult) == 0 && statResult.st_size > 0) {
+        d_mappingSize = static_cast<size_t>(statResult.st_size);
+        d_mapping =
+            mmap(nullptr, d_mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (d_mapping == MAP_FAILED) {
+        return;
+    }
+
+    d_position = static_cast<const char *>(d_mapping);
+    d_end = d_position + d_mappingSize;
+    d_valid = true;
+
+    size_t keyLength = 0;
+    d_valid = readLength(&keyLength) &&
+              static_cast<size_t>(d_end - d_position) >= keyLength &&
+              keyLength == key.size() &&
+              memcmp(d_position, key.data(), keyLength) == 0;
+    if (d_valid) {
+        d_position += keyLength;
+    }
+}
+
+ConfigSnapshotReader::~ConfigSnapshotReader()
+{
+    if (d_mapping != MAP_FAILED) {
+        munmap(d_mapping, d_mappingSize);
+    }
+}
+
+bool ConfigSnapshotReader::readLength(size_t *length)
+{
+    uint32_t value = 0;
+    if (!d_valid || static_cast<size_t>(d_end - d_position) < sizeof(value)) {
+        d_valid = false;
+        return false;
+    }
+    memcpy(&value, d_position, sizeof(value));
+    d_position += sizeof(value);
+    *length = value;
+    return true;
+}
+
+bool ConfigSnapshotReader::read(std::string *value)
+{
+    size_t length = 0;
+    if (!readLength(&length) ||
+        static_cast<size_t>(d_end - d_position) < length) {
+        d_valid = false;
+        return false;
+    }
+    value->assign(d_position, length);
+    d_position += length;
+    return true;
+}
+
+bool ConfigSnapshotReader::read(bool *value)
+{
+    if (!d_valid || d_position == d_end) {
+        d_valid = false;
+        return false;
+    }
+    *value = *d_position++ != 0;
+    return true;
+}
+
+bool ConfigSnapshotReader::read(int *value)
+{
+    int32_t encoded = 0;
+    if (!d_valid ||
+        static_cast<size_t>(d_end - d_position) < sizeof(encoded)) {
+        d_valid = false;
+        return false;
+    }
+    memcpy(&encoded, d_position, sizeof(encoded));
+    d_position += sizeof(encoded);
+    *value = static_cast<int>(encoded);
+    return true;
+}
+
+bool ConfigSnapshotReader::read(std::set<std::string> *value)
+{
+    size_t count = 0;
+    if (!readLength(&count)) {
+        return false;
+    }
+    value->clear();
+    std::string element;
+    for (size_t i = 0; i < count; ++i) {
+        if (!read(&element)) {
+            return false;
+        }
+        value->emplace_hint(value->end(), element);
+    }
+    return true;
+}
+
+bool ConfigSnapshotReader::read(std::map<std::string, std::string> *value)
+{
+    size_t count = 0;
+    if (!readLength(&count)) {
+        return false;
+    }
+    value->clear();
+    std::string key;
+    std::string element;
+    for (size_t i = 0; i < count; ++i) {
+        if (!read(&key) || !read(&element)) {
+            return false;
+        }
+        value->emplace_hint(value->end(), key, element);
+    }
+    return true;
+}
+
+} // namespace recc
+} // namespace BloombergLP
@@ -0,0 +1,105 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef INCLUDED_CONFIGSNAPSHOT
+#define INCLUDED_CONFIGSNAPSHOT
+
+#include <cstddef>
+#include <map>
+#include <set>
+#include <string>
+
+namespace BloombergLP {
+namespace recc {
+
+/**
+ * Encodes configuration values for a snapshot, a file that caches what the
+ * config files and environment parse to (see
+ * `Env::parse_config_variables()`).
+ *
+ * A snapshot starts with the key it was written for, followed by the
+ * values in the order they were written. It is only meant to be read by
+ * the same build of recc that wrote it, so numbers are in native byte
+ * order.
+ */
+class ConfigSnapshotWriter {
+  public:
+    explicit ConfigSnapshotWriter(const std::string &key);
+
+    void write(const std::string &value);
+    void write(bool value);
+    void write(int value);
+    void write(const std::set<std::string> &value);
+    void write(const std::map<std::string, std::string> &value);
+
+    const std::string &data() const { return d_data; }
+
+  private:
+    void writeLength(size_t length);
+
+    std::string d_data;
+};
+
+/**
+ * Reads the values from a snapshot written by `ConfigSnapshotWriter`,
+ * which is mapped into memory rather than copied.
+ */
+class ConfigSnapshotReader {
+  public:
+    /**
+     * Map the snapshot at the given path. `valid()` returns false if it
+     * can't be read or was written for a different key.
+     */
+    ConfigSnapshotReader(const std::string &path, const std::string &key);
+    ~ConfigSnapshotReader();
+
+    ConfigSnapshotReader(const ConfigSnapshotReader &) = delete;
+    ConfigSnapshotReader &operator=(const ConfigSnapshotReader &) = delete;
+
+    /**
+     * Return false if the snapshot couldn't be read, or if any read so far
+     * has failed.
+     */
+    bool valid() const { return d_valid; }
+
+    /**
+     * Return whether every value in the snapshot has been read.
+     */
+    bool atEnd() const { return d_position == d_end; }
+
+    /**
+     * Read the next value. Returns false, and makes the reader invalid, if
+     * the snapshot is truncated.
+     */
+    bool read(std::string *value);
+    bool read(bool *value);
+    bool read(int *value);
+    bool read(std::set<std::string> *value);
+    bool read(std::map<std::string, std::string> *value);
+
+  private:
+    bool readLength(size_t *length);
+
+    void *d_mapping;
+    size_t d_mappingSize;
+    const char *d_position;
+    const char *d_end;
+    bool d_valid;
+};
+
+} // namespace recc
+} // namespace BloombergLP
+
+#endif
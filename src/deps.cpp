@@ -15,43 +15,283 @@
 #include <deps.h>
 
 #include <compilerdefaults.h>
+#include <digestgenerator.h>
+#include <digesttable.h>
 #include <env.h>
+#include <fileutils.h>
+#include <responsefile.h>
 #include <subprocess.h>
+#include <toolchainprobe.h>
 
 #include <buildboxcommon_fileutils.h>
 #include <buildboxcommon_logging.h>
 
+#include <algorithm>
 #include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <list>
+#include <memory>
 #include <regex>
 #include <sstream>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <system_error>
 #include <unistd.h>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#endif
 
 namespace BloombergLP {
 namespace recc {
 
+namespace {
+
+/**
+ * Return whether the given character changes the state of the make rules
+ * parser wherever it appears. (A slash only does at the start of a file
+ * name.)
+ */
+inline bool isSpecialCharacter(char character)
+{
+    return character == '\\' || character == ':' || character == '\n' ||
+           character == ' ';
+}
+
+/**
+ * Return the first special character in [start, end), or a slash if
+ * `stopAtSlash` is set, or `end` if there is none.
+ */
+const char *findSpecialCharacter(const char *start, const char *end,
+                                 bool stopAtSlash)
+{
+#if defined(__SSE2__) && defined(__GNUC__)
+    // Compare 16 bytes at a time against every special character
+    const __m128i backslashes = _mm_set1_epi8('\\');
+    const __m128i colons = _mm_set1_epi8(':');
+    const __m128i newlines = _mm_set1_epi8('\n');
+    const __m128i spaces = _mm_set1_epi8(' ');
+    const __m128i slashes = _mm_set1_epi8(stopAtSlash ? '/' : ' ');
+    while (end - start >= 16) {
+        const __m128i chunk =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(start));
+        const __m128i matches = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, backslashes),
+                         _mm_cmpeq_epi8(chunk, colons)),
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, newlines),
+                                      _mm_cmpeq_epi8(chunk, spaces)),
+                         _mm_cmpeq_epi8(chunk, slashes)));
+        const int mask = _mm_movemask_epi8(matches);
+        if (mask != 0) {
+            return start + __builtin_ctz(static_cast<unsigned int>(mask));
+        }
+        start += 16;
+    }
+#endif
+    while (start != end && !isSpecialCharacter(*start) &&
+           !(stopAtSlash && *start == '/')) {
+        ++start;
+    }
+    return start;
+}
+
+/**
+ * Collects the file names found by the make rules parser. Names are kept
+ * as pointers into the parsed rules where possible, and only copied once
+ * each, when the result is built.
+ */
+class FileNames {
+  public:
+    FileNames() : d_currentStart(nullptr), d_currentLength(0) {}
+
+    bool currentEmpty() const { return d_currentLength == 0; }
+
+    /**
+     * Append [begin, end) to the current file name.
+     */
+    void append(const char *begin, const char *end)
+    {
+        if (d_currentLength == 0) {
+            d_currentStart = begin;
+            d_currentLength = static_cast<size_t>(end - begin);
+        }
+        else if (d_currentStart == d_currentCopy.data() ||
+                 d_currentStart + d_currentLength != begin) {
+            // Not contiguous in the rules, e.g. after an escaped character
+            if (d_currentStart != d_currentCopy.data()) {
+                d_currentCopy.assign(d_currentStart, d_currentLength);
+            }
+            d_currentCopy.append(begin, end);
+            d_currentStart = d_currentCopy.data();
+            d_currentLength = d_currentCopy.size();
+        }
+        else {
+            d_currentLength += static_cast<size_t>(end - begin);
+        }
+    }
+
+    /**
+     * Add the current file name, if any, to the result and start a new one.
+     */
+    void finishCurrent()
+    {
+        if (d_currentLength == 0) {
+            return;
+        }
+        if (d_currentStart == d_currentCopy.data()) {
+            d_copies.push_back(std::move(d_currentCopy));
+            d_currentCopy = std::string();
+            d_currentStart = d_copies.back().data();
+        }
+        d_names.emplace_back(d_currentStart, d_currentLength);
+        d_currentLength = 0;
+    }
+
+    /**
+     * Return the distinct file names.
+     */
+    std::set<std::string> toSet()
+    {
+        const auto less = [](const Name &a, const Name &b) {
+            const int comparison =
+                memcmp(a.first, b.first, std::min(a.second, b.second));
+            return comparison < 0 ||
+                   (comparison == 0 && a.second < b.second);
+        };
+        const auto equal = [](const Name &a, const Name &b) {
+            return a.second == b.second &&
+                   memcmp(a.first, b.first, a.second) == 0;
+        };
+        std::sort(d_names.begin(), d_names.end(), less);
+        d_names.erase(std::unique(d_names.begin(), d_names.end(), equal),
+                      d_names.end());
+
+        // Sorted, so every insertion goes at the end
+        std::set<std::string> result;
+        for (const auto &name : d_names) {
+            result.emplace_hint(result.end(), name.first, name.second);
+        }
+        return result;
+    }
+
+  private:
+    typedef std::pair<const char *, size_t> Name;
+
+    const char *d_currentStart;
+    size_t d_currentLength;
+    // Holds the current name if it isn't contiguous in the rules
+    std::string d_currentCopy;
+    // Node-based, so the names keep their addresses
+    std::list<std::string> d_copies;
+    std::vector<Name> d_names;
+};
+
+const std::string DepfileRecordHeader = "recc-depfile 1";
+
+/**
+ * Return the given path, relative to the given directory if it is
+ * relative and the directory isn't empty.
+ */
+std::string inDirectory(const std::string &path, const std::string &directory)
+{
+    return directory.empty() || path.empty() || path.front() == '/'
+               ? path
+               : directory + "/" + path;
+}
+
+/**
+ * Return where the record of the command that wrote the given dependency
+ * file is kept.
+ */
+std::string depfileRecordPath(const std::string &depfile,
+                              const std::string &workingDirectory)
+{
+    const std::string path = inDirectory(depfile, workingDirectory);
+    return RECC_CACHE_DIR + "/depfiles/" +
+           DigestGenerator::make_digest(
+               buildboxcommon::FileUtils::normalizePath(path.c_str()))
+               .hash();
+}
+
+/**
+ * Return the record of the given command having written the dependency
+ * file with the given stat result, or an empty string if the compiler
+ * can't be found.
+ *
+ * The record identifies the compiler, its arguments (the order of `-I`
+ * options and any `-D` options select the headers), the directory it ran
+ * in and `RECC_DEPS_ENV`, and the exact dependency file that was written.
+ */
+std::string depfileRecord(const ParsedCommand &command,
+                          const std::string &workingDirectory,
+                          const struct stat &depfileStat)
+{
+    const auto &arguments = command.d_originalCommand;
+    const std::string &compiler = arguments.front();
+    const std::string compilerKey = ToolchainProbe::cacheKey(
+        compiler.find('/') == std::string::npos
+            ? compiler
+            : inDirectory(compiler, workingDirectory),
+        std::vector<std::string>(arguments.begin() + 1, arguments.end()));
+    if (compilerKey.empty()) {
+        return "";
+    }
+
+    const FileIdentity identity = FileIdentity::fromStat(depfileStat);
+    std::ostringstream record;
+    record << DepfileRecordHeader << "\n"
+           << DigestGenerator::make_digest(compilerKey + workingDirectory)
+                  .hash()
+           << "\n"
+           << identity.d_device << " " << identity.d_inode << " "
+           << identity.d_size << " " << identity.d_mtime << " "
+           << identity.d_ctime << "\n";
+    return record.str();
+}
+
+} // namespace
+
 std::set<std::string> Deps::dependencies_from_make_rules(
     const std::string &rules, bool is_sun_format, bool include_global_paths)
 {
-    std::set<std::string> result;
+    FileNames fileNames;
     bool saw_colon_on_line = false;
     bool saw_backslash = false;
     bool ignoring_file = false;
 
-    std::string current_filename;
-    for (const char &character : rules) {
+    // Runs of characters that don't affect the parser's state are skipped
+    // or added to the current file name in one go; the others are handled
+    // one at a time.
+    const char *position = rules.data();
+    const char *const end = position + rules.size();
+    while (position != end) {
+        const char character = *position;
         if (saw_backslash) {
             saw_backslash = false;
             if (character != '\n' && !ignoring_file && saw_colon_on_line) {
-                current_filename += character;
+                fileNames.append(position, position + 1);
             }
         }
+        else if (!isSpecialCharacter(character) &&
+                 (character != '/' || !fileNames.currentEmpty() ||
+                  include_global_paths)) {
+            // Without a colon, or while ignoring a file, the current file
+            // name is empty, so a slash starts an ignored file
+            const bool appending = saw_colon_on_line && !ignoring_file;
+            const char *runEnd = findSpecialCharacter(
+                position + 1, end, !appending && !include_global_paths);
+            if (appending) {
+                fileNames.append(position, runEnd);
+            }
+            position = runEnd;
+            continue;
+        }
         else if (character == '\\') {
             saw_backslash = true;
         }
@@ -61,40 +301,32 @@ std::set<std::string> Deps::dependencies_from_make_rules(
         else if (character == '\n') {
             saw_colon_on_line = false;
             ignoring_file = false;
-            if (!current_filename.empty()) {
-                result.insert(current_filename);
-            }
-            current_filename.clear();
+            fileNames.finishCurrent();
         }
         else if (character == ' ') {
             if (is_sun_format) {
-                if (!current_filename.empty() && !ignoring_file &&
+                if (!fileNames.currentEmpty() && !ignoring_file &&
                     saw_colon_on_line) {
-                    current_filename += character;
+                    fileNames.append(position, position + 1);
                 }
             }
             else {
                 ignoring_file = false;
-                if (!current_filename.empty()) {
-                    result.insert(current_filename);
-                }
-                current_filename.clear();
+                fileNames.finishCurrent();
             }
         }
-        else if (character == '/' && current_filename.empty() &&
-                 !include_global_paths) {
+        else if (character == '/') {
             ignoring_file = true;
         }
         else if (!ignoring_file && saw_colon_on_line) {
-            current_filename += character;
+            // A colon after the first one on a line
+            fileNames.append(position, position + 1);
         }
+        ++position;
     }
 
-    if (!current_filename.empty()) {
-        result.insert(current_filename);
-    }
-
-    return result;
+    fileNames.finishCurrent();
+    return fileNames.toSet();
 }
 
 std::string Deps::crtbegin_from_clang_v(const std::string &str)
@@ -131,46 +363,205 @@ std::string Deps::crtbegin_from_clang_v(const std::string &str)
     return crtbegin_file;
 }
 
-CommandFileInfo Deps::get_file_info(const ParsedCommand &parsedCommand)
+bool Deps::dependencies_from_depfile(const ParsedCommand &parsedCommand,
+                                     std::set<std::string> *dependencies,
+                                     const std::string &directory)
 {
-    CommandFileInfo result;
-    bool is_clang = parsedCommand.is_clang();
-    const auto subprocessResult =
-        Subprocess::execute(parsedCommand.get_dependencies_command(), true,
-                            is_clang, RECC_DEPS_ENV);
+    const std::string workingDirectory =
+        directory.empty() ? FileUtils::getCurrentWorkingDirectory()
+                          : directory;
+    const std::string depfile =
+        inDirectory(parsedCommand.get_dependency_file(), directory);
+    if (depfile.empty() || parsedCommand.is_AIX() ||
+        parsedCommand.produces_sun_make_rules()) {
+        return false;
+    }
+
+    if (RECC_CACHE_DIR.empty()) {
+        // Nowhere to keep records of which command wrote the file
+        return false;
+    }
+
+    if (RECC_DEPS_GLOBAL_PATHS &&
+        parsedCommand.dependency_file_omits_system_headers()) {
+        // The dependency file is missing inputs that we need to report:
+        // system headers with -MMD.
+        return false;
+    }
+
+    struct stat depfileStat;
+    if (stat(depfile.c_str(), &depfileStat) != 0) {
+        BUILDBOX_LOG_DEBUG("Dependency file \"" << depfile
+                                                << "\" not found");
+        return false;
+    }
+
+    // A dependency file left by a different command (e.g. with the `-I`
+    // options in a different order) may list the wrong headers.
+    const std::string record =
+        depfileRecord(parsedCommand, workingDirectory, depfileStat);
+    const std::string recordPath =
+        depfileRecordPath(depfile, workingDirectory);
+    std::string recordedRecord;
+    try {
+        recordedRecord =
+            buildboxcommon::FileUtils::getFileContents(recordPath.c_str());
+    }
+    catch (const std::exception &) {
+    }
+    if (record.empty() || record != recordedRecord) {
+        BUILDBOX_LOG_DEBUG("Dependency file \""
+                           << depfile
+                           << "\" was not written by the same command");
+        return false;
+    }
+
+    std::string rules;
+    try {
+        rules = buildboxcommon::FileUtils::getFileContents(depfile.c_str());
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_DEBUG("Could not read dependency file \""
+                           << depfile << "\": " << e.what());
+        return false;
+    }
+
+    // Validate every entry, including system headers, even if they are not
+    // going to be reported.
+    const std::set<std::string> allDependencies =
+        dependencies_from_make_rules(rules, false, true);
+    if (allDependencies.empty()) {
+        return false;
+    }
+
+    // Compared with the full resolution of the timestamps
+    const uint64_t depfileTime = FileIdentity::fromStat(depfileStat).d_mtime;
+    for (const auto &dependency : allDependencies) {
+        struct stat dependencyStat;
+        if (stat(inDirectory(dependency, directory).c_str(),
+                 &dependencyStat) != 0 ||
+            FileIdentity::fromStat(dependencyStat).d_mtime >= depfileTime) {
+            BUILDBOX_LOG_DEBUG("Dependency file \""
+                               << depfile << "\" is stale: \"" << dependency
+                               << "\" is missing or was modified after it");
+            return false;
+        }
+    }
 
-    if (subprocessResult.d_exitCode != 0) {
-        std::string errorMsg = "Failed to execute get dependencies command: ";
-        for (const auto &token : parsedCommand.get_dependencies_command()) {
-            errorMsg += (token + " ");
+    dependencies->clear();
+    for (const auto &dependency : allDependencies) {
+        if (RECC_DEPS_GLOBAL_PATHS || dependency.front() != '/') {
+            dependencies->insert(dependency);
         }
-        BUILDBOX_LOG_ERROR(errorMsg);
-        BUILDBOX_LOG_ERROR("Exit status: " << subprocessResult.d_exitCode);
-        BUILDBOX_LOG_DEBUG("stdout: " << subprocessResult.d_stdOut);
-        BUILDBOX_LOG_DEBUG("stderr: " << subprocessResult.d_stdErr);
-        throw subprocess_failed_error(subprocessResult.d_exitCode);
     }
 
-    std::string dependencies = subprocessResult.d_stdOut;
+    BUILDBOX_LOG_DEBUG("Using dependencies from \"" << depfile << "\"");
+    return true;
+}
+
+void Deps::record_depfile(const ParsedCommand &command,
+                          const std::string &workingDirectory)
+{
+    const std::string depfile = command.get_dependency_file();
+    if (!RECC_DEPS_DEPEND_MODE || RECC_CACHE_DIR.empty() || depfile.empty() ||
+        command.d_originalCommand.empty()) {
+        return;
+    }
+
+    const std::string path = inDirectory(depfile, workingDirectory);
+    struct stat depfileStat;
+    if (stat(path.c_str(), &depfileStat) != 0) {
+        return;
+    }
 
-    // If AIX compiler, read dependency information from temporary file.
+    const std::string record =
+        depfileRecord(command, workingDirectory, depfileStat);
+    if (record.empty()) {
+        return;
+    }
 
-    if (parsedCommand.is_AIX()) {
-        dependencies = buildboxcommon::FileUtils::getFileContents(
-            parsedCommand.get_aix_dependency_file_name().c_str());
+    const std::string recordPath =
+        depfileRecordPath(depfile, workingDirectory);
+    try {
+        FileUtils::writeFileAtomically(recordPath, record);
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_WARNING("Could not record the command that wrote \""
+                             << path << "\" in " << recordPath << ": "
+                             << e.what());
     }
+}
+
+CommandFileInfo Deps::get_file_info(const ParsedCommand &parsedCommand,
+                                    const std::string &workingDirectory)
+{
+    CommandFileInfo result;
+    bool is_clang = parsedCommand.is_clang();
+
+    const bool fromDepfile =
+        RECC_DEPS_DEPEND_MODE &&
+        dependencies_from_depfile(parsedCommand, &result.d_dependencies,
+                                  workingDirectory);
+    if (!fromDepfile) {
+        // The arguments of response files were expanded, and may be too
+        // many to pass on the command line
+        std::unique_ptr<TemporaryResponseFile> responseFile;
+        if (parsedCommand.uses_response_files()) {
+            responseFile = std::make_unique<TemporaryResponseFile>(
+                parsedCommand.get_dependencies_command());
+        }
+        const auto subprocessResult = Subprocess::execute(
+            responseFile ? responseFile->command()
+                         : parsedCommand.get_dependencies_command(),
+            true, is_clang, RECC_DEPS_ENV, workingDirectory);
+
+        if (subprocessResult.d_exitCode != 0) {
+            std::string errorMsg =
+                "Failed to execute get dependencies command: ";
+            for (const auto &token :
+                 parsedCommand.get_dependencies_command()) {
+                errorMsg += (token + " ");
+            }
+            BUILDBOX_LOG_ERROR(errorMsg);
+            BUILDBOX_LOG_ERROR("Exit status: " << subprocessResult.d_exitCode);
+            BUILDBOX_LOG_DEBUG("stdout: " << subprocessResult.d_stdOut);
+            BUILDBOX_LOG_DEBUG("stderr: " << subprocessResult.d_stdErr);
+            throw subprocess_failed_error(subprocessResult.d_exitCode);
+        }
+
+        std::string dependencies = subprocessResult.d_stdOut;
+
+        // If AIX compiler, read dependency information from temporary file.
 
-    result.d_dependencies = dependencies_from_make_rules(
-        dependencies, parsedCommand.produces_sun_make_rules(),
-        RECC_DEPS_GLOBAL_PATHS);
+        if (parsedCommand.is_AIX()) {
+            dependencies = buildboxcommon::FileUtils::getFileContents(
+                parsedCommand.get_aix_dependency_file_name().c_str());
+        }
+
+        result.d_dependencies = dependencies_from_make_rules(
+            dependencies, parsedCommand.produces_sun_make_rules(),
+            RECC_DEPS_GLOBAL_PATHS);
+
+        if (RECC_DEPS_GLOBAL_PATHS && is_clang &&
+            !ToolchainProbe::cacheEnabled()) {
+            // Clang tries to locate GCC installations by looking for
+            // crtbegin.o and then adjusts its system include paths. We need
+            // to upload this file as if it were an input.
+            std::string crtbegin =
+                crtbegin_from_clang_v(subprocessResult.d_stdErr);
+            if (crtbegin != "") {
+                result.d_dependencies.insert(crtbegin);
+            }
+        }
+    }
 
-    if (RECC_DEPS_GLOBAL_PATHS && is_clang) {
-        // Clang tries to locate GCC installations by looking for crtbegin.o
-        // and then adjusts its system include paths. We need to upload this
-        // file as if it were an input.
-        std::string crtbegin =
-            crtbegin_from_clang_v(subprocessResult.d_stdErr);
-        if (crtbegin != "") {
+    if (RECC_DEPS_GLOBAL_PATHS && is_clang &&
+        (ToolchainProbe::cacheEnabled() || fromDepfile)) {
+        // As above, but the location is remembered across invocations, or
+        // the dependency command (and its `-v` output) was skipped.
+        const std::string crtbegin =
+            ToolchainProbe::get(parsedCommand).d_crtbegin;
+        if (!crtbegin.empty()) {
             result.d_dependencies.insert(crtbegin);
         }
     }
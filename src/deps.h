@@ -53,8 +53,14 @@ struct Deps {
      * returns false, the result of calling get_file_info is undefined.
      *
      * Only paths local to the build directory are returned.
+     *
+     * The command is taken to be run in `workingDirectory`, or in the
+     * current directory if it is empty. Relative paths in the result are
+     * relative to that directory.
      */
-    static CommandFileInfo get_file_info(const ParsedCommand &command);
+    static CommandFileInfo
+    get_file_info(const ParsedCommand &command,
+                  const std::string &workingDirectory = "");
 
     /**
      * Parse the given Make rules and return a set containing their
@@ -65,6 +71,38 @@ struct Deps {
                                  bool is_sun_format = false,
                                  bool include_global_paths = false);
 
+    /**
+     * Read the dependency file left behind by a previous run of the given
+     * command (see `ParsedCommand::get_dependency_file()`) and store the
+     * dependencies it lists in `dependencies`, filtered in the same way as
+     * `dependencies_from_make_rules()`.
+     *
+     * The file is only used if `record_depfile()` recorded that it was
+     * written by the same compiler, with the same arguments and
+     * `RECC_DEPS_ENV`, and it hasn't changed since.
+     *
+     * Returns false, leaving `dependencies` untouched, if the command doesn't
+     * write a dependency file, `RECC_CACHE_DIR` is empty, the file doesn't
+     * exist, wasn't recorded for this command, or it is stale (that is, any
+     * of the files it lists is missing or not older than it).
+     *
+     * As with `get_file_info()`, the command is taken to be run in
+     * `workingDirectory`, or in the current directory if it is empty.
+     */
+    static bool
+    dependencies_from_depfile(const ParsedCommand &command,
+                              std::set<std::string> *dependencies,
+                              const std::string &workingDirectory = "");
+
+    /**
+     * Record in `RECC_CACHE_DIR` that the dependency file of the given
+     * command, run in the given directory, has just been written by it.
+     * Does nothing unless `RECC_DEPS_DEPEND_MODE` is set and the command
+     * writes a dependency file.
+     */
+    static void record_depfile(const ParsedCommand &command,
+                               const std::string &workingDirectory);
+
     /**
      * Given a set of dependencies, return a set of possible compilation
      * outputs.
@@ -0,0 +1,332 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <digesttable.h>
+
+#include <compactdigest.h>
+#include <env.h>
+
+#include <buildboxcommon_logging.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <ctime>
+#include <fcntl.h>
+#include <memory>
+#include <sstream>
+#include <sys/mman.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace BloombergLP {
+namespace recc {
+
+namespace {
+
+// A writer that hasn't finished writing a slot after this long is assumed
+// to have died, and another one may take the slot over.
+const int64_t StaleWriteMilliseconds = 1000;
+
+// How many consecutive slots an identity may be stored in
+const size_t ProbeLength = 4;
+
+// Enough for a SHA-512 hash
+const size_t MaxHashWords = 8;
+
+// Files changed more recently than this are not added to the table
+const time_t RecentModificationSeconds = 2;
+
+int64_t nowMilliseconds()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+uint64_t mix(uint64_t hash, uint64_t value)
+{
+    // splitmix64's finalizer
+    uint64_t z = hash + value + 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+uint64_t hashIdentity(const FileIdentity &identity)
+{
+    uint64_t hash = 0;
+    for (const uint64_t value :
+         {identity.d_device, identity.d_inode, identity.d_size,
+          identity.d_mtime, identity.d_ctime}) {
+        hash = mix(hash, value);
+    }
+    return hash;
+}
+
+uint64_t nanoseconds(time_t seconds, long nanoseconds)
+{
+    return static_cast<uint64_t>(seconds) * 1000000000ULL +
+           static_cast<uint64_t>(nanoseconds);
+}
+
+} // namespace
+
+// Shared by all the processes that map the file. A new file is zero-filled,
+// which is a table of empty slots; no file has inode 0.
+struct DigestTable::Slot {
+    // Odd while a writer is writing the slot
+    std::atomic<uint64_t> d_sequence;
+    // When the current writer started, see StaleWriteMilliseconds
+    std::atomic<int64_t> d_writeStartedAt;
+    std::atomic<uint64_t> d_device;
+    std::atomic<uint64_t> d_inode;
+    std::atomic<uint64_t> d_size;
+    std::atomic<uint64_t> d_mtime;
+    std::atomic<uint64_t> d_ctime;
+    // Of the hash, in bytes
+    std::atomic<uint64_t> d_hashLength;
+    std::atomic<uint64_t> d_hash[MaxHashWords];
+    // Of all the fields above except the sequence number and start time
+    std::atomic<uint64_t> d_checksum;
+
+    uint64_t computeChecksum(const FileIdentity &identity,
+                             uint64_t hashLength, const uint64_t *hash) const
+    {
+        uint64_t checksum = mix(hashIdentity(identity), hashLength);
+        for (size_t i = 0; i < MaxHashWords; ++i) {
+            checksum = mix(checksum, hash[i]);
+        }
+        return checksum;
+    }
+};
+
+FileIdentity FileIdentity::fromStat(const struct stat &statResult)
+{
+    FileIdentity identity;
+    identity.d_device = static_cast<uint64_t>(statResult.st_dev);
+    identity.d_inode = static_cast<uint64_t>(statResult.st_ino);
+    identity.d_size = static_cast<uint64_t>(statResult.st_size);
+#if defined(__APPLE__)
+    identity.d_mtime = nanoseconds(statResult.st_mtimespec.tv_sec,
+                                   statResult.st_mtimespec.tv_nsec);
+    identity.d_ctime = nanoseconds(statResult.st_ctimespec.tv_sec,
+                                   statResult.st_ctimespec.tv_nsec);
+#elif defined(_AIX)
+    identity.d_mtime = nanoseconds(statResult.st_mtime, 0);
+    identity.d_ctime = nanoseconds(statResult.st_ctime, 0);
+#else
+    identity.d_mtime = nanoseconds(statResult.st_mtim.tv_sec,
+                                   statResult.st_mtim.tv_nsec);
+    identity.d_ctime = nanoseconds(statResult.st_ctim.tv_sec,
+                                   statResult.st_ctim.tv_nsec);
+#endif
+    return identity;
+}
+
+bool FileIdentity::operator==(const FileIdentity &other) const
+{
+    return d_device == other.d_device && d_inode == other.d_inode &&
+           d_size == other.d_size && d_mtime == other.d_mtime &&
+           d_ctime == other.d_ctime;
+}
+
+bool DigestTable::isSettled(const struct stat &statResult)
+{
+    return time(nullptr) - std::max(statResult.st_mtime, statResult.st_ctime) >
+           RecentModificationSeconds;
+}
+
+DigestTable *DigestTable::instance()
+{
+    static const std::unique_ptr<DigestTable> s_instance = []() {
+        std::unique_ptr<DigestTable> result;
+        if (RECC_DIGEST_TABLE_SLOTS <= 0) {
+            return result;
+        }
+
+        // The layout depends on the number of slots, and the digests on
+        // the digest function
+        std::ostringstream path;
+        path << TMPDIR << "/recc-digests-" << getuid() << "-"
+             << RECC_CAS_DIGEST_FUNCTION << "-" << RECC_DIGEST_TABLE_SLOTS;
+        try {
+            result = std::make_unique<DigestTable>(
+                path.str(), static_cast<size_t>(RECC_DIGEST_TABLE_SLOTS));
+        }
+        catch (const std::exception &e) {
+            BUILDBOX_LOG_WARNING("Not using a digest table: " << e.what());
+        }
+        return result;
+    }();
+    return s_instance.get();
+}
+
+DigestTable::DigestTable(const std::string &path, size_t slots)
+    : d_slots(nullptr), d_slotCount(slots)
+{
+    if (!std::atomic<uint64_t>().is_lock_free()) {
+        throw std::runtime_error("64-bit atomics are not lock-free");
+    }
+    if (slots == 0) {
+        throw std::invalid_argument("A digest table needs slots");
+    }
+
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        throw std::system_error(errno, std::system_category(),
+                                "Could not open " + path);
+    }
+
+    const size_t size = slots * sizeof(Slot);
+    struct stat statResult;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &statResult) == 0 &&
+        (statResult.st_size >= static_cast<off_t>(size) ||
+         ftruncate(fd, static_cast<off_t>(size)) == 0)) {
+        mapping =
+            mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    const int error = errno;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::system_error(error, std::system_category(),
+                                "Could not map " + path);
+    }
+    d_slots = static_cast<Slot *>(mapping);
+}
+
+DigestTable::~DigestTable() { munmap(d_slots, d_slotCount * sizeof(Slot)); }
+
+bool DigestTable::lookup(const FileIdentity &identity,
+                         proto::Digest *digest) const
+{
+    const uint64_t start = hashIdentity(identity) % d_slotCount;
+    for (size_t probe = 0; probe < ProbeLength; ++probe) {
+        const Slot &slot = d_slots[(start + probe) % d_slotCount];
+
+        const uint64_t sequence =
+            slot.d_sequence.load(std::memory_order_acquire);
+        if (sequence % 2 != 0) {
+            continue;
+        }
+
+        FileIdentity stored;
+        stored.d_device = slot.d_device.load(std::memory_order_relaxed);
+        stored.d_inode = slot.d_inode.load(std::memory_order_relaxed);
+        stored.d_size = slot.d_size.load(std::memory_order_relaxed);
+        stored.d_mtime = slot.d_mtime.load(std::memory_order_relaxed);
+        stored.d_ctime = slot.d_ctime.load(std::memory_order_relaxed);
+        const uint64_t hashLength =
+            slot.d_hashLength.load(std::memory_order_relaxed);
+        uint64_t hash[MaxHashWords];
+        for (size_t i = 0; i < MaxHashWords; ++i) {
+            hash[i] = slot.d_hash[i].load(std::memory_order_relaxed);
+        }
+        const uint64_t checksum =
+            slot.d_checksum.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.d_sequence.load(std::memory_order_relaxed) != sequence ||
+            stored != identity || hashLength == 0 ||
+            hashLength > MaxHashWords * 8 ||
+            checksum != slot.computeChecksum(stored, hashLength, hash)) {
+            continue;
+        }
+
+        unsigned char bytes[MaxHashWords * 8];
+        for (size_t i = 0; i < hashLength; ++i) {
+            bytes[i] =
+                static_cast<unsigned char>(hash[i / 8] >> (8 * (i % 8)));
+        }
+        digest->set_hash(CompactDigest::encodeHex(bytes, hashLength));
+        digest->set_size_bytes(static_cast<int64_t>(identity.d_size));
+        return true;
+    }
+    return false;
+}
+
+void DigestTable::publish(const FileIdentity &identity,
+                          const proto::Digest &digest)
+{
+    const std::string &hex = digest.hash();
+    if (identity.d_inode == 0 || hex.empty() || hex.size() % 2 != 0 ||
+        hex.size() > MaxHashWords * 16 ||
+        static_cast<uint64_t>(digest.size_bytes()) != identity.d_size) {
+        return;
+    }
+
+    unsigned char bytes[MaxHashWords * 8];
+    if (!CompactDigest::decodeHex(hex, bytes)) {
+        return;
+    }
+    const uint64_t hashLength = hex.size() / 2;
+    uint64_t hash[MaxHashWords] = {};
+    for (size_t i = 0; i < hashLength; ++i) {
+        hash[i / 8] |= static_cast<uint64_t>(bytes[i]) << (8 * (i % 8));
+    }
+
+    // Use the slot already holding this identity, or else an empty one, or
+    // else evict the first one
+    const uint64_t start = hashIdentity(identity) % d_slotCount;
+    Slot *target = nullptr;
+    for (size_t probe = 0; probe < ProbeLength && target == nullptr;
+         ++probe) {
+        Slot &slot = d_slots[(start + probe) % d_slotCount];
+        const uint64_t inode = slot.d_inode.load(std::memory_order_relaxed);
+        if (inode == identity.d_inode || inode == 0) {
+            target = &slot;
+        }
+    }
+    Slot &slot = target != nullptr ? *target : d_slots[start];
+
+    uint64_t sequence = slot.d_sequence.load(std::memory_order_relaxed);
+    const int64_t now = nowMilliseconds();
+    if (sequence % 2 != 0 &&
+        now - slot.d_writeStartedAt.load(std::memory_order_relaxed) <
+            StaleWriteMilliseconds) {
+        return;
+    }
+    // Stays odd while writing, also when taking over from a dead writer
+    const uint64_t writingSequence = sequence + (sequence % 2 == 0 ? 1 : 2);
+    if (!slot.d_sequence.compare_exchange_strong(
+            sequence, writingSequence, std::memory_order_relaxed)) {
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.d_writeStartedAt.store(now, std::memory_order_relaxed);
+    slot.d_device.store(identity.d_device, std::memory_order_relaxed);
+    slot.d_inode.store(identity.d_inode, std::memory_order_relaxed);
+    slot.d_size.store(identity.d_size, std::memory_order_relaxed);
+    slot.d_mtime.store(identity.d_mtime, std::memory_order_relaxed);
+    slot.d_ctime.store(identity.d_ctime, std::memory_order_relaxed);
+    slot.d_hashLength.store(hashLength, std::memory_order_relaxed);
+    for (size_t i = 0; i < MaxHashWords; ++i) {
+        slot.d_hash[i].store(hash[i], std::memory_order_relaxed);
+    }
+    slot.d_checksum.store(slot.computeChecksum(identity, hashLength, hash),
+                          std::memory_order_relaxed);
+
+    // If another writer took the slot over in the meantime, it is left to
+    // that writer to finish
+    uint64_t expected = writingSequence;
+    slot.d_sequence.compare_exchange_strong(expected, writingSequence + 1,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed);
+}
+
+} // namespace recc
+} // namespace BloombergLP
@@ -0,0 +1,110 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_DIGESTTABLE
+#define INCLUDED_DIGESTTABLE
+
+#include <protos.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/stat.h>
+
+namespace BloombergLP {
+namespace recc {
+
+/**
+ * What identifies the contents of a file without reading it. Two stat
+ * results with the same identity are assumed to be of the same contents.
+ */
+struct FileIdentity {
+    uint64_t d_device;
+    uint64_t d_inode;
+    uint64_t d_size;
+    // In nanoseconds
+    uint64_t d_mtime;
+    uint64_t d_ctime;
+
+    static FileIdentity fromStat(const struct stat &statResult);
+
+    bool operator==(const FileIdentity &other) const;
+    bool operator!=(const FileIdentity &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+/**
+ * A fixed-size hash table from file identities to digests, in a file that
+ * every recc process on the host maps into memory. When many processes
+ * start at once, as they do in a parallel build, a header is hashed once
+ * and the others look its digest up.
+ *
+ * The table is lock-free. Each slot is guarded by a sequence number that
+ * writers make odd while they write and readers check before and after
+ * reading. A slot left odd by a writer that died is taken over after a
+ * second, and each slot holds a checksum of its contents so that a write
+ * from a writer that was only stalled is never read as valid. Entries
+ * are only ever evicted by newer ones.
+ */
+class DigestTable {
+  public:
+    /**
+     * Return the table for `RECC_CAS_DIGEST_FUNCTION`, or null if
+     * `RECC_DIGEST_TABLE_SLOTS` is 0 or the table's file can't be used.
+     */
+    static DigestTable *instance();
+
+    /**
+     * Return whether the file with the given stat result was last changed
+     * long enough ago for its identity to be added to the table. With
+     * coarse timestamps, a file modified again right away could keep its
+     * identity.
+     */
+    static bool isSettled(const struct stat &statResult);
+
+    /**
+     * Use the table with the given number of slots stored in the given
+     * file, creating it if needed. Throws `std::system_error` if the file
+     * can't be mapped.
+     */
+    DigestTable(const std::string &path, size_t slots);
+    ~DigestTable();
+
+    DigestTable(const DigestTable &) = delete;
+    DigestTable &operator=(const DigestTable &) = delete;
+
+    /**
+     * Look the digest of a file up. Returns false if it isn't in the table.
+     */
+    bool lookup(const FileIdentity &identity, proto::Digest *digest) const;
+
+    /**
+     * Add the digest of a file to the table. Gives up silently if another
+     * process is writing to the slot.
+     */
+    void publish(const FileIdentity &identity, const proto::Digest &digest);
+
+  private:
+    struct Slot;
+
+    Slot *d_slots;
+    size_t d_slotCount;
+};
+
+} // namespace recc
+} // namespace BloombergLP
+
+#endif
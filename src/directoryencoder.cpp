@@ -0,0 +1,176 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <directoryencoder.h>
+
+#include <stdexcept>
+
+namespace BloombergLP {
+namespace recc {
+
+namespace {
+
+// Field numbers, from remote_execution.proto
+const int DirectoryFilesField = 1;
+const int DirectoryDirectoriesField = 2;
+const int DirectorySymlinksField = 3;
+
+const int NodeNameField = 1;
+const int NodeDigestField = 2;
+const int FileNodeIsExecutableField = 4;
+const int SymlinkNodeTargetField = 2;
+
+const int DigestHashField = 1;
+const int DigestSizeBytesField = 2;
+
+const int WireTypeVarint = 0;
+const int WireTypeLengthDelimited = 2;
+
+// All the field numbers above fit in a single byte tag
+const size_t TagSize = 1;
+
+} // namespace
+
+DirectoryEncoder::DirectoryEncoder(std::string *buffer)
+    : d_buffer(buffer), d_lastField(0)
+{
+    d_buffer->clear();
+}
+
+void DirectoryEncoder::addFile(const std::string &name,
+                               const proto::Digest &digest, bool isExecutable)
+{
+    startField(DirectoryFilesField);
+
+    const size_t digestLength = digestSize(digest);
+    const size_t length = stringFieldSize(name) + TagSize +
+                          varintSize(digestLength) + digestLength +
+                          (isExecutable ? TagSize + 1 : 0);
+    writeTag(DirectoryFilesField, WireTypeLengthDelimited);
+    writeVarint(length);
+
+    writeString(NodeNameField, name);
+    writeDigest(NodeDigestField, digest);
+    if (isExecutable) {
+        writeTag(FileNodeIsExecutableField, WireTypeVarint);
+        writeVarint(1);
+    }
+}
+
+void DirectoryEncoder::addDirectory(const std::string &name,
+                                    const proto::Digest &digest)
+{
+    startField(DirectoryDirectoriesField);
+
+    const size_t digestLength = digestSize(digest);
+    const size_t length = stringFieldSize(name) + TagSize +
+                          varintSize(digestLength) + digestLength;
+    writeTag(DirectoryDirectoriesField, WireTypeLengthDelimited);
+    writeVarint(length);
+
+    writeString(NodeNameField, name);
+    writeDigest(NodeDigestField, digest);
+}
+
+void DirectoryEncoder::addSymlink(const std::string &name,
+                                  const std::string &target)
+{
+    startField(DirectorySymlinksField);
+
+    const size_t length = stringFieldSize(name) + stringFieldSize(target);
+    writeTag(DirectorySymlinksField, WireTypeLengthDelimited);
+    writeVarint(length);
+
+    writeString(NodeNameField, name);
+    writeString(SymlinkNodeTargetField, target);
+}
+
+void DirectoryEncoder::startField(int fieldNumber)
+{
+    if (fieldNumber < d_lastField) {
+        throw std::logic_error("Directory entries must be added as files, "
+                               "then directories, then symlinks");
+    }
+    d_lastField = fieldNumber;
+}
+
+void DirectoryEncoder::writeVarint(uint64_t value)
+{
+    while (value >= 0x80) {
+        d_buffer->push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    d_buffer->push_back(static_cast<char>(value));
+}
+
+void DirectoryEncoder::writeTag(int fieldNumber, int wireType)
+{
+    d_buffer->push_back(static_cast<char>((fieldNumber << 3) | wireType));
+}
+
+void DirectoryEncoder::writeString(int fieldNumber, const std::string &value)
+{
+    // Like protobuf, leave out fields that have their default value
+    if (value.empty()) {
+        return;
+    }
+    writeTag(fieldNumber, WireTypeLengthDelimited);
+    writeVarint(value.size());
+    d_buffer->append(value);
+}
+
+void DirectoryEncoder::writeDigest(int fieldNumber,
+                                   const proto::Digest &digest)
+{
+    // The digest submessage is always set on nodes, so it is written even
+    // if it is empty
+    writeTag(fieldNumber, WireTypeLengthDelimited);
+    writeVarint(digestSize(digest));
+    writeString(DigestHashField, digest.hash());
+    if (digest.size_bytes() != 0) {
+        writeTag(DigestSizeBytesField, WireTypeVarint);
+        writeVarint(static_cast<uint64_t>(digest.size_bytes()));
+    }
+}
+
+size_t DirectoryEncoder::varintSize(uint64_t value)
+{
+    size_t result = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        result++;
+    }
+    return result;
+}
+
+size_t DirectoryEncoder::stringFieldSize(const std::string &value)
+{
+    if (value.empty()) {
+        return 0;
+    }
+    return TagSize + varintSize(value.size()) + value.size();
+}
+
+size_t DirectoryEncoder::digestSize(const proto::Digest &digest)
+{
+    size_t result = stringFieldSize(digest.hash());
+    if (digest.size_bytes() != 0) {
+        result += TagSize +
+                  varintSize(static_cast<uint64_t>(digest.size_bytes()));
+    }
+    return result;
+}
+
+} // namespace recc
+} // namespace BloombergLP
@@ -0,0 +1,71 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_DIRECTORYENCODER
+#define INCLUDED_DIRECTORYENCODER
+
+#include <protos.h>
+
+#include <cstdint>
+#include <string>
+
+namespace BloombergLP {
+namespace recc {
+
+/**
+ * Writes a `Directory` message in the protobuf wire format, byte for byte
+ * as `proto::Directory::SerializeAsString()` would, without building the
+ * message and its nodes first.
+ *
+ * Protobuf writes fields in field number order, so all files have to be
+ * added before any directory, and all directories before any symlink.
+ * Within each kind, entries are written in the order they are added.
+ */
+class DirectoryEncoder {
+  public:
+    /**
+     * Start a new message in the given buffer, discarding its contents but
+     * keeping its capacity.
+     */
+    explicit DirectoryEncoder(std::string *buffer);
+
+    /**
+     * Append a `FileNode`, `DirectoryNode` or `SymlinkNode`.
+     *
+     * Throws `std::logic_error` if the entry is added out of order.
+     */
+    void addFile(const std::string &name, const proto::Digest &digest,
+                 bool isExecutable);
+    void addDirectory(const std::string &name, const proto::Digest &digest);
+    void addSymlink(const std::string &name, const std::string &target);
+
+  private:
+    void startField(int fieldNumber);
+    void writeVarint(uint64_t value);
+    void writeTag(int fieldNumber, int wireType);
+    void writeString(int fieldNumber, const std::string &value);
+    void writeDigest(int fieldNumber, const proto::Digest &digest);
+
+    static size_t varintSize(uint64_t value);
+    static size_t stringFieldSize(const std::string &value);
+    static size_t digestSize(const proto::Digest &digest);
+
+    std::string *d_buffer;
+    int d_lastField;
+};
+
+} // namespace recc
+} // namespace BloombergLP
+
+#endif
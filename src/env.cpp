@@ -20,9 +20,11 @@
 #include <buildboxcommon_protos.h>
 
 #include <algorithm>
+#include <configsnapshot.h>
 #include <cstring>
 #include <ctype.h>
 #include <digestgenerator.h>
+#include <digesttable.h>
 #include <env.h>
 #include <fileutils.h>
 
@@ -34,6 +36,7 @@
 #include <sstream>
 #include <stdio.h>
 #include <string>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <utility>
 #include <vector>
@@ -53,6 +56,7 @@ std::string RECC_INSTANCE = DEFAULT_RECC_INSTANCE;
 std::string RECC_DEPS_DIRECTORY_OVERRIDE =
     DEFAULT_RECC_DEPS_DIRECTORY_OVERRIDE;
 std::string RECC_PROJECT_ROOT = DEFAULT_RECC_PROJECT_ROOT;
+std::string RECC_CACHE_DIR = DEFAULT_RECC_CACHE_DIR;
 std::string TMPDIR = DEFAULT_RECC_TMPDIR;
 std::string RECC_ACCESS_TOKEN_PATH = DEFAULT_RECC_ACCESS_TOKEN_PATH;
 std::string RECC_CORRELATED_INVOCATIONS_ID =
@@ -63,22 +67,40 @@ std::string RECC_PREFIX_MAP = DEFAULT_RECC_PREFIX_MAP;
 std::vector<std::pair<std::string, std::string>> RECC_PREFIX_REPLACEMENT;
 
 std::string RECC_CAS_DIGEST_FUNCTION = DEFAULT_RECC_CAS_DIGEST_FUNCTION;
+int RECC_CAS_CHUNKING_THRESHOLD = DEFAULT_RECC_CAS_CHUNKING_THRESHOLD;
+int RECC_CAS_CHUNK_CACHE_MB = DEFAULT_RECC_CAS_CHUNK_CACHE_MB;
 std::string RECC_WORKING_DIR_PREFIX = DEFAULT_RECC_WORKING_DIR_PREFIX;
 
 bool RECC_ENABLE_METRICS = DEFAULT_RECC_ENABLE_METRICS;
 bool RECC_FORCE_REMOTE = DEFAULT_RECC_FORCE_REMOTE;
 bool RECC_ACTION_UNCACHEABLE = DEFAULT_RECC_ACTION_UNCACHEABLE;
 bool RECC_SKIP_CACHE = DEFAULT_RECC_SKIP_CACHE;
+bool RECC_CACHE_ONLY = DEFAULT_RECC_CACHE_ONLY;
+bool RECC_RACE_LOCALLY = DEFAULT_RECC_RACE_LOCALLY;
+int RECC_RACE_LOCAL_SLOTS = DEFAULT_RECC_RACE_LOCAL_SLOTS;
+bool RECC_SCHEDULE_FROM_HISTORY = DEFAULT_RECC_SCHEDULE_FROM_HISTORY;
+int RECC_HEDGE_PERCENTILE = DEFAULT_RECC_HEDGE_PERCENTILE;
+int RECC_BATCH_JOBS = DEFAULT_RECC_BATCH_JOBS;
+bool RECC_JOBSERVER = DEFAULT_RECC_JOBSERVER;
+int RECC_DIGEST_TABLE_SLOTS = DEFAULT_RECC_DIGEST_TABLE_SLOTS;
+int RECC_UPLOAD_WAIT_TIMEOUT = DEFAULT_RECC_UPLOAD_WAIT_TIMEOUT;
 bool RECC_DONT_SAVE_OUTPUT = DEFAULT_RECC_DONT_SAVE_OUTPUT;
+bool RECC_PRESERVE_UNCHANGED_MTIME =
+    DEFAULT_RECC_PRESERVE_UNCHANGED_MTIME;
 bool RECC_SERVER_AUTH_GOOGLEAPI = DEFAULT_RECC_SERVER_AUTH_GOOGLEAPI;
 bool RECC_SERVER_SSL =
     DEFAULT_RECC_SERVER_SSL; // deprecated: inferred from URL
 bool RECC_DEPS_GLOBAL_PATHS = DEFAULT_RECC_DEPS_GLOBAL_PATHS;
+bool RECC_DEPS_DEPEND_MODE = DEFAULT_RECC_DEPS_DEPEND_MODE;
+bool RECC_CACHE_TOOLCHAINS = DEFAULT_RECC_CACHE_TOOLCHAINS;
+bool RECC_PREPROCESS_LOCALLY = DEFAULT_RECC_PREPROCESS_LOCALLY;
 bool RECC_VERBOSE = DEFAULT_RECC_VERBOSE;
 bool RECC_CAS_GET_CAPABILITIES = false;
 
 int RECC_RETRY_LIMIT = DEFAULT_RECC_RETRY_LIMIT;
 int RECC_RETRY_DELAY = DEFAULT_RECC_RETRY_DELAY;
+int RECC_CIRCUIT_BREAKER_THRESHOLD = DEFAULT_RECC_CIRCUIT_BREAKER_THRESHOLD;
+int RECC_CIRCUIT_BREAKER_COOLDOWN = DEFAULT_RECC_CIRCUIT_BREAKER_COOLDOWN;
 
 // Hidden variables (not displayed in the help string)
 std::string RECC_AUTH_UNCONFIGURED_MSG = DEFAULT_RECC_AUTH_UNCONFIGURED_MSG;
@@ -234,10 +256,105 @@ void parse_config_files(const std::string &config_file_name)
     Env::parse_config_variables(env_cstrings.data());
 }
 
+/**
+ * Variables that usually differ between invocations sharing the same
+ * configuration. They are left out of config snapshots, so that setting
+ * them doesn't create a new snapshot on every run, and are always taken
+ * from the environment instead.
+ */
+const char *const PER_INVOCATION_VARIABLES[] = {
+    "RECC_CORRELATED_INVOCATIONS_ID=",  "RECC_DEPS_OVERRIDE=",
+    "RECC_DEPS_DIRECTORY_OVERRIDE=",    "RECC_OUTPUT_FILES_OVERRIDE=",
+    "RECC_OUTPUT_DIRECTORIES_OVERRIDE="};
+
+bool is_per_invocation_variable(const char *entry)
+{
+    for (const char *prefix : PER_INVOCATION_VARIABLES) {
+        if (strncmp(entry, prefix, strlen(prefix)) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Return the null-terminated list of entries in "env" that are, or are
+ * not, per-invocation variables.
+ */
+std::vector<const char *> select_variables(const char *const *env,
+                                           bool perInvocation)
+{
+    std::vector<const char *> result;
+    for (int i = 0; env[i] != nullptr; ++i) {
+        if (is_per_invocation_variable(env[i]) == perInvocation) {
+            result.push_back(env[i]);
+        }
+    }
+    result.push_back(nullptr);
+    return result;
+}
+
 } // namespace
 
 // clang-format off
 
+// Every configuration variable, by type. Sets also give their delimiter.
+#define RECC_CONFIG_VARIABLES(STRVAR, BOOLVAR, INTVAR, SETVAR, MAPVAR)        \
+    STRVAR(RECC_SERVER)                                                       \
+    STRVAR(RECC_CAS_SERVER)                                                   \
+    STRVAR(RECC_ACTION_CACHE_SERVER)                                          \
+    STRVAR(RECC_INSTANCE)                                                     \
+    STRVAR(RECC_DEPS_DIRECTORY_OVERRIDE)                                      \
+    STRVAR(RECC_PROJECT_ROOT)                                                 \
+    STRVAR(RECC_CACHE_DIR)                                                    \
+    STRVAR(TMPDIR)                                                            \
+    STRVAR(RECC_ACCESS_TOKEN_PATH)                                            \
+    STRVAR(RECC_AUTH_UNCONFIGURED_MSG)                                        \
+    STRVAR(RECC_CORRELATED_INVOCATIONS_ID)                                    \
+    STRVAR(RECC_METRICS_FILE)                                                 \
+    STRVAR(RECC_METRICS_UDP_SERVER)                                           \
+    STRVAR(RECC_PREFIX_MAP)                                                   \
+    STRVAR(RECC_CAS_DIGEST_FUNCTION)                                          \
+    STRVAR(RECC_WORKING_DIR_PREFIX)                                           \
+    STRVAR(RECC_REAPI_VERSION)                                                \
+    BOOLVAR(RECC_VERBOSE)                                                     \
+    BOOLVAR(RECC_ENABLE_METRICS)                                              \
+    BOOLVAR(RECC_FORCE_REMOTE)                                                \
+    BOOLVAR(RECC_ACTION_UNCACHEABLE)                                          \
+    BOOLVAR(RECC_SKIP_CACHE)                                                  \
+    BOOLVAR(RECC_CACHE_ONLY)                                                  \
+    BOOLVAR(RECC_RACE_LOCALLY)                                                \
+    BOOLVAR(RECC_SCHEDULE_FROM_HISTORY)                                       \
+    BOOLVAR(RECC_JOBSERVER)                                                   \
+    BOOLVAR(RECC_DONT_SAVE_OUTPUT)                                            \
+    BOOLVAR(RECC_PRESERVE_UNCHANGED_MTIME)                                    \
+    BOOLVAR(RECC_SERVER_AUTH_GOOGLEAPI)                                       \
+    BOOLVAR(RECC_SERVER_SSL)                                                  \
+    BOOLVAR(RECC_DEPS_GLOBAL_PATHS)                                           \
+    BOOLVAR(RECC_DEPS_DEPEND_MODE)                                            \
+    BOOLVAR(RECC_CACHE_TOOLCHAINS)                                            \
+    BOOLVAR(RECC_PREPROCESS_LOCALLY)                                          \
+    BOOLVAR(RECC_CAS_GET_CAPABILITIES)                                        \
+    INTVAR(RECC_RETRY_LIMIT)                                                  \
+    INTVAR(RECC_RETRY_DELAY)                                                  \
+    INTVAR(RECC_CIRCUIT_BREAKER_THRESHOLD)                                    \
+    INTVAR(RECC_CIRCUIT_BREAKER_COOLDOWN)                                     \
+    INTVAR(RECC_MAX_THREADS)                                                  \
+    INTVAR(RECC_CAS_CHUNKING_THRESHOLD)                                       \
+    INTVAR(RECC_CAS_CHUNK_CACHE_MB)                                           \
+    INTVAR(RECC_RACE_LOCAL_SLOTS)                                             \
+    INTVAR(RECC_HEDGE_PERCENTILE)                                             \
+    INTVAR(RECC_BATCH_JOBS)                                                   \
+    INTVAR(RECC_DIGEST_TABLE_SLOTS)                                           \
+    INTVAR(RECC_UPLOAD_WAIT_TIMEOUT)                                          \
+    SETVAR(RECC_DEPS_OVERRIDE, ',')                                           \
+    SETVAR(RECC_OUTPUT_FILES_OVERRIDE, ',')                                   \
+    SETVAR(RECC_OUTPUT_DIRECTORIES_OVERRIDE, ',')                             \
+    SETVAR(RECC_DEPS_EXCLUDE_PATHS, ',')                                      \
+    MAPVAR(RECC_DEPS_ENV)                                                     \
+    MAPVAR(RECC_REMOTE_ENV)                                                   \
+    MAPVAR(RECC_REMOTE_PLATFORM)
+
 // https://gcc.gnu.org/onlinedocs/gcc/Diagnostic-Pragmas.html
 // Suppress unused parameter warnings and sign conversion warnings stemming from the helper macros below.
 _Pragma("GCC diagnostic push")
@@ -283,46 +400,105 @@ void Env::parse_config_variables(const char *const *env)
     // Parse all the options from ENV
     for (int i = 0; env[i] != nullptr; ++i) {
         VARS_START()
-        STRVAR(RECC_SERVER)
-        STRVAR(RECC_CAS_SERVER)
-        STRVAR(RECC_ACTION_CACHE_SERVER)
-        STRVAR(RECC_INSTANCE)
-        STRVAR(RECC_DEPS_DIRECTORY_OVERRIDE)
-        STRVAR(RECC_PROJECT_ROOT)
-        STRVAR(TMPDIR)
-        STRVAR(RECC_ACCESS_TOKEN_PATH)
-        STRVAR(RECC_AUTH_UNCONFIGURED_MSG)
-        STRVAR(RECC_CORRELATED_INVOCATIONS_ID)
-        STRVAR(RECC_METRICS_FILE)
-        STRVAR(RECC_METRICS_UDP_SERVER)
-        STRVAR(RECC_PREFIX_MAP)
-        STRVAR(RECC_CAS_DIGEST_FUNCTION)
-        STRVAR(RECC_WORKING_DIR_PREFIX)
-        STRVAR(RECC_REAPI_VERSION)
-
-        BOOLVAR(RECC_VERBOSE)
-        BOOLVAR(RECC_ENABLE_METRICS)
-        BOOLVAR(RECC_FORCE_REMOTE)
-        BOOLVAR(RECC_ACTION_UNCACHEABLE)
-        BOOLVAR(RECC_SKIP_CACHE)
-        BOOLVAR(RECC_DONT_SAVE_OUTPUT)
-        BOOLVAR(RECC_SERVER_AUTH_GOOGLEAPI)
-        BOOLVAR(RECC_SERVER_SSL)
-        BOOLVAR(RECC_DEPS_GLOBAL_PATHS)
-        BOOLVAR(RECC_CAS_GET_CAPABILITIES)
-
-        INTVAR(RECC_RETRY_LIMIT)
-        INTVAR(RECC_RETRY_DELAY)
-        INTVAR(RECC_MAX_THREADS)
-
-        SETVAR(RECC_DEPS_OVERRIDE, ',')
-        SETVAR(RECC_OUTPUT_FILES_OVERRIDE, ',')
-        SETVAR(RECC_OUTPUT_DIRECTORIES_OVERRIDE, ',')
-        SETVAR(RECC_DEPS_EXCLUDE_PATHS, ',')
-
-        MAPVAR(RECC_DEPS_ENV)
-        MAPVAR(RECC_REMOTE_ENV)
-        MAPVAR(RECC_REMOTE_PLATFORM)
+        RECC_CONFIG_VARIABLES(STRVAR, BOOLVAR, INTVAR, SETVAR, MAPVAR)
+    }
+}
+
+bool Env::config_snapshot_location(const char *const *env,
+                                   std::string *path, std::string *key)
+{
+#define VARIABLE_NAME(name) #name " "
+#define SET_VARIABLE_NAME(name, delim) #name " "
+    // The layout of a snapshot depends on the variables
+    std::string result = "recc-config-snapshot 2\n";
+    result += RECC_CONFIG_VARIABLES(VARIABLE_NAME, VARIABLE_NAME,
+                                    VARIABLE_NAME, SET_VARIABLE_NAME,
+                                    VARIABLE_NAME);
+    result += '\n';
+
+    for (const auto &location : RECC_CONFIG_LOCATIONS) {
+        const std::string configFile =
+            location + "/" + DEFAULT_RECC_CONFIG;
+        result += configFile;
+        result += '\0';
+        struct stat statResult;
+        if (stat(configFile.c_str(), &statResult) == 0) {
+            const FileIdentity identity = FileIdentity::fromStat(statResult);
+            result += std::to_string(identity.d_device) + ":" +
+                      std::to_string(identity.d_inode) + ":" +
+                      std::to_string(identity.d_size) + ":" +
+                      std::to_string(identity.d_mtime) + ":" +
+                      std::to_string(identity.d_ctime);
+        }
+        result += '\n';
+    }
+
+    // The same variables that parse_config_variables() looks at, in order,
+    // except for the per-invocation ones that aren't part of the snapshot
+    const std::string cacheDirPrefix = "RECC_CACHE_DIR=";
+    std::string cacheDir;
+    for (int i = 0; env[i] != nullptr; ++i) {
+        VARS_START()
+        if (is_per_invocation_variable(env[i])) {
+            continue;
+        }
+        if (strncmp(env[i], cacheDirPrefix.c_str(), cacheDirPrefix.size()) ==
+            0) {
+            cacheDir = env[i] + cacheDirPrefix.size();
+        }
+        result += env[i];
+        result += '\0';
+    }
+
+    if (cacheDir.empty()) {
+        return false;
+    }
+    *path =
+        cacheDir + "/config/" + DigestGenerator::make_digest(result).hash();
+    *key = std::move(result);
+    return true;
+}
+
+bool Env::load_config_snapshot(const std::string &path,
+                               const std::string &key)
+{
+    ConfigSnapshotReader reader(path, key);
+    bool valid = reader.valid();
+
+    // Read everything before setting anything, so that a bad snapshot
+    // leaves the variables unchanged
+#define READ_VARIABLE(name)                                                   \
+    decltype(name) snapshot_##name = decltype(name)();                        \
+    valid = valid && reader.read(&snapshot_##name);
+#define READ_SET_VARIABLE(name, delim) READ_VARIABLE(name)
+    RECC_CONFIG_VARIABLES(READ_VARIABLE, READ_VARIABLE, READ_VARIABLE,
+                          READ_SET_VARIABLE, READ_VARIABLE)
+    if (!valid || !reader.atEnd()) {
+        return false;
+    }
+
+#define ASSIGN_VARIABLE(name) name = std::move(snapshot_##name);
+#define ASSIGN_SET_VARIABLE(name, delim) ASSIGN_VARIABLE(name)
+    RECC_CONFIG_VARIABLES(ASSIGN_VARIABLE, ASSIGN_VARIABLE, ASSIGN_VARIABLE,
+                          ASSIGN_SET_VARIABLE, ASSIGN_VARIABLE)
+    return true;
+}
+
+void Env::save_config_snapshot(const std::string &path,
+                               const std::string &key)
+{
+    ConfigSnapshotWriter writer(key);
+#define WRITE_VARIABLE(name) writer.write(name);
+#define WRITE_SET_VARIABLE(name, delim) WRITE_VARIABLE(name)
+    RECC_CONFIG_VARIABLES(WRITE_VARIABLE, WRITE_VARIABLE, WRITE_VARIABLE,
+                          WRITE_SET_VARIABLE, WRITE_VARIABLE)
+
+    try {
+        FileUtils::writeFileAtomically(path, writer.data());
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_WARNING("Could not write configuration snapshot to "
+                             << path << ": " << e.what());
     }
 }
 
@@ -427,7 +603,6 @@ void Env::handle_special_defaults()
         RECC_PREFIX_REPLACEMENT =
             Env::vector_from_delimited_string(RECC_PREFIX_MAP);
     }
-
     if (DigestGenerator::stringToDigestFunctionMap().count(
             RECC_CAS_DIGEST_FUNCTION) == 0) {
         BUILDBOXCOMMON_THROW_EXCEPTION(
@@ -441,6 +616,35 @@ void Env::handle_special_defaults()
     }
 }
 
+const PathPrefixMatcher &Env::prefix_replacement_matcher()
+{
+    static thread_local std::vector<std::pair<std::string, std::string>>
+        compiled;
+    static thread_local PathPrefixMatcher matcher;
+    if (compiled != RECC_PREFIX_REPLACEMENT) {
+        compiled = RECC_PREFIX_REPLACEMENT;
+        matcher.clear();
+        for (const auto &pair : compiled) {
+            matcher.add(pair.first);
+        }
+    }
+    return matcher;
+}
+
+const PathPrefixMatcher &Env::deps_exclude_paths_matcher()
+{
+    static thread_local std::set<std::string> compiled;
+    static thread_local PathPrefixMatcher matcher;
+    if (compiled != RECC_DEPS_EXCLUDE_PATHS) {
+        compiled = RECC_DEPS_EXCLUDE_PATHS;
+        matcher.clear();
+        for (const auto &path : compiled) {
+            matcher.add(path);
+        }
+    }
+    return matcher;
+}
+
 void Env::assert_reapi_version_is_valid()
 {
     if (!proto::s_reapiSupportedVersions.count(RECC_REAPI_VERSION)) {
@@ -606,8 +810,19 @@ const std::string Env::backwardsCompatibleURL(const std::string &url)
 
 void Env::parse_config_variables()
 {
-    Env::find_and_parse_config_files();
-    Env::parse_config_variables(environ);
+    std::string snapshotPath;
+    std::string snapshotKey;
+    const bool useSnapshot =
+        Env::config_snapshot_location(environ, &snapshotPath, &snapshotKey);
+    if (!useSnapshot ||
+        !Env::load_config_snapshot(snapshotPath, snapshotKey)) {
+        Env::find_and_parse_config_files();
+        Env::parse_config_variables(select_variables(environ, false).data());
+        if (useSnapshot) {
+            Env::save_config_snapshot(snapshotPath, snapshotKey);
+        }
+    }
+    Env::parse_config_variables(select_variables(environ, true).data());
 
     // Update the log-level if verbose was set before continuing
     if (RECC_VERBOSE) {
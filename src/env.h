@@ -15,6 +15,8 @@
 #ifndef INCLUDED_ENV
 #define INCLUDED_ENV
 
+#include <pathprefixmatcher.h>
+
 #include <deque>
 #include <map>
 #include <set>
@@ -45,6 +47,20 @@ extern bool RECC_CAS_GET_CAPABILITIES;
  */
 extern std::string RECC_CAS_DIGEST_FUNCTION;
 
+/**
+ * Blobs of at least this many bytes are split into content-defined chunks
+ * when the CAS server supports the SplitBlob and SpliceBlob RPCs, so that
+ * only the chunks it doesn't have are transferred. 0 disables chunking.
+ */
+extern int RECC_CAS_CHUNKING_THRESHOLD;
+
+/**
+ * Chunks downloaded by splitting blobs are kept under RECC_CACHE_DIR, up to
+ * this many megabytes. When that is exceeded, the least recently used
+ * chunks are removed. 0 disables the chunk cache.
+ */
+extern int RECC_CAS_CHUNK_CACHE_MB;
+
 /**
  * The URI of the action cache server to use. By default, uses
  * RECC_CAS_SERVER if set or RECC_SERVER if not.
@@ -86,6 +102,37 @@ extern std::string RECC_METRICS_UDP_SERVER;
  */
 extern bool RECC_DEPS_GLOBAL_PATHS;
 
+/**
+ * If set, and the compile command writes a dependency file (-MD/-MMD), recc
+ * will read the dependency file left behind by the previous compile of the
+ * same translation unit instead of running the dependency command. The file
+ * is only trusted if recc recorded in `RECC_CACHE_DIR` that it was written by
+ * the same compiler with the same arguments, and every dependency it lists is
+ * older than the file itself.
+ */
+extern bool RECC_DEPS_DEPEND_MODE;
+
+/**
+ * If set, compile commands are preprocessed locally and the remote action
+ * compiles the single preprocessed file instead of the original sources.
+ */
+extern bool RECC_PREPROCESS_LOCALLY;
+
+/**
+ * Directory in which recc persists information between invocations, such as
+ * the results of probing compilers and, if set in the environment, of
+ * parsing the configuration. If empty, nothing is persisted.
+ */
+extern std::string RECC_CACHE_DIR;
+
+/**
+ * If set, the system include directories, predefined macros and crtbegin.o
+ * location of each compiler are found by probing it once and kept under
+ * RECC_CACHE_DIR, instead of being reported by every dependency command.
+ * Failed probes are remembered too, until the compiler changes.
+ */
+extern bool RECC_CACHE_TOOLCHAINS;
+
 /**
  * The location to store temporary files. (Currently used only by the tests.)
  */
@@ -119,11 +166,89 @@ extern bool RECC_ACTION_UNCACHEABLE;
  */
 extern bool RECC_SKIP_CACHE;
 
+/**
+ * If set, the execution service is never used. Actions that aren't in the
+ * action cache are run locally instead, and their results are uploaded to
+ * the action cache.
+ */
+extern bool RECC_CACHE_ONLY;
+
+/**
+ * If set, on an action cache miss the command is also compiled locally
+ * while it is executed remotely, and whichever result is available first is
+ * used. Only compile commands whose outputs can be redirected are raced.
+ */
+extern bool RECC_RACE_LOCALLY;
+
+/**
+ * The maximum number of local compiles that RECC_RACE_LOCALLY runs at the
+ * same time, across all recc processes of the user. 0 means one per CPU.
+ */
+extern int RECC_RACE_LOCAL_SLOTS;
+
+/**
+ * If set, recc keeps timings of each compile command under RECC_CACHE_DIR
+ * and uses them to decide whether to run it locally or remotely when it
+ * isn't in the action cache.
+ */
+extern bool RECC_SCHEDULE_FROM_HISTORY;
+
+/**
+ * If set, a remote execution that takes longer than this percentile of the
+ * recent executions of the same command (kept under RECC_CACHE_DIR) is
+ * started a second time, and whichever finishes first is used. 0 disables
+ * this. Since the result of the second execution is stored in the action
+ * cache as that of the first, this isn't done with RECC_ACTION_UNCACHEABLE.
+ */
+extern int RECC_HEDGE_PERCENTILE;
+
+/**
+ * Maximum number of action cache lookups and executions that
+ * `recc --batch` keeps in flight at once.
+ */
+extern int RECC_BATCH_JOBS;
+
+/**
+ * If set and recc is run by GNU make with a jobserver, recc gives its job
+ * slot back to make while it waits on the remote servers and takes it
+ * back before running anything locally or exiting, waiting for another
+ * job to finish if needed. When killed by SIGINT, SIGTERM or SIGHUP, it
+ * only waits for a second.
+ */
+extern bool RECC_JOBSERVER;
+
+/**
+ * Number of slots of the table, shared by the recc processes on the host,
+ * that maps file identities to digests so that files are hashed once. 0
+ * disables it.
+ */
+extern int RECC_DIGEST_TABLE_SLOTS;
+
+/**
+ * How long, in milliseconds, to wait for another recc process on the host
+ * that is uploading a blob this one also needs, before uploading it too.
+ * 0 disables the coordination of uploads between processes.
+ */
+extern int RECC_UPLOAD_WAIT_TIMEOUT;
+
 /**
  * Prevents compilation output from being saved to disk.
  */
 extern bool RECC_DONT_SAVE_OUTPUT;
 
+/**
+ * Outputs that are already on disk with the right contents are not fetched
+ * or written again, but their modification time is updated as if they had
+ * been written, so that make sees them as newer than their inputs.
+ *
+ * If set, their modification time is left alone instead. This saves
+ * rebuilding whatever depends on them with build tools that compare
+ * timestamps of dependencies only after running a command (e.g. Ninja's
+ * `restat`), but make keeps considering such outputs out of date and runs
+ * their command again on every build.
+ */
+extern bool RECC_PRESERVE_UNCHANGED_MTIME;
+
 /**
  * Use Google's authentication to talk to the build server. Also applies to the
  * CAS server. Not setting this implies insecure communication.
@@ -135,6 +260,19 @@ extern bool RECC_SERVER_AUTH_GOOGLEAPI;
  */
 extern int RECC_RETRY_LIMIT;
 
+/**
+ * After this many consecutive RPCs fail to reach the servers, the circuit
+ * breaker shared by all recc processes on the host opens: commands run
+ * locally and failed RPCs aren't retried. 0 disables the circuit breaker.
+ */
+extern int RECC_CIRCUIT_BREAKER_THRESHOLD;
+
+/**
+ * How many seconds the circuit breaker stays open before one process tries
+ * the servers again.
+ */
+extern int RECC_CIRCUIT_BREAKER_COOLDOWN;
+
 /**
  * The base delay between retries. If the first request is request 0,
  * the delay between request n and request n+1 is RECC_RETRY_DELAY * 2^n.
@@ -286,6 +424,14 @@ struct Env {
      */
     static void handle_special_defaults();
 
+    /**
+     * Return the keys of RECC_PREFIX_REPLACEMENT, or RECC_DEPS_EXCLUDE_PATHS,
+     * compiled for matching. Each thread compiles them when it first uses
+     * them, and again whenever they have changed since.
+     */
+    static const PathPrefixMatcher &prefix_replacement_matcher();
+    static const PathPrefixMatcher &deps_exclude_paths_matcher();
+
     /**
      * Asserts that RECC_REAPI_VERSION is set to a valid value.
      */
@@ -348,12 +494,48 @@ struct Env {
      */
     static const std::string backwardsCompatibleURL(const std::string &url);
 
+    /**
+     * Return the path of the snapshot of what the files in
+     * RECC_CONFIG_LOCATIONS and the given environment parse to, and the
+     * key that it is written for. The key changes whenever a config file
+     * or any RECC_* variable in the environment does, except for the ones
+     * that usually differ between invocations, like
+     * RECC_CORRELATED_INVOCATIONS_ID and the *_OVERRIDE variables. Those
+     * are applied from the environment after loading a snapshot.
+     *
+     * Snapshots are kept under the RECC_CACHE_DIR set in the environment.
+     * (One set in a config file is only known after parsing it.) Returns
+     * false if there is none.
+     */
+    static bool config_snapshot_location(const char *const *environ,
+                                         std::string *path,
+                                         std::string *key);
+
+    /**
+     * Set the configuration variables from the snapshot at the given path.
+     * Returns false, leaving them unchanged, if it can't be read or was
+     * written for a different key.
+     */
+    static bool load_config_snapshot(const std::string &path,
+                                     const std::string &key);
+
+    /**
+     * Write the current values of the configuration variables to a
+     * snapshot at the given path. Failures are logged and ignored.
+     */
+    static void save_config_snapshot(const std::string &path,
+                                     const std::string &key);
+
     /**
      * Calculate and set the config locations, parse the config files from
      * those, then parse the environment variables for overrides and run some
      * sanity checks (handle_special_defaults) on the resulting config. Takes
      * optional parameter specifying source file which calls it, to pass to
      * handle_special_defaults
+     *
+     * If RECC_CACHE_DIR is set in the environment, the parsed values are
+     * loaded from a snapshot when the config files and environment haven't
+     * changed since it was written.
      */
     static void parse_config_variables();
 
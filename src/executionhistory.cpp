@@ -0,0 +1,289 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <executionhistory.h>
+
+#include <digestgenerator.h>
+#include <env.h>
+#include <fileutils.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_logging.h>
+
+#include <algorithm>
+#include <cmath>
+#include <dirent.h>
+#include <map>
+#include <sstream>
+#include <sys/stat.h>
+
+namespace BloombergLP {
+namespace recc {
+
+namespace {
+
+const std::string HistoryFileHeader = "recc-history 1";
+
+// Number of recent values that a `RunningAverage` follows
+const int AverageWindow = 8;
+
+// Number of `Execute()` durations kept for percentiles, and the number
+// needed before they are used
+const size_t ExecuteTimesKept = 16;
+const size_t ExecuteTimesNeeded = 5;
+
+std::string historyDirectory() { return RECC_CACHE_DIR + "/history"; }
+
+// Read a file, returning an empty string if it doesn't exist or can't be
+// read.
+std::string readFile(const std::string &path)
+{
+    struct stat statResult;
+    if (stat(path.c_str(), &statResult) != 0 || !S_ISREG(statResult.st_mode)) {
+        return "";
+    }
+    try {
+        return FileUtils::getFileContents(path, statResult);
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_DEBUG("Could not read " << path << ": " << e.what());
+        return "";
+    }
+}
+
+void writeFile(const std::string &path, const std::string &contents)
+{
+    try {
+        FileUtils::writeFileAtomically(path, contents);
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_WARNING("Could not write " << path << ": " << e.what());
+    }
+}
+
+void writeAverage(std::ostream &stream, const std::string &name,
+                  const RunningAverage &average)
+{
+    if (average.d_count > 0) {
+        stream << name << " " << average.d_count << " " << average.d_mean
+               << "\n";
+    }
+}
+
+double toMilliseconds(const google::protobuf::Timestamp &timestamp)
+{
+    return static_cast<double>(timestamp.seconds()) * 1000 +
+           timestamp.nanos() / 1000000.0;
+}
+
+} // namespace
+
+void RunningAverage::add(double value)
+{
+    if (d_count < AverageWindow) {
+        ++d_count;
+    }
+    d_mean += (value - d_mean) / d_count;
+}
+
+double ExecutionHistory::remoteEstimate() const
+{
+    return d_upload.d_mean + d_remoteQueue.d_mean +
+           d_remoteExecution.d_mean + d_download.d_mean;
+}
+
+void ExecutionHistory::addRemoteTimings(
+    const proto::ExecutedActionMetadata &metadata, double executeTime)
+{
+    d_recentExecuteTimes.push_back(executeTime);
+    if (d_recentExecuteTimes.size() > ExecuteTimesKept) {
+        d_recentExecuteTimes.erase(d_recentExecuteTimes.begin());
+    }
+
+    if (!metadata.has_execution_start_timestamp() ||
+        !metadata.has_execution_completed_timestamp()) {
+        d_remoteExecution.add(executeTime);
+        return;
+    }
+
+    d_remoteExecution.add(
+        toMilliseconds(metadata.execution_completed_timestamp()) -
+        toMilliseconds(metadata.execution_start_timestamp()));
+    if (metadata.has_queued_timestamp() &&
+        metadata.has_worker_start_timestamp()) {
+        d_remoteQueue.add(toMilliseconds(metadata.worker_start_timestamp()) -
+                          toMilliseconds(metadata.queued_timestamp()));
+    }
+}
+
+double ExecutionHistory::executeTimePercentile(int percentile) const
+{
+    if (d_recentExecuteTimes.size() < ExecuteTimesNeeded) {
+        return 0;
+    }
+
+    // Nearest-rank method
+    std::vector<double> sorted = d_recentExecuteTimes;
+    std::sort(sorted.begin(), sorted.end());
+    const size_t rank = static_cast<size_t>(
+        std::ceil(percentile / 100.0 * static_cast<double>(sorted.size())));
+    return sorted[std::min(std::max(rank, size_t(1)), sorted.size()) - 1];
+}
+
+std::string
+ExecutionHistory::path(const std::vector<std::string> &command,
+                       const std::string &workingDirectory)
+{
+    std::string key = workingDirectory;
+    for (const auto &argument : command) {
+        key += '\0' + argument;
+    }
+    return historyDirectory() + "/" +
+           DigestGenerator::make_digest(key).hash();
+}
+
+ExecutionHistory ExecutionHistory::load(const std::string &path)
+{
+    ExecutionHistory history;
+    const std::string data = readFile(path);
+    if (!data.empty() && !deserialize(data, &history)) {
+        BUILDBOX_LOG_DEBUG("Discarding invalid " << path);
+        return ExecutionHistory();
+    }
+    return history;
+}
+
+std::vector<ExecutionHistory> ExecutionHistory::loadAll()
+{
+    std::vector<ExecutionHistory> result;
+    const std::string directory = historyDirectory();
+    DIR *dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+        return result;
+    }
+
+    std::vector<std::string> names;
+    for (dirent *entry = readdir(dir); entry != nullptr;
+         entry = readdir(dir)) {
+        if (entry->d_name[0] != '.') {
+            names.push_back(entry->d_name);
+        }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+
+    for (const auto &name : names) {
+        ExecutionHistory history;
+        if (deserialize(readFile(directory + "/" + name), &history)) {
+            result.push_back(history);
+        }
+    }
+    return result;
+}
+
+void ExecutionHistory::save(const std::string &path) const
+{
+    writeFile(path, serialize(*this));
+}
+
+std::string ExecutionHistory::serialize(const ExecutionHistory &history)
+{
+    std::ostringstream result;
+    result << HistoryFileHeader << "\n"
+           << "directory " << history.d_workingDirectory << "\n"
+           << "command " << history.d_command << "\n";
+    writeAverage(result, "local_execution", history.d_localExecution);
+    writeAverage(result, "dependencies", history.d_dependencies);
+    writeAverage(result, "upload_bytes", history.d_uploadBytes);
+    writeAverage(result, "upload", history.d_upload);
+    writeAverage(result, "remote_queue", history.d_remoteQueue);
+    writeAverage(result, "remote_execution", history.d_remoteExecution);
+    writeAverage(result, "download", history.d_download);
+    if (!history.d_recentExecuteTimes.empty()) {
+        result << "execute_times";
+        for (const auto executeTime : history.d_recentExecuteTimes) {
+            result << " " << executeTime;
+        }
+        result << "\n";
+    }
+    if (!history.d_lastDecision.empty()) {
+        result << "decision " << history.d_lastDecision << "\n";
+    }
+    return result.str();
+}
+
+bool ExecutionHistory::deserialize(const std::string &data,
+                                   ExecutionHistory *history)
+{
+    std::istringstream lines(data);
+    std::string line;
+    if (!std::getline(lines, line) || line != HistoryFileHeader) {
+        return false;
+    }
+
+    ExecutionHistory result;
+    const std::map<std::string, RunningAverage *> averages = {
+        {"local_execution", &result.d_localExecution},
+        {"dependencies", &result.d_dependencies},
+        {"upload_bytes", &result.d_uploadBytes},
+        {"upload", &result.d_upload},
+        {"remote_queue", &result.d_remoteQueue},
+        {"remote_execution", &result.d_remoteExecution},
+        {"download", &result.d_download}};
+    const std::map<std::string, std::string *> strings = {
+        {"directory", &result.d_workingDirectory},
+        {"command", &result.d_command},
+        {"decision", &result.d_lastDecision}};
+
+    while (std::getline(lines, line)) {
+        const auto space = line.find(' ');
+        const std::string name = line.substr(0, space);
+        const std::string value =
+            space == std::string::npos ? "" : line.substr(space + 1);
+
+        const auto string = strings.find(name);
+        const auto average = averages.find(name);
+        if (string != strings.end()) {
+            *string->second = value;
+        }
+        else if (name == "execute_times") {
+            std::istringstream values(value);
+            double executeTime;
+            while (values >> executeTime) {
+                result.d_recentExecuteTimes.push_back(executeTime);
+            }
+            if (!values.eof()) {
+                return false;
+            }
+        }
+        else if (average != averages.end()) {
+            std::istringstream values(value);
+            if (!(values >> average->second->d_count >>
+                  average->second->d_mean) ||
+                average->second->d_count <= 0) {
+                return false;
+            }
+        }
+        else {
+            return false;
+        }
+    }
+
+    *history = result;
+    return true;
+}
+
+} // namespace recc
+} // namespace BloombergLP
@@ -0,0 +1,123 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef INCLUDED_EXECUTIONHISTORY
+#define INCLUDED_EXECUTIONHISTORY
+
+#include <protos.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace BloombergLP {
+namespace recc {
+
+/**
+ * The average of the most recent values of a measurement. Older values
+ * carry less weight, so that the average follows changes in the build.
+ */
+struct RunningAverage {
+    int d_count = 0;
+    double d_mean = 0;
+
+    void add(double value);
+};
+
+/**
+ * Measurements of past runs of one compile command, persisted under
+ * `RECC_CACHE_DIR` so that recc can decide whether to run it locally or
+ * remotely. Durations are in milliseconds.
+ */
+struct ExecutionHistory {
+    std::string d_workingDirectory;
+    std::string d_command;
+
+    // Running the command locally
+    RunningAverage d_localExecution;
+    // Finding the command's inputs (e.g. by running the preprocessor),
+    // which only remote execution needs
+    RunningAverage d_dependencies;
+    // Uploading the inputs the CAS didn't have yet
+    RunningAverage d_uploadBytes;
+    RunningAverage d_upload;
+    // As reported in the `ExecutedActionMetadata` of the remote result
+    RunningAverage d_remoteQueue;
+    RunningAverage d_remoteExecution;
+    // Fetching the outputs and writing them to disk
+    RunningAverage d_download;
+    // Durations of the most recent `Execute()` calls, oldest first
+    std::vector<double> d_recentExecuteTimes;
+
+    // Where the command was last run and why
+    std::string d_lastDecision;
+
+    /**
+     * Return the estimated time it takes to get the result of an action
+     * that isn't in the action cache from the remote execution service:
+     * upload, queue, execution and download.
+     */
+    double remoteEstimate() const;
+
+    /**
+     * Add the queue and execution times reported by the remote execution
+     * service, and the `executeTime` that the whole `Execute()` call took.
+     * If the service didn't report them, all of it is counted as execution.
+     */
+    void addRemoteTimings(const proto::ExecutedActionMetadata &metadata,
+                          double executeTime);
+
+    /**
+     * Return the given percentile of the durations of recent `Execute()`
+     * calls, or 0 if there are too few of them to tell.
+     */
+    double executeTimePercentile(int percentile) const;
+
+    /**
+     * Return the path of the file that holds the history of the given
+     * command, run in the given directory. `RECC_CACHE_DIR` must be set.
+     */
+    static std::string path(const std::vector<std::string> &command,
+                            const std::string &workingDirectory);
+
+    /**
+     * Read the history stored in the given file. Returns an empty history
+     * if there is none.
+     */
+    static ExecutionHistory load(const std::string &path);
+
+    /**
+     * Read all the histories stored under `RECC_CACHE_DIR`.
+     */
+    static std::vector<ExecutionHistory> loadAll();
+
+    /**
+     * Write this history to the given file, replacing what was there.
+     */
+    void save(const std::string &path) const;
+
+    /**
+     * Convert an `ExecutionHistory` to and from the format it is persisted
+     * in. `deserialize()` returns false if the data is not in that format.
+     */
+    static std::string serialize(const ExecutionHistory &history);
+    static bool deserialize(const std::string &data,
+                            ExecutionHistory *history);
+};
+
+} // namespace recc
+} // namespace BloombergLP
+
+#endif
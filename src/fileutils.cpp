@@ -17,10 +17,14 @@
 #include <buildboxcommon_fileutils.h>
 #include <buildboxcommon_logging.h>
 
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
 #include <cstring>
 #include <env.h>
 #include <fstream>
 #include <sstream>
+#include <system_error>
 #include <unistd.h>
 
 namespace BloombergLP {
@@ -46,7 +50,8 @@ void FileUtils::createDirectoryRecursive(const std::string &path)
             std::string parent(path_p, static_cast<std::string::size_type>(
                                            lastSlash - path_p));
             createDirectoryRecursive(parent);
-            if (mkdir(path_p, 0777) != 0) {
+            // Another thread or process may have created it meanwhile.
+            if (mkdir(path_p, 0777) != 0 && errno != EEXIST) {
                 std::ostringstream error;
                 error << "error in mkdir for path \"" << path_p << "\""
                       << ", errno = [" << errno << ":" << strerror(errno)
@@ -179,6 +184,26 @@ void FileUtils::writeFile(const std::string &path, const std::string &contents)
     fileStream << contents << std::flush;
 }
 
+void FileUtils::writeFileAtomically(const std::string &path,
+                                    const std::string &contents)
+{
+    // Unique across the threads of this process, and across processes
+    static std::atomic<unsigned> counter(0);
+    const std::string temporaryPath = path + ".recc-tmp." +
+                                      std::to_string(getpid()) + "." +
+                                      std::to_string(counter++);
+    try {
+        writeFile(temporaryPath, contents);
+        if (rename(temporaryPath.c_str(), path.c_str()) != 0) {
+            throw std::system_error(errno, std::system_category());
+        }
+    }
+    catch (...) {
+        unlink(temporaryPath.c_str());
+        throw;
+    }
+}
+
 bool FileUtils::hasPathPrefix(const std::string &path,
                               const std::string &prefix)
 {
@@ -186,20 +211,17 @@ bool FileUtils::hasPathPrefix(const std::string &path,
     if (prefix.empty()) {
         return false;
     }
-    if (path == prefix) {
-        return true;
+    if (path.compare(0, prefix.size(), prefix) != 0) {
+        return false;
     }
 
     /*
-     * Make sure prefix ends in a slash.
-     * This is so we don't return true if path = /foo and prefix = /foobar
+     * The prefix is assumed to be a directory, so what follows it in path
+     * must start a new segment.
+     * This is so we don't return true if path = /foobar and prefix = /foo
      */
-    std::string tmpPrefix(prefix);
-    if (tmpPrefix.back() != '/') {
-        tmpPrefix.push_back('/');
-    }
-
-    return path.substr(0, tmpPrefix.length()) == tmpPrefix;
+    return path.size() == prefix.size() || prefix.back() == '/' ||
+           path[prefix.size()] == '/';
 }
 
 bool FileUtils::hasPathPrefixes(const std::string &path,
@@ -424,23 +446,19 @@ std::string FileUtils::resolvePathFromPrefixMap(const std::string &path)
         return path;
     }
 
-    // Iterate through dictionary, replacing path if it includes key, with
-    // value.
-    for (const auto &pair : RECC_PREFIX_REPLACEMENT) {
-        // Check if prefix is found in the path, and that it is a prefix.
-        if (FileUtils::hasPathPrefix(path, pair.first)) {
-            // Append a trailing slash to the replacement, in cases of
-            // replacing `/` Double slashes will get removed during
-            // normalization.
-            const std::string replaced_path =
-                pair.second + '/' + path.substr(pair.first.length());
-            const std::string newPath =
-                buildboxcommon::FileUtils::normalizePath(
-                    replaced_path.c_str());
-            return newPath;
-        }
+    // The first pair in the map whose key is a prefix of the path
+    const int match = Env::prefix_replacement_matcher().firstMatch(path);
+    if (match < 0) {
+        return path;
     }
-    return path;
+
+    const auto &pair = RECC_PREFIX_REPLACEMENT[match];
+    // Append a trailing slash to the replacement, in cases of
+    // replacing `/` Double slashes will get removed during
+    // normalization.
+    const std::string replaced_path =
+        pair.second + '/' + path.substr(pair.first.length());
+    return buildboxcommon::FileUtils::normalizePath(replaced_path.c_str());
 }
 
 std::vector<std::string> FileUtils::parseDirectories(const std::string &path)
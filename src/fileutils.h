@@ -68,6 +68,14 @@ struct FileUtils {
     static void writeFile(const std::string &path,
                           const std::string &contents);
 
+    /**
+     * Like `writeFile()`, but write to a temporary file first and rename it
+     * into place, so that concurrent readers never see a partially written
+     * file.
+     */
+    static void writeFileAtomically(const std::string &path,
+                                    const std::string &contents);
+
     /**
      * Returns true if "path" has "prefix" as a prefix.
      *
@@ -145,7 +153,7 @@ struct FileUtils {
 
     /**
      * Check and replace input str if a path matches one in
-     * PREFIX_REPLACEMENT_MAP.
+     * PREFIX_REPLACEMENT_MAP. The first matching pair is used.
      */
     static std::string resolvePathFromPrefixMap(const std::string &path);
 
@@ -14,6 +14,7 @@
 
 #include <grpcretry.h>
 
+#include <circuitbreaker.h>
 #include <env.h>
 #include <grpcchannels.h>
 #include <grpccontext.h>
@@ -21,11 +22,47 @@
 #include <buildboxcommon_logging.h>
 
 #include <math.h>
+#include <random>
 #include <thread>
 
 namespace BloombergLP {
 namespace recc {
 
+namespace {
+
+/**
+ * Return a random delay between half the given delay and the full delay,
+ * so that clients that failed at the same time don't retry in lockstep.
+ */
+int with_jitter(int delay)
+{
+    static thread_local std::mt19937 generator{std::random_device()()};
+    return delay / 2 +
+           std::uniform_int_distribution<int>(0, delay - delay / 2)(generator);
+}
+
+} // namespace
+
+ServerHealth server_health(const grpc::Status &status)
+{
+    switch (status.error_code()) {
+        case grpc::StatusCode::UNAVAILABLE:
+        case grpc::StatusCode::DEADLINE_EXCEEDED:
+            return ServerHealth::Unreachable;
+        // Replies about the request itself, which only a working server
+        // sends
+        case grpc::StatusCode::OK:
+        case grpc::StatusCode::NOT_FOUND:
+        case grpc::StatusCode::ALREADY_EXISTS:
+        case grpc::StatusCode::FAILED_PRECONDITION:
+        case grpc::StatusCode::INVALID_ARGUMENT:
+        case grpc::StatusCode::OUT_OF_RANGE:
+            return ServerHealth::Healthy;
+        default:
+            return ServerHealth::Unknown;
+    }
+}
+
 void grpc_retry(
     const std::function<grpc::Status(grpc::ClientContext &)> &grpc_invocation,
     GrpcContext *grpcContext)
@@ -35,9 +72,19 @@ void grpc_retry(
     bool refreshed = false;
     int NO_AUTH = int(grpc::StatusCode::UNAUTHENTICATED);
     grpc::Status status;
+    CircuitBreaker *breaker = CircuitBreaker::instance();
     do {
         auto context = grpcContext->new_client_context();
         status = grpc_invocation(*context);
+        if (breaker != nullptr) {
+            const ServerHealth health = server_health(status);
+            if (health == ServerHealth::Unreachable) {
+                breaker->recordFailure();
+            }
+            else if (health == ServerHealth::Healthy) {
+                breaker->recordSuccess();
+            }
+        }
         if (status.ok()) {
             return;
         }
@@ -46,11 +93,20 @@ void grpc_retry(
         }
         else {
             /* The call failed. */
+            if (n_attempts < RECC_RETRY_LIMIT && breaker != nullptr &&
+                (!breaker->allowRequests() || !breaker->tryRetry())) {
+                // Other processes see the same failures, so leave the
+                // servers alone rather than adding to the retries.
+                BUILDBOX_LOG_ERROR("Not retrying after gRPC error "
+                                   << status.error_code() << ": "
+                                   << status.error_message());
+                break;
+            }
             if (n_attempts < RECC_RETRY_LIMIT) {
                 /* Delay the next call based on the number of attempts made */
-                const int time_delay =
+                const int time_delay = with_jitter(
                     static_cast<int>(RECC_RETRY_DELAY *
-                                     pow(static_cast<double>(2), n_attempts));
+                                     pow(static_cast<double>(2), n_attempts)));
 
                 const std::string error_msg =
                     "Attempt " + std::to_string(n_attempts + 1) + "/" +
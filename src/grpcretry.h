@@ -19,9 +19,30 @@
 namespace BloombergLP {
 namespace recc {
 
+/**
+ * What the status of an RPC says about the server that sent it, as
+ * recorded by the circuit breaker.
+ */
+enum class ServerHealth {
+    // The server couldn't be reached
+    Unreachable,
+    // The server handled the request
+    Healthy,
+    // Anything else, e.g. an internal error that may come from an
+    // overloaded proxy in front of an unreachable server
+    Unknown
+};
+
+ServerHealth server_health(const grpc::Status &status);
+
 /**
  * Call a GRPC method. On failure, retry up to RECC_RETRY_LIMIT times,
- * using binary exponential backoff to delay between calls.
+ * using binary exponential backoff with jitter to delay between calls.
+ *
+ * If the circuit breaker is enabled, the outcome of each call is recorded
+ * in it unless its `server_health()` is unknown, and failed calls are only
+ * retried while the breaker allows requests and its retry budget isn't
+ * exhausted.
  *
  * As input, takes a function that takes a grpc::ClientContext and returns a
  * grpc::Status.
@@ -0,0 +1,312 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <jobserver.h>
+
+#include <env.h>
+
+#include <buildboxcommon_logging.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <poll.h>
+#include <signal.h>
+#include <sstream>
+#include <system_error>
+#include <unistd.h>
+
+namespace BloombergLP {
+namespace recc {
+
+namespace {
+
+bool parseFds(const std::string &value, int *readFd, int *writeFd)
+{
+    char comma;
+    std::istringstream fds(value);
+    return (fds >> *readFd >> comma >> *writeFd) && comma == ',' &&
+           fds.peek() == std::char_traits<char>::eof() && *readFd >= 0 &&
+           *writeFd >= 0;
+}
+
+/**
+ * The jobserver given in `MAKEFLAGS` when this process started.
+ */
+struct InheritedJobServer {
+    bool d_found = false;
+    bool d_fdsOpen = false;
+    int d_readFd = -1;
+    int d_writeFd = -1;
+    std::string d_fifoPath;
+};
+
+const InheritedJobServer &inheritedJobServer()
+{
+    static const InheritedJobServer s_inherited = []() {
+        InheritedJobServer result;
+        const char *makeflags = getenv("MAKEFLAGS");
+        if (makeflags == nullptr) {
+            return result;
+        }
+
+        result.d_found =
+            JobServer::parseMakeflags(makeflags, &result.d_readFd,
+                                      &result.d_writeFd, &result.d_fifoPath);
+        result.d_fdsOpen = result.d_found && result.d_fifoPath.empty() &&
+                           fcntl(result.d_readFd, F_GETFD) != -1 &&
+                           fcntl(result.d_writeFd, F_GETFD) != -1;
+        return result;
+    }();
+    return s_inherited;
+}
+
+JobServer *s_exitingJobServer = nullptr;
+
+const int ExitSignals[] = {SIGINT, SIGTERM, SIGHUP};
+struct sigaction s_previousActions[sizeof(ExitSignals) / sizeof(int)];
+
+void acquireSlotAtExit()
+{
+    if (s_exitingJobServer != nullptr) {
+        s_exitingJobServer->acquireSlotBeforeExit(-1);
+    }
+}
+
+void acquireSlotOnSignal(int signalNumber)
+{
+    const int savedErrno = errno;
+    if (s_exitingJobServer != nullptr) {
+        s_exitingJobServer->acquireSlotBeforeExit(
+            JobServer::SignalExitTimeoutMs);
+    }
+
+    // Carry on with whatever would have happened without this handler
+    for (size_t i = 0; i < sizeof(ExitSignals) / sizeof(int); ++i) {
+        if (ExitSignals[i] == signalNumber) {
+            sigaction(signalNumber, &s_previousActions[i], nullptr);
+        }
+    }
+    errno = savedErrno;
+    raise(signalNumber);
+}
+
+void acquireSlotOnExit(JobServer *jobServer)
+{
+    s_exitingJobServer = jobServer;
+    std::atexit(acquireSlotAtExit);
+
+    struct sigaction action = {};
+    action.sa_handler = acquireSlotOnSignal;
+    sigemptyset(&action.sa_mask);
+    for (size_t i = 0; i < sizeof(ExitSignals) / sizeof(int); ++i) {
+        if (sigaction(ExitSignals[i], nullptr, &s_previousActions[i]) == 0 &&
+            s_previousActions[i].sa_handler != SIG_IGN) {
+            sigaction(ExitSignals[i], &action, nullptr);
+        }
+    }
+}
+
+} // namespace
+
+JobServer *JobServer::instance()
+{
+    static const std::unique_ptr<JobServer> s_instance = []() {
+        std::unique_ptr<JobServer> result;
+        const InheritedJobServer &inherited = inheritedJobServer();
+        if (!RECC_JOBSERVER) {
+            return result;
+        }
+        if (!inherited.d_found) {
+            BUILDBOX_LOG_DEBUG("No jobserver in MAKEFLAGS");
+            return result;
+        }
+
+        // make only passes the file descriptors to commands it knows to
+        // be recursive invocations
+        if (inherited.d_fifoPath.empty() && !inherited.d_fdsOpen) {
+            BUILDBOX_LOG_DEBUG("The jobserver's file descriptors are closed");
+            return result;
+        }
+
+        try {
+            if (!inherited.d_fifoPath.empty()) {
+                result = std::make_unique<JobServer>(inherited.d_fifoPath);
+            }
+            else {
+                result = std::make_unique<JobServer>(inherited.d_readFd,
+                                                     inherited.d_writeFd);
+            }
+        }
+        catch (const std::exception &e) {
+            BUILDBOX_LOG_WARNING("Not using the jobserver: " << e.what());
+        }
+
+        if (result) {
+            acquireSlotOnExit(result.get());
+        }
+        return result;
+    }();
+    return s_instance.get();
+}
+
+void JobServer::inheritFromMake() { inheritedJobServer(); }
+
+bool JobServer::parseMakeflags(const std::string &makeflags, int *readFd,
+                               int *writeFd, std::string *fifoPath)
+{
+    const std::string authOption = "--jobserver-auth=";
+    const std::string fdsOption = "--jobserver-fds=";
+    const std::string fifoPrefix = "fifo:";
+
+    // The last option wins, as make itself does
+    bool found = false;
+    std::istringstream words(makeflags);
+    std::string word;
+    while (words >> word) {
+        std::string value;
+        if (word.compare(0, authOption.size(), authOption) == 0) {
+            value = word.substr(authOption.size());
+        }
+        else if (word.compare(0, fdsOption.size(), fdsOption) == 0) {
+            value = word.substr(fdsOption.size());
+        }
+        else if (word == "--") {
+            // Variable definitions follow
+            break;
+        }
+        else {
+            continue;
+        }
+
+        if (value.compare(0, fifoPrefix.size(), fifoPrefix) == 0 &&
+            value.size() > fifoPrefix.size()) {
+            *fifoPath = value.substr(fifoPrefix.size());
+            found = true;
+        }
+        else if (parseFds(value, readFd, writeFd)) {
+            fifoPath->clear();
+            found = true;
+        }
+    }
+    return found;
+}
+
+JobServer::JobServer(int readFd, int writeFd)
+    : d_readFd(-1), d_writeFd(writeFd), d_ownedFd(-1), d_released(false),
+      d_token('+')
+{
+    // Making make's own descriptor non-blocking would break versions that
+    // rely on read() blocking, so open the pipe again for this process
+    const std::string path = "/proc/self/fd/" + std::to_string(readFd);
+    d_readFd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (d_readFd == -1) {
+        throw std::system_error(errno, std::system_category(),
+                                "Could not open \"" + path + "\"");
+    }
+    d_ownedFd = d_readFd;
+}
+
+JobServer::JobServer(const std::string &fifoPath)
+    : d_readFd(-1), d_writeFd(-1), d_ownedFd(-1), d_released(false),
+      d_token('+')
+{
+    d_readFd = open(fifoPath.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (d_readFd == -1) {
+        throw std::system_error(errno, std::system_category(),
+                                "Could not open \"" + fifoPath + "\"");
+    }
+    d_writeFd = d_readFd;
+    d_ownedFd = d_readFd;
+}
+
+JobServer::~JobServer()
+{
+    if (d_ownedFd != -1) {
+        close(d_ownedFd);
+    }
+}
+
+void JobServer::releaseSlot()
+{
+    if (d_released) {
+        return;
+    }
+
+    ssize_t written;
+    do {
+        written = write(d_writeFd, &d_token, 1);
+    } while (written == -1 && errno == EINTR);
+
+    if (written == 1) {
+        d_released = true;
+    }
+    else {
+        BUILDBOX_LOG_WARNING("Could not release jobserver token: "
+                             << strerror(errno));
+    }
+}
+
+bool JobServer::readToken(int timeoutMs)
+{
+    for (;;) {
+        char token;
+        errno = 0;
+        const ssize_t bytesRead = read(d_readFd, &token, 1);
+        if (bytesRead == 1) {
+            d_token = token;
+            return true;
+        }
+        else if (bytesRead == -1 && errno == EINTR) {
+            continue;
+        }
+        else if (bytesRead == -1 && errno == EAGAIN) {
+            // Another client may still take the token before the next
+            // read(), which then fails with EAGAIN again
+            struct pollfd readable = {d_readFd, POLLIN, 0};
+            if (poll(&readable, 1, timeoutMs) == 0) {
+                return false;
+            }
+            continue;
+        }
+        return false;
+    }
+}
+
+void JobServer::acquireSlot()
+{
+    if (!d_released) {
+        return;
+    }
+
+    if (!readToken(-1)) {
+        // make is gone; there's nothing to give the slot back to
+        BUILDBOX_LOG_WARNING("Could not acquire jobserver token: "
+                             << (errno == 0 ? "end of file"
+                                            : strerror(errno)));
+    }
+    d_released = false;
+}
+
+void JobServer::acquireSlotBeforeExit(int timeoutMs)
+{
+    if (d_released && readToken(timeoutMs)) {
+        d_released = false;
+    }
+}
+
+} // namespace recc
+} // namespace BloombergLP
@@ -0,0 +1,129 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_JOBSERVER
+#define INCLUDED_JOBSERVER
+
+#include <atomic>
+#include <string>
+
+namespace BloombergLP {
+namespace recc {
+
+/**
+ * A client of the GNU make jobserver, which make uses to limit how many
+ * jobs run at once across recursive invocations.
+ *
+ * make starts recc holding a job slot. recc keeps it while it does CPU
+ * work locally (finding dependencies, compiling locally) and lends it
+ * back to make while it waits on the remote servers, so that make can
+ * start another job. The slot must be taken back before exiting or
+ * running anything locally, which may mean waiting for another job to
+ * finish.
+ */
+class JobServer {
+  public:
+    /**
+     * Return the jobserver given in `MAKEFLAGS`, or null if
+     * `RECC_JOBSERVER` is not set or there isn't a usable one.
+     *
+     * The first call also makes sure that a lent slot is taken back if
+     * this process exits or is killed by SIGINT, SIGTERM or SIGHUP.
+     */
+    static JobServer *instance();
+
+    /**
+     * Check the file descriptors of the jobserver given in `MAKEFLAGS`.
+     *
+     * make closes them for commands it doesn't know to be recursive
+     * invocations, after which they may be reused by any file this
+     * process opens. This must therefore be called before opening
+     * anything, and `instance()` only uses the descriptors that were open
+     * then.
+     */
+    static void inheritFromMake();
+
+    /**
+     * Find the jobserver in the value of `MAKEFLAGS`: either a pair of
+     * file descriptors (`--jobserver-auth=R,W`, or `--jobserver-fds=R,W`
+     * before make 4.2) or a named pipe (`--jobserver-auth=fifo:PATH`).
+     * Returns false if there is neither.
+     */
+    static bool parseMakeflags(const std::string &makeflags, int *readFd,
+                               int *writeFd, std::string *fifoPath);
+
+    /**
+     * Use the jobserver reachable through the given file descriptors, or
+     * through the given named pipe. Tokens are read through a descriptor
+     * of this process's own in non-blocking mode, so that another client
+     * taking a token first can't leave it stuck in `read()`. Throws
+     * `std::system_error` if that can't be opened.
+     */
+    JobServer(int readFd, int writeFd);
+    explicit JobServer(const std::string &fifoPath);
+    ~JobServer();
+
+    JobServer(const JobServer &) = delete;
+    JobServer &operator=(const JobServer &) = delete;
+
+    /**
+     * Lend this process's job slot to make. Does nothing if it is already
+     * lent.
+     */
+    void releaseSlot();
+
+    /**
+     * Take the job slot back, waiting until one is available. Does nothing
+     * if this process holds it.
+     */
+    void acquireSlot();
+
+    /**
+     * Take the job slot back before this process exits, waiting at most
+     * `timeoutMs` for one to be available, or until there is one if it is
+     * -1. Only makes async-signal-safe calls, so it can be used from a
+     * signal handler.
+     */
+    void acquireSlotBeforeExit(int timeoutMs);
+
+    bool holdsSlot() const { return !d_released; }
+
+    /**
+     * How long to wait for the slot when killed by a signal. The build is
+     * being interrupted then, and make may be waiting for this process.
+     * On a normal exit, it waits until the slot is back so that make's
+     * pool doesn't keep the token it was lent.
+     */
+    static const int SignalExitTimeoutMs = 1000;
+
+  private:
+    /**
+     * Read a token into `d_token`, waiting at most `timeoutMs` (-1 for no
+     * limit) for one. Returns false if there was none, or make is gone.
+     */
+    bool readToken(int timeoutMs);
+
+    int d_readFd;
+    int d_writeFd;
+    // The descriptor opened by this object, if any
+    int d_ownedFd;
+    std::atomic<bool> d_released;
+    // make expects the tokens it hands out to be written back as is
+    char d_token;
+};
+
+} // namespace recc
+} // namespace BloombergLP
+
+#endif
@@ -0,0 +1,118 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <localexecution.h>
+
+#include <digestgenerator.h>
+#include <reccfile.h>
+#include <subprocess.h>
+
+#include <buildboxcommon_logging.h>
+#include <buildboxcommonmetrics_durationmetrictimer.h>
+#include <buildboxcommonmetrics_metricguard.h>
+
+#include <sys/stat.h>
+
+#define TIMER_NAME_EXECUTE_LOCALLY "recc.execute_locally"
+
+namespace BloombergLP {
+namespace recc {
+
+namespace {
+
+/**
+ * Add the output file at the given path relative to `root` to the result,
+ * if it exists. Returns false if it is a directory.
+ */
+bool addOutputFile(const std::string &path, const std::string &root,
+                   proto::ActionResult *result, digest_string_umap *blobs)
+{
+    const std::string localPath = root + "/" + path;
+    struct stat statResult;
+    if (stat(localPath.c_str(), &statResult) != 0) {
+        BUILDBOX_LOG_DEBUG("Output file \"" << localPath
+                                            << "\" was not produced");
+        return true;
+    }
+    if (S_ISDIR(statResult.st_mode)) {
+        BUILDBOX_LOG_DEBUG("Output \"" << localPath << "\" is a directory");
+        return false;
+    }
+
+    const auto file = ReccFileFactory::createFile(localPath.c_str());
+    if (!file) {
+        BUILDBOX_LOG_DEBUG("Output \"" << localPath
+                                       << "\" is not a regular file");
+        return true;
+    }
+
+    proto::OutputFile *outputFile = result->add_output_files();
+    outputFile->set_path(path);
+    *outputFile->mutable_digest() = file->getDigest();
+    outputFile->set_is_executable(file->isExecutable());
+    (*blobs)[file->getDigest()] = file->getFileContents();
+    return true;
+}
+
+} // namespace
+
+bool LocalExecution::buildActionResult(const proto::Command &commandProto,
+                                       int exitCode, const std::string &stdOut,
+                                       const std::string &stdErr,
+                                       const std::string &root,
+                                       proto::ActionResult *result,
+                                       digest_string_umap *blobs)
+{
+    result->Clear();
+    result->set_exit_code(exitCode);
+
+    const auto stdOutDigest = DigestGenerator::make_digest(stdOut);
+    *result->mutable_stdout_digest() = stdOutDigest;
+    (*blobs)[stdOutDigest] = stdOut;
+
+    const auto stdErrDigest = DigestGenerator::make_digest(stdErr);
+    *result->mutable_stderr_digest() = stdErrDigest;
+    (*blobs)[stdErrDigest] = stdErr;
+
+    bool complete = commandProto.output_directories().empty();
+    for (const auto &path : commandProto.output_files()) {
+        complete = addOutputFile(path, root, result, blobs) && complete;
+    }
+    for (const auto &path : commandProto.output_paths()) {
+        complete = addOutputFile(path, root, result, blobs) && complete;
+    }
+    return complete;
+}
+
+bool LocalExecution::execute(const std::vector<std::string> &command,
+                             const proto::Command &commandProto,
+                             proto::ActionResult *result,
+                             digest_string_umap *blobs)
+{
+    Subprocess::SubprocessResult subprocessResult;
+    { // Timed block
+        buildboxcommon::buildboxcommonmetrics::MetricGuard<
+            buildboxcommon::buildboxcommonmetrics::DurationMetricTimer>
+            mt(TIMER_NAME_EXECUTE_LOCALLY);
+        subprocessResult = Subprocess::execute(command, true, true);
+    }
+
+    return buildActionResult(commandProto, subprocessResult.d_exitCode,
+                             subprocessResult.d_stdOut,
+                             subprocessResult.d_stdErr, ".", result, blobs);
+}
+
+} // namespace recc
+} // namespace BloombergLP
@@ -0,0 +1,67 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef INCLUDED_LOCALEXECUTION
+#define INCLUDED_LOCALEXECUTION
+
+#include <merklize.h>
+#include <protos.h>
+
+#include <string>
+#include <vector>
+
+namespace BloombergLP {
+namespace recc {
+
+struct LocalExecution {
+    /**
+     * Run the given command locally in the current directory, capturing its
+     * standard output and error, and store an `ActionResult` describing it
+     * and the outputs declared by `commandProto` in `result`.
+     *
+     * The contents of the outputs, standard output and standard error are
+     * stored in `blobs` under their digests.
+     *
+     * Returns false if `result` doesn't describe all the outputs, because
+     * some of them are directories, which are not supported.
+     */
+    static bool execute(const std::vector<std::string> &command,
+                        const proto::Command &commandProto,
+                        proto::ActionResult *result,
+                        digest_string_umap *blobs);
+
+    /**
+     * Store an `ActionResult` in `result` for a command that exited with the
+     * given status and output, containing the output files declared by
+     * `commandProto` that exist under `root`. Declared outputs that the
+     * command didn't produce are left out, as a remote worker would.
+     *
+     * The contents of the outputs, standard output and standard error are
+     * stored in `blobs` under their digests.
+     *
+     * Returns false if some of the outputs are directories.
+     */
+    static bool buildActionResult(const proto::Command &commandProto,
+                                  int exitCode, const std::string &stdOut,
+                                  const std::string &stdErr,
+                                  const std::string &root,
+                                  proto::ActionResult *result,
+                                  digest_string_umap *blobs);
+};
+
+} // namespace recc
+} // namespace BloombergLP
+
+#endif
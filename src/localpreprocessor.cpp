@@ -0,0 +1,350 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <localpreprocessor.h>
+
+#include <compilerdefaults.h>
+#include <deps.h>
+#include <env.h>
+#include <parsedcommandfactory.h>
+#include <responsefile.h>
+#include <subprocess.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_logging.h>
+#include <buildboxcommonmetrics_durationmetrictimer.h>
+#include <buildboxcommonmetrics_metricguard.h>
+
+#include <cctype>
+#include <memory>
+
+#define TIMER_NAME_LOCAL_PREPROCESS "recc.local_preprocess"
+
+namespace BloombergLP {
+namespace recc {
+
+namespace {
+
+const std::set<std::string> CSourceSuffixes = {".c"};
+const std::set<std::string> CxxSourceSuffixes = {".cc",  ".cp", ".cxx", ".cpp",
+                                                 ".CPP", ".c++", ".C"};
+const std::set<std::string> CxxCompilers = {"g++", "c++", "clang++"};
+
+// Options that only affect the preprocessor and take a separate argument
+// (`-I dir`), or have their argument attached (`-Idir`).
+const std::set<std::string> PreprocessorOptionsWithArgument = {
+    "-I",        "-D",           "-U",          "-include",
+    "-imacros",  "-isystem",     "-iquote",     "-idirafter",
+    "-iprefix",  "-iwithprefix", "-isysroot",   "-iwithprefixbefore",
+    "-MF",       "-MT",          "-MQ",         "-Xpreprocessor"};
+const std::vector<std::string> PreprocessorOptionPrefixes = {
+    "-I",       "-D",       "-U",         "-Wp,",     "-include",
+    "-imacros", "-isystem", "-idirafter", "-iquote",  "-MF",
+    "-MT",      "-MQ"};
+const std::set<std::string> PreprocessorFlags = {
+    "-M",        "-MM",        "-MD", "-MMD",   "-MG", "-MP",
+    "-nostdinc", "-nostdinc++", "-H", "-undef", "-C",  "-CC"};
+
+// Other options whose argument may look like a source file.
+const std::set<std::string> OtherOptionsWithArgument = {
+    "-o", "-x", "-Xassembler", "-Xlinker", "-arch", "-target", "-aux-info"};
+
+const std::string DirectivesOnlyOption = "-fdirectives-only";
+
+std::string suffixOf(const std::string &path)
+{
+    const auto dot = path.rfind('.');
+    const auto slash = path.rfind('/');
+    if (dot == std::string::npos ||
+        (slash != std::string::npos && dot < slash)) {
+        return "";
+    }
+    return path.substr(dot);
+}
+
+bool hasOptionWithPrefix(const std::vector<std::string> &arguments,
+                         const std::string &prefix)
+{
+    for (const auto &argument : arguments) {
+        if (argument.compare(0, prefix.size(), prefix) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool isPreprocessorOptionWithAttachedArgument(const std::string &argument)
+{
+    for (const auto &prefix : PreprocessorOptionPrefixes) {
+        if (argument.size() > prefix.size() &&
+            argument.compare(0, prefix.size(), prefix) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+size_t
+LocalPreprocessor::findSourceFile(const std::vector<std::string> &arguments)
+{
+    size_t source = std::string::npos;
+    for (size_t i = 1; i < arguments.size(); ++i) {
+        const auto &argument = arguments[i];
+        if (PreprocessorOptionsWithArgument.count(argument) ||
+            OtherOptionsWithArgument.count(argument)) {
+            ++i;
+            continue;
+        }
+
+        const auto suffix = suffixOf(argument);
+        if (argument.front() != '-' && (CSourceSuffixes.count(suffix) ||
+                                        CxxSourceSuffixes.count(suffix))) {
+            if (source != std::string::npos) {
+                return std::string::npos;
+            }
+            source = i;
+        }
+    }
+    return source;
+}
+
+bool LocalPreprocessor::supports(const ParsedCommand &command)
+{
+    if (!command.is_compiler_command() ||
+        !SupportedCompilers::Gcc.count(command.get_compiler())) {
+        return false;
+    }
+
+    const auto &arguments = command.get_command();
+    if (hasOptionWithPrefix(arguments, "-x")) {
+        return false;
+    }
+
+    return findSourceFile(arguments) != std::string::npos;
+}
+
+std::vector<std::string>
+LocalPreprocessor::preprocessCommand(const ParsedCommand &command)
+{
+    const auto &arguments = command.d_originalCommand;
+
+    std::vector<std::string> result;
+    for (size_t i = 0; i < arguments.size(); ++i) {
+        const auto &argument = arguments[i];
+        if (argument == "-c") {
+            continue;
+        }
+        if (argument == "-o") {
+            ++i;
+            continue;
+        }
+        if (argument.compare(0, 2, "-o") == 0) {
+            continue;
+        }
+        result.push_back(argument);
+    }
+    result.push_back("-E");
+
+    // The dependency file's location and target are derived from the
+    // output file when not given explicitly, so spell them out now that
+    // `-o` is gone.
+    const auto dependencyFile = command.get_dependency_file();
+    if (!dependencyFile.empty()) {
+        if (!hasOptionWithPrefix(arguments, "-MF")) {
+            result.push_back("-MF");
+            result.push_back(dependencyFile);
+        }
+        if (!command.d_outputFile.empty() &&
+            !hasOptionWithPrefix(arguments, "-MT") &&
+            !hasOptionWithPrefix(arguments, "-MQ")) {
+            result.push_back("-MT");
+            result.push_back(command.d_outputFile);
+        }
+    }
+
+    return result;
+}
+
+std::vector<std::string>
+LocalPreprocessor::compileCommand(const ParsedCommand &command,
+                                  const std::string &fileName)
+{
+    const auto &arguments = command.get_command();
+    const auto source = findSourceFile(arguments);
+
+    std::vector<std::string> result;
+    bool directivesOnly = false;
+    for (size_t i = 0; i < arguments.size(); ++i) {
+        const auto &argument = arguments[i];
+        if (i == source) {
+            result.push_back(fileName);
+        }
+        else if (PreprocessorOptionsWithArgument.count(argument)) {
+            ++i;
+        }
+        else if (PreprocessorFlags.count(argument) ||
+                 isPreprocessorOptionWithAttachedArgument(argument)) {
+            continue;
+        }
+        else if (argument == DirectivesOnlyOption) {
+            directivesOnly = true;
+        }
+        else {
+            result.push_back(argument);
+        }
+    }
+
+    // GCC can compile the output of `-E -fdirectives-only` only if told
+    // that it has already been preprocessed; otherwise the remaining macros
+    // would be expanded twice. Clang expands everything in `-E`.
+    if (directivesOnly && !command.is_clang()) {
+        result.push_back("-fpreprocessed");
+        result.push_back(DirectivesOnlyOption);
+    }
+
+    return result;
+}
+
+std::string
+LocalPreprocessor::preprocessedFileName(const ParsedCommand &command)
+{
+    const auto &arguments = command.get_command();
+    const auto &source = arguments.at(findSourceFile(arguments));
+
+    std::string name = source.substr(source.rfind('/') + 1);
+    const auto suffix = suffixOf(name);
+    name = name.substr(0, name.size() - suffix.size());
+
+    if (CxxSourceSuffixes.count(suffix) ||
+        CxxCompilers.count(command.get_compiler())) {
+        return name + ".ii";
+    }
+    return name + ".i";
+}
+
+std::string
+LocalPreprocessor::normalizeLineMarkers(const std::string &source,
+                                        const std::string &workingDirectory)
+{
+    std::string result;
+    result.reserve(source.size());
+
+    size_t lineStart = 0;
+    while (lineStart < source.size()) {
+        size_t lineEnd = source.find('\n', lineStart);
+        lineEnd = (lineEnd == std::string::npos) ? source.size() : lineEnd + 1;
+
+        // Line markers look like `# 12 "path" flags` or `#line 12 "path"`.
+        const bool isLineMarker =
+            source[lineStart] == '#' &&
+            ((lineStart + 2 < lineEnd && source[lineStart + 1] == ' ' &&
+              isdigit(static_cast<unsigned char>(source[lineStart + 2]))) ||
+             source.compare(lineStart, 6, "#line ") == 0);
+
+        const size_t pathStart =
+            isLineMarker ? source.find('"', lineStart) : std::string::npos;
+        const size_t pathEnd = (pathStart < lineEnd)
+                                   ? source.find('"', pathStart + 1)
+                                   : std::string::npos;
+
+        if (pathEnd < lineEnd) {
+            const std::string path =
+                source.substr(pathStart + 1, pathEnd - pathStart - 1);
+            // Leave escaped paths alone rather than risk mangling them.
+            const std::string replacedPath =
+                (path.find('\\') == std::string::npos)
+                    ? ParsedCommandModifiers::modifyRemotePath(
+                          path, workingDirectory)
+                    : path;
+
+            result.append(source, lineStart, pathStart + 1 - lineStart);
+            result.append(replacedPath);
+            result.append(source, pathEnd, lineEnd - pathEnd);
+        }
+        else {
+            result.append(source, lineStart, lineEnd - lineStart);
+        }
+
+        lineStart = lineEnd;
+    }
+
+    return result;
+}
+
+PreprocessedSource
+LocalPreprocessor::preprocess(const ParsedCommand &command,
+                              const std::string &workingDirectory)
+{
+    const auto preprocessorCommand = preprocessCommand(command);
+
+    // As with the dependency command, the arguments of response files may
+    // be too many to pass on the command line
+    std::unique_ptr<TemporaryResponseFile> responseFile;
+    if (command.uses_response_files()) {
+        responseFile =
+            std::make_unique<TemporaryResponseFile>(preprocessorCommand);
+    }
+
+    Subprocess::SubprocessResult subprocessResult;
+    { // Timed block
+        buildboxcommon::buildboxcommonmetrics::MetricGuard<
+            buildboxcommon::buildboxcommonmetrics::DurationMetricTimer>
+            mt(TIMER_NAME_LOCAL_PREPROCESS);
+        subprocessResult = Subprocess::execute(
+            responseFile ? responseFile->command() : preprocessorCommand,
+            true, false, RECC_DEPS_ENV, workingDirectory);
+    }
+
+    if (subprocessResult.d_exitCode != 0) {
+        std::string errorMsg = "Failed to execute preprocessor command: ";
+        for (const auto &token : preprocessorCommand) {
+            errorMsg += (token + " ");
+        }
+        BUILDBOX_LOG_ERROR(errorMsg);
+        BUILDBOX_LOG_ERROR("Exit status: " << subprocessResult.d_exitCode);
+        throw subprocess_failed_error(subprocessResult.d_exitCode);
+    }
+
+    PreprocessedSource result;
+    result.d_fileName = preprocessedFileName(command);
+    result.d_contents =
+        normalizeLineMarkers(subprocessResult.d_stdOut, workingDirectory);
+    result.d_command = compileCommand(command, result.d_fileName);
+
+    // The dependency file has already been written by the preprocessor.
+    std::set<std::string> products = command.get_products();
+    const auto dependencyFile = command.get_dependency_file();
+    if (!dependencyFile.empty()) {
+        products.erase(ParsedCommandModifiers::modifyRemotePath(
+            dependencyFile, workingDirectory));
+    }
+    if (products.empty()) {
+        products = Deps::guess_products({result.d_fileName});
+    }
+
+    for (const auto &product : products) {
+        result.d_products.insert(
+            buildboxcommon::FileUtils::normalizePath(product.c_str()));
+    }
+
+    BUILDBOX_LOG_DEBUG("Preprocessed locally into \""
+                       << result.d_fileName << "\" ("
+                       << result.d_contents.size() << " bytes)");
+    return result;
+}
+
+} // namespace recc
+} // namespace BloombergLP
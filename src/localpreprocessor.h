@@ -0,0 +1,105 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_LOCALPREPROCESSOR
+#define INCLUDED_LOCALPREPROCESSOR
+
+#include <parsedcommand.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+namespace BloombergLP {
+namespace recc {
+
+/**
+ * The result of preprocessing a compile command locally: the preprocessed
+ * translation unit and the command that compiles it remotely.
+ */
+struct PreprocessedSource {
+    // Name of the preprocessed file, relative to the working directory
+    std::string d_fileName;
+    std::string d_contents;
+    // Compile command with the source replaced by `d_fileName` and the
+    // preprocessor options removed
+    std::vector<std::string> d_command;
+    std::set<std::string> d_products;
+};
+
+struct LocalPreprocessor {
+    /**
+     * Returns true if the given command can be split into a local
+     * preprocessing step and a remote compilation of its output. Only
+     * gcc-style commands compiling a single C or C++ source file without an
+     * explicit `-x` language are supported.
+     */
+    static bool supports(const ParsedCommand &command);
+
+    /**
+     * Run the preprocessor locally for the given command and return the
+     * preprocessed source, along with the command to compile it remotely.
+     *
+     * If the command writes a dependency file, it is written by the local
+     * preprocessing step and is not requested from the remote.
+     *
+     * Throws `subprocess_failed_error` if the preprocessor fails.
+     */
+    static PreprocessedSource preprocess(const ParsedCommand &command,
+                                         const std::string &workingDirectory);
+
+    /**
+     * Return the command that preprocesses the given command's source file,
+     * writing the result to standard output. Paths are left as they appear
+     * in the original command.
+     */
+    static std::vector<std::string>
+    preprocessCommand(const ParsedCommand &command);
+
+    /**
+     * Return the command that compiles the preprocessed file `fileName`
+     * remotely, derived from the given command's remote arguments.
+     */
+    static std::vector<std::string>
+    compileCommand(const ParsedCommand &command, const std::string &fileName);
+
+    /**
+     * Return the name of the file that the preprocessed output of the given
+     * command is stored in: the source's basename with a `.i` or `.ii`
+     * suffix, depending on the language.
+     */
+    static std::string preprocessedFileName(const ParsedCommand &command);
+
+    /**
+     * Rewrite the paths in the line markers (`# 1 "path"`) of the given
+     * preprocessor output through `RECC_PREFIX_MAP` and make them relative to
+     * the working directory, so that the output doesn't depend on where the
+     * sources are checked out.
+     */
+    static std::string
+    normalizeLineMarkers(const std::string &source,
+                         const std::string &workingDirectory);
+
+  private:
+    /**
+     * Return the index of the (only) source file argument in `arguments`, or
+     * `std::string::npos` if there isn't exactly one.
+     */
+    static size_t findSourceFile(const std::vector<std::string> &arguments);
+};
+
+} // namespace recc
+} // namespace BloombergLP
+
+#endif
@@ -15,6 +15,7 @@
 #include <merklize.h>
 
 #include <digestgenerator.h>
+#include <directoryencoder.h>
 #include <fileutils.h>
 
 #include <buildboxcommon_logging.h>
@@ -103,6 +104,29 @@ void NestedDirectory::add(std::shared_ptr<ReccFile> file,
     }
 }
 
+void NestedDirectory::add(std::shared_ptr<ReccFile> file,
+                          const PathTable &paths, PathTable::PathId path)
+{
+    const auto segments = paths.segments(path);
+    if (segments.first == segments.second) {
+        return;
+    }
+
+    if (file->isSymlink()) {
+        this->addSymlink(file->getFileContents(),
+                         paths.toString(path).c_str(), true);
+        return;
+    }
+
+    // Map keys are only copied when a directory is seen for the first time
+    NestedDirectory *directory = this;
+    const auto last = segments.second - 1;
+    for (auto it = segments.first; it != last; ++it) {
+        directory = &(*directory->d_subdirs)[paths.segment(*it)];
+    }
+    directory->d_files[paths.segment(*last)] = file;
+}
+
 void NestedDirectory::addSymlink(const std::string &target,
                                  const char *relativePath, bool checkedPrefix)
 {
@@ -194,31 +218,35 @@ proto::Digest NestedDirectory::to_digest(digest_string_umap *digestMap) const
     // The 'd_files' and 'd_subdirs' maps make sure everything is sorted by
     // name thus the iterators will iterate lexicographically
 
-    proto::Directory directoryMessage;
+    // Subdirectories are hashed first, since they reuse the buffer below
+    std::vector<proto::Digest> subdirDigests;
+    subdirDigests.reserve(d_subdirs->size());
+    for (const auto &subdirIter : *d_subdirs) {
+        subdirDigests.push_back(subdirIter.second.to_digest(digestMap));
+    }
+
+    // Write the Directory message directly rather than building one and
+    // serializing it
+    static thread_local std::string blob;
+    DirectoryEncoder encoder(&blob);
 
     // files
     for (const auto &fileIter : d_files) {
-        *directoryMessage.add_files() =
-            fileIter.second->getFileNode(fileIter.first);
-    }
-
-    // symlinks
-    for (const auto &symlinkIter : d_symlinks) {
-        proto::SymlinkNode symlinkNode;
-        symlinkNode.set_name(symlinkIter.first);
-        symlinkNode.set_target(symlinkIter.second);
-        *directoryMessage.add_symlinks() = symlinkNode;
+        encoder.addFile(fileIter.first, fileIter.second->getDigest(),
+                        fileIter.second->isExecutable());
     }
 
     // directories
+    auto subdirDigestIter = subdirDigests.cbegin();
     for (const auto &subdirIter : *d_subdirs) {
-        auto subdirNode = directoryMessage.add_directories();
-        subdirNode->set_name(subdirIter.first);
-        auto subdirDigest = subdirIter.second.to_digest(digestMap);
-        *subdirNode->mutable_digest() = subdirDigest;
+        encoder.addDirectory(subdirIter.first, *subdirDigestIter++);
+    }
+
+    // symlinks
+    for (const auto &symlinkIter : d_symlinks) {
+        encoder.addSymlink(symlinkIter.first, symlinkIter.second);
     }
 
-    const auto blob = directoryMessage.SerializeAsString();
     const auto digest = DigestGenerator::make_digest(blob);
 
     if (digestMap != nullptr) {
@@ -17,7 +17,9 @@
 
 #include <buildboxcommon_fileutils.h>
 
+#include <compactdigest.h>
 #include <env.h>
+#include <pathtable.h>
 #include <protos.h>
 #include <reccfile.h>
 
@@ -30,8 +32,6 @@
 namespace BloombergLP {
 namespace recc {
 
-typedef std::unordered_map<proto::Digest, std::string> digest_string_umap;
-
 /**
  * Represents a directory that, optionally, has other directories inside.
  */
@@ -57,6 +57,15 @@ struct NestedDirectory {
     void add(std::shared_ptr<ReccFile> file, const char *relativePath,
              bool checkedPrefix = false);
 
+    /**
+     * Add the given File to this NestedDirectory at the given path from
+     * the given table, taken relative to this directory even if it is
+     * absolute. No path replacement is done. Paths without segments are
+     * ignored.
+     */
+    void add(std::shared_ptr<ReccFile> file, const PathTable &paths,
+             PathTable::PathId path);
+
     /**
      * Add the given symlink to this NestedDirectory at the given relative
      * path, which may include subdirectories
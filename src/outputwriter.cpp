@@ -0,0 +1,199 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <outputwriter.h>
+
+#include <digestgenerator.h>
+#include <digesttable.h>
+#include <fileutils.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_logging.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace BloombergLP {
+namespace recc {
+
+namespace {
+
+[[noreturn]] void throwError(const std::string &operation,
+                             const std::string &path, int error)
+{
+    std::ostringstream oss;
+    oss << "error in " << operation << " for path \"" << path << "\""
+        << ", errno = [" << error << ":" << strerror(error) << "]";
+    BUILDBOX_LOG_ERROR(oss.str());
+    throw std::system_error(error, std::system_category(), oss.str());
+}
+
+std::string temporaryPath(const std::string &path)
+{
+    // Unique across the threads of this process, and across processes
+    static std::atomic<unsigned> counter(0);
+    return path + ".recc-tmp." + std::to_string(getpid()) + "." +
+           std::to_string(counter++);
+}
+
+void writeAll(int fd, const std::string &contents,
+              const std::string &path)
+{
+    const char *data = contents.data();
+    size_t remaining = contents.size();
+    while (remaining > 0) {
+        const ssize_t written = ::write(fd, data, remaining);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throwError("write", path, errno);
+        }
+        data += written;
+        remaining -= static_cast<size_t>(written);
+    }
+}
+
+proto::Digest digestFile(const std::string &path,
+                         const struct stat &statResult)
+{
+    DigestTable *table = DigestTable::instance();
+    const FileIdentity identity = FileIdentity::fromStat(statResult);
+    proto::Digest digest;
+    if (table != nullptr && table->lookup(identity, &digest)) {
+        return digest;
+    }
+
+    digest = DigestGenerator::make_digest(
+        FileUtils::getFileContents(path, statResult));
+
+    // Only publish the digest if the file didn't change while it was read
+    struct stat statAfterReading;
+    if (table != nullptr && DigestTable::isSettled(statResult) &&
+        lstat(path.c_str(), &statAfterReading) == 0 &&
+        FileIdentity::fromStat(statAfterReading) == identity) {
+        table->publish(identity, digest);
+    }
+    return digest;
+}
+
+} // namespace
+
+OutputWriter::OutputWriter(const std::string &root) : d_root(root) {}
+
+void OutputWriter::createParentDirectory(const std::string &path)
+{
+    const auto slash = path.rfind('/');
+    if (slash == std::string::npos || slash == 0) {
+        return;
+    }
+    const std::string directory = path.substr(0, slash);
+
+    {
+        std::lock_guard<std::mutex> lock(d_directoriesMutex);
+        if (d_directories.count(directory)) {
+            return;
+        }
+    }
+
+    FileUtils::createDirectoryRecursive(
+        buildboxcommon::FileUtils::normalizePath(directory.c_str()));
+
+    std::lock_guard<std::mutex> lock(d_directoriesMutex);
+    d_directories.insert(directory);
+}
+
+void OutputWriter::write(const std::string &path, const std::string &contents,
+                         bool executable)
+{
+    const std::string fullPath = d_root + "/" + path;
+    BUILDBOX_LOG_DEBUG("Writing " << fullPath);
+    createParentDirectory(fullPath);
+
+    // The mode is subject to the umask, like that of any other new file.
+    const std::string tempPath = temporaryPath(fullPath);
+    const mode_t mode = executable ? 0777 : 0666;
+    const int fd =
+        open(tempPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+    if (fd < 0) {
+        throwError("open", tempPath, errno);
+    }
+
+    try {
+        writeAll(fd, contents, tempPath);
+    }
+    catch (...) {
+        close(fd);
+        unlink(tempPath.c_str());
+        throw;
+    }
+    if (close(fd) != 0) {
+        const int error = errno;
+        unlink(tempPath.c_str());
+        throwError("close", tempPath, error);
+    }
+
+    if (rename(tempPath.c_str(), fullPath.c_str()) != 0) {
+        const int error = errno;
+        unlink(tempPath.c_str());
+        throwError("rename", fullPath, error);
+    }
+}
+
+bool OutputWriter::isUpToDate(const std::string &path,
+                              const proto::Digest &digest, bool executable,
+                              bool touch) const
+{
+    const std::string fullPath = d_root + "/" + path;
+    struct stat statResult;
+    if (lstat(fullPath.c_str(), &statResult) != 0 ||
+        !S_ISREG(statResult.st_mode) ||
+        static_cast<int64_t>(statResult.st_size) != digest.size_bytes() ||
+        FileUtils::isExecutable(statResult) != executable) {
+        return false;
+    }
+
+    try {
+        const proto::Digest existingDigest =
+            digestFile(fullPath, statResult);
+        if (existingDigest.hash() != digest.hash()) {
+            return false;
+        }
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_DEBUG("Could not read " << fullPath << ": " << e.what());
+        return false;
+    }
+
+    if (touch && utimensat(AT_FDCWD, fullPath.c_str(), nullptr, 0) != 0) {
+        BUILDBOX_LOG_WARNING("Could not update the modification time of "
+                             << fullPath << ", errno = [" << errno << ":"
+                             << strerror(errno) << "]");
+        return false;
+    }
+
+    BUILDBOX_LOG_DEBUG(fullPath << " is up to date");
+    return true;
+}
+
+} // namespace recc
+} // namespace BloombergLP
@@ -0,0 +1,77 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef INCLUDED_OUTPUTWRITER
+#define INCLUDED_OUTPUTWRITER
+
+#include <protos.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+namespace BloombergLP {
+namespace recc {
+
+/**
+ * Writes output files below a root directory.
+ *
+ * Each file is written to a temporary file in its directory, created with
+ * its final permissions, and then renamed over its path. A build that
+ * reads the output, or a crash during the write, never sees a partial
+ * file. Directories that have been created are remembered, so each one is
+ * only created once.
+ *
+ * `write()` can be called from several threads at once.
+ */
+class OutputWriter {
+  public:
+    explicit OutputWriter(const std::string &root = ".");
+
+    /**
+     * Write the given contents to the given path, relative to the root,
+     * creating any missing parent directories.
+     *
+     * Throws `std::system_error` on failure, leaving no temporary file
+     * behind.
+     */
+    void write(const std::string &path, const std::string &contents,
+               bool executable);
+
+    /**
+     * Return true if the given path, relative to the root, is already a
+     * regular file with the given digest and executable bit, so that it
+     * doesn't need to be written. Its digest is looked up in the
+     * `DigestTable` if there is one.
+     *
+     * If `touch` is true, the modification time of a file that is up to
+     * date is set to the current time. If that fails, false is returned
+     * so that the file is written instead.
+     */
+    bool isUpToDate(const std::string &path, const proto::Digest &digest,
+                    bool executable, bool touch) const;
+
+  private:
+    void createParentDirectory(const std::string &path);
+
+    std::string d_root;
+    std::mutex d_directoriesMutex;
+    std::unordered_set<std::string> d_directories;
+};
+
+} // namespace recc
+} // namespace BloombergLP
+
+#endif
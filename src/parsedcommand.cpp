@@ -15,6 +15,7 @@
 #include <compilerdefaults.h>
 #include <env.h>
 #include <parsedcommand.h>
+#include <toolchainprobe.h>
 
 namespace BloombergLP {
 namespace recc {
@@ -22,7 +23,9 @@ namespace recc {
 ParsedCommand::ParsedCommand(const std::string &command)
     : d_compilerCommand(false), d_isClang(false),
       d_producesSunMakeRules(false), d_containsUnsupportedOptions(false),
-      d_dependencyFileAIX(nullptr)
+      d_writesDependencyFile(false),
+      d_dependencyFileOmitsSystemHeaders(false), d_usesResponseFiles(false),
+      d_nextArgument(0), d_dependencyFileAIX(nullptr)
 {
     if (command.empty()) {
         return;
@@ -33,9 +36,10 @@ ParsedCommand::ParsedCommand(const std::string &command)
         d_defaultDepsCommand = SupportedCompilers::GccDefaultDeps;
         if (d_compiler == "clang" || d_compiler == "clang++") {
             d_isClang = true;
-            if (RECC_DEPS_GLOBAL_PATHS) {
+            if (RECC_DEPS_GLOBAL_PATHS && !ToolchainProbe::cacheEnabled()) {
                 // Clang mentions where it found crtbegin.o in
-                // stderr with this flag.
+                // stderr with this flag. (With RECC_CACHE_TOOLCHAINS, it
+                // is looked up by probing the compiler once instead.)
                 d_defaultDepsCommand.push_back("-v");
             }
         }
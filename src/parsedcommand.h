@@ -16,7 +16,6 @@
 #define INCLUDED_PARSEDCOMMAND
 
 #include <buildboxcommon_temporaryfile.h>
-#include <list>
 #include <set>
 #include <string>
 #include <vector>
@@ -35,6 +34,9 @@ class ParsedCommand {
     ParsedCommand()
         : d_compilerCommand(false), d_isClang(false),
           d_producesSunMakeRules(false), d_containsUnsupportedOptions(false),
+          d_writesDependencyFile(false),
+          d_dependencyFileOmitsSystemHeaders(false),
+          d_usesResponseFiles(false), d_nextArgument(0),
           d_dependencyFileAIX(nullptr)
     {
     }
@@ -58,14 +60,14 @@ class ParsedCommand {
      * Returns the original command that was passed to the constructor,
      * with absolute paths replaced with equivalent relative paths.
      */
-    std::vector<std::string> get_command() const { return d_command; }
+    const std::vector<std::string> &get_command() const { return d_command; }
 
     /**
      * Return a command that prints this command's dependencies in Makefile
      * format. If this command is not a supported compiler command, the
      * result is undefined.
      */
-    std::vector<std::string> get_dependencies_command() const
+    const std::vector<std::string> &get_dependencies_command() const
     {
         return d_dependenciesCommand;
     }
@@ -73,7 +75,7 @@ class ParsedCommand {
     /**
      * Return compiler basename specified from the command.
      */
-    std::string get_compiler() const { return d_compiler; }
+    const std::string &get_compiler() const { return d_compiler; }
 
     /**
      * Return the name of the file the compiler will write the source
@@ -97,7 +99,32 @@ class ParsedCommand {
      * (For example, if no output files are specified, many compilers will
      * write to a.out by default.)
      */
-    std::set<std::string> get_products() const { return d_commandProducts; }
+    const std::set<std::string> &get_products() const
+    {
+        return d_commandProducts;
+    }
+
+    /**
+     * Return the local path of the Makefile-format dependency file that the
+     * compiler writes as a side effect of this command (e.g. via -MD or
+     * -MMD), or an empty string if the command doesn't write one.
+     */
+    std::string get_dependency_file() const
+    {
+        if (!d_writesDependencyFile) {
+            return "";
+        }
+        return d_dependencyFile;
+    }
+
+    /**
+     * Returns true if the dependency file written by this command leaves out
+     * system headers (-MMD).
+     */
+    bool dependency_file_omits_system_headers() const
+    {
+        return d_dependencyFileOmitsSystemHeaders;
+    }
 
     /**
      * If true, the dependencies command will produce nonstandard Sun-style
@@ -106,6 +133,12 @@ class ParsedCommand {
      */
     bool produces_sun_make_rules() const { return d_producesSunMakeRules; }
 
+    /**
+     * Returns true if the original command had `@file` arguments. The
+     * arguments of the parsed command are those read from the files.
+     */
+    bool uses_response_files() const { return d_usesResponseFiles; }
+
     /**
      * Converts a command path (e.g. "/usr/bin/gcc-4.7") to a command name
      * (e.g. "gcc")
@@ -116,13 +149,22 @@ class ParsedCommand {
     bool d_isClang;
     bool d_producesSunMakeRules;
     bool d_containsUnsupportedOptions;
+    bool d_writesDependencyFile;
+    bool d_dependencyFileOmitsSystemHeaders;
+    bool d_usesResponseFiles;
     std::string d_compiler;
-    std::list<std::string> d_originalCommand;
+    // The arguments of the command, including any read from response files.
+    // They are parsed in place; `d_nextArgument` is the index of the first
+    // one that hasn't been parsed yet.
+    std::vector<std::string> d_originalCommand;
+    size_t d_nextArgument;
     std::vector<std::string> d_defaultDepsCommand;
     std::vector<std::string> d_preProcessorOptions;
     std::vector<std::string> d_command;
     std::vector<std::string> d_dependenciesCommand;
     std::set<std::string> d_commandProducts;
+    std::string d_outputFile;
+    std::string d_dependencyFile;
     std::unique_ptr<buildboxcommon::TemporaryFile> d_dependencyFileAIX;
 };
 
@@ -16,11 +16,16 @@
 
 #include <compilerdefaults.h>
 #include <fileutils.h>
+#include <responsefile.h>
 
 #include <buildboxcommon_exception.h>
 #include <buildboxcommon_fileutils.h>
 #include <buildboxcommon_logging.h>
 
+#include <algorithm>
+#include <cctype>
+#include <iterator>
+
 namespace BloombergLP {
 namespace recc {
 
@@ -130,6 +135,32 @@ static const ParsedCommandFactory::CompilerOptionToFuncMapType AixRules = {
      ParsedCommandModifiers::parseOptionIsUnsupported},
 };
 
+namespace {
+
+bool isSpace(char character)
+{
+    return isspace(static_cast<unsigned char>(character)) != 0;
+}
+
+const CompilerOptionMatcher &gccPreprocessorMatcher()
+{
+    static const CompilerOptionMatcher matcher(GccPreprocessorRules);
+    return matcher;
+}
+
+bool hasArgument(const ParsedCommand &command)
+{
+    return command.d_nextArgument < command.d_originalCommand.size();
+}
+
+// The first argument that hasn't been parsed yet
+const std::string &currentArgument(const ParsedCommand &command)
+{
+    return command.d_originalCommand[command.d_nextArgument];
+}
+
+} // namespace
+
 ParsedCommand ParsedCommandFactory::createParsedCommand(
     const std::vector<std::string> &command,
     const std::string &workingDirectory)
@@ -143,29 +174,23 @@ ParsedCommand ParsedCommandFactory::createParsedCommand(
     // certain type.
     ParsedCommand parsedCommand(command[0]);
 
-    // Get the map that maps compilers to options maps.
-    const auto &parsedCommandMap =
-        ParsedCommandModifiers::getParsedCommandMap();
-
-    // Create a list from the vector.
-    parsedCommand.d_originalCommand.insert(
-        parsedCommand.d_originalCommand.begin(), command.begin(),
-        command.end());
-
-    // Map containing options corresponding to compiler passed in.
-    CompilerOptionToFuncMapType optionToUse;
-
-    // Find the options map that corresponds to the compiler.
-    for (const auto &val : parsedCommandMap) {
-        auto it = val.first.find(parsedCommand.d_compiler);
-        if (it != val.first.end()) {
-            optionToUse = val.second;
-            break;
-        }
+    // Parse the arguments in any response files in their place. Other
+    // compilers (e.g. Sun's and AIX's) don't read `@file` arguments.
+    if (SupportedCompilers::Gcc.count(parsedCommand.d_compiler) > 0) {
+        parsedCommand.d_originalCommand = ResponseFile::expand(
+            command, workingDirectory, parsedCommand.is_clang(),
+            &parsedCommand.d_usesResponseFiles);
+    }
+    else {
+        parsedCommand.d_originalCommand = command;
     }
 
-    // Parse and construct the command, and deps command vector.
-    parseCommand(&parsedCommand, optionToUse, workingDirectory);
+    // Parse and construct the command, and deps command vector, with the
+    // options corresponding to the compiler.
+    parseCommand(&parsedCommand,
+                 ParsedCommandModifiers::getCompilerOptionMatcher(
+                     parsedCommand.d_compiler),
+                 workingDirectory);
 
     // If unsupported options, set compile command to false, and return the
     // constructed parsedCommand.
@@ -181,12 +206,10 @@ ParsedCommand ParsedCommandFactory::createParsedCommand(
         ParsedCommand preprocessorCommand;
         // Set preprecessor command to that created from parsing original
         // command, so it can be parsed.
-        preprocessorCommand.d_originalCommand.insert(
-            preprocessorCommand.d_originalCommand.begin(),
-            parsedCommand.d_preProcessorOptions.begin(),
-            parsedCommand.d_preProcessorOptions.end());
+        preprocessorCommand.d_originalCommand =
+            parsedCommand.d_preProcessorOptions;
 
-        parseCommand(&preprocessorCommand, GccPreprocessorRules,
+        parseCommand(&preprocessorCommand, gccPreprocessorMatcher(),
                      workingDirectory);
 
         for (const auto &preproArg : preprocessorCommand.d_command) {
@@ -203,6 +226,35 @@ ParsedCommand ParsedCommandFactory::createParsedCommand(
         for (const auto &preproArg : preprocessorCommand.d_commandProducts) {
             parsedCommand.d_commandProducts.insert(preproArg);
         }
+
+        if (preprocessorCommand.d_writesDependencyFile) {
+            parsedCommand.d_writesDependencyFile = true;
+            parsedCommand.d_dependencyFileOmitsSystemHeaders =
+                preprocessorCommand.d_dependencyFileOmitsSystemHeaders;
+        }
+        if (!preprocessorCommand.d_dependencyFile.empty()) {
+            parsedCommand.d_dependencyFile =
+                preprocessorCommand.d_dependencyFile;
+        }
+    }
+
+    // With -MD/-MMD and no -MF, the compiler writes the dependency file next
+    // to the object file, replacing its suffix with ".d". Request it as an
+    // output so that it is available locally after a remote build.
+    if (parsedCommand.d_writesDependencyFile &&
+        parsedCommand.d_dependencyFile.empty() &&
+        !parsedCommand.d_outputFile.empty()) {
+        const auto &output = parsedCommand.d_outputFile;
+        const auto dot = output.rfind('.');
+        const auto slash = output.rfind('/');
+        const bool hasSuffix =
+            dot != std::string::npos &&
+            (slash == std::string::npos || dot > slash + 1);
+        parsedCommand.d_dependencyFile =
+            (hasSuffix ? output.substr(0, dot) : output) + ".d";
+        parsedCommand.d_commandProducts.insert(
+            ParsedCommandModifiers::modifyRemotePath(
+                parsedCommand.d_dependencyFile, workingDirectory));
     }
 
     // Insert default deps options into newly constructed parsedCommand deps
@@ -214,12 +266,6 @@ ParsedCommand ParsedCommandFactory::createParsedCommand(
         parsedCommand.d_defaultDepsCommand.begin(),
         parsedCommand.d_defaultDepsCommand.end());
 
-    // d_originalCommand gets modified during the parsing of the
-    // command-> Reset it.
-    parsedCommand.d_originalCommand.insert(
-        parsedCommand.d_originalCommand.begin(), command.begin(),
-        command.end());
-
     return parsedCommand;
 }
 
@@ -237,21 +283,21 @@ ParsedCommand ParsedCommandFactory::createParsedCommand(
 }
 
 void ParsedCommandFactory::parseCommand(
-    ParsedCommand *command, const CompilerOptionToFuncMapType &options,
+    ParsedCommand *command, const CompilerOptionMatcher &options,
     const std::string &workingDirectory)
 {
     // Iterate through the options map, comparing the options in the
     // command to each option, if matching, applying the coresponding option
     // function.
-    while (!command->d_originalCommand.empty()) {
-        const auto &curr_val = command->d_originalCommand.front();
+    while (hasArgument(*command)) {
+        const auto &curr_val = currentArgument(*command);
 
-        const auto &optionModifier =
+        const auto *optionModifier =
             ParsedCommandModifiers::matchCompilerOptions(curr_val, options);
 
-        if (optionModifier.second) {
-            optionModifier.second(command, workingDirectory,
-                                  optionModifier.first);
+        if (optionModifier != nullptr && optionModifier->d_function) {
+            optionModifier->d_function(command, workingDirectory,
+                                       optionModifier->d_option);
         }
         else {
             const std::string replacedPath =
@@ -259,7 +305,7 @@ void ParsedCommandFactory::parseCommand(
                                                          workingDirectory);
             command->d_command.push_back(replacedPath);
             command->d_dependenciesCommand.push_back(curr_val);
-            command->d_originalCommand.pop_front();
+            ++command->d_nextArgument;
         }
     } // end while
 }
@@ -284,49 +330,120 @@ ParsedCommandFactory::vectorFromArgv(const char *const *argv)
     return result;
 }
 
-std::pair<std::string, std::function<void(ParsedCommand *, const std::string &,
-                                          const std::string &)>>
-ParsedCommandModifiers::matchCompilerOptions(
-    const std::string &option,
+CompilerOptionMatcher::CompilerOptionMatcher() : d_nodes(1) {}
+
+CompilerOptionMatcher::CompilerOptionMatcher(
     const ParsedCommandFactory::CompilerOptionToFuncMapType &options)
+    : d_nodes(1)
 {
-    auto tempOption = option;
+    for (const auto &option : options) {
+        size_t node = 0;
+        for (const char character : option.first) {
+            auto &children = d_nodes[node].d_children;
+            auto it = std::lower_bound(
+                children.begin(), children.end(), character,
+                [](const std::pair<char, size_t> &entry, char value) {
+                    return entry.first < value;
+                });
+            if (it == children.end() || it->first != character) {
+                it = children.emplace(it, character, d_nodes.size());
+                // Invalidates `children`
+                d_nodes.emplace_back();
+            }
+            node = it->second;
+        }
+        d_nodes[node].d_rule = static_cast<int>(d_rules.size());
+        d_rules.push_back(Rule{option.first, option.second});
+    }
+}
 
-    if (!tempOption.empty() && tempOption.front() == '-') {
+size_t CompilerOptionMatcher::child(size_t node, char character) const
+{
+    // Nodes have a handful of children at most
+    for (const auto &entry : d_nodes[node].d_children) {
+        if (entry.first == character) {
+            return entry.second;
+        }
+    }
+    return 0;
+}
 
-        // Check for an equal sign, if any, return left side.
-        tempOption = tempOption.substr(0, tempOption.find("="));
+int CompilerOptionMatcher::find(const std::string &option) const
+{
+    size_t node = 0;
+    for (const char character : option) {
+        node = child(node, character);
+        if (node == 0) {
+            return -1;
+        }
+    }
+    return d_nodes[node].d_rule;
+}
 
-        // First try finding an exact match, removing and parsing until an
-        // equal sign. Remove any spaces from the option.
-        tempOption.erase(
-            remove_if(tempOption.begin(), tempOption.end(), ::isspace),
-            tempOption.end());
+const CompilerOptionMatcher::Rule *
+CompilerOptionMatcher::match(const std::string &option) const
+{
+    if (option.empty() || option.front() != '-') {
+        return nullptr;
+    }
 
-        if (options.count(tempOption) > 0) {
-            return std::make_pair(tempOption, options.at(tempOption));
-        }
+    // The part of the option before any equal sign, which is compared with
+    // whitespace removed
+    const size_t keyLength = std::min(option.find('='), option.size());
+    const auto keyEnd =
+        option.begin() + static_cast<std::string::difference_type>(keyLength);
+    const bool keyHasSpace = std::any_of(option.begin(), keyEnd, isSpace);
+
+    int exactMatch = -1;
+    if (keyHasSpace) {
+        std::string key(option.begin(), keyEnd);
+        key.erase(std::remove_if(key.begin(), key.end(), isSpace), key.end());
+        exactMatch = find(key);
+    }
 
-        // Second, try a substring search, iterating through all the
-        // options in the map.
-        for (const auto &option_map_val : options) {
-            const auto val = option.substr(0, option_map_val.first.length());
-            if (val == option_map_val.first) {
-                return std::make_pair(option_map_val.first,
-                                      option_map_val.second);
+    // Walk along the option, keeping track of the longest rule that it
+    // starts with
+    int longestMatch = -1;
+    size_t node = 0;
+    for (size_t i = 0;; ++i) {
+        const int rule = d_nodes[node].d_rule;
+        if (rule >= 0) {
+            longestMatch = rule;
+            if (i == keyLength && !keyHasSpace) {
+                exactMatch = rule;
             }
         }
+        if (i == option.size()) {
+            break;
+        }
+        node = child(node, option[i]);
+        if (node == 0) {
+            break;
+        }
     }
 
-    return std::make_pair("", nullptr);
+    const int result = exactMatch >= 0 ? exactMatch : longestMatch;
+    return result >= 0 ? &d_rules[static_cast<size_t>(result)] : nullptr;
+}
+
+const CompilerOptionMatcher::Rule *
+ParsedCommandModifiers::matchCompilerOptions(
+    const std::string &option, const CompilerOptionMatcher &options)
+{
+    return options.match(option);
 }
 
 void ParsedCommandModifiers::parseInterfersWithDepsOption(
-    ParsedCommand *command, const std::string &, const std::string &)
+    ParsedCommand *command, const std::string &, const std::string &option)
 {
+    if (option == "-MD" || option == "-MMD") {
+        command->d_writesDependencyFile = true;
+        command->d_dependencyFileOmitsSystemHeaders = (option == "-MMD");
+    }
+
     // Only push back to command vector.
-    command->d_command.push_back(command->d_originalCommand.front());
-    command->d_originalCommand.pop_front();
+    command->d_command.push_back(currentArgument(*command));
+    ++command->d_nextArgument;
 }
 
 void ParsedCommandModifiers::parseIsInputPathOption(
@@ -356,13 +473,43 @@ void ParsedCommandModifiers::parseOptionRedirectsOutput(
     ParsedCommand *command, const std::string &workingDirectory,
     const std::string &option)
 {
+    // Keep track of the local paths of the object and dependency files, as
+    // written by the compiler when run on this machine.
+    const auto &val = currentArgument(*command);
+    std::string localPath;
+    if (val == option) {
+        const size_t next = command->d_nextArgument + 1;
+        if (next < command->d_originalCommand.size()) {
+            localPath = command->d_originalCommand[next];
+        }
+    }
+    else {
+        const auto equalPos = val.find('=');
+        localPath = (equalPos != std::string::npos)
+                        ? val.substr(equalPos + 1)
+                        : val.substr(option.size());
+    }
+
+    if (option == "-o") {
+        command->d_outputFile = localPath;
+    }
+    else if (option == "-MF") {
+        command->d_dependencyFile = localPath;
+    }
+    else if (option == "-MD" || option == "-MMD") {
+        // Preprocessor form, e.g. `-Wp,-MD,path`
+        command->d_dependencyFile = localPath;
+        command->d_writesDependencyFile = true;
+        command->d_dependencyFileOmitsSystemHeaders = (option == "-MMD");
+    }
+
     gccOptionModifier(command, workingDirectory, option, false, true);
 }
 
 void ParsedCommandModifiers::parseIsPreprocessorArgOption(
     ParsedCommand *command, const std::string &, const std::string &option)
 {
-    auto val = command->d_originalCommand.front();
+    const auto &val = currentArgument(*command);
     if (option == "-Wp,") {
         // parse comma separated list of args, and store in
         // commands preprocessor vector.
@@ -371,12 +518,14 @@ void ParsedCommandModifiers::parseIsPreprocessorArgOption(
     }
     else if (option == "-Xpreprocessor") {
         // push back next arg
-        command->d_originalCommand.pop_front();
-        command->d_preProcessorOptions.push_back(
-            command->d_originalCommand.front());
+        ++command->d_nextArgument;
+        if (hasArgument(*command)) {
+            command->d_preProcessorOptions.push_back(
+                currentArgument(*command));
+        }
     }
 
-    command->d_originalCommand.pop_front();
+    ++command->d_nextArgument;
 }
 
 void ParsedCommandModifiers::parseOptionIsUnsupported(ParsedCommand *command,
@@ -386,23 +535,25 @@ void ParsedCommandModifiers::parseOptionIsUnsupported(ParsedCommand *command,
     command->d_containsUnsupportedOptions = true;
 
     // append the rest of the command and deps command vector.
+    const auto rest = command->d_originalCommand.begin() +
+                      static_cast<std::vector<std::string>::difference_type>(
+                          command->d_nextArgument);
     command->d_dependenciesCommand.insert(command->d_dependenciesCommand.end(),
-                                          command->d_originalCommand.begin(),
+                                          rest,
                                           command->d_originalCommand.end());
 
-    command->d_command.insert(command->d_command.end(),
-                              command->d_originalCommand.begin(),
+    command->d_command.insert(command->d_command.end(), rest,
                               command->d_originalCommand.end());
 
-    // clear the original command so parsing stops.
-    command->d_originalCommand.clear();
+    // skip the rest of the original command so parsing stops.
+    command->d_nextArgument = command->d_originalCommand.size();
 }
 
 void ParsedCommandModifiers::gccOptionModifier(
     ParsedCommand *command, const std::string &workingDirectory,
     const std::string &option, bool toDeps, bool isOutput)
 {
-    auto val = command->d_originalCommand.front();
+    const auto &val = currentArgument(*command);
     // Space between option and input path (-I /usr/bin/include)
     if (val == option) {
         ParsedCommandModifiers::appendAndRemoveOption(
@@ -437,7 +588,7 @@ void ParsedCommandModifiers::gccOptionModifier(
                                                      optionPath);
         }
 
-        command->d_originalCommand.pop_front();
+        ++command->d_nextArgument;
     }
 }
 
@@ -445,7 +596,12 @@ void ParsedCommandModifiers::appendAndRemoveOption(
     ParsedCommand *command, const std::string &workingDirectory, bool isPath,
     bool toDeps, bool isOutput)
 {
-    auto option = command->d_originalCommand.front();
+    // The option may be missing its path at the end of the command
+    if (!hasArgument(*command)) {
+        return;
+    }
+
+    const auto &option = currentArgument(*command);
     if (isPath) {
 
         const std::string replacedPath =
@@ -470,8 +626,8 @@ void ParsedCommandModifiers::appendAndRemoveOption(
         }
     }
 
-    // Remove from original_command
-    command->d_originalCommand.pop_front();
+    // Move on to the next argument
+    ++command->d_nextArgument;
 }
 
 std::string
@@ -502,15 +658,30 @@ void ParsedCommandModifiers::parseStageOptionList(
     result->push_back(current);
 }
 
-ParsedCommandFactory::CompilerOptionToParsingFunctionMap
-ParsedCommandModifiers::getParsedCommandMap()
+const CompilerOptionMatcher &
+ParsedCommandModifiers::getCompilerOptionMatcher(const std::string &compiler)
 {
-    return {
-        {SupportedCompilers::Gcc, GccRules},
-        {SupportedCompilers::GccPreprocessor, GccPreprocessorRules},
-        {SupportedCompilers::SunCPP, SunCPPRules},
-        {SupportedCompilers::AIX, AixRules},
-    };
+    static const CompilerOptionMatcher gccMatcher(GccRules);
+    static const CompilerOptionMatcher sunCppMatcher(SunCPPRules);
+    static const CompilerOptionMatcher aixMatcher(AixRules);
+    static const CompilerOptionMatcher emptyMatcher;
+
+    static const std::vector<std::pair<
+        const SupportedCompilers::CompilerListType *,
+        const CompilerOptionMatcher *>>
+        matchers = {
+            {&SupportedCompilers::Gcc, &gccMatcher},
+            {&SupportedCompilers::GccPreprocessor, &gccPreprocessorMatcher()},
+            {&SupportedCompilers::SunCPP, &sunCppMatcher},
+            {&SupportedCompilers::AIX, &aixMatcher},
+        };
+
+    for (const auto &entry : matchers) {
+        if (entry.first->count(compiler) > 0) {
+            return *entry.second;
+        }
+    }
+    return emptyMatcher;
 }
 
 } // namespace recc
@@ -18,7 +18,6 @@
 #include <compilerdefaults.h>
 #include <functional>
 #include <initializer_list>
-#include <list>
 #include <map>
 #include <memory>
 #include <parsedcommand.h>
@@ -31,6 +30,8 @@
 namespace BloombergLP {
 namespace recc {
 
+class CompilerOptionMatcher;
+
 class ParsedCommandFactory {
   public:
     /**
@@ -42,13 +43,6 @@ class ParsedCommandFactory {
                                         const std::string &)>,
                      std::greater<std::string>>
         CompilerOptionToFuncMapType;
-    /**
-     * An unordered_map from a set of strings to a CompilerOptionToFuncMapType.
-     */
-    typedef std::unordered_map<SupportedCompilers::CompilerListType,
-                               CompilerOptionToFuncMapType,
-                               CompilerListTypeHasher>
-        CompilerOptionToParsingFunctionMap;
 
     /**
      * Default overloaded factory methods for creating a parsedCommand.
@@ -77,12 +71,66 @@ class ParsedCommandFactory {
      * This method modifies the state of the passed in ParsedCommand object.
      */
     static void parseCommand(ParsedCommand *command,
-                             const CompilerOptionToFuncMapType &options,
+                             const CompilerOptionMatcher &options,
                              const std::string &workingDirectory);
 
     ParsedCommandFactory() = delete;
 };
 
+/**
+ * Matches command options against the options in a
+ * CompilerOptionToFuncMapType, as described in
+ * ParsedCommandModifiers::matchCompilerOptions().
+ *
+ * The options are kept in a trie, so that a match takes a single walk along
+ * the command option and doesn't allocate (unless the option contains
+ * whitespace before any equal sign).
+ */
+class CompilerOptionMatcher {
+  public:
+    struct Rule {
+        std::string d_option;
+        ParsedCommandFactory::CompilerOptionToFuncMapType::mapped_type
+            d_function;
+    };
+
+    /**
+     * Construct a matcher that matches nothing.
+     */
+    CompilerOptionMatcher();
+
+    explicit CompilerOptionMatcher(
+        const ParsedCommandFactory::CompilerOptionToFuncMapType &options);
+
+    /**
+     * Return the rule for the given command option, or nullptr if there is
+     * none.
+     */
+    const Rule *match(const std::string &option) const;
+
+  private:
+    struct Node {
+        // Sorted by character
+        std::vector<std::pair<char, size_t>> d_children;
+        // Index in d_rules of the option ending here, or -1
+        int d_rule = -1;
+    };
+
+    /**
+     * Return the node reached by following the given character from the
+     * given node, or 0 (the root, which is never a child) if there is none.
+     */
+    size_t child(size_t node, char character) const;
+
+    /**
+     * Return the index of the rule for exactly the given option, or -1.
+     */
+    int find(const std::string &option) const;
+
+    std::vector<Rule> d_rules;
+    std::vector<Node> d_nodes;
+};
+
 struct ParsedCommandModifiers {
 
     static void
@@ -117,15 +165,15 @@ struct ParsedCommandModifiers {
                                          const std::string &option);
     /**
      * Match command option passed in, to compiler options in compiler option
-     * map. Return a pair including the function or an empty function depending
-     * on if there was a match.
+     * map. Return the matching rule, or nullptr if there was no match.
+     *
+     * An option matches the rule for the part of it before any equal sign,
+     * with whitespace removed. Failing that, it matches the rule for the
+     * longest option that it starts with.
      */
-    static std::pair<std::string,
-                     std::function<void(ParsedCommand *, const std::string &,
-                                        const std::string &)>>
-    matchCompilerOptions(
-        const std::string &option,
-        const ParsedCommandFactory::CompilerOptionToFuncMapType &options);
+    static const CompilerOptionMatcher::Rule *
+    matchCompilerOptions(const std::string &option,
+                         const CompilerOptionMatcher &options);
 
     /**
      * This helper deals with gcc options parsing, which can have a space after
@@ -160,10 +208,11 @@ struct ParsedCommandModifiers {
                                      std::vector<std::string> *result);
 
     /**
-     * Constructs and returns a CompilerOptionToParsingFunctionMap.
+     * Return the matcher for the options of the given compiler, which
+     * matches nothing if the compiler isn't supported.
      */
-    static ParsedCommandFactory::CompilerOptionToParsingFunctionMap
-    getParsedCommandMap();
+    static const CompilerOptionMatcher &
+    getCompilerOptionMatcher(const std::string &compiler);
 };
 
 } // namespace recc
@@ -0,0 +1,167 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <pathprefixmatcher.h>
+
+#include <algorithm>
+
+namespace BloombergLP {
+namespace recc {
+
+namespace {
+
+const size_t NoNode = static_cast<size_t>(-1);
+
+struct Segment {
+    const char *d_data;
+    size_t d_length;
+};
+
+int compare(const std::string &name, const Segment &segment)
+{
+    return name.compare(0, std::string::npos, segment.d_data,
+                        segment.d_length);
+}
+
+template <typename EntryType>
+typename std::vector<EntryType>::const_iterator
+findEntry(const std::vector<EntryType> &entries, const Segment &segment)
+{
+    const auto it = std::lower_bound(
+        entries.cbegin(), entries.cend(), segment,
+        [](const EntryType &entry, const Segment &value) {
+            return compare(entry.first, value) < 0;
+        });
+    if (it != entries.cend() && compare(it->first, segment) == 0) {
+        return it;
+    }
+    return entries.cend();
+}
+
+void keepFirst(int *current, int prefix)
+{
+    if (*current < 0 || prefix < *current) {
+        *current = prefix;
+    }
+}
+
+} // namespace
+
+PathPrefixMatcher::PathPrefixMatcher() : d_nodes(1), d_size(0) {}
+
+void PathPrefixMatcher::clear()
+{
+    d_nodes.assign(1, Node());
+    d_size = 0;
+}
+
+size_t PathPrefixMatcher::child(size_t node, const char *segment,
+                                size_t length) const
+{
+    const auto &children = d_nodes[node].d_children;
+    const auto it = findEntry(children, Segment{segment, length});
+    return it == children.cend() ? NoNode : it->second;
+}
+
+size_t PathPrefixMatcher::addChild(size_t node, const std::string &segment)
+{
+    const size_t existing = child(node, segment.data(), segment.size());
+    if (existing != NoNode) {
+        return existing;
+    }
+
+    const size_t newNode = d_nodes.size();
+    d_nodes.emplace_back();
+    auto &children = d_nodes[node].d_children;
+    const auto it = std::lower_bound(
+        children.begin(), children.end(), segment,
+        [](const NodeChildren::value_type &entry, const std::string &value) {
+            return entry.first < value;
+        });
+    children.emplace(it, segment, newNode);
+    return newNode;
+}
+
+void PathPrefixMatcher::add(const std::string &prefix)
+{
+    const int number = static_cast<int>(d_size++);
+    if (prefix.empty()) {
+        return;
+    }
+
+    // Every segment followed by a slash is a level of the trie. The prefix
+    // matches paths that start with it followed by a slash...
+    size_t node = 0;
+    size_t start = 0;
+    size_t slash;
+    while ((slash = prefix.find('/', start)) != std::string::npos) {
+        node = addChild(node, prefix.substr(start, slash - start));
+        start = slash + 1;
+    }
+
+    if (start == prefix.size()) {
+        keepFirst(&d_nodes[node].d_prefix, number);
+        return;
+    }
+
+    // ...and, if it doesn't end in a slash, the path equal to it.
+    const std::string lastSegment = prefix.substr(start);
+    const size_t lastNode = addChild(node, lastSegment);
+    keepFirst(&d_nodes[lastNode].d_prefix, number);
+
+    auto &leaves = d_nodes[node].d_leaves;
+    const auto it = std::lower_bound(
+        leaves.begin(), leaves.end(), lastSegment,
+        [](const NodeLeaves::value_type &entry, const std::string &value) {
+            return entry.first < value;
+        });
+    if (it != leaves.end() && it->first == lastSegment) {
+        keepFirst(&it->second, number);
+    }
+    else {
+        leaves.emplace(it, lastSegment, number);
+    }
+}
+
+int PathPrefixMatcher::firstMatch(const std::string &path) const
+{
+    int result = -1;
+    size_t node = 0;
+    size_t start = 0;
+    while (true) {
+        const size_t slash = path.find('/', start);
+        if (slash == std::string::npos) {
+            const auto &leaves = d_nodes[node].d_leaves;
+            const auto it =
+                findEntry(leaves, Segment{path.data() + start,
+                                          path.size() - start});
+            if (it != leaves.cend()) {
+                keepFirst(&result, it->second);
+            }
+            return result;
+        }
+
+        node = child(node, path.data() + start, slash - start);
+        if (node == NoNode) {
+            return result;
+        }
+        if (d_nodes[node].d_prefix >= 0) {
+            keepFirst(&result, d_nodes[node].d_prefix);
+        }
+        start = slash + 1;
+    }
+}
+
+} // namespace recc
+} // namespace BloombergLP
@@ -0,0 +1,91 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_PATHPREFIXMATCHER
+#define INCLUDED_PATHPREFIXMATCHER
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace BloombergLP {
+namespace recc {
+
+/**
+ * A set of path prefixes compiled into a trie of path segments, so that
+ * finding the ones that match a path takes a single pass over the path
+ * and doesn't allocate.
+ *
+ * Prefixes have the same meaning as in `FileUtils::hasPathPrefix()`.
+ */
+class PathPrefixMatcher {
+  public:
+    PathPrefixMatcher();
+
+    /**
+     * Add a prefix. Prefixes are numbered from 0 in the order they are
+     * added. An empty prefix takes a number but never matches.
+     */
+    void add(const std::string &prefix);
+
+    /**
+     * Remove all prefixes.
+     */
+    void clear();
+
+    /**
+     * Return the number of the first prefix added that is a prefix of the
+     * given path, or -1 if there isn't one.
+     */
+    int firstMatch(const std::string &path) const;
+
+    bool matches(const std::string &path) const
+    {
+        return firstMatch(path) >= 0;
+    }
+
+    /**
+     * Return the number of prefixes added.
+     */
+    size_t size() const { return d_size; }
+
+  private:
+    // Sorted by name, so they can be searched without building a string
+    typedef std::vector<std::pair<std::string, size_t>> NodeChildren;
+    typedef std::vector<std::pair<std::string, int>> NodeLeaves;
+
+    struct Node {
+        // Nodes for the segments that can follow this one
+        NodeChildren d_children;
+        // Prefixes that end with a segment that has no trailing slash,
+        // matched only when it is also the last segment of the path
+        NodeLeaves d_leaves;
+        // Prefix that matches every path that reaches this node
+        int d_prefix;
+
+        Node() : d_prefix(-1) {}
+    };
+
+    size_t child(size_t node, const char *segment, size_t length) const;
+    size_t addChild(size_t node, const std::string &segment);
+
+    std::vector<Node> d_nodes;
+    size_t d_size;
+};
+
+} // namespace recc
+} // namespace BloombergLP
+
+#endif
@@ -0,0 +1,177 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <pathtable.h>
+
+namespace BloombergLP {
+namespace recc {
+
+namespace {
+
+const PathTable::SegmentId NoSegment = static_cast<PathTable::SegmentId>(-1);
+
+// Dependencies are usually headers a few directories deep
+const size_t TypicalDepth = 8;
+
+} // namespace
+
+PathTable::PathTable() { d_parentSegment = intern("..", 2); }
+
+PathTable::PathId PathTable::add(const std::string &path,
+                                 const std::string &base)
+{
+    const bool relativeToBase =
+        (path.empty() || path[0] != '/') && !base.empty();
+    const std::string &start = relativeToBase ? base : path;
+
+    PathEntry entry;
+    entry.d_offset = static_cast<uint32_t>(d_arena.size());
+    entry.d_absolute = !start.empty() && start[0] == '/';
+
+    appendSegments(start, entry.d_offset, entry.d_absolute);
+    if (relativeToBase) {
+        appendSegments(path, entry.d_offset, entry.d_absolute);
+    }
+
+    entry.d_length = static_cast<uint32_t>(d_arena.size() - entry.d_offset);
+    d_paths.push_back(entry);
+    return d_paths.size() - 1;
+}
+
+void PathTable::reserve(size_t paths)
+{
+    d_paths.reserve(paths);
+    d_arena.reserve(paths * TypicalDepth);
+}
+
+PathTable::SegmentRange PathTable::segments(PathId path) const
+{
+    const PathEntry &entry = d_paths[path];
+    const SegmentId *begin = d_arena.data() + entry.d_offset;
+    return SegmentRange(begin, begin + entry.d_length);
+}
+
+void PathTable::toString(PathId path, std::string *out) const
+{
+    out->clear();
+    if (isAbsolute(path)) {
+        out->push_back('/');
+    }
+
+    const SegmentRange range = segments(path);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it != range.first) {
+            out->push_back('/');
+        }
+        out->append(segment(*it));
+    }
+
+    if (out->empty()) {
+        out->push_back('.');
+    }
+}
+
+std::string PathTable::toString(PathId path) const
+{
+    std::string result;
+    toString(path, &result);
+    return result;
+}
+
+void PathTable::appendSegments(const std::string &path, size_t pathOffset,
+                               bool absolute)
+{
+    size_t start = 0;
+    while (start < path.size()) {
+        size_t end = path.find('/', start);
+        if (end == std::string::npos) {
+            end = path.size();
+        }
+
+        const char *name = path.data() + start;
+        const size_t length = end - start;
+        if (length == 0 || (length == 1 && name[0] == '.')) {
+            // Empty and "." segments don't change the path
+        }
+        else if (length == 2 && name[0] == '.' && name[1] == '.') {
+            // A relative path can start with "..", but ".." in the root
+            // directory is the root directory
+            if (d_arena.size() > pathOffset &&
+                d_arena.back() != d_parentSegment) {
+                d_arena.pop_back();
+            }
+            else if (!absolute) {
+                d_arena.push_back(d_parentSegment);
+            }
+        }
+        else {
+            d_arena.push_back(intern(name, length));
+        }
+
+        start = end + 1;
+    }
+}
+
+PathTable::SegmentId PathTable::intern(const char *name, size_t length)
+{
+    if (2 * (d_segmentNames.size() + 1) > d_index.size()) {
+        growIndex();
+    }
+
+    const size_t mask = d_index.size() - 1;
+    size_t slot = hash(name, length) & mask;
+    while (d_index[slot] != NoSegment) {
+        const std::string &existing = d_segmentNames[d_index[slot]];
+        if (existing.size() == length &&
+            existing.compare(0, length, name, length) == 0) {
+            return d_index[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    const SegmentId id = static_cast<SegmentId>(d_segmentNames.size());
+    d_segmentNames.emplace_back(name, length);
+    d_index[slot] = id;
+    return id;
+}
+
+void PathTable::growIndex()
+{
+    std::vector<SegmentId> index(d_index.empty() ? 64 : 2 * d_index.size(),
+                                 NoSegment);
+    const size_t mask = index.size() - 1;
+    for (SegmentId id = 0; id < d_segmentNames.size(); ++id) {
+        const std::string &name = d_segmentNames[id];
+        size_t slot = hash(name.data(), name.size()) & mask;
+        while (index[slot] != NoSegment) {
+            slot = (slot + 1) & mask;
+        }
+        index[slot] = id;
+    }
+    d_index.swap(index);
+}
+
+size_t PathTable::hash(const char *name, size_t length)
+{
+    // FNV-1a
+    uint64_t result = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; ++i) {
+        result ^= static_cast<unsigned char>(name[i]);
+        result *= 1099511628211ULL;
+    }
+    return static_cast<size_t>(result ^ (result >> 32));
+}
+
+} // namespace recc
+} // namespace BloombergLP
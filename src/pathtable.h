@@ -0,0 +1,117 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_PATHTABLE
+#define INCLUDED_PATHTABLE
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace BloombergLP {
+namespace recc {
+
+/**
+ * A table of normalized paths, each stored as a sequence of interned
+ * segment ids in a shared arena. Every distinct directory or file name is
+ * stored once, however many paths it appears in, and a path is normalized
+ * once, when it is added.
+ *
+ * Adding paths isn't thread-safe, but a table that is no longer being
+ * added to can be read from several threads.
+ */
+class PathTable {
+  public:
+    typedef uint32_t SegmentId;
+    typedef size_t PathId;
+    typedef std::pair<const SegmentId *, const SegmentId *> SegmentRange;
+
+    PathTable();
+
+    /**
+     * Normalize the given path, as `buildboxcommon::FileUtils::
+     * normalizePath()` does, and add it to the table.
+     *
+     * If the path is relative and `base` isn't empty, the path is taken
+     * relative to `base`, as if `base + "/" + path` had been given.
+     */
+    PathId add(const std::string &path, const std::string &base = "");
+
+    /**
+     * Reserve space for the given number of paths of typical depth.
+     */
+    void reserve(size_t paths);
+
+    /**
+     * Return whether the given path is absolute.
+     */
+    bool isAbsolute(PathId path) const { return d_paths[path].d_absolute; }
+
+    /**
+     * Return the segments of the given path. A relative path may start
+     * with ".." segments; no other segment is ".", ".." or empty.
+     */
+    SegmentRange segments(PathId path) const;
+
+    /**
+     * Return the name of the given segment. The reference is valid until
+     * the next path is added.
+     */
+    const std::string &segment(SegmentId segment) const
+    {
+        return d_segmentNames[segment];
+    }
+
+    /**
+     * Write the given path to `out` as a string, replacing its contents.
+     */
+    void toString(PathId path, std::string *out) const;
+    std::string toString(PathId path) const;
+
+    /**
+     * Return the number of paths and distinct segments in the table.
+     */
+    size_t size() const { return d_paths.size(); }
+    size_t segmentCount() const { return d_segmentNames.size(); }
+
+  private:
+    struct PathEntry {
+        uint32_t d_offset;
+        uint32_t d_length;
+        bool d_absolute;
+    };
+
+    void appendSegments(const std::string &path, size_t pathOffset,
+                        bool absolute);
+    SegmentId intern(const char *name, size_t length);
+    void growIndex();
+
+    static size_t hash(const char *name, size_t length);
+
+    std::vector<std::string> d_segmentNames;
+    // Open addressing hash table of segment ids, keyed on their names.
+    // Its size is a power of two and it is at most half full.
+    std::vector<SegmentId> d_index;
+    // The segments of all paths, one after the other
+    std::vector<SegmentId> d_arena;
+    std::vector<PathEntry> d_paths;
+    SegmentId d_parentSegment;
+};
+
+} // namespace recc
+} // namespace BloombergLP
+
+#endif
@@ -0,0 +1,548 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <race.h>
+
+#include <compilerdefaults.h>
+#include <env.h>
+#include <fileutils.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_logging.h>
+#include <buildboxcommonmetrics_countingmetricutil.h>
+#include <buildboxcommonmetrics_durationmetricvalue.h>
+#include <buildboxcommonmetrics_metriccollectorfactoryutil.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <future>
+#include <iostream>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+
+#define COUNTER_NAME_RACE_LOCAL_WON "recc.race.local_won"
+#define COUNTER_NAME_RACE_REMOTE_WON "recc.race.remote_won"
+#define METRIC_NAME_RACE_LOCAL_DURATION "recc.race.local_duration"
+#define METRIC_NAME_RACE_REMOTE_DURATION "recc.race.remote_duration"
+#define METRIC_NAME_RACE_MARGIN "recc.race.margin"
+
+extern char **environ;
+
+namespace BloombergLP {
+namespace recc {
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const std::chrono::milliseconds PollInterval(10);
+
+const std::string PrivateDirectoryPrefix = ".recc-race-";
+
+// Process group of the local compile that is running, if any, so that it
+// can be killed if recc exits while racing (e.g. on SIGINT)
+std::atomic<pid_t> s_localProcessGroup(0);
+
+// The private directory and the files the local compile writes in it, so
+// that they can be removed from a signal handler. Only set once per
+// process, before `s_privateFilesSet`.
+std::vector<std::string> s_privateFiles;
+std::string s_privateDirectory;
+std::atomic_bool s_privateFilesSet(false);
+
+const int ExitSignals[] = {SIGINT, SIGTERM, SIGHUP};
+struct sigaction s_previousActions[sizeof(ExitSignals) / sizeof(int)];
+
+// Only calls async-signal-safe functions
+void stopLocalCommand()
+{
+    const pid_t processGroup = s_localProcessGroup.exchange(0);
+    if (processGroup > 0) {
+        kill(-processGroup, SIGKILL);
+    }
+    if (s_privateFilesSet.exchange(false)) {
+        for (const auto &file : s_privateFiles) {
+            unlink(file.c_str());
+        }
+        rmdir(s_privateDirectory.c_str());
+    }
+}
+
+void stopLocalCommandOnSignal(int signalNumber)
+{
+    const int savedErrno = errno;
+    stopLocalCommand();
+
+    // Carry on with whatever would have happened without this handler
+    for (size_t i = 0; i < sizeof(ExitSignals) / sizeof(int); ++i) {
+        if (ExitSignals[i] == signalNumber) {
+            sigaction(signalNumber, &s_previousActions[i], nullptr);
+        }
+    }
+    errno = savedErrno;
+    raise(signalNumber);
+}
+
+/**
+ * Make sure that the local compile is stopped and its private directory
+ * removed if recc exits or is interrupted while racing.
+ */
+void stopLocalCommandOnExit()
+{
+    static bool registered = false;
+    if (registered) {
+        return;
+    }
+    registered = true;
+
+    atexit(stopLocalCommand);
+
+    struct sigaction action = {};
+    action.sa_handler = stopLocalCommandOnSignal;
+    sigemptyset(&action.sa_mask);
+    for (size_t i = 0; i < sizeof(ExitSignals) / sizeof(int); ++i) {
+        if (sigaction(ExitSignals[i], nullptr, &s_previousActions[i]) == 0 &&
+            s_previousActions[i].sa_handler != SIG_IGN) {
+            sigaction(ExitSignals[i], &action, nullptr);
+        }
+    }
+}
+
+bool startsWith(const std::string &str, const std::string &prefix)
+{
+    return str.compare(0, prefix.size(), prefix) == 0;
+}
+
+std::string directoryName(const std::string &path)
+{
+    const auto lastSlash = path.rfind('/');
+    if (lastSlash == std::string::npos) {
+        return ".";
+    }
+    if (lastSlash == 0) {
+        return "/";
+    }
+    return path.substr(0, lastSlash);
+}
+
+/**
+ * Start the given command in its own process group, with its standard
+ * output and error redirected to the given files. Returns its pid.
+ */
+pid_t startLocalCommand(const std::vector<std::string> &command,
+                        const std::string &stdOutPath,
+                        const std::string &stdErrPath)
+{
+    std::vector<char *> argv;
+    for (const auto &argument : command) {
+        argv.push_back(const_cast<char *>(argument.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t fileActions;
+    posix_spawn_file_actions_init(&fileActions);
+    posix_spawn_file_actions_addopen(&fileActions, STDOUT_FILENO,
+                                     stdOutPath.c_str(),
+                                     O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    posix_spawn_file_actions_addopen(&fileActions, STDERR_FILENO,
+                                     stdErrPath.c_str(),
+                                     O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attributes, 0);
+
+    // Unlike fork(), posix_spawn() is safe to call while the gRPC threads
+    // are running, and doesn't copy the page tables of a large parent.
+    pid_t pid = -1;
+    const int spawnError = posix_spawnp(&pid, argv[0], &fileActions,
+                                        &attributes, argv.data(), environ);
+    posix_spawnattr_destroy(&attributes);
+    posix_spawn_file_actions_destroy(&fileActions);
+    if (spawnError != 0) {
+        throw std::system_error(spawnError, std::system_category(),
+                                "Could not start " + command.front());
+    }
+
+    s_localProcessGroup = pid;
+    return pid;
+}
+
+int exitCodeFromStatus(int status)
+{
+    if (WIFSIGNALED(status)) {
+        // Exit code as returned by Bash.
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
+
+void storeDuration(const std::string &name, Clock::duration duration)
+{
+    buildboxcommon::buildboxcommonmetrics::MetricCollectorFactoryUtil::store(
+        name,
+        buildboxcommon::buildboxcommonmetrics::DurationMetricValue(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                duration)));
+}
+
+void recordWinner(bool localWon)
+{
+    buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+        recordCounterMetric(localWon ? COUNTER_NAME_RACE_LOCAL_WON
+                                     : COUNTER_NAME_RACE_REMOTE_WON,
+                            1);
+}
+
+} // namespace
+
+void Race::removeOrphanedDirectories(const std::string &directory)
+{
+    DIR *dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+        return;
+    }
+
+    std::vector<std::string> orphans;
+    while (const struct dirent *entry = readdir(dir)) {
+        const std::string name = entry->d_name;
+        if (!startsWith(name, PrivateDirectoryPrefix)) {
+            continue;
+        }
+        // Named after the pid of the recc process that created it
+        const pid_t pid = static_cast<pid_t>(
+            atol(name.c_str() + PrivateDirectoryPrefix.size()));
+        if (pid > 0 && kill(pid, 0) != 0 && errno == ESRCH) {
+            orphans.push_back(directory + "/" + name);
+        }
+    }
+    closedir(dir);
+
+    for (const auto &orphan : orphans) {
+        BUILDBOX_LOG_DEBUG("Removing orphaned directory " << orphan);
+        try {
+            buildboxcommon::FileUtils::deleteDirectory(orphan.c_str());
+        }
+        catch (const std::exception &e) {
+            BUILDBOX_LOG_DEBUG("Could not remove " << orphan << ": "
+                                                   << e.what());
+        }
+    }
+}
+
+std::unique_ptr<LocalSlot> LocalSlot::tryAcquire(const std::string &directory,
+                                                 int slots)
+{
+    if (slots <= 0) {
+        return nullptr;
+    }
+    FileUtils::createDirectoryRecursive(directory);
+
+    // Start at a different slot in each process, so that they don't all
+    // contend for the first ones.
+    const int first = static_cast<int>(getpid() % slots);
+    for (int i = 0; i < slots; ++i) {
+        const std::string path =
+            directory + "/slot" + std::to_string((first + i) % slots);
+        const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd == -1) {
+            BUILDBOX_LOG_WARNING("Could not open " << path << ": "
+                                                   << strerror(errno));
+            continue;
+        }
+
+        struct flock lock;
+        memset(&lock, 0, sizeof(lock));
+        lock.l_type = F_WRLCK;
+        lock.l_whence = SEEK_SET;
+        if (fcntl(fd, F_SETLK, &lock) == 0) {
+            return std::unique_ptr<LocalSlot>(new LocalSlot(fd));
+        }
+        close(fd);
+    }
+    return nullptr;
+}
+
+LocalSlot::~LocalSlot() { close(d_fd); }
+
+bool Race::supports(const ParsedCommand &command)
+{
+    if (!command.is_compiler_command() ||
+        !SupportedCompilers::Gcc.count(command.get_compiler()) ||
+        command.d_outputFile.empty()) {
+        return false;
+    }
+
+    // The preprocessor writes these dependency files itself, bypassing the
+    // options we rewrite.
+    for (const auto &argument : command.d_originalCommand) {
+        if (startsWith(argument, "-Wp,")) {
+            return false;
+        }
+    }
+
+    const size_t outputs = command.get_dependency_file().empty() ? 1 : 2;
+    return command.get_products().size() == outputs;
+}
+
+PrivateOutputCommand
+Race::privateOutputCommand(const ParsedCommand &command,
+                           const std::string &directory)
+{
+    PrivateOutputCommand result;
+    const auto privatePath = [&](const std::string &path) {
+        // Prefixed with a counter in case two outputs share a basename
+        const std::string newPath =
+            directory + "/" + std::to_string(result.d_outputs.size()) + "-" +
+            buildboxcommon::FileUtils::pathBasename(path.c_str());
+        result.d_outputs[newPath] = path;
+        return newPath;
+    };
+
+    const auto &arguments = command.d_originalCommand;
+    bool hasDependencyFileOption = false;
+    bool hasTargetOption = false;
+    for (size_t i = 0; i < arguments.size(); ++i) {
+        const auto &argument = arguments[i];
+        if ((argument == "-o" || argument == "-MF") &&
+            i + 1 < arguments.size()) {
+            hasDependencyFileOption |= argument == "-MF";
+            result.d_command.push_back(argument);
+            result.d_command.push_back(privatePath(arguments[++i]));
+        }
+        else if (i > 0 && startsWith(argument, "-MF")) {
+            hasDependencyFileOption = true;
+            result.d_command.push_back("-MF" +
+                                       privatePath(argument.substr(3)));
+        }
+        else if (i > 0 && startsWith(argument, "-o")) {
+            result.d_command.push_back("-o" + privatePath(argument.substr(2)));
+        }
+        else {
+            hasTargetOption |=
+                startsWith(argument, "-MT") || startsWith(argument, "-MQ");
+            result.d_command.push_back(argument);
+        }
+    }
+
+    const std::string dependencyFile = command.get_dependency_file();
+    if (!dependencyFile.empty()) {
+        // Without -MF, the name of the dependency file would be derived
+        // from the private output path...
+        if (!hasDependencyFileOption) {
+            result.d_command.push_back("-MF");
+            result.d_command.push_back(privatePath(dependencyFile));
+        }
+        // ...and so would the target of the rule it contains.
+        if (!hasTargetOption) {
+            result.d_command.push_back("-MT");
+            result.d_command.push_back(command.d_outputFile);
+        }
+    }
+    return result;
+}
+
+bool Race::run(RemoteExecutionClient *client, const ParsedCommand &command,
+               const proto::Digest &actionDigest, ActionResult *remoteResult,
+               int *localExitCode)
+{
+    const int slots =
+        RECC_RACE_LOCAL_SLOTS > 0
+            ? RECC_RACE_LOCAL_SLOTS
+            : static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN));
+    std::unique_ptr<LocalSlot> slot;
+    try {
+        slot = LocalSlot::tryAcquire(
+            TMPDIR + "/recc-slots-" + std::to_string(getuid()), slots);
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_WARNING("Could not acquire a local slot: " << e.what());
+    }
+
+    // Keep the private directory next to the output, so that the outputs
+    // can be renamed into place. Directories left behind by recc processes
+    // that were killed are removed first.
+    const std::string outputDirectory = directoryName(command.d_outputFile);
+    std::string directory = outputDirectory + "/" + PrivateDirectoryPrefix +
+                            std::to_string(getpid()) + "-XXXXXX";
+    if (slot != nullptr) {
+        removeOrphanedDirectories(outputDirectory);
+    }
+    if (slot == nullptr || mkdtemp(&directory[0]) == nullptr) {
+        if (slot != nullptr) {
+            BUILDBOX_LOG_WARNING("Could not create " << directory << ": "
+                                                     << strerror(errno));
+        }
+        BUILDBOX_LOG_DEBUG("Not racing a local compile");
+        *remoteResult = client->execute_action(actionDigest, RECC_SKIP_CACHE);
+        return false;
+    }
+
+    const auto localCommand = privateOutputCommand(command, directory);
+    const std::string stdOutPath = directory + "/stdout";
+    const std::string stdErrPath = directory + "/stderr";
+
+    stopLocalCommandOnExit();
+    s_privateFiles = {stdOutPath, stdErrPath};
+    for (const auto &output : localCommand.d_outputs) {
+        s_privateFiles.push_back(output.first);
+    }
+    s_privateDirectory = directory;
+    s_privateFilesSet = true;
+
+    const auto start = Clock::now();
+    auto remoteFuture = std::async(std::launch::async, [&]() {
+        return client->execute_action(actionDigest, RECC_SKIP_CACHE);
+    });
+
+    pid_t pid = -1;
+    try {
+        pid = startLocalCommand(localCommand.d_command, stdOutPath,
+                                stdErrPath);
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_WARNING("Could not start local compile: " << e.what());
+    }
+
+    bool localDone = pid == -1;
+    bool localStarted = pid != -1;
+    int localStatus = 0;
+    Clock::time_point localEnd;
+
+    bool remoteDone = false;
+    bool remoteOk = false;
+    std::exception_ptr remoteError;
+    Clock::time_point remoteEnd;
+
+    // The first side to succeed wins. If both fail, the remote result is
+    // used, unless there isn't one.
+    bool localWon = false;
+    while (true) {
+        if (!remoteDone &&
+            remoteFuture.wait_for(PollInterval) == std::future_status::ready) {
+            remoteDone = true;
+            remoteEnd = Clock::now();
+            try {
+                *remoteResult = remoteFuture.get();
+                remoteOk = true;
+            }
+            catch (...) {
+                remoteError = std::current_exception();
+            }
+            if (remoteOk && remoteResult->d_exitCode == 0) {
+                break;
+            }
+        }
+
+        if (!localDone) {
+            if (remoteDone) {
+                std::this_thread::sleep_for(PollInterval);
+            }
+            int status = 0;
+            if (waitpid(pid, &status, WNOHANG) == pid) {
+                localDone = true;
+                localEnd = Clock::now();
+                localStatus = exitCodeFromStatus(status);
+                s_localProcessGroup = 0;
+                if (localStatus == 0) {
+                    localWon = true;
+                    break;
+                }
+            }
+        }
+
+        if (localDone && remoteDone) {
+            localWon = !remoteOk && localStarted;
+            break;
+        }
+    }
+
+    if (!localDone) {
+        kill(-pid, SIGKILL);
+        int status = 0;
+        waitpid(pid, &status, 0);
+        s_localProcessGroup = 0;
+    }
+    if (!remoteDone) {
+        client->cancel_execution();
+        try {
+            remoteFuture.get();
+        }
+        catch (const std::exception &e) {
+            BUILDBOX_LOG_DEBUG("Remote execution stopped: " << e.what());
+        }
+    }
+
+    if (localWon) {
+        BUILDBOX_LOG_DEBUG("Local compile finished first");
+        storeDuration(METRIC_NAME_RACE_LOCAL_DURATION, localEnd - start);
+
+        for (const auto &output : localCommand.d_outputs) {
+            if (rename(output.first.c_str(), output.second.c_str()) != 0 &&
+                errno != ENOENT) {
+                const std::string error = strerror(errno);
+                s_privateFilesSet = false;
+                buildboxcommon::FileUtils::deleteDirectory(directory.c_str());
+                throw std::runtime_error("Could not move " + output.first +
+                                         " to " + output.second + ": " +
+                                         error);
+            }
+        }
+
+        /* These don't use logging macros because they are compiler output
+         */
+        std::cout << buildboxcommon::FileUtils::getFileContents(
+            stdOutPath.c_str());
+        std::cerr << buildboxcommon::FileUtils::getFileContents(
+            stdErrPath.c_str());
+        *localExitCode = localStatus;
+    }
+    else if (remoteOk) {
+        BUILDBOX_LOG_DEBUG("Remote execution finished first");
+        storeDuration(METRIC_NAME_RACE_REMOTE_DURATION, remoteEnd - start);
+    }
+
+    // The loser is usually stopped before it finishes, in which case the
+    // margin isn't known.
+    if (localDone && localStarted && remoteDone) {
+        storeDuration(METRIC_NAME_RACE_MARGIN, localEnd > remoteEnd
+                                                   ? localEnd - remoteEnd
+                                                   : remoteEnd - localEnd);
+    }
+
+    s_privateFilesSet = false;
+    buildboxcommon::FileUtils::deleteDirectory(directory.c_str());
+
+    if (!localWon && !remoteOk) {
+        std::rethrow_exception(remoteError);
+    }
+    recordWinner(localWon);
+    return localWon;
+}
+
+} // namespace recc
+} // namespace BloombergLP
@@ -0,0 +1,115 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef INCLUDED_RACE
+#define INCLUDED_RACE
+
+#include <parsedcommand.h>
+#include <remoteexecutionclient.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace BloombergLP {
+namespace recc {
+
+/**
+ * A compile command rewritten to write its outputs into a private
+ * directory, so that it can run alongside a remote execution of the
+ * original command.
+ */
+struct PrivateOutputCommand {
+    std::vector<std::string> d_command;
+    // Maps the path of each output in the private directory to the path
+    // that the original command writes it to
+    std::map<std::string, std::string> d_outputs;
+};
+
+/**
+ * One of a limited number of slots for running commands locally, shared by
+ * all recc processes of the current user on the host. The slot is held
+ * until the object is destroyed, or the process exits.
+ */
+class LocalSlot {
+  public:
+    /**
+     * Try to take one of `slots` slots, using lock files in `directory`.
+     * Returns null if they are all taken.
+     */
+    static std::unique_ptr<LocalSlot> tryAcquire(const std::string &directory,
+                                                 int slots);
+
+    ~LocalSlot();
+    LocalSlot(const LocalSlot &) = delete;
+    LocalSlot &operator=(const LocalSlot &) = delete;
+
+  private:
+    explicit LocalSlot(int fd) : d_fd(fd) {}
+    int d_fd;
+};
+
+struct Race {
+    /**
+     * Returns true if the outputs of the given command can be redirected
+     * into a private directory: it must be a gcc-style compile command with
+     * an explicit `-o` that produces no outputs besides that file and its
+     * dependency file.
+     */
+    static bool supports(const ParsedCommand &command);
+
+    /**
+     * Return the given command, rewritten to write its outputs into
+     * `directory`.
+     */
+    static PrivateOutputCommand
+    privateOutputCommand(const ParsedCommand &command,
+                         const std::string &directory);
+
+    /**
+     * Remove the private directories in `directory` whose recc process is
+     * no longer running, e.g. because it was killed with SIGKILL.
+     */
+    static void removeOrphanedDirectories(const std::string &directory);
+
+    /**
+     * Execute the action remotely while compiling it locally into a private
+     * directory, if a local slot is free, and use the result that is
+     * available first. The other one is cancelled. The action's inputs must
+     * already be in the CAS.
+     *
+     * If the local compile wins, its outputs are moved into place, its
+     * standard output and error are written to ours and its exit code is
+     * stored in `localExitCode`. Otherwise, the remote result is stored in
+     * `remoteResult` to be handled like any other.
+     *
+     * If recc exits or is interrupted by SIGINT, SIGTERM or SIGHUP while
+     * racing, the local compile is killed and its private directory
+     * removed.
+     *
+     * Returns true if the local compile won. Throws if the remote execution
+     * fails and there is no local result to fall back on.
+     */
+    static bool run(RemoteExecutionClient *client,
+                    const ParsedCommand &command,
+                    const proto::Digest &actionDigest,
+                    ActionResult *remoteResult, int *localExitCode);
+};
+
+} // namespace recc
+} // namespace BloombergLP
+
+#endif
@@ -26,6 +26,8 @@
 #define DEFAULT_RECC_POLL_WAIT std::chrono::seconds(1)
 #define DEFAULT_RECC_RETRY_LIMIT 0
 #define DEFAULT_RECC_RETRY_DELAY 100
+#define DEFAULT_RECC_CIRCUIT_BREAKER_THRESHOLD 0
+#define DEFAULT_RECC_CIRCUIT_BREAKER_COOLDOWN 30
 #define DEFAULT_RECC_SERVER "http://localhost:8085"
 #define DEFAULT_RECC_TMPDIR "/tmp"
 #define DEFAULT_RECC_TMP_PREFIX "recc"
@@ -34,7 +36,11 @@
 #define DEFAULT_RECC_SERVER_SSL 0
 #define DEFAULT_RECC_CONFIG "recc.conf"
 #define DEFAULT_RECC_PROJECT_ROOT ""
+#define DEFAULT_RECC_CACHE_DIR ""
 #define DEFAULT_RECC_DEPS_GLOBAL_PATHS 0
+#define DEFAULT_RECC_DEPS_DEPEND_MODE 0
+#define DEFAULT_RECC_CACHE_TOOLCHAINS 0
+#define DEFAULT_RECC_PREPROCESS_LOCALLY 0
 #define DEFAULT_RECC_AUTH_UNCONFIGURED_MSG ""
 #define DEFAULT_RECC_CORRELATED_INVOCATIONS_ID ""
 #define DEFAULT_RECC_METRICS_FILE ""
@@ -45,7 +51,17 @@
 #define DEFAULT_RECC_FORCE_REMOTE 0
 #define DEFAULT_RECC_ACTION_UNCACHEABLE 0
 #define DEFAULT_RECC_SKIP_CACHE 0
+#define DEFAULT_RECC_CACHE_ONLY 0
+#define DEFAULT_RECC_RACE_LOCALLY 0
+#define DEFAULT_RECC_RACE_LOCAL_SLOTS 0
+#define DEFAULT_RECC_SCHEDULE_FROM_HISTORY 0
+#define DEFAULT_RECC_HEDGE_PERCENTILE 0
+#define DEFAULT_RECC_BATCH_JOBS 64
+#define DEFAULT_RECC_JOBSERVER 0
+#define DEFAULT_RECC_DIGEST_TABLE_SLOTS 0
+#define DEFAULT_RECC_UPLOAD_WAIT_TIMEOUT 0
 #define DEFAULT_RECC_DONT_SAVE_OUTPUT 0
+#define DEFAULT_RECC_PRESERVE_UNCHANGED_MTIME 0
 #define DEFAULT_RECC_WORKING_DIR_PREFIX ""
 
 #define DEFAULT_RECC_DEPS_DIRECTORY_OVERRIDE ""
@@ -59,6 +75,8 @@
 #define DEFAULT_RECC_REMOTE_PLATFORM {}
 
 #define DEFAULT_RECC_CAS_DIGEST_FUNCTION "SHA256"
+#define DEFAULT_RECC_CAS_CHUNKING_THRESHOLD 0
+#define DEFAULT_RECC_CAS_CHUNK_CACHE_MB 1024
 #define DEFAULT_RECC_MAX_THREADS 4
 
 #define DEFAULT_RECC_REAPI_VERSION "2.0"
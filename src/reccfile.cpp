@@ -15,13 +15,79 @@
 #include <reccfile.h>
 
 #include <digestgenerator.h>
+#include <digesttable.h>
 #include <fileutils.h>
 
 #include <buildboxcommon_fileutils.h>
 #include <buildboxcommon_logging.h>
+#include <buildboxcommonmetrics_countingmetricutil.h>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <sys/stat.h>
+#include <utility>
 
 namespace BloombergLP {
 namespace recc {
+
+namespace {
+
+#define COUNTER_NAME_DIGEST_TABLE_HITS "recc.digest_table.hits"
+#define COUNTER_NAME_DIGEST_TABLE_MISSES "recc.digest_table.misses"
+
+struct CachedFile {
+    FileIdentity d_identity;
+    std::string d_contents;
+    proto::Digest d_digest;
+};
+
+std::atomic_bool s_cacheEnabled(false);
+std::mutex s_cacheMutex;
+// Keyed by absolute path and whether symlinks were followed
+std::map<std::pair<std::string, bool>, CachedFile> s_cache;
+
+/**
+ * Return the digest of `contents`, read from the file at `path` after
+ * `stat()` returned `statResult`, looking it up in the host's digest table
+ * if there is one.
+ */
+proto::Digest digestFileContents(const char *path, bool followSymlinks,
+                                 const struct stat &statResult,
+                                 const std::string &contents)
+{
+    DigestTable *table = DigestTable::instance();
+    if (table == nullptr || !S_ISREG(statResult.st_mode)) {
+        return DigestGenerator::make_digest(contents);
+    }
+
+    // The contents are only those of the identity if the file didn't
+    // change while it was read
+    const FileIdentity identity = FileIdentity::fromStat(statResult);
+    struct stat statAfterReading;
+    const bool unchanged =
+        (followSymlinks ? stat(path, &statAfterReading)
+                        : lstat(path, &statAfterReading)) == 0 &&
+        FileIdentity::fromStat(statAfterReading) == identity;
+
+    proto::Digest digest;
+    if (unchanged && table->lookup(identity, &digest)) {
+        buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+            recordCounterMetric(COUNTER_NAME_DIGEST_TABLE_HITS, 1);
+        return digest;
+    }
+
+    buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+        recordCounterMetric(COUNTER_NAME_DIGEST_TABLE_MISSES, 1);
+    digest = DigestGenerator::make_digest(contents);
+    if (unchanged && DigestTable::isSettled(statResult)) {
+        table->publish(identity, digest);
+    }
+    return digest;
+}
+
+} // namespace
+
 ReccFile::ReccFile(const std::string &file_path, const std::string &file_name,
                    const std::string &contents, const proto::Digest &digest,
                    bool executable, bool symlink)
@@ -43,7 +109,7 @@ proto::FileNode ReccFile::getFileNode(const std::string &override_name) const
     return result;
 }
 
-proto::Digest ReccFile::getDigest() const { return d_digest; }
+const proto::Digest &ReccFile::getDigest() const { return d_digest; }
 
 const std::string &ReccFile::getFileName() const { return d_fileName; }
 
@@ -69,13 +135,38 @@ ReccFileFactory::createFile(const char *path, const bool followSymlinks)
         const bool symlink = FileUtils::isSymlink(statResult);
         const std::string file_name =
             buildboxcommon::FileUtils::pathBasename(path);
+
+        std::pair<std::string, bool> cacheKey;
+        if (s_cacheEnabled) {
+            cacheKey.first =
+                path[0] == '/'
+                    ? std::string(path)
+                    : FileUtils::getCurrentWorkingDirectory() + "/" + path;
+            cacheKey.second = followSymlinks;
+
+            const std::lock_guard<std::mutex> lock(s_cacheMutex);
+            const auto it = s_cache.find(cacheKey);
+            if (it != s_cache.end() &&
+                it->second.d_identity == FileIdentity::fromStat(statResult)) {
+                return std::make_shared<ReccFile>(ReccFile(
+                    std::string(path), file_name, it->second.d_contents,
+                    it->second.d_digest, executable, symlink));
+            }
+        }
+
         const std::string file_contents =
             (symlink
                  ? FileUtils::getSymlinkContents(path, statResult)
                  : FileUtils::getFileContents(std::string(path), statResult));
 
-        const proto::Digest file_digest =
-            DigestGenerator::make_digest(file_contents);
+        const proto::Digest file_digest = digestFileContents(
+            path, followSymlinks, statResult, file_contents);
+
+        if (s_cacheEnabled) {
+            const std::lock_guard<std::mutex> lock(s_cacheMutex);
+            s_cache[cacheKey] = {FileIdentity::fromStat(statResult),
+                                 file_contents, file_digest};
+        }
 
         BUILDBOX_LOG_DEBUG(
             "Creating" << (executable ? " " : " non-")
@@ -94,5 +185,14 @@ ReccFileFactory::createFile(const char *path, const bool followSymlinks)
     }
 }
 
+void ReccFileFactory::setCacheEnabled(bool enabled)
+{
+    const std::lock_guard<std::mutex> lock(s_cacheMutex);
+    s_cacheEnabled = enabled;
+    if (!enabled) {
+        s_cache.clear();
+    }
+}
+
 } // namespace recc
 } // namespace BloombergLP
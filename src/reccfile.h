@@ -36,7 +36,7 @@ class ReccFile {
      * Defaults to the file_name taken from the path.
      */
     proto::FileNode getFileNode(const std::string &override_name = "") const;
-    proto::Digest getDigest() const;
+    const proto::Digest &getDigest() const;
     const std::string &getFileName() const;
     const std::string &getFilePath() const;
     const std::string &getFileContents() const;
@@ -59,6 +59,15 @@ class ReccFileFactory {
   public:
     static std::shared_ptr<ReccFile>
     createFile(const char *path, const bool followSymlinks = true);
+
+    /**
+     * If enabled, the contents and digest of every file created are kept,
+     * and creating a file again while its stat signature is unchanged
+     * doesn't read and hash it again. This is meant for processes that
+     * build many actions sharing the same headers (`recc --batch`).
+     */
+    static void setCacheEnabled(bool enabled);
+
     ReccFileFactory() = delete;
 };
 
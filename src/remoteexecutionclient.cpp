@@ -15,20 +15,31 @@
 #include <remoteexecutionclient.h>
 
 #include <digestgenerator.h>
-#include <fileutils.h>
 #include <grpcretry.h>
+#include <outputwriter.h>
 #include <reccdefaults.h>
 #include <remoteexecutionsignals.h>
+#include <threadutils.h>
 
 #include <buildboxcommon_logging.h>
+#include <buildboxcommonmetrics_countingmetricutil.h>
 #include <buildboxcommonmetrics_durationmetrictimer.h>
 #include <buildboxcommonmetrics_metricguard.h>
 
+#include <atomic>
+#include <exception>
 #include <functional>
 #include <future>
+#include <mutex>
 #include <signal.h>
+#include <vector>
 
 #define TIMER_NAME_FETCH_WRITE_RESULTS "recc.fetch_write_results"
+#define COUNTER_NAME_HEDGED_EXECUTIONS "recc.hedge.started"
+#define COUNTER_NAME_HEDGE_ORIGINAL_WON "recc.hedge.original_won"
+#define COUNTER_NAME_HEDGE_DUPLICATE_WON "recc.hedge.duplicate_won"
+#define COUNTER_NAME_UNCHANGED_OUTPUTS "recc.unchanged_outputs"
+#define COUNTER_NAME_UNCHANGED_OUTPUT_BYTES "recc.unchanged_output_bytes"
 
 using namespace google::longrunning;
 
@@ -36,6 +47,9 @@ namespace BloombergLP {
 namespace recc {
 
 namespace { // Helper functions used by `RemoteExecutionClient`.
+
+const std::chrono::milliseconds HedgePollInterval(10);
+
 /**
  * Add the files from the given directory (and its subdirectories, recursively)
  * to the given outputFiles map.
@@ -197,10 +211,48 @@ bool RemoteExecutionClient::fetch_from_action_cache(
     return true;
 }
 
+void RemoteExecutionClient::update_action_cache(
+    const proto::Digest &actionDigest, const proto::ActionResult &result)
+{
+    proto::UpdateActionResultRequest request;
+    request.set_instance_name(d_instanceName);
+    *request.mutable_action_digest() = actionDigest;
+    *request.mutable_action_result() = result;
+
+    proto::ActionResult response;
+    auto update_lambda = [&](grpc::ClientContext &context) {
+        return d_actionCacheStub->UpdateActionResult(&context, request,
+                                                     &response);
+    };
+
+    grpc_retry(update_lambda, d_grpcContext);
+}
+
 ActionResult
 RemoteExecutionClient::execute_action(const proto::Digest &actionDigest,
                                       bool skipCache)
 {
+    PendingExecution execution;
+    return run_execution(actionDigest, skipCache, &execution);
+}
+
+ActionResult
+RemoteExecutionClient::run_execution(const proto::Digest &actionDigest,
+                                     bool skipCache,
+                                     PendingExecution *execution)
+{
+    {
+        std::lock_guard<std::mutex> lock(d_cancelMutex);
+        if (d_cancelled) {
+            throw ExecutionCancelled();
+        }
+        d_pendingExecutions.insert(execution);
+    }
+    const auto unregister = [&]() {
+        std::lock_guard<std::mutex> lock(d_cancelMutex);
+        d_pendingExecutions.erase(execution);
+    };
+
     /* Prepare an asynchronous Execute request */
     proto::ExecuteRequest executeRequest;
     executeRequest.set_instance_name(d_instanceName);
@@ -215,16 +267,57 @@ RemoteExecutionClient::execute_action(const proto::Digest &actionDigest,
 
     /* Create the lambda to pass to grpc_retry */
     auto execute_lambda = [&](grpc::ClientContext &context) {
+        {
+            std::lock_guard<std::mutex> lock(d_cancelMutex);
+            if (execution->d_cancelled) {
+                throw ExecutionCancelled();
+            }
+            execution->d_context = &context;
+        }
+        // grpc_retry destroys the context after each attempt, including
+        // ones that throw, so it must not be left for `cancel()` to use
+        struct ContextReset {
+            std::mutex &d_mutex;
+            PendingExecution *d_execution;
+            ~ContextReset()
+            {
+                std::lock_guard<std::mutex> lock(d_mutex);
+                d_execution->d_context = nullptr;
+            }
+        } contextReset{d_cancelMutex, execution};
+
         reader_ptr = d_executionStub->Execute(&context, executeRequest);
 
         /* Read the result of the Execute request into an OperationPointer */
         operation_ptr = std::make_shared<Operation>();
         read_operation(reader_ptr, operation_ptr);
 
-        return reader_ptr->Finish();
+        const grpc::Status status = reader_ptr->Finish();
+
+        bool cancelled;
+        {
+            std::lock_guard<std::mutex> lock(d_cancelMutex);
+            cancelled = execution->d_cancelled;
+        }
+        // Cancelling the stream doesn't stop the execution on the server,
+        // which may otherwise keep running it
+        if (cancelled) {
+            if (!operation_ptr->name().empty()) {
+                cancel_operation(operation_ptr->name());
+            }
+            throw ExecutionCancelled();
+        }
+        return status;
     };
 
-    grpc_retry(execute_lambda, d_grpcContext);
+    try {
+        grpc_retry(execute_lambda, d_grpcContext);
+    }
+    catch (...) {
+        unregister();
+        throw;
+    }
+    unregister();
 
     Operation operation = *operation_ptr;
     if (!operation.done()) {
@@ -254,9 +347,113 @@ RemoteExecutionClient::execute_action(const proto::Digest &actionDigest,
                                << " path=[" << dirProto.path() << "]");
         }
     }
+    execution->d_result = resultProto;
     return from_proto(resultProto);
 }
 
+ActionResult RemoteExecutionClient::execute_action_hedged(
+    const proto::Digest &actionDigest, const proto::Digest &hedgeActionDigest,
+    std::chrono::milliseconds hedgeDelay, bool skipCache)
+{
+    PendingExecution first;
+    auto firstFuture = std::async(std::launch::async, [&]() {
+        return run_execution(actionDigest, skipCache, &first);
+    });
+    if (firstFuture.wait_for(hedgeDelay) == std::future_status::ready) {
+        return firstFuture.get();
+    }
+
+    BUILDBOX_LOG_INFO("Action " << actionDigest.hash()
+                                << " still running after "
+                                << hedgeDelay.count()
+                                << " ms, executing it again as "
+                                << hedgeActionDigest.hash());
+    buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+        recordCounterMetric(COUNTER_NAME_HEDGED_EXECUTIONS, 1);
+
+    PendingExecution second;
+    auto secondFuture = std::async(std::launch::async, [&]() {
+        return run_execution(hedgeActionDigest, skipCache, &second);
+    });
+
+    // Use the first result to arrive. If one execution fails, wait for the
+    // other one, and only fail if both do.
+    std::future<ActionResult> *futures[] = {&firstFuture, &secondFuture};
+    PendingExecution *executions[] = {&first, &second};
+    bool done[] = {false, false};
+    std::exception_ptr firstError;
+    for (size_t i = 0;; i = 1 - i) {
+        if (done[i] || futures[i]->wait_for(HedgePollInterval) !=
+                           std::future_status::ready) {
+            continue;
+        }
+        done[i] = true;
+
+        ActionResult result;
+        try {
+            result = futures[i]->get();
+        }
+        catch (...) {
+            if (done[1 - i]) {
+                std::rethrow_exception(firstError ? firstError
+                                                  : std::current_exception());
+            }
+            firstError = std::current_exception();
+            continue;
+        }
+
+        if (!done[1 - i]) {
+            {
+                std::lock_guard<std::mutex> lock(d_cancelMutex);
+                cancel(executions[1 - i]);
+            }
+            try {
+                futures[1 - i]->get();
+            }
+            catch (const std::exception &e) {
+                BUILDBOX_LOG_DEBUG("Stopped other execution: " << e.what());
+            }
+        }
+        buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+            recordCounterMetric(i == 0 ? COUNTER_NAME_HEDGE_ORIGINAL_WON
+                                       : COUNTER_NAME_HEDGE_DUPLICATE_WON,
+                                1);
+
+        // The server only cached the result under the duplicate's digest,
+        // which the next build won't look up
+        if (i == 1 && result.d_exitCode == 0) {
+            try {
+                update_action_cache(actionDigest, second.d_result);
+            }
+            catch (const std::exception &e) {
+                BUILDBOX_LOG_WARNING("Could not store the result of "
+                                     << hedgeActionDigest.hash() << " as "
+                                     << actionDigest.hash() << ": "
+                                     << e.what());
+            }
+        }
+        return result;
+    }
+}
+
+void RemoteExecutionClient::cancel(PendingExecution *execution)
+{
+    execution->d_cancelled = true;
+    if (execution->d_context != nullptr) {
+        // Makes the pending read of the Operation stream return.
+        execution->d_context->TryCancel();
+    }
+}
+
+void RemoteExecutionClient::cancel_execution()
+{
+    std::lock_guard<std::mutex> lock(d_cancelMutex);
+    d_cancelled = true;
+    for (const auto execution : d_pendingExecutions) {
+        cancel(execution);
+    }
+}
+
 void RemoteExecutionClient::cancel_operation(const std::string &operationName)
 {
     proto::CancelOperationRequest cancelRequest;
@@ -287,13 +484,59 @@ void RemoteExecutionClient::write_files_to_disk(const ActionResult &result,
         buildboxcommon::buildboxcommonmetrics::DurationMetricTimer>
         mt(TIMER_NAME_FETCH_WRITE_RESULTS);
 
-    for (const auto &fileIter : result.d_outputFiles) {
-        const std::string path = std::string(root) + "/" + fileIter.first;
-        BUILDBOX_LOG_DEBUG("Writing " << path);
-        FileUtils::writeFile(path, get_outputblob(fileIter.second));
-        if (fileIter.second.d_executable) {
-            buildboxcommon::FileUtils::makeExecutable(path.c_str());
-        }
+    OutputWriter writer(root);
+    std::vector<FileInfoMap::const_iterator> outputs;
+    outputs.reserve(result.d_outputFiles.size());
+    for (auto it = result.d_outputFiles.cbegin();
+         it != result.d_outputFiles.cend(); ++it) {
+        outputs.push_back(it);
+    }
+
+    // Each output is written by the thread that fetched it, so fetches
+    // overlap with writes and the blobs aren't all held in memory at once.
+    // Outputs that are already on disk aren't fetched at all.
+    std::atomic<int64_t> unchangedOutputs(0);
+    std::atomic<int64_t> unchangedBytes(0);
+    std::mutex errorMutex;
+    std::exception_ptr error;
+    typedef std::vector<FileInfoMap::const_iterator>::iterator OutputIterator;
+    std::function<void(OutputIterator, OutputIterator)> writeOutputs =
+        [&](OutputIterator start, OutputIterator end) {
+            for (; start != end; ++start) {
+                const auto &output = **start;
+                try {
+                    if (writer.isUpToDate(output.first, output.second.d_digest,
+                                          output.second.d_executable,
+                                          !RECC_PRESERVE_UNCHANGED_MTIME)) {
+                        ++unchangedOutputs;
+                        unchangedBytes += output.second.d_digest.size_bytes();
+                        continue;
+                    }
+                    writer.write(output.first, get_outputblob(output.second),
+                                 output.second.d_executable);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                    return;
+                }
+            }
+        };
+    ThreadUtils::parallelizeContainerOperations(outputs, writeOutputs);
+
+    if (unchangedOutputs > 0) {
+        buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+            recordCounterMetric(COUNTER_NAME_UNCHANGED_OUTPUTS,
+                                unchangedOutputs);
+        buildboxcommon::buildboxcommonmetrics::CountingMetricUtil::
+            recordCounterMetric(COUNTER_NAME_UNCHANGED_OUTPUT_BYTES,
+                                unchangedBytes);
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
     }
 }
 
@@ -305,6 +548,7 @@ RemoteExecutionClient::from_proto(const proto::ActionResult &proto)
     result.d_exitCode = proto.exit_code();
     result.d_stdOut = OutputBlob(proto.stdout_raw(), proto.stdout_digest());
     result.d_stdErr = OutputBlob(proto.stderr_raw(), proto.stderr_digest());
+    result.d_executionMetadata = proto.execution_metadata();
 
     for (int i = 0; i < proto.output_files_size(); ++i) {
         auto fileProto = proto.output_files(i);
@@ -20,8 +20,11 @@
 #include <protos.h>
 
 #include <atomic>
+#include <chrono>
 #include <map>
+#include <mutex>
 #include <set>
+#include <stdexcept>
 
 namespace BloombergLP {
 namespace recc {
@@ -65,6 +68,16 @@ struct ActionResult {
     OutputBlob d_stdErr;
     int d_exitCode;
     FileInfoMap d_outputFiles;
+    proto::ExecutedActionMetadata d_executionMetadata;
+};
+
+/**
+ * Thrown by `RemoteExecutionClient::execute_action()` if the execution was
+ * cancelled with `cancel_execution()`.
+ */
+class ExecutionCancelled : public std::runtime_error {
+  public:
+    ExecutionCancelled() : std::runtime_error("Execution was cancelled") {}
 };
 
 class RemoteExecutionClient final : public CASClient {
@@ -76,6 +89,35 @@ class RemoteExecutionClient final : public CASClient {
     static std::atomic_bool s_sigint_received;
     GrpcContext *d_grpcContext;
 
+    /**
+     * An execution in progress, which can be cancelled from another thread.
+     */
+    struct PendingExecution {
+        bool d_cancelled = false;
+        grpc::ClientContext *d_context = nullptr;
+        // Set by the thread running the execution once it finishes
+        proto::ActionResult d_result;
+    };
+
+    // Protects the members below and the contents of the
+    // `PendingExecution`s, which let `cancel_execution()` and hedged
+    // executions stop executions running in other threads.
+    std::mutex d_cancelMutex;
+    bool d_cancelled = false;
+    std::set<PendingExecution *> d_pendingExecutions;
+
+    /**
+     * Implements `execute_action()`, registering the execution so that it
+     * can be cancelled.
+     */
+    ActionResult run_execution(const proto::Digest &actionDigest,
+                               bool skipCache, PendingExecution *execution);
+
+    /**
+     * Cancel the given execution. `d_cancelMutex` must be held.
+     */
+    static void cancel(PendingExecution *execution);
+
     void read_operation(ReaderPointer &reader,
                         OperationPointer &operation_ptr);
 
@@ -143,6 +185,14 @@ class RemoteExecutionClient final : public CASClient {
                                  const std::string &instanceName,
                                  ActionResult *result);
 
+    /**
+     * Store the given ActionResult in the action cache as the result of the
+     * action with the given digest. The Action and the blobs referenced by
+     * the ActionResult should already be present in the server's CAS.
+     */
+    void update_action_cache(const proto::Digest &actionDigest,
+                             const proto::ActionResult &result);
+
     /**
      * Run the action with the given digest on the given server, waiting
      * synchronously for it to complete. The Action must already be present in
@@ -151,6 +201,29 @@ class RemoteExecutionClient final : public CASClient {
     ActionResult execute_action(const proto::Digest &actionDigest,
                                 bool skipCache = false);
 
+    /**
+     * Like `execute_action()`, but if the action hasn't finished after
+     * `hedgeDelay`, also execute `hedgeActionDigest`, which must be an
+     * equivalent Action that the server won't merge with the first one
+     * (e.g. with a different salt). The first result to arrive is returned
+     * and the other execution is cancelled.
+     *
+     * If the second execution wins with a successful result, that result
+     * is also stored in the action cache as the result of `actionDigest`,
+     * for the next build to find. The Action must therefore be cacheable.
+     */
+    ActionResult execute_action_hedged(const proto::Digest &actionDigest,
+                                       const proto::Digest &hedgeActionDigest,
+                                       std::chrono::milliseconds hedgeDelay,
+                                       bool skipCache = false);
+
+    /**
+     * Cancel the calls to `execute_action()` running in other threads: their
+     * Operations are cancelled and they throw `ExecutionCancelled`. Later
+     * calls throw immediately.
+     */
+    void cancel_execution();
+
     /**
      * Get the contents of the given OutputBlob.
      */
@@ -161,6 +234,15 @@ class RemoteExecutionClient final : public CASClient {
 
     /**
      * Write the given ActionResult's output files to disk.
+     *
+     * Outputs are fetched and written in parallel (see
+     * `ThreadUtils::parallelizeContainerOperations()`), and each one is
+     * replaced atomically. Outputs that are already on disk with the right
+     * contents are neither fetched nor written; their modification time is
+     * updated unless `RECC_PRESERVE_UNCHANGED_MTIME` is set.
+     *
+     * If an output can't be fetched or written, the first error is
+     * rethrown once all of the threads have finished.
      */
     void write_files_to_disk(const ActionResult &result,
                              const char *root = ".");
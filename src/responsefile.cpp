@@ -0,0 +1,196 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <responsefile.h>
+
+#include <fileutils.h>
+
+#include <fstream>
+#include <sstream>
+
+namespace BloombergLP {
+namespace recc {
+
+namespace {
+
+bool isWhitespace(char character)
+{
+    return character == ' ' || character == '\t' || character == '\n' ||
+           character == '\r' || character == '\f' || character == '\v';
+}
+
+bool readFile(const std::string &path, std::string *contents)
+{
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    std::ostringstream stream;
+    stream << file.rdbuf();
+    if (file.bad()) {
+        return false;
+    }
+    *contents = stream.str();
+    return true;
+}
+
+void expandInto(const std::vector<std::string> &arguments, size_t start,
+                const std::string &directory, bool relativeToContainingFile,
+                int depth, std::vector<std::string> *result, bool *expanded)
+{
+    for (size_t i = start; i < arguments.size(); ++i) {
+        const std::string &argument = arguments[i];
+        if (argument.size() < 2 || argument.front() != '@' ||
+            depth >= ResponseFile::MaxDepth) {
+            result->push_back(argument);
+            continue;
+        }
+
+        const std::string path = argument[1] == '/' || directory.empty()
+                                     ? argument.substr(1)
+                                     : directory + "/" + argument.substr(1);
+        std::string contents;
+        if (!readFile(path, &contents)) {
+            result->push_back(argument);
+            continue;
+        }
+
+        *expanded = true;
+        const auto slash = path.rfind('/');
+        const std::string nestedDirectory =
+            !relativeToContainingFile ? directory
+            : slash == std::string::npos ? ""
+            : slash == 0                 ? "/"
+                                         : path.substr(0, slash);
+        expandInto(ResponseFile::parse(contents), 0, nestedDirectory,
+                   relativeToContainingFile, depth + 1, result, expanded);
+    }
+}
+
+} // namespace
+
+std::vector<std::string> ResponseFile::parse(const std::string &contents)
+{
+    std::vector<std::string> result;
+    auto it = contents.begin();
+    const auto end = contents.end();
+    while (true) {
+        while (it != end && isWhitespace(*it)) {
+            ++it;
+        }
+        if (it == end) {
+            return result;
+        }
+
+        // An argument runs until unquoted whitespace, and exists even if
+        // it is empty (e.g. `""`)
+        std::string argument;
+        bool singleQuoted = false;
+        bool doubleQuoted = false;
+        for (; it != end; ++it) {
+            const char character = *it;
+            if (character == '\\') {
+                if (++it == end) {
+                    break;
+                }
+                argument.push_back(*it);
+            }
+            else if (singleQuoted) {
+                if (character == '\'') {
+                    singleQuoted = false;
+                }
+                else {
+                    argument.push_back(character);
+                }
+            }
+            else if (doubleQuoted) {
+                if (character == '"') {
+                    doubleQuoted = false;
+                }
+                else {
+                    argument.push_back(character);
+                }
+            }
+            else if (isWhitespace(character)) {
+                break;
+            }
+            else if (character == '\'') {
+                singleQuoted = true;
+            }
+            else if (character == '"') {
+                doubleQuoted = true;
+            }
+            else {
+                argument.push_back(character);
+            }
+        }
+        result.push_back(std::move(argument));
+    }
+}
+
+std::string ResponseFile::serialize(const std::vector<std::string> &arguments)
+{
+    std::string result;
+    for (const auto &argument : arguments) {
+        if (argument.empty()) {
+            result += "\"\"";
+        }
+        for (const char character : argument) {
+            if (character == '\\' || character == '\'' || character == '"' ||
+                isWhitespace(character)) {
+                result.push_back('\\');
+            }
+            result.push_back(character);
+        }
+        result.push_back('\n');
+    }
+    return result;
+}
+
+std::vector<std::string>
+ResponseFile::expand(const std::vector<std::string> &command,
+                     const std::string &workingDirectory,
+                     bool relativeToContainingFile, bool *expanded)
+{
+    bool anyExpanded = false;
+    std::vector<std::string> result;
+    if (!command.empty()) {
+        result.reserve(command.size());
+        result.push_back(command.front());
+        expandInto(command, 1, workingDirectory, relativeToContainingFile, 0,
+                   &result, &anyExpanded);
+    }
+    if (expanded != nullptr) {
+        *expanded = anyExpanded;
+    }
+    return result;
+}
+
+TemporaryResponseFile::TemporaryResponseFile(
+    const std::vector<std::string> &command)
+    : d_file("recc-rsp")
+{
+    d_file.close();
+    if (!command.empty()) {
+        FileUtils::writeFile(
+            d_file.strname(),
+            ResponseFile::serialize(std::vector<std::string>(
+                command.begin() + 1, command.end())));
+        d_command = {command.front(), "@" + d_file.strname()};
+    }
+}
+
+} // namespace recc
+} // namespace BloombergLP
@@ -0,0 +1,100 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef INCLUDED_RESPONSEFILE
+#define INCLUDED_RESPONSEFILE
+
+#include <buildboxcommon_temporaryfile.h>
+
+#include <string>
+#include <vector>
+
+namespace BloombergLP {
+namespace recc {
+
+/**
+ * Handles response files, which hold command arguments that compilers read
+ * in place of an `@file` argument.
+ *
+ * Arguments in a response file are quoted the way GCC and clang read them:
+ * they are separated by whitespace, single and double quotes group
+ * characters into an argument, and a backslash escapes the next character
+ * anywhere, including inside quotes.
+ */
+struct ResponseFile {
+    /**
+     * Split the contents of a response file into arguments.
+     */
+    static std::vector<std::string> parse(const std::string &contents);
+
+    /**
+     * Return the contents of a response file that `parse()` splits into the
+     * given arguments.
+     */
+    static std::string serialize(const std::vector<std::string> &arguments);
+
+    /**
+     * Return the given command with each `@file` argument after the first
+     * replaced by the arguments in the file, which can refer to further
+     * response files.
+     *
+     * Relative paths are relative to `workingDirectory`, or to the current
+     * directory if it is empty. If `relativeToContainingFile` is set, as
+     * clang does, those in a response file are instead relative to the
+     * directory of that file.
+     *
+     * As with GCC, an `@file` argument is kept as is if the file can't be
+     * read, or if it is nested too deeply (e.g. because it includes
+     * itself).
+     *
+     * If `expanded` is given, it is set to whether any argument was
+     * replaced.
+     */
+    static std::vector<std::string>
+    expand(const std::vector<std::string> &command,
+           const std::string &workingDirectory = "",
+           bool relativeToContainingFile = false, bool *expanded = nullptr);
+
+    // How many response files can be nested in each other
+    static const int MaxDepth = 32;
+};
+
+/**
+ * A temporary response file holding the arguments of a command, so that
+ * commands with more arguments than the system allows (e.g. after their
+ * response files were expanded) can still be run.
+ */
+class TemporaryResponseFile {
+  public:
+    /**
+     * Write the arguments after the first of the given command to a
+     * temporary file, which is removed when this is destroyed.
+     */
+    explicit TemporaryResponseFile(const std::vector<std::string> &command);
+
+    /**
+     * Return the command, with its arguments replaced by the file.
+     */
+    const std::vector<std::string> &command() const { return d_command; }
+
+  private:
+    buildboxcommon::TemporaryFile d_file;
+    std::vector<std::string> d_command;
+};
+
+} // namespace recc
+} // namespace BloombergLP
+
+#endif
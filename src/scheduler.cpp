@@ -0,0 +1,84 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <scheduler.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <unistd.h>
+
+#if defined(__sun)
+#include <sys/loadavg.h>
+#endif
+
+namespace BloombergLP {
+namespace recc {
+
+SchedulingDecision Scheduler::decide(const ExecutionHistory &history,
+                                     double load, bool remoteAvailable)
+{
+    std::ostringstream reason;
+    if (!remoteAvailable) {
+        return {true, "the remote servers are unavailable"};
+    }
+
+    if (history.d_remoteExecution.d_count == 0) {
+        return {false, "no remote timings yet"};
+    }
+
+    if (history.d_localExecution.d_count == 0) {
+        if (load < 1) {
+            reason << "no local timings yet, and the host is not busy (load "
+                   << load << " per CPU)";
+            return {true, reason.str()};
+        }
+        reason << "no local timings yet, and the host is busy (load "
+               << load << " per CPU)";
+        return {false, reason.str()};
+    }
+
+    const double remote = history.remoteEstimate();
+    const double local =
+        history.d_localExecution.d_mean * std::max(1.0, load);
+    const bool runLocally = local < remote;
+    reason << "estimated " << static_cast<int64_t>(local)
+           << " ms locally (load " << load << " per CPU) vs "
+           << static_cast<int64_t>(remote) << " ms remotely (upload "
+           << static_cast<int64_t>(history.d_upload.d_mean) << ", queue "
+           << static_cast<int64_t>(history.d_remoteQueue.d_mean)
+           << ", execution "
+           << static_cast<int64_t>(history.d_remoteExecution.d_mean)
+           << ", download "
+           << static_cast<int64_t>(history.d_download.d_mean) << ")";
+    return {runLocally, reason.str()};
+}
+
+double Scheduler::currentLoad()
+{
+#if defined(_AIX)
+    return 0;
+#else
+    double loadAverage = 0;
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (getloadavg(&loadAverage, 1) != 1 || cpus <= 0) {
+        return 0;
+    }
+    return loadAverage / static_cast<double>(cpus);
+#endif
+}
+
+} // namespace recc
+} // namespace BloombergLP
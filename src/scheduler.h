@@ -0,0 +1,57 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef INCLUDED_SCHEDULER
+#define INCLUDED_SCHEDULER
+
+#include <executionhistory.h>
+
+#include <string>
+
+namespace BloombergLP {
+namespace recc {
+
+struct SchedulingDecision {
+    bool d_runLocally;
+    // Human-readable explanation of the decision
+    std::string d_reason;
+};
+
+struct Scheduler {
+    /**
+     * Decide whether to run a command that isn't in the action cache
+     * locally or remotely, based on its history, the current load of the
+     * host (as returned by `currentLoad()`) and whether the remote
+     * servers are available, as tracked by the `CircuitBreaker`.
+     *
+     * Commands run remotely until there are timings to compare: once the
+     * remote timings are known, the command is run locally once to measure
+     * it, if the host isn't busy. After that, whichever is estimated to be
+     * faster is used, with the local time scaled by the load.
+     */
+    static SchedulingDecision decide(const ExecutionHistory &history,
+                                     double load, bool remoteAvailable);
+
+    /**
+     * Return the load average of the host over the last minute, divided by
+     * the number of CPUs, or 0 if it isn't available.
+     */
+    static double currentLoad();
+};
+
+} // namespace recc
+} // namespace BloombergLP
+
+#endif
@@ -1,4 +1,4 @@
-// Copyright 2018 Bloomberg Finance L.P
+// Copyright 2020 Bloomberg Finance L.P
 //
 // Licensed under the Apache License, Version 2.0 (the "License");
 // you may not use this file except in compliance with the License.
@@ -14,14 +14,18 @@
 
 #include <subprocess.h>
 
+#include <fileutils.h>
+
+#include <algorithm>
 #include <array>
 #include <cerrno>
 #include <cstring>
+#include <fcntl.h>
 #include <map>
-#include <memory>
-#include <sstream>
-#include <sys/select.h>
-#include <sys/time.h>
+#include <mutex>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <system_error>
@@ -29,164 +33,433 @@
 
 #include <buildboxcommon_logging.h>
 
+extern char **environ;
+
 namespace BloombergLP {
 namespace recc {
 
 namespace {
-static std::array<int, 2> createPipe()
+
+// As much as a pipe holds by default, so that one read() empties it
+const size_t ReadSize = 64 * 1024;
+
+// How often to check on children that have closed their output but not
+// exited yet
+const int ExitPollIntervalMs = 10;
+
+std::array<int, 2> createPipe()
 {
-    std::array<int, 2> pipe_fds = {0, 0};
+    std::array<int, 2> pipe_fds = {-1, -1};
 
-    if (pipe(pipe_fds.data()) == -1) {
+    // Close-on-exec, so that pipes of concurrently spawned processes don't
+    // leak into each other; the ends a child uses are dup2()ed
+#if defined(__linux__)
+    const int status = pipe2(pipe_fds.data(), O_CLOEXEC);
+#else
+    int status = pipe(pipe_fds.data());
+    if (status == 0) {
+        fcntl(pipe_fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(pipe_fds[1], F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    if (status == -1) {
         BUILDBOX_LOG_ERROR("Error calling `pipe()`: " << strerror(errno));
         throw std::system_error(errno, std::system_category());
     }
     return pipe_fds;
 }
 
-} // namespace
+void closeFd(int *fd)
+{
+    if (*fd != -1) {
+        close(*fd);
+        *fd = -1;
+    }
+}
 
-Subprocess::SubprocessResult
-Subprocess::execute(const std::vector<std::string> &command, bool pipeStdOut,
-                    bool pipeStdErr,
-                    const std::map<std::string, std::string> &env)
+int exitCodeFromStatus(int status)
 {
-    // Convert the command to a char*[]
-    size_t argc = command.size();
-    std::unique_ptr<const char *[]> argv(new const char *[argc + 1]);
-    for (size_t i = 0; i < argc; ++i) {
-        argv[i] = command[i].c_str();
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    if (WIFSIGNALED(status)) {
+        // Exit code as returned by Bash.
+        // (https://gnu.org/software/bash/manual/html_node/Exit-Status.html)
+        return 128 + WTERMSIG(status);
     }
-    argv[argc] = nullptr;
 
-    // Pipe, fork and exec
-    auto stdOutPipeFDs = createPipe();
-    auto stdErrPipeFDs = createPipe();
+    /* According to the documentation for `waitpid()` we should never get
+     * here:
+     *
+     * "If the information pointed to by stat_loc was stored by a call to
+     * waitpid() that did not specify the WUNTRACED  or
+     * CONTINUED flags, or by a call to the wait() function,
+     * exactly one of the macros WIFEXITED(*stat_loc) and
+     * WIFSIGNALED(*stat_loc) shall evaluate to a non-zero value."
+     *
+     * (https://pubs.opengroup.org/onlinepubs/009695399/functions/wait.html)
+     */
+    throw std::runtime_error("`waitpid()` returned an unexpected status: " +
+                             std::to_string(status));
+}
 
-    const auto pid = fork();
-    if (pid == -1) {
-        BUILDBOX_LOG_ERROR("Error calling `fork()`: " << strerror(errno));
-        throw std::system_error(errno, std::system_category());
+/**
+ * The environment of a child: ours, with the given variables added or
+ * replaced. Built before spawning, so the child doesn't have to call
+ * setenv().
+ */
+class Environment {
+  public:
+    explicit Environment(const std::map<std::string, std::string> &env)
+    {
+        if (env.empty()) {
+            return;
+        }
+
+        for (char **variable = environ; *variable != nullptr; ++variable) {
+            const char *equals = strchr(*variable, '=');
+            const std::string name =
+                equals ? std::string(*variable,
+                                     static_cast<size_t>(equals - *variable))
+                       : std::string(*variable);
+            if (env.count(name) == 0) {
+                d_pointers.push_back(*variable);
+            }
+        }
+        for (const auto &envPair : env) {
+            d_variables.push_back(envPair.first + "=" + envPair.second);
+        }
+        for (const auto &variable : d_variables) {
+            d_pointers.push_back(const_cast<char *>(variable.c_str()));
+        }
+        d_pointers.push_back(nullptr);
     }
 
-    if (pid == 0) {
-        // (runs only in the child)
-        if (pipeStdOut) {
-            close(stdOutPipeFDs[0]);
-            dup2(stdOutPipeFDs[1],
-                 STDOUT_FILENO); // redirect stdout to input end of pipe
-            close(stdOutPipeFDs[1]);
+    char *const *envp() const
+    {
+        return d_pointers.empty() ? environ : d_pointers.data();
+    }
+
+  private:
+    std::vector<std::string> d_variables;
+    std::vector<char *> d_pointers;
+};
+
+/**
+ * Return the executable that `execvp()` would run for the given command
+ * name with the given `PATH`, or an empty string if there is none.
+ */
+std::string findInPath(const std::string &name, const std::string &path)
+{
+    size_t start = 0;
+    while (start <= path.size()) {
+        size_t end = path.find(':', start);
+        if (end == std::string::npos) {
+            end = path.size();
         }
-        if (pipeStdErr) {
-            close(stdErrPipeFDs[0]);
-            dup2(stdErrPipeFDs[1],
-                 STDERR_FILENO); // redirect stderr to input end of pipe
-            close(stdErrPipeFDs[1]);
+        const std::string directory = path.substr(start, end - start);
+        const std::string candidate =
+            (directory.empty() ? "." : directory) + "/" + name;
+        if (access(candidate.c_str(), X_OK) == 0) {
+            return candidate;
         }
+        start = end + 1;
+    }
+    return "";
+}
 
-        for (const auto &envPair : env) {
-            setenv(envPair.first.c_str(), envPair.second.c_str(), 1);
+/**
+ * A child process whose output is being collected.
+ */
+struct Child {
+    pid_t d_pid = -1;
+    int d_stdOutFd = -1;
+    int d_stdErrFd = -1;
+    Subprocess::SubprocessResult *d_result = nullptr;
+
+    bool outputOpen() const { return d_stdOutFd != -1 || d_stdErrFd != -1; }
+};
+
+#ifndef RECC_HAVE_POSIX_SPAWN_ADDCHDIR
+// Without posix_spawn_file_actions_addchdir_np(), children are started in
+// another directory by changing that of the whole process for a moment
+std::mutex ChdirMutex;
+#endif
+
+/**
+ * Start the given command, filling in `child`. If it can't be started,
+ * the exit code is set in the result the way a shell would set it and
+ * `child->d_pid` is left as -1.
+ *
+ * If `directory` is not empty, the command is run in it. If that isn't a
+ * directory, the exit code is 1 and the reason is set as its standard
+ * error.
+ */
+void spawn(const std::vector<std::string> &command, bool pipeStdOut,
+           bool pipeStdErr, const std::map<std::string, std::string> &env,
+           const std::string &directory, Child *child)
+{
+    if (!directory.empty()) {
+        struct stat statResult;
+        const int statError =
+            stat(directory.c_str(), &statResult) != 0 ? errno
+            : !S_ISDIR(statResult.st_mode)           ? ENOTDIR
+                                                     : 0;
+        if (statError != 0) {
+            child->d_result->d_exitCode = 1;
+            child->d_result->d_stdErr = "Could not change to directory \"" +
+                                        directory +
+                                        "\": " + strerror(statError) + "\n";
+            return;
         }
+    }
 
-        const auto exec_status =
-            execvp(argv[0], const_cast<char *const *>(argv.get()));
+    std::vector<char *> argv;
+    for (const auto &argument : command) {
+        argv.push_back(const_cast<char *>(argument.c_str()));
+    }
+    argv.push_back(nullptr);
 
-        int exit_code = 1;
-        if (exec_status != 0) {
-            const auto exec_error = errno;
-            // Following the Bash convention for exit codes.
-            // (https://gnu.org/software/bash/manual/html_node/Exit-Status.html)
-            if (exec_error == ENOENT) {
-                exit_code = 127; // "command not found"
-            }
-            else {
-                exit_code = 126; // Command invoked cannot execute
-            }
+    const Environment environment(env);
+
+    // posix_spawnp() searches our PATH; if the child gets a different one,
+    // search that instead, as execvp() in the child would have.
+    std::string executable;
+    const auto pathIter = env.find("PATH");
+    if (pathIter != env.end() && !command.empty() &&
+        command[0].find('/') == std::string::npos) {
+        executable = findInPath(command[0], pathIter->second);
+        if (executable.empty()) {
+            child->d_result->d_exitCode = 127; // "command not found"
+            return;
         }
+    }
 
-        _Exit(exit_code);
+    std::array<int, 2> stdOutPipe = {-1, -1};
+    std::array<int, 2> stdErrPipe = {-1, -1};
+    posix_spawn_file_actions_t fileActions;
+    posix_spawn_file_actions_init(&fileActions);
+    try {
+        if (pipeStdOut) {
+            stdOutPipe = createPipe();
+            posix_spawn_file_actions_adddup2(&fileActions, stdOutPipe[1],
+                                             STDOUT_FILENO);
+        }
+        if (pipeStdErr) {
+            stdErrPipe = createPipe();
+            posix_spawn_file_actions_adddup2(&fileActions, stdErrPipe[1],
+                                             STDERR_FILENO);
+        }
+    }
+    catch (...) {
+        posix_spawn_file_actions_destroy(&fileActions);
+        for (auto *pipeFds : {&stdOutPipe, &stdErrPipe}) {
+            closeFd(&(*pipeFds)[0]);
+            closeFd(&(*pipeFds)[1]);
+        }
+        throw;
     }
 
-    // (runs only in the parent)
-    SubprocessResult result;
+#ifdef RECC_HAVE_POSIX_SPAWN_ADDCHDIR
+    if (!directory.empty()) {
+        posix_spawn_file_actions_addchdir_np(&fileActions, directory.c_str());
+    }
+#else
+    std::unique_lock<std::mutex> chdirLock(ChdirMutex, std::defer_lock);
+    std::string startDirectory;
+    if (!directory.empty()) {
+        chdirLock.lock();
+        startDirectory = FileUtils::getCurrentWorkingDirectory();
+        if (chdir(directory.c_str()) != 0) {
+            startDirectory.clear();
+        }
+    }
+#endif
+
+    // posix_spawn() uses vfork() or an equivalent where it can, so this
+    // doesn't copy the page tables of a large parent
+    pid_t pid = -1;
+    const int spawnError =
+        executable.empty()
+            ? posix_spawnp(&pid, argv[0], &fileActions, nullptr,
+                           argv.data(), environment.envp())
+            : posix_spawn(&pid, executable.c_str(), &fileActions, nullptr,
+                          argv.data(), environment.envp());
+    posix_spawn_file_actions_destroy(&fileActions);
 
-    // Get the output from the child process
-    fd_set fdSet;
-    FD_ZERO(&fdSet);
-    if (pipeStdOut) {
-        FD_SET(stdOutPipeFDs[0], &fdSet);
-        close(stdOutPipeFDs[1]);
+#ifndef RECC_HAVE_POSIX_SPAWN_ADDCHDIR
+    if (!startDirectory.empty() && chdir(startDirectory.c_str()) != 0) {
+        BUILDBOX_LOG_WARNING("Could not change back to directory \""
+                             << startDirectory << "\": " << strerror(errno));
     }
-    if (pipeStdErr) {
-        FD_SET(stdErrPipeFDs[0], &fdSet);
-        close(stdErrPipeFDs[1]);
+#endif
+
+    closeFd(&stdOutPipe[1]);
+    closeFd(&stdErrPipe[1]);
+
+    if (spawnError != 0) {
+        closeFd(&stdOutPipe[0]);
+        closeFd(&stdErrPipe[0]);
+        // Following the Bash convention for exit codes.
+        // (https://gnu.org/software/bash/manual/html_node/Exit-Status.html)
+        child->d_result->d_exitCode =
+            spawnError == ENOENT ? 127  // "command not found"
+                                 : 126; // Command invoked cannot execute
+        return;
     }
 
-    char buffer[4096];
-    while (FD_ISSET(stdOutPipeFDs[0], &fdSet) ||
-           FD_ISSET(stdErrPipeFDs[0], &fdSet)) {
-        fd_set readFDSet = fdSet;
+    child->d_pid = pid;
+    child->d_stdOutFd = stdOutPipe[0];
+    child->d_stdErrFd = stdErrPipe[0];
+}
 
-        struct timeval timeout;
-        timeout.tv_sec = 5;
-        timeout.tv_usec = 0;
+/**
+ * Read what is available from `*fd` into `output`, closing it at the end
+ * of the stream.
+ */
+void readOutput(int *fd, std::string *output)
+{
+    char buffer[ReadSize];
+    ssize_t bytesRead;
+    do {
+        bytesRead = read(*fd, buffer, sizeof(buffer));
+    } while (bytesRead == -1 && errno == EINTR);
 
-        select(FD_SETSIZE, &readFDSet, nullptr, nullptr, &timeout);
+    if (bytesRead <= 0) {
+        closeFd(fd);
+        return;
+    }
+    output->append(buffer, static_cast<size_t>(bytesRead));
+}
 
-        if (FD_ISSET(stdOutPipeFDs[0], &readFDSet)) {
-            ssize_t bytesRead = read(stdOutPipeFDs[0], buffer, sizeof(buffer));
-            if (bytesRead > 0) {
-                result.d_stdOut.append(buffer, static_cast<size_t>(bytesRead));
-            }
-            else {
-                close(stdOutPipeFDs[0]);
-                FD_CLR(stdOutPipeFDs[0], &fdSet);
+/**
+ * Collect the output of the given children until one or more have exited,
+ * and remove those from the list.
+ */
+void waitForChildren(std::vector<Child> *children)
+{
+    std::vector<pollfd> pollFds;
+    bool waitingForExit = false;
+    for (const auto &child : *children) {
+        for (const int fd : {child.d_stdOutFd, child.d_stdErrFd}) {
+            if (fd != -1) {
+                pollFds.push_back({fd, POLLIN, 0});
             }
         }
-        if (FD_ISSET(stdErrPipeFDs[0], &readFDSet)) {
-            ssize_t bytesRead = read(stdErrPipeFDs[0], buffer, sizeof(buffer));
-            if (bytesRead > 0) {
-                result.d_stdErr.append(buffer, static_cast<size_t>(bytesRead));
-            }
-            else {
-                close(stdErrPipeFDs[0]);
-                FD_CLR(stdErrPipeFDs[0], &fdSet);
-            }
+        waitingForExit = waitingForExit || !child.outputOpen();
+    }
+
+    if (!pollFds.empty()) {
+        const int timeout = waitingForExit ? ExitPollIntervalMs : -1;
+        if (poll(pollFds.data(), pollFds.size(), timeout) == -1 &&
+            errno != EINTR) {
+            throw std::system_error(errno, std::system_category(),
+                                    "Error calling `poll()`");
         }
     }
 
-    // Get the status code from the child process
-    int status;
-    if (waitpid(pid, &status, 0) == -1) {
-        throw std::system_error(errno, std::system_category());
+    size_t pollIndex = 0;
+    for (auto &child : *children) {
+        if (child.d_stdOutFd != -1 && pollFds[pollIndex++].revents != 0) {
+            readOutput(&child.d_stdOutFd, &child.d_result->d_stdOut);
+        }
+        if (child.d_stdErrFd != -1 && pollFds[pollIndex++].revents != 0) {
+            readOutput(&child.d_stdErrFd, &child.d_result->d_stdErr);
+        }
     }
 
-    if (WIFEXITED(status)) {
-        result.d_exitCode = WEXITSTATUS(status);
+    // Once a child's output is closed, it is about to exit. If that is
+    // the only child, wait for it; otherwise keep collecting the output
+    // of the others and check on it between polls.
+    const bool block =
+        children->size() == 1 && !children->front().outputOpen();
+    const size_t childCount = children->size();
+    for (auto it = children->begin(); it != children->end();) {
+        if (it->outputOpen()) {
+            ++it;
+            continue;
+        }
+
+        int status;
+        pid_t waited;
+        do {
+            waited = waitpid(it->d_pid, &status, block ? 0 : WNOHANG);
+        } while (waited == -1 && errno == EINTR);
+        if (waited == -1) {
+            throw std::system_error(errno, std::system_category());
+        }
+        if (waited == 0) {
+            ++it;
+            continue;
+        }
+
+        it->d_result->d_exitCode = exitCodeFromStatus(status);
+        it = children->erase(it);
     }
-    else if (WIFSIGNALED(status)) {
-        result.d_exitCode = 128 + WTERMSIG(status);
-        // Exit code as returned by Bash.
-        // (https://gnu.org/software/bash/manual/html_node/Exit-Status.html)
+
+    // None of the children have output left to wait for, but none have
+    // exited yet either: wait a little, rather than spin checking on them.
+    if (pollFds.empty() && children->size() == childCount) {
+        poll(nullptr, 0, ExitPollIntervalMs);
     }
-    else {
-        /* According to the documentation for `waitpid()` we should never get
-         * here:
-         *
-         * "If the information pointed to by stat_loc was stored by a call to
-         * waitpid() that did not specify the WUNTRACED  or
-         * CONTINUED flags, or by a call to the wait() function,
-         * exactly one of the macros WIFEXITED(*stat_loc) and
-         * WIFSIGNALED(*stat_loc) shall evaluate to a non-zero value."
-         *
-         * (https://pubs.opengroup.org/onlinepubs/009695399/functions/wait.html)
-         */
-        throw std::runtime_error(
-            "`waitpid()` returned an unexpected status: " +
-            std::to_string(status));
+}
+
+} // namespace
+
+Subprocess::SubprocessResult
+Subprocess::execute(const std::vector<std::string> &command, bool pipeStdOut,
+                    bool pipeStdErr,
+                    const std::map<std::string, std::string> &env,
+                    const std::string &cwd)
+{
+    SubprocessResult result;
+    result.d_exitCode = 0;
+
+    std::vector<Child> children(1);
+    children[0].d_result = &result;
+    spawn(command, pipeStdOut, pipeStdErr, env, cwd, &children[0]);
+    if (children[0].d_pid == -1) {
+        return result;
     }
 
+    while (!children.empty()) {
+        waitForChildren(&children);
+    }
     return result;
 }
+
+std::vector<Subprocess::SubprocessResult>
+Subprocess::executeAll(const std::vector<std::vector<std::string>> &commands,
+                       const std::vector<std::string> &directories, int jobs)
+{
+    std::vector<SubprocessResult> results(commands.size());
+    for (auto &result : results) {
+        result.d_exitCode = 0;
+    }
+
+    const size_t maxChildren = static_cast<size_t>(std::max(jobs, 1));
+    const std::string noDirectory;
+    std::vector<Child> children;
+    size_t next = 0;
+    while (next < commands.size() || !children.empty()) {
+        while (next < commands.size() && children.size() < maxChildren) {
+            const size_t i = next++;
+            Child child;
+            child.d_result = &results[i];
+            spawn(commands[i], true, true, {},
+                  directories.empty() ? noDirectory : directories[i],
+                  &child);
+            if (child.d_pid != -1) {
+                children.push_back(child);
+            }
+        }
+
+        if (!children.empty()) {
+            waitForChildren(&children);
+        }
+    }
+    return results;
+}
+
 } // namespace recc
 } // namespace BloombergLP
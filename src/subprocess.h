@@ -48,7 +48,23 @@ struct Subprocess {
     static SubprocessResult
     execute(const std::vector<std::string> &command, bool pipeStdOut = false,
             bool pipeStdErr = false,
-            const std::map<std::string, std::string> &env = {});
+            const std::map<std::string, std::string> &env = {},
+            const std::string &cwd = "");
+
+    /**
+     * Execute the given commands, at most `jobs` at a time, capturing their
+     * standard output and error. Results are returned in the order of the
+     * commands.
+     *
+     * If `directories` is not empty, it holds the working directory of each
+     * command; an empty entry means the current one. A command whose
+     * directory can't be entered isn't run and gets exit code 1. The
+     * working directory of this process is left alone where the platform
+     * has `posix_spawn_file_actions_addchdir_np()`.
+     */
+    static std::vector<SubprocessResult>
+    executeAll(const std::vector<std::vector<std::string>> &commands,
+               const std::vector<std::string> &directories, int jobs);
 };
 
 } // namespace recc
@@ -0,0 +1,345 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <toolchainprobe.h>
+
+#include <deps.h>
+#include <digestgenerator.h>
+#include <env.h>
+#include <fileutils.h>
+#include <subprocess.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_logging.h>
+#include <buildboxcommonmetrics_durationmetrictimer.h>
+#include <buildboxcommonmetrics_metricguard.h>
+
+#include <cstdlib>
+#include <set>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TIMER_NAME_TOOLCHAIN_PROBE "recc.toolchain_probe"
+
+namespace BloombergLP {
+namespace recc {
+
+namespace {
+
+const std::string CacheFileHeader = "recc-toolchain-probe 1";
+// Stored instead of the toolchain information when the probe failed
+const std::string ProbeFailedLine = "probe-failed";
+const std::string CrtbeginPrefix = "crtbegin ";
+const std::string IncludePrefix = "include ";
+const std::string DefinePrefix = "define ";
+
+// Options whose value is a separate argument.
+const std::set<std::string> TargetOptionsWithArgument = {
+    "-target", "--sysroot", "-isysroot", "-arch", "--gcc-toolchain"};
+const std::vector<std::string> TargetOptionPrefixes = {
+    "--target=", "--sysroot=", "-isysroot", "--gcc-toolchain=",
+    "-m",        "-std=",      "-stdlib=",  "-nostdinc",
+    "-B"};
+
+const std::set<std::string> CxxCompilers = {"g++", "c++", "clang++"};
+
+bool startsWith(const std::string &str, const std::string &prefix)
+{
+    return str.compare(0, prefix.size(), prefix) == 0;
+}
+
+} // namespace
+
+std::vector<std::string>
+ToolchainProbe::targetOptions(const ParsedCommand &command)
+{
+    const auto &arguments = command.d_originalCommand;
+
+    std::vector<std::string> result;
+    for (size_t i = 1; i < arguments.size(); ++i) {
+        const auto &argument = arguments[i];
+        if (TargetOptionsWithArgument.count(argument)) {
+            result.push_back(argument);
+            if (i + 1 < arguments.size()) {
+                result.push_back(arguments[++i]);
+            }
+            continue;
+        }
+        for (const auto &prefix : TargetOptionPrefixes) {
+            if (startsWith(argument, prefix)) {
+                result.push_back(argument);
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+std::string ToolchainProbe::findExecutable(const std::string &name)
+{
+    if (name.find('/') != std::string::npos) {
+        return access(name.c_str(), X_OK) == 0 ? name : "";
+    }
+
+    const char *path = getenv("PATH");
+    if (path == nullptr) {
+        return "";
+    }
+
+    std::istringstream directories(path);
+    std::string directory;
+    while (std::getline(directories, directory, ':')) {
+        const std::string candidate =
+            (directory.empty() ? "." : directory) + "/" + name;
+        if (access(candidate.c_str(), X_OK) == 0) {
+            return candidate;
+        }
+    }
+    return "";
+}
+
+std::string ToolchainProbe::cacheKey(const std::string &compiler,
+                                     const std::vector<std::string> &options)
+{
+    const std::string executable = findExecutable(compiler);
+    struct stat statResult;
+    if (executable.empty() || stat(executable.c_str(), &statResult) != 0) {
+        return "";
+    }
+
+    std::ostringstream key;
+    key << executable << "\n"
+        << statResult.st_dev << ":" << statResult.st_ino << ":"
+        << statResult.st_size << ":" << statResult.st_mtime << "\n";
+    for (const auto &option : options) {
+        key << option << "\n";
+    }
+    for (const auto &envIter : RECC_DEPS_ENV) {
+        key << envIter.first << "=" << envIter.second << "\n";
+    }
+    return key.str();
+}
+
+std::vector<std::string>
+ToolchainProbe::includeDirectoriesFromV(const std::string &str)
+{
+    // The list looks like this:
+    //   #include "..." search starts here:
+    //   #include <...> search starts here:
+    //    /usr/lib/gcc/x86_64-linux-gnu/9/include
+    //    /usr/include
+    //   End of search list.
+    std::vector<std::string> result;
+    bool inList = false;
+
+    std::istringstream lines(str);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (startsWith(line, "#include <...> search starts here:")) {
+            inList = true;
+        }
+        else if (startsWith(line, "End of search list.")) {
+            break;
+        }
+        else if (inList && startsWith(line, " ")) {
+            std::string directory = line.substr(1);
+            // macOS marks framework directories
+            const std::string frameworkSuffix = " (framework directory)";
+            if (directory.size() > frameworkSuffix.size() &&
+                directory.compare(directory.size() - frameworkSuffix.size(),
+                                  frameworkSuffix.size(),
+                                  frameworkSuffix) == 0) {
+                directory.resize(directory.size() - frameworkSuffix.size());
+            }
+            result.push_back(buildboxcommon::FileUtils::normalizePath(
+                directory.c_str()));
+        }
+    }
+    return result;
+}
+
+ToolchainInfo ToolchainProbe::parseProbeOutput(const std::string &stdOut,
+                                               const std::string &stdErr)
+{
+    ToolchainInfo info;
+    if (stdErr.find("Selected GCC installation: ") != std::string::npos) {
+        info.d_crtbegin = Deps::crtbegin_from_clang_v(stdErr);
+    }
+    info.d_systemIncludeDirectories = includeDirectoriesFromV(stdErr);
+
+    const std::string define = "#define ";
+    std::istringstream lines(stdOut);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (startsWith(line, define)) {
+            info.d_predefinedMacros.push_back(line.substr(define.size()));
+        }
+    }
+    return info;
+}
+
+std::string ToolchainProbe::serialize(const ToolchainInfo &info)
+{
+    std::ostringstream result;
+    result << CacheFileHeader << "\n";
+    if (!info.d_crtbegin.empty()) {
+        result << CrtbeginPrefix << info.d_crtbegin << "\n";
+    }
+    for (const auto &directory : info.d_systemIncludeDirectories) {
+        result << IncludePrefix << directory << "\n";
+    }
+    for (const auto &macro : info.d_predefinedMacros) {
+        result << DefinePrefix << macro << "\n";
+    }
+    return result.str();
+}
+
+bool ToolchainProbe::deserialize(const std::string &data, ToolchainInfo *info)
+{
+    std::istringstream lines(data);
+    std::string line;
+    if (!std::getline(lines, line) || line != CacheFileHeader) {
+        return false;
+    }
+
+    ToolchainInfo result;
+    while (std::getline(lines, line)) {
+        if (startsWith(line, CrtbeginPrefix)) {
+            result.d_crtbegin = line.substr(CrtbeginPrefix.size());
+        }
+        else if (startsWith(line, IncludePrefix)) {
+            result.d_systemIncludeDirectories.push_back(
+                line.substr(IncludePrefix.size()));
+        }
+        else if (startsWith(line, DefinePrefix)) {
+            result.d_predefinedMacros.push_back(
+                line.substr(DefinePrefix.size()));
+        }
+        else {
+            return false;
+        }
+    }
+
+    *info = result;
+    return true;
+}
+
+bool ToolchainProbe::probe(const std::string &compiler,
+                           const std::vector<std::string> &options,
+                           ToolchainInfo *info)
+{
+    std::vector<std::string> command = {compiler};
+    command.insert(command.end(), options.begin(), options.end());
+    command.insert(command.end(), {"-E", "-v", "-dM", "/dev/null"});
+
+    buildboxcommon::buildboxcommonmetrics::MetricGuard<
+        buildboxcommon::buildboxcommonmetrics::DurationMetricTimer>
+        mt(TIMER_NAME_TOOLCHAIN_PROBE);
+
+    const auto subprocessResult =
+        Subprocess::execute(command, true, true, RECC_DEPS_ENV);
+    if (subprocessResult.d_exitCode != 0) {
+        BUILDBOX_LOG_WARNING("Failed to probe compiler \""
+                             << compiler << "\", exit status: "
+                             << subprocessResult.d_exitCode);
+        BUILDBOX_LOG_DEBUG("stderr: " << subprocessResult.d_stdErr);
+        return false;
+    }
+
+    *info = parseProbeOutput(subprocessResult.d_stdOut,
+                             subprocessResult.d_stdErr);
+    return true;
+}
+
+bool ToolchainProbe::cacheEnabled()
+{
+    return RECC_CACHE_TOOLCHAINS && !RECC_CACHE_DIR.empty();
+}
+
+ToolchainInfo ToolchainProbe::get(const ParsedCommand &command)
+{
+    ToolchainInfo info;
+    if (command.d_originalCommand.empty()) {
+        return info;
+    }
+
+    const std::string &compiler = command.d_originalCommand.front();
+    std::vector<std::string> options = targetOptions(command);
+    options.push_back("-x");
+    options.push_back(CxxCompilers.count(command.get_compiler()) ? "c++"
+                                                                 : "c");
+
+    if (!cacheEnabled()) {
+        probe(compiler, options, &info);
+        return info;
+    }
+
+    const std::string key = cacheKey(compiler, options);
+    if (key.empty()) {
+        BUILDBOX_LOG_DEBUG("Could not find compiler \"" << compiler
+                                                        << "\" to probe");
+        return info;
+    }
+
+    const std::string cacheFile = RECC_CACHE_DIR + "/toolchains/" +
+                                  DigestGenerator::make_digest(key).hash();
+
+    const std::string probeFailed =
+        CacheFileHeader + "\n" + ProbeFailedLine + "\n";
+    struct stat statResult;
+    if (stat(cacheFile.c_str(), &statResult) == 0) {
+        try {
+            const std::string data =
+                FileUtils::getFileContents(cacheFile, statResult);
+            if (data == probeFailed) {
+                BUILDBOX_LOG_DEBUG("Probing compiler \""
+                                   << compiler << "\" failed before, see "
+                                   << cacheFile);
+                return info;
+            }
+            if (deserialize(data, &info)) {
+                BUILDBOX_LOG_DEBUG("Using cached toolchain information from "
+                                   << cacheFile);
+                return info;
+            }
+        }
+        catch (const std::exception &e) {
+            BUILDBOX_LOG_DEBUG("Could not read " << cacheFile << ": "
+                                                 << e.what());
+        }
+        BUILDBOX_LOG_DEBUG("Discarding invalid " << cacheFile);
+    }
+
+    // A failure is remembered too, so that a compiler that can't be probed
+    // isn't run again for every command. The key changes with the compiler.
+    const bool probed = probe(compiler, options, &info);
+    if (!probed) {
+        info = ToolchainInfo();
+    }
+
+    try {
+        FileUtils::writeFileAtomically(cacheFile,
+                                       probed ? serialize(info) : probeFailed);
+    }
+    catch (const std::exception &e) {
+        BUILDBOX_LOG_WARNING("Could not write toolchain information to "
+                             << cacheFile << ": " << e.what());
+    }
+
+    return info;
+}
+
+} // namespace recc
+} // namespace BloombergLP
@@ -0,0 +1,117 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_TOOLCHAINPROBE
+#define INCLUDED_TOOLCHAINPROBE
+
+#include <parsedcommand.h>
+
+#include <string>
+#include <vector>
+
+namespace BloombergLP {
+namespace recc {
+
+/**
+ * Information about a compiler installation that doesn't depend on the
+ * source file being compiled.
+ */
+struct ToolchainInfo {
+    // Location of the crtbegin.o that clang uses to select a GCC
+    // installation, empty if not applicable
+    std::string d_crtbegin;
+    // Directories searched for `#include <...>`, in order
+    std::vector<std::string> d_systemIncludeDirectories;
+    // Predefined macros, as printed by `-dM -E` without the `#define `
+    std::vector<std::string> d_predefinedMacros;
+};
+
+struct ToolchainProbe {
+    /**
+     * Return the toolchain information for the compiler used by the given
+     * command.
+     *
+     * If `cacheEnabled()`, the compiler is only probed the first time it
+     * is seen; results, including failures, are persisted under
+     * `RECC_CACHE_DIR`, keyed by the compiler's path and stat signature,
+     * the options that select the target, and `RECC_DEPS_ENV`. Otherwise,
+     * the compiler is probed on every call.
+     *
+     * Returns an empty `ToolchainInfo` if the compiler can't be probed.
+     */
+    static ToolchainInfo get(const ParsedCommand &command);
+
+    /**
+     * Returns true if probe results are persisted: `RECC_CACHE_TOOLCHAINS`
+     * is set and `RECC_CACHE_DIR` isn't empty.
+     */
+    static bool cacheEnabled();
+
+    /**
+     * Return the options of the given command that affect which headers,
+     * libraries and predefined macros the compiler uses (e.g. `-target`,
+     * `--sysroot`, `-m32`, `-std=`).
+     */
+    static std::vector<std::string>
+    targetOptions(const ParsedCommand &command);
+
+    /**
+     * Return the string that identifies a probe of the given compiler with
+     * the given options, or an empty string if the compiler can't be found.
+     */
+    static std::string cacheKey(const std::string &compiler,
+                                const std::vector<std::string> &options);
+
+    /**
+     * Extract the toolchain information from the output of
+     * `<compiler> -E -v -dM -x <language> /dev/null`.
+     */
+    static ToolchainInfo parseProbeOutput(const std::string &stdOut,
+                                          const std::string &stdErr);
+
+    /**
+     * Return the system include directories listed in the stderr output of
+     * `<compiler> -E -v`.
+     */
+    static std::vector<std::string>
+    includeDirectoriesFromV(const std::string &str);
+
+    /**
+     * Convert a `ToolchainInfo` to and from the format it is persisted in.
+     * `deserialize()` returns false if the data is not in that format.
+     */
+    static std::string serialize(const ToolchainInfo &info);
+    static bool deserialize(const std::string &data, ToolchainInfo *info);
+
+  private:
+    /**
+     * Run the compiler with the given options and parse its output.
+     * Returns false if it fails.
+     */
+    static bool probe(const std::string &compiler,
+                      const std::vector<std::string> &options,
+                      ToolchainInfo *info);
+
+    /**
+     * Return the path of the executable that running `name` would execute,
+     * searching `PATH` if it doesn't contain a slash. Returns an empty string
+     * if there isn't one.
+     */
+    static std::string findExecutable(const std::string &name);
+};
+
+} // namespace recc
+} // namespace BloombergLP
+
+#endif
@@ -0,0 +1,185 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <uploadcoordinator.h>
+
+#include <env.h>
+
+#include <buildboxcommon_logging.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <sstream>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+
+namespace BloombergLP {
+namespace recc {
+
+namespace {
+
+const std::chrono::milliseconds PollInterval(10);
+
+bool lockReleased(const std::string &path)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return true;
+    }
+    const bool released = flock(fd, LOCK_SH | LOCK_NB) == 0;
+    close(fd);
+    return released;
+}
+
+} // namespace
+
+// Each lock takes a file descriptor
+const size_t UploadCoordinator::s_maxLocks = 256;
+
+UploadCoordinator::Claims::~Claims()
+{
+    for (const auto &lock : d_locks) {
+        // Unlinking first means that a process that opens the file from
+        // now on gets a new one, and won't wait on this one.
+        unlink(lock.first.c_str());
+        close(lock.second);
+    }
+}
+
+UploadCoordinator *UploadCoordinator::instance()
+{
+    static const std::unique_ptr<UploadCoordinator> s_instance = []() {
+        std::unique_ptr<UploadCoordinator> result;
+        if (RECC_UPLOAD_WAIT_TIMEOUT <= 0) {
+            return result;
+        }
+
+        // The same blob is uploaded separately to different servers
+        std::ostringstream directory;
+        directory << TMPDIR << "/recc-uploads-" << getuid() << "-"
+                  << std::hex
+                  << std::hash<std::string>()(RECC_CAS_SERVER + "\n" +
+                                              RECC_INSTANCE);
+        try {
+            result = std::make_unique<UploadCoordinator>(
+                directory.str(),
+                std::chrono::milliseconds(RECC_UPLOAD_WAIT_TIMEOUT));
+        }
+        catch (const std::exception &e) {
+            BUILDBOX_LOG_WARNING(
+                "Not coordinating uploads with other processes: "
+                << e.what());
+        }
+        return result;
+    }();
+    return s_instance.get();
+}
+
+UploadCoordinator::UploadCoordinator(const std::string &directory,
+                                     std::chrono::milliseconds timeout)
+    : d_directory(directory), d_timeout(timeout)
+{
+    if (mkdir(directory.c_str(), 0700) != 0 && errno != EEXIST) {
+        throw std::system_error(errno, std::system_category(),
+                                "Could not create " + directory);
+    }
+}
+
+std::string UploadCoordinator::lockPath(const CompactDigest &digest) const
+{
+    return d_directory + "/" + digest.hash() + "_" +
+           std::to_string(digest.size_bytes());
+}
+
+std::unique_ptr<UploadCoordinator::Claims>
+UploadCoordinator::claim(const digest_uset &digests) const
+{
+    std::unique_ptr<Claims> claims(new Claims());
+
+    // Duplicate uploads of large blobs cost the most
+    std::vector<CompactDigest> sortedDigests(digests.cbegin(),
+                                             digests.cend());
+    std::sort(sortedDigests.begin(), sortedDigests.end(),
+              [](const CompactDigest &a, const CompactDigest &b) {
+                  return a.size_bytes() > b.size_bytes();
+              });
+
+    for (const auto &digest : sortedDigests) {
+        if (claims->d_locks.size() >= s_maxLocks) {
+            claims->d_claimed.insert(digest);
+            continue;
+        }
+
+        const std::string path = lockPath(digest);
+        const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd == -1) {
+            BUILDBOX_LOG_DEBUG("Could not open " << path << ": "
+                                                 << strerror(errno));
+            claims->d_claimed.insert(digest);
+            continue;
+        }
+
+        struct stat statResult;
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+            claims->d_inFlight.insert(digest);
+            close(fd);
+        }
+        else if (fstat(fd, &statResult) == 0 && statResult.st_nlink == 0) {
+            // Another process has just finished uploading it
+            claims->d_inFlight.insert(digest);
+            close(fd);
+        }
+        else {
+            claims->d_claimed.insert(digest);
+            claims->d_locks.emplace_back(path, fd);
+        }
+    }
+    return claims;
+}
+
+void UploadCoordinator::waitFor(const digest_uset &digests) const
+{
+    const auto deadline = std::chrono::steady_clock::now() + d_timeout;
+
+    std::vector<std::string> pending;
+    for (const auto &digest : digests) {
+        pending.push_back(lockPath(digest));
+    }
+
+    while (!pending.empty()) {
+        pending.erase(
+            std::remove_if(pending.begin(), pending.end(), lockReleased),
+            pending.end());
+
+        if (pending.empty() ||
+            std::chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+        std::this_thread::sleep_for(PollInterval);
+    }
+
+    if (!pending.empty()) {
+        BUILDBOX_LOG_DEBUG("Gave up waiting for other processes to upload "
+                           << pending.size() << " blobs");
+    }
+}
+
+} // namespace recc
+} // namespace BloombergLP
@@ -0,0 +1,108 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCLUDED_UPLOADCOORDINATOR
+#define INCLUDED_UPLOADCOORDINATOR
+
+#include <compactdigest.h>
+#include <protos.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace BloombergLP {
+namespace recc {
+
+/**
+ * Keeps the recc processes on a host from uploading the same blob at the
+ * same time. A process about to upload a blob locks a file named after
+ * its digest; the others see the lock, wait for it to be released and
+ * check whether the blob is still missing, instead of sending the same
+ * bytes.
+ *
+ * The locks are `flock()`s, which are released when a process dies, so a
+ * crashed uploader never blocks the others for longer than it lived.
+ */
+class UploadCoordinator {
+  public:
+    /**
+     * The blobs that the process holding this must upload, and the ones
+     * that other processes are uploading. The locks are held until it is
+     * destroyed.
+     */
+    class Claims {
+      public:
+        ~Claims();
+
+        Claims(const Claims &) = delete;
+        Claims &operator=(const Claims &) = delete;
+
+        const digest_uset &claimed() const { return d_claimed; }
+        const digest_uset &inFlight() const { return d_inFlight; }
+
+      private:
+        friend class UploadCoordinator;
+        Claims() = default;
+
+        digest_uset d_claimed;
+        digest_uset d_inFlight;
+        // Lock files and their descriptors
+        std::vector<std::pair<std::string, int>> d_locks;
+    };
+
+    /**
+     * Return the coordinator for the CAS server and instance in the
+     * configuration, or null if `RECC_UPLOAD_WAIT_TIMEOUT` is 0 or its
+     * directory can't be created.
+     */
+    static UploadCoordinator *instance();
+
+    /**
+     * Use the lock files in the given directory, creating it if needed.
+     * Throws `std::system_error` if it can't be created.
+     */
+    UploadCoordinator(const std::string &directory,
+                      std::chrono::milliseconds timeout);
+
+    /**
+     * Lock the given digests, largest first. A digest whose lock is held
+     * by another process is in flight; the rest are claimed. At most
+     * `s_maxLocks` digests are locked; the rest are claimed without one.
+     */
+    std::unique_ptr<Claims>
+    claim(const digest_uset &digests) const;
+
+    /**
+     * Wait until the other processes have released the locks of the given
+     * digests, or until the timeout has passed.
+     */
+    void waitFor(const digest_uset &digests) const;
+
+    static const size_t s_maxLocks;
+
+  private:
+    std::string lockPath(const CompactDigest &digest) const;
+
+    std::string d_directory;
+    std::chrono::milliseconds d_timeout;
+};
+
+} // namespace recc
+} // namespace BloombergLP
+
+#endif
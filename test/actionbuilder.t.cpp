@@ -14,6 +14,7 @@
 
 #include <actionbuilder.h>
 #include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_temporarydirectory.h>
 #include <buildboxcommonmetrics_durationmetricvalue.h>
 #include <buildboxcommonmetrics_testingutils.h>
 #include <digestgenerator.h>
@@ -21,6 +22,7 @@
 #include <fileutils.h>
 #include <fstream>
 #include <protos.h>
+#include <responsefile.h>
 
 #include <gtest/gtest.h>
 
@@ -48,6 +50,7 @@ class ActionBuilderTestFixture
         d_previous_working_dir_prefix = RECC_WORKING_DIR_PREFIX;
         d_previous_reapi_version = RECC_REAPI_VERSION;
         d_previous_remote_platform = RECC_REMOTE_PLATFORM;
+        d_previous_preprocess_locally = RECC_PREPROCESS_LOCALLY;
     }
 
     void TearDown() override
@@ -60,6 +63,7 @@ class ActionBuilderTestFixture
         RECC_WORKING_DIR_PREFIX = d_previous_working_dir_prefix;
         RECC_REAPI_VERSION = d_previous_reapi_version;
         RECC_REMOTE_PLATFORM = d_previous_remote_platform;
+        RECC_PREPROCESS_LOCALLY = d_previous_preprocess_locally;
     }
 
     void writeDependenciesToTempFile(const std::string &dependency_file_name)
@@ -87,6 +91,7 @@ class ActionBuilderTestFixture
     std::string d_previous_working_dir_prefix;
     std::string d_previous_reapi_version;
     std::map<std::string, std::string> d_previous_remote_platform;
+    bool d_previous_preprocess_locally;
 };
 
 TEST_F(ActionBuilderTestFixture, BuildSimpleCommand)
@@ -222,7 +227,7 @@ TEST_F(ActionBuilderTestFixture, GetDependenciesVerifyMetricsCollection)
     std::set<std::string> prod;
     const auto command =
         ParsedCommandFactory::createParsedCommand(recc_args, cwd.c_str());
-    getDependencies(command, &deps, &prod);
+    getDependencies(command, cwd, &deps, &prod);
     EXPECT_TRUE(
         collectedByName<DurationMetricValue>(TIMER_NAME_COMPILER_DEPS));
 }
@@ -603,6 +608,51 @@ TEST_P(ActionBuilderTestFixture, ActionBuiltGoldenDigests)
     }
 }
 
+/**
+ * With local preprocessing, the input root contains only the output of the
+ * (fake) preprocessor, and the remote command compiles it.
+ */
+TEST_P(ActionBuilderTestFixture, PreprocessLocally)
+{
+    const std::string working_dir_prefix = GetParam();
+
+    if (!working_dir_prefix.empty()) {
+        RECC_WORKING_DIR_PREFIX = working_dir_prefix;
+    }
+    RECC_PREPROCESS_LOCALLY = true;
+
+    const std::vector<std::string> recc_args = {
+        "./gcc", "-c", "-I.", "-DHELLO", "hello.cpp", "-o", "hello.o"};
+    const auto command =
+        ParsedCommandFactory::createParsedCommand(recc_args, cwd.c_str());
+
+    const auto actionPtr = ActionBuilder::BuildAction(command, cwd, &blobs,
+                                                      &digest_to_filecontents);
+
+    ASSERT_NE(actionPtr, nullptr);
+
+    proto::Command commandProto;
+    ASSERT_TRUE(
+        commandProto.ParseFromString(blobs[actionPtr->command_digest()]));
+    const std::vector<std::string> expected_args = {"./gcc", "-c", "hello.ii",
+                                                    "-o", "hello.o"};
+    EXPECT_EQ(expected_args,
+              std::vector<std::string>(commandProto.arguments().begin(),
+                                       commandProto.arguments().end()));
+
+    MerkleTree expected_tree;
+    if (working_dir_prefix.empty()) {
+        expected_tree = {{{"files", {"hello.ii"}}}};
+    }
+    else {
+        expected_tree = {{{"directories", {working_dir_prefix}}},
+                         {{"files", {"hello.ii"}}}};
+    }
+    size_t startIndex = 0;
+    verify_merkle_tree(actionPtr->input_root_digest(), expected_tree,
+                       startIndex, expected_tree.size(), blobs);
+}
+
 /**
  * Non-compile commands return nullptrs, indicating that they are intended to
  * be run locally if RECC_FORCE_REMOTE isn't set
@@ -1148,6 +1198,55 @@ TEST_P(ActionBuilderTestFixture, PathsMadeRelativeToProjectRoot)
                        expected_tree.size(), blobs);
 }
 
+/**
+ * Test that arguments given in a response file are passed to the remote
+ * compiler in a response file of the input root, with their paths rewritten
+ */
+TEST_F(ActionBuilderTestFixture, ResponseFilePassedRewritten)
+{
+    const std::string previous_project_root = RECC_PROJECT_ROOT;
+    RECC_PROJECT_ROOT = cwd;
+    RECC_DEPS_OVERRIDE = {cwd + "/hello.cpp"};
+
+    buildboxcommon::TemporaryDirectory tempDir;
+    const std::string responseFile = std::string(tempDir.name()) + "/args";
+    FileUtils::writeFileAtomically(responseFile,
+                                   "-c hello.cpp -o hello.o\n-I" + cwd +
+                                       "/include\n");
+
+    const std::vector<std::string> recc_args = {"/my/fake/gcc",
+                                                "@" + responseFile};
+    const auto command =
+        ParsedCommandFactory::createParsedCommand(recc_args, cwd.c_str());
+    const auto actionPtr = ActionBuilder::BuildAction(command, cwd, &blobs,
+                                                      &digest_to_filecontents);
+    RECC_PROJECT_ROOT = previous_project_root;
+    ASSERT_NE(actionPtr, nullptr);
+
+    proto::Command command_proto;
+    ASSERT_TRUE(command_proto.ParseFromString(
+        blobs.at(actionPtr->command_digest())));
+    ASSERT_EQ(command_proto.arguments_size(), 2);
+    EXPECT_EQ(command_proto.arguments(0), "/my/fake/gcc");
+
+    const std::string remoteResponseFile = command_proto.arguments(1);
+    ASSERT_EQ(remoteResponseFile.substr(0, 6), "@recc-");
+
+    proto::Directory input_root;
+    ASSERT_TRUE(
+        input_root.ParseFromString(blobs.at(actionPtr->input_root_digest())));
+    std::string contents;
+    for (const auto &file : input_root.files()) {
+        if (file.name() == remoteResponseFile.substr(1)) {
+            contents = digest_to_filecontents.at(file.digest());
+        }
+    }
+
+    const std::vector<std::string> expected = {"-c", "hello.cpp", "-o",
+                                               "hello.o", "-Iinclude"};
+    EXPECT_EQ(ResponseFile::parse(contents), expected);
+}
+
 // Run each test twice, once with no working_dir_prefix set, and one with
 // it set to "recc-build"
 INSTANTIATE_TEST_CASE_P(ActionBuilder, ActionBuilderTestFixture,
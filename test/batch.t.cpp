@@ -0,0 +1,103 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <batch.h>
+
+#include <gtest/gtest.h>
+
+using namespace BloombergLP::recc;
+
+TEST(BatchTest, SplitCommandLine)
+{
+    const std::vector<std::string> expected = {"gcc", "-c", "hello.c", "-o",
+                                               "hello.o"};
+    EXPECT_EQ(Batch::splitCommandLine("gcc -c hello.c -o hello.o"),
+              expected);
+    EXPECT_EQ(Batch::splitCommandLine("  gcc\t-c  hello.c -o hello.o\n"),
+              expected);
+}
+
+TEST(BatchTest, SplitCommandLineQuotes)
+{
+    const std::vector<std::string> expected = {
+        "gcc", "-DNAME=\"a b\"", "-DQUOTE='", "-I/with space", "", "x$y"};
+    EXPECT_EQ(Batch::splitCommandLine("gcc -DNAME=\\\"a\\ b\\\" "
+                                      "\"-DQUOTE='\" '-I/with space' \"\" "
+                                      "'x$y'"),
+              expected);
+    EXPECT_EQ(Batch::splitCommandLine("a\"b\\\"c\"'d\\'"),
+              std::vector<std::string>({"ab\"cd\\"}));
+}
+
+TEST(BatchTest, SplitCommandLineUnterminatedQuote)
+{
+    EXPECT_THROW(Batch::splitCommandLine("gcc \"-DX"), std::runtime_error);
+}
+
+TEST(BatchTest, ParseCompilationDatabase)
+{
+    const auto commands = Batch::parseCompilationDatabase(R"([
+        {
+            "directory": "/src/build",
+            "command": "gcc -c ../a.c -o a.o",
+            "file": "../a.c"
+        },
+        {
+            "directory": "/src",
+            "arguments": ["g++", "-c", "b file.cpp"],
+            "file": "b file.cpp",
+            "output": "b.o"
+        }
+    ])");
+
+    ASSERT_EQ(commands.size(), 2);
+    EXPECT_EQ(commands[0].d_directory, "/src/build");
+    EXPECT_EQ(commands[0].d_arguments,
+              std::vector<std::string>({"gcc", "-c", "../a.c", "-o", "a.o"}));
+    EXPECT_EQ(commands[0].d_file, "../a.c");
+    EXPECT_EQ(commands[1].d_directory, "/src");
+    EXPECT_EQ(commands[1].d_arguments,
+              std::vector<std::string>({"g++", "-c", "b file.cpp"}));
+    EXPECT_EQ(commands[1].d_file, "b file.cpp");
+}
+
+TEST(BatchTest, ParseEmptyCompilationDatabase)
+{
+    EXPECT_TRUE(Batch::parseCompilationDatabase("[]").empty());
+}
+
+TEST(BatchTest, ParseInvalidCompilationDatabase)
+{
+    // Not JSON
+    EXPECT_THROW(Batch::parseCompilationDatabase("gcc -c a.c"),
+                 std::runtime_error);
+    // Not an array
+    EXPECT_THROW(Batch::parseCompilationDatabase(
+                     R"({"directory": "/", "command": "gcc"})"),
+                 std::runtime_error);
+    // No directory
+    EXPECT_THROW(Batch::parseCompilationDatabase(R"([{"command": "gcc"}])"),
+                 std::runtime_error);
+    // No command
+    EXPECT_THROW(Batch::parseCompilationDatabase(R"([{"directory": "/"}])"),
+                 std::runtime_error);
+    // Empty command
+    EXPECT_THROW(Batch::parseCompilationDatabase(
+                     R"([{"directory": "/", "arguments": []}])"),
+                 std::runtime_error);
+    // Arguments that are not strings
+    EXPECT_THROW(Batch::parseCompilationDatabase(
+                     R"([{"directory": "/", "arguments": ["gcc", 1]}])"),
+                 std::runtime_error);
+}
@@ -15,6 +15,7 @@
 #include <buildboxcommonmetrics_durationmetricvalue.h>
 #include <buildboxcommonmetrics_testingutils.h>
 #include <casclient.h>
+#include <chunker.h>
 #include <digestgenerator.h>
 #include <env.h>
 #include <fileutils.h>
@@ -29,7 +30,10 @@
 #include <google/protobuf/util/message_differencer.h>
 #include <grpcpp/test/mock_stream.h>
 #include <gtest/gtest.h>
+#include <dirent.h>
+#include <random>
 #include <regex>
+#include <sys/stat.h>
 
 #define TIMER_NAME_FIND_MISSING_BLOBS "recc.find_missing_blobs"
 #define TIMER_NAME_UPLOAD_MISSING_BLOBS "recc.upload_missing_blobs"
@@ -121,7 +125,7 @@ TEST_F(CasClientFixture, AlreadyUploadedBlob)
         .WillOnce(DoAll(SetArgPointee<2>(response), Return(grpc::Status::OK)));
     EXPECT_CALL(*casStub, BatchUpdateBlobs(_, _, _)).Times(0);
 
-    casClient.upload_resources(blobs, {});
+    EXPECT_EQ(0, casClient.upload_resources(blobs, {}));
 }
 
 TEST_F(CasClientFixture, AlreadyUploadedFile)
@@ -165,7 +169,9 @@ TEST_F(CasClientFixture, NewBlobUpload)
         .WillOnce(DoAll(SetArgPointee<2>(updateBlobsResponse),
                         Return(grpc::Status::OK)));
 
-    casClient.upload_resources(blobs, {});
+    // Only the missing blob is uploaded
+    EXPECT_EQ(static_cast<int64_t>(defg.size()),
+              casClient.upload_resources(blobs, {}));
 }
 
 TEST_F(CasClientFixture, NewFileUpload)
@@ -409,3 +415,203 @@ TEST_F(CasClientFixture, VerifyMetricsCollection)
                                      TIMER_NAME_UPLOAD_MISSING_BLOBS};
     EXPECT_TRUE(allCollectedByName<DurationMetricValue>(metrics));
 }
+
+#ifdef RECC_HAVE_SPLIT_SPLICE_BLOB
+/**
+ * A stand-in CAS server that keeps blobs in memory and implements SplitBlob
+ * and SpliceBlob, counting the bytes transferred.
+ */
+class ChunkedCasClientFixture : public CasClientFixture {
+  protected:
+    buildboxcommon::TemporaryDirectory cacheDir;
+    digest_string_umap storage;
+    size_t bytesUploaded = 0;
+    size_t bytesDownloaded = 0;
+
+    const int previousThreshold = RECC_CAS_CHUNKING_THRESHOLD;
+    const int previousCacheSize = RECC_CAS_CHUNK_CACHE_MB;
+    const std::string previousCacheDir = RECC_CACHE_DIR;
+
+    ChunkedCasClientFixture()
+    {
+        RECC_CAS_CHUNKING_THRESHOLD = 1024 * 1024;
+        RECC_CACHE_DIR = cacheDir.name();
+
+        ON_CALL(*casStub, FindMissingBlobs(_, _, _))
+            .WillByDefault(
+                Invoke([this](grpc::ClientContext *,
+                              const proto::FindMissingBlobsRequest &request,
+                              proto::FindMissingBlobsResponse *response) {
+                    for (const auto &digest : request.blob_digests()) {
+                        if (!storage.count(digest)) {
+                            *response->add_missing_blob_digests() = digest;
+                        }
+                    }
+                    return grpc::Status::OK;
+                }));
+        ON_CALL(*casStub, BatchUpdateBlobs(_, _, _))
+            .WillByDefault(
+                Invoke([this](grpc::ClientContext *,
+                              const proto::BatchUpdateBlobsRequest &request,
+                              proto::BatchUpdateBlobsResponse *response) {
+                    for (const auto &blobRequest : request.requests()) {
+                        storage[blobRequest.digest()] = blobRequest.data();
+                        bytesUploaded += blobRequest.data().size();
+                        *response->add_responses()->mutable_digest() =
+                            blobRequest.digest();
+                    }
+                    return grpc::Status::OK;
+                }));
+        ON_CALL(*casStub, BatchReadBlobs(_, _, _))
+            .WillByDefault(
+                Invoke([this](grpc::ClientContext *,
+                              const proto::BatchReadBlobsRequest &request,
+                              proto::BatchReadBlobsResponse *response) {
+                    for (const auto &digest : request.digests()) {
+                        auto blobResponse = response->add_responses();
+                        *blobResponse->mutable_digest() = digest;
+                        blobResponse->set_data(storage.at(digest));
+                        bytesDownloaded += blobResponse->data().size();
+                    }
+                    return grpc::Status::OK;
+                }));
+        ON_CALL(*casStub, SplitBlob(_, _, _))
+            .WillByDefault(
+                Invoke([this](grpc::ClientContext *,
+                              const proto::SplitBlobRequest &request,
+                              proto::SplitBlobResponse *response) {
+                    if (!storage.count(request.blob_digest())) {
+                        return grpc::Status(grpc::NOT_FOUND, "");
+                    }
+                    for (const auto &chunk :
+                         Chunker::split(storage[request.blob_digest()])) {
+                        const auto digest = make_digest(chunk);
+                        storage[digest] = chunk;
+                        *response->add_chunk_digests() = digest;
+                    }
+                    return grpc::Status::OK;
+                }));
+        ON_CALL(*casStub, SpliceBlob(_, _, _))
+            .WillByDefault(
+                Invoke([this](grpc::ClientContext *,
+                              const proto::SpliceBlobRequest &request,
+                              proto::SpliceBlobResponse *response) {
+                    std::string blob;
+                    for (const auto &digest : request.chunk_digests()) {
+                        if (!storage.count(digest)) {
+                            return grpc::Status(grpc::NOT_FOUND, "");
+                        }
+                        blob += storage[digest];
+                    }
+                    if (make_digest(blob) != request.blob_digest()) {
+                        return grpc::Status(grpc::INVALID_ARGUMENT, "");
+                    }
+                    storage[request.blob_digest()] = blob;
+                    *response->mutable_blob_digest() = request.blob_digest();
+                    return grpc::Status::OK;
+                }));
+
+        proto::ServerCapabilities serverCapabilities;
+        auto cacheCapabilities =
+            serverCapabilities.mutable_cache_capabilities();
+        for (const auto &entry :
+             DigestGenerator::stringToDigestFunctionMap()) {
+            cacheCapabilities->add_digest_function(entry.second);
+        }
+        cacheCapabilities->set_split_blob_support(true);
+        cacheCapabilities->set_splice_blob_support(true);
+        EXPECT_CALL(*capabilitiesStub, GetCapabilities(_, _, _))
+            .WillOnce(DoAll(SetArgPointee<2>(serverCapabilities),
+                            Return(grpc::Status::OK)));
+        casClient.setUpFromServerCapabilities();
+
+        // Nothing goes through ByteStream
+        EXPECT_CALL(*byteStreamStub, WriteRaw(_, _)).Times(0);
+        EXPECT_CALL(*byteStreamStub, ReadRaw(_, _)).Times(0);
+    }
+
+    ~ChunkedCasClientFixture()
+    {
+        RECC_CAS_CHUNKING_THRESHOLD = previousThreshold;
+        RECC_CAS_CHUNK_CACHE_MB = previousCacheSize;
+        RECC_CACHE_DIR = previousCacheDir;
+    }
+
+    static std::string randomBlob(size_t size, unsigned int seed)
+    {
+        std::mt19937 engine(seed);
+        std::uniform_int_distribution<int> byteDist(0, 255);
+        std::string blob(size, '\0');
+        for (auto &c : blob) {
+            c = static_cast<char>(byteDist(engine));
+        }
+        return blob;
+    }
+};
+
+TEST_F(ChunkedCasClientFixture, UploadOnlySendsMissingChunks)
+{
+    const std::string blob = randomBlob(8 * 1024 * 1024, 1);
+    casClient.upload_resources({{make_digest(blob), blob}}, {});
+    EXPECT_EQ(blob, storage[make_digest(blob)]);
+    EXPECT_EQ(blob.size(), bytesUploaded);
+
+    std::string modified = blob;
+    modified.replace(blob.size() / 3, 10, "0123456789");
+    bytesUploaded = 0;
+    casClient.upload_resources({{make_digest(modified), modified}}, {});
+    EXPECT_EQ(modified, storage[make_digest(modified)]);
+    EXPECT_LE(bytesUploaded, 2 * Chunker::s_maxChunkSize);
+}
+
+TEST_F(ChunkedCasClientFixture, BlobsBelowThresholdAreNotChunked)
+{
+    const std::string blob = randomBlob(512 * 1024, 2);
+    EXPECT_CALL(*casStub, SpliceBlob(_, _, _)).Times(0);
+
+    casClient.upload_resources({{make_digest(blob), blob}}, {});
+    EXPECT_EQ(blob, storage[make_digest(blob)]);
+}
+
+TEST_F(ChunkedCasClientFixture, FetchReusesCachedChunks)
+{
+    const std::string blob = randomBlob(8 * 1024 * 1024, 3);
+    storage[make_digest(blob)] = blob;
+    EXPECT_EQ(blob, casClient.fetch_blob(make_digest(blob)));
+    EXPECT_EQ(blob.size(), bytesDownloaded);
+
+    std::string modified = blob;
+    modified.replace(blob.size() / 3, 10, "0123456789");
+    storage[make_digest(modified)] = modified;
+    bytesDownloaded = 0;
+    EXPECT_EQ(modified, casClient.fetch_blob(make_digest(modified)));
+    EXPECT_LE(bytesDownloaded, 2 * Chunker::s_maxChunkSize);
+}
+
+TEST_F(ChunkedCasClientFixture, ChunkCacheIsTrimmed)
+{
+    RECC_CAS_CHUNK_CACHE_MB = 2;
+    const std::string blob = randomBlob(8 * 1024 * 1024, 4);
+    storage[make_digest(blob)] = blob;
+    EXPECT_EQ(blob, casClient.fetch_blob(make_digest(blob)));
+
+    const std::string chunkDirectory =
+        std::string(cacheDir.name()) + "/chunks";
+    off_t cacheSize = 0;
+    size_t cachedChunks = 0;
+    DIR *dir = opendir(chunkDirectory.c_str());
+    ASSERT_NE(nullptr, dir);
+    while (const struct dirent *entry = readdir(dir)) {
+        struct stat statResult;
+        if (stat((chunkDirectory + "/" + entry->d_name).c_str(),
+                 &statResult) == 0 &&
+            S_ISREG(statResult.st_mode)) {
+            cacheSize += statResult.st_size;
+            ++cachedChunks;
+        }
+    }
+    closedir(dir);
+    EXPECT_GT(cachedChunks, 0);
+    EXPECT_LE(cacheSize, 2 * 1024 * 1024);
+}
+#endif
@@ -0,0 +1,118 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <chunker.h>
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <set>
+
+using namespace BloombergLP::recc;
+
+namespace {
+
+std::string randomBlob(size_t size, unsigned int seed)
+{
+    std::mt19937 engine(seed);
+    std::uniform_int_distribution<int> byteDist(0, 255);
+    std::string blob(size, '\0');
+    for (auto &c : blob) {
+        c = static_cast<char>(byteDist(engine));
+    }
+    return blob;
+}
+
+size_t sharedChunks(const std::vector<std::string> &a,
+                    const std::vector<std::string> &b)
+{
+    const std::set<std::string> chunksOfA(a.begin(), a.end());
+    size_t result = 0;
+    for (const auto &chunk : b) {
+        result += chunksOfA.count(chunk);
+    }
+    return result;
+}
+
+} // namespace
+
+TEST(ChunkerTest, SmallBlobIsOneChunk)
+{
+    const std::string blob = randomBlob(Chunker::s_minChunkSize, 1);
+    const std::vector<std::string> expected = {blob};
+    EXPECT_EQ(expected, Chunker::split(blob));
+
+    EXPECT_TRUE(Chunker::split("").empty());
+}
+
+TEST(ChunkerTest, ChunksMakeUpTheBlob)
+{
+    const std::string blob = randomBlob(4 * 1024 * 1024, 2);
+    const auto chunks = Chunker::split(blob);
+
+    std::string joined;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        EXPECT_LE(chunks[i].size(), Chunker::s_maxChunkSize);
+        if (i + 1 < chunks.size()) {
+            EXPECT_GT(chunks[i].size(), Chunker::s_minChunkSize);
+        }
+        joined += chunks[i];
+    }
+    EXPECT_EQ(blob, joined);
+
+    // Normalized chunking keeps chunks close to the average size.
+    const size_t averageSize = blob.size() / chunks.size();
+    EXPECT_GT(averageSize, Chunker::s_averageChunkSize / 2);
+    EXPECT_LT(averageSize, Chunker::s_averageChunkSize * 2);
+}
+
+TEST(ChunkerTest, ChunkingIsDeterministic)
+{
+    const std::string blob = randomBlob(1024 * 1024, 3);
+    EXPECT_EQ(Chunker::split(blob), Chunker::split(std::string(blob)));
+}
+
+TEST(ChunkerTest, ZeroesAreCutAtTheMaximumSize)
+{
+    const std::string blob(Chunker::s_maxChunkSize * 3, '\0');
+    const auto chunks = Chunker::split(blob);
+    ASSERT_EQ(3, chunks.size());
+    EXPECT_EQ(Chunker::s_maxChunkSize, chunks[0].size());
+}
+
+TEST(ChunkerTest, ModificationOnlyChangesNearbyChunks)
+{
+    const std::string blob = randomBlob(4 * 1024 * 1024, 4);
+    std::string modified = blob;
+    for (size_t i = 0; i < 100; ++i) {
+        modified[blob.size() / 2 + i] ^= 0x55;
+    }
+
+    const auto chunks = Chunker::split(blob);
+    const auto modifiedChunks = Chunker::split(modified);
+    EXPECT_GE(sharedChunks(chunks, modifiedChunks), modifiedChunks.size() - 2);
+}
+
+TEST(ChunkerTest, InsertionOnlyChangesNearbyChunks)
+{
+    const std::string blob = randomBlob(4 * 1024 * 1024, 5);
+    // With fixed-size blocks, every block after the insertion would change.
+    const std::string modified = blob.substr(0, 1000) + "inserted" +
+                                 blob.substr(1000) + randomBlob(5000, 6);
+
+    const auto chunks = Chunker::split(blob);
+    const auto modifiedChunks = Chunker::split(modified);
+    EXPECT_GE(sharedChunks(chunks, modifiedChunks), modifiedChunks.size() - 3);
+}
@@ -0,0 +1,146 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <circuitbreaker.h>
+#include <grpcretry.h>
+
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+using namespace BloombergLP::recc;
+
+class CircuitBreakerFixture : public ::testing::Test {
+  protected:
+    buildboxcommon::TemporaryDirectory directory;
+    const std::string path = std::string(directory.name()) + "/breaker";
+};
+
+TEST_F(CircuitBreakerFixture, OpensAfterConsecutiveFailures)
+{
+    CircuitBreaker breaker(path, 3, std::chrono::seconds(60));
+    EXPECT_TRUE(breaker.allowRequests());
+
+    breaker.recordFailure();
+    breaker.recordFailure();
+    breaker.recordSuccess();
+    breaker.recordFailure();
+    breaker.recordFailure();
+    EXPECT_TRUE(breaker.allowRequests());
+
+    breaker.recordFailure();
+    EXPECT_FALSE(breaker.allowRequests());
+
+    // The state is shared with other processes using the same file
+    CircuitBreaker other(path, 3, std::chrono::seconds(60));
+    EXPECT_FALSE(other.allowRequests());
+}
+
+TEST_F(CircuitBreakerFixture, SingleProbeWhenHalfOpen)
+{
+    CircuitBreaker breaker(path, 1, std::chrono::milliseconds(20));
+    CircuitBreaker other(path, 1, std::chrono::milliseconds(20));
+    breaker.recordFailure();
+    EXPECT_FALSE(breaker.allowRequests());
+    EXPECT_FALSE(other.allowRequests());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    EXPECT_TRUE(breaker.allowRequests());
+    EXPECT_FALSE(other.allowRequests());
+    EXPECT_TRUE(breaker.allowRequests());
+
+    breaker.recordSuccess();
+    EXPECT_TRUE(other.allowRequests());
+}
+
+TEST_F(CircuitBreakerFixture, FailedProbeReopens)
+{
+    CircuitBreaker breaker(path, 5, std::chrono::milliseconds(20));
+    for (int i = 0; i < 5; ++i) {
+        breaker.recordFailure();
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    ASSERT_TRUE(breaker.allowRequests());
+    // A single failure of the probe is enough
+    breaker.recordFailure();
+    EXPECT_FALSE(breaker.allowRequests());
+}
+
+TEST_F(CircuitBreakerFixture, RetryBudget)
+{
+    CircuitBreaker breaker(path, 1, std::chrono::seconds(60));
+    int retries = 0;
+    while (breaker.tryRetry()) {
+        ++retries;
+    }
+    EXPECT_EQ(20, retries);
+
+    // Each successful call pays back a tenth of a retry
+    for (int i = 0; i < 9; ++i) {
+        breaker.recordSuccess();
+    }
+    EXPECT_FALSE(breaker.tryRetry());
+    breaker.recordSuccess();
+    EXPECT_TRUE(breaker.tryRetry());
+}
+
+TEST_F(CircuitBreakerFixture, UnusableFile)
+{
+    EXPECT_THROW(CircuitBreaker(std::string(directory.name()) +
+                                    "/missing/breaker",
+                                1, std::chrono::seconds(60)),
+                 std::system_error);
+}
+
+TEST_F(CircuitBreakerFixture, IsOpenDoesNotProbe)
+{
+    CircuitBreaker breaker(path, 2, std::chrono::milliseconds(20));
+    CircuitBreaker other(path, 2, std::chrono::milliseconds(20));
+    EXPECT_FALSE(breaker.isOpen());
+
+    breaker.recordFailure();
+    EXPECT_FALSE(breaker.isOpen());
+    breaker.recordFailure();
+    EXPECT_TRUE(other.isOpen());
+    EXPECT_EQ(2, other.consecutiveFailures());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    EXPECT_TRUE(breaker.isOpen());
+    // Asking didn't take the probe from the other processes
+    EXPECT_TRUE(other.allowRequests());
+}
+
+TEST(CircuitBreakerTest, ServerHealth)
+{
+    EXPECT_EQ(ServerHealth::Healthy, server_health(grpc::Status::OK));
+    EXPECT_EQ(ServerHealth::Healthy,
+              server_health(grpc::Status(grpc::NOT_FOUND, "")));
+    EXPECT_EQ(ServerHealth::Unreachable,
+              server_health(grpc::Status(grpc::UNAVAILABLE, "")));
+    EXPECT_EQ(ServerHealth::Unreachable,
+              server_health(grpc::Status(grpc::DEADLINE_EXCEEDED, "")));
+
+    // A proxy in front of an unreachable server may send these, so they
+    // don't close the breaker
+    EXPECT_EQ(ServerHealth::Unknown,
+              server_health(grpc::Status(grpc::INTERNAL, "")));
+    EXPECT_EQ(ServerHealth::Unknown,
+              server_health(grpc::Status(grpc::UNKNOWN, "")));
+    EXPECT_EQ(ServerHealth::Unknown,
+              server_health(grpc::Status(grpc::RESOURCE_EXHAUSTED, "")));
+}
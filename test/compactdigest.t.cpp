@@ -0,0 +1,102 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <compactdigest.h>
+#include <digestgenerator.h>
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+using namespace BloombergLP::recc;
+
+TEST(CompactDigestTest, RoundTrip)
+{
+    const proto::Digest digest = DigestGenerator::make_digest("hello");
+    const CompactDigest compactDigest(digest);
+    EXPECT_EQ(compactDigest.hash(), digest.hash());
+    EXPECT_EQ(compactDigest.size_bytes(), 5);
+    EXPECT_EQ(compactDigest.toProto(), digest);
+}
+
+TEST(CompactDigestTest, RoundTripSha512)
+{
+    proto::Digest digest;
+    digest.set_hash(std::string(64, '0') + std::string(64, 'f'));
+    digest.set_size_bytes(123);
+    EXPECT_EQ(CompactDigest(digest).toProto(), digest);
+}
+
+TEST(CompactDigestTest, HashesThatAreNotHexAreKept)
+{
+    for (const std::string &hash :
+         {std::string("HASH HERE"), std::string("ABCD"), std::string("abc"),
+          std::string(130, 'a'), std::string()}) {
+        proto::Digest digest;
+        digest.set_hash(hash);
+        digest.set_size_bytes(7);
+        EXPECT_EQ(CompactDigest(digest).toProto(), digest);
+    }
+}
+
+TEST(CompactDigestTest, EncodeAndDecodeHex)
+{
+    const unsigned char bytes[] = {0x00, 0x1f, 0xa0, 0xff};
+    EXPECT_EQ("001fa0ff", CompactDigest::encodeHex(bytes, sizeof(bytes)));
+
+    unsigned char decoded[sizeof(bytes)] = {};
+    ASSERT_TRUE(CompactDigest::decodeHex("001fa0ff", decoded));
+    EXPECT_EQ(0, memcmp(bytes, decoded, sizeof(bytes)));
+
+    EXPECT_FALSE(CompactDigest::decodeHex("001", decoded));
+    EXPECT_FALSE(CompactDigest::decodeHex("001FA0FF", decoded));
+    EXPECT_FALSE(CompactDigest::decodeHex("00xz", decoded));
+}
+
+TEST(CompactDigestTest, Equality)
+{
+    const proto::Digest a = DigestGenerator::make_digest("a");
+    const proto::Digest b = DigestGenerator::make_digest("b");
+    EXPECT_EQ(CompactDigest(a), CompactDigest(a));
+    EXPECT_NE(CompactDigest(a), CompactDigest(b));
+
+    proto::Digest resized = a;
+    resized.set_size_bytes(2);
+    EXPECT_NE(CompactDigest(a), CompactDigest(resized));
+
+    // A packed hash never equals one that was kept as is
+    proto::Digest upper = a;
+    for (auto &c : *upper.mutable_hash()) {
+        c = static_cast<char>(toupper(c));
+    }
+    EXPECT_NE(CompactDigest(a), CompactDigest(upper));
+
+    EXPECT_EQ(CompactDigest(), CompactDigest(proto::Digest()));
+}
+
+TEST(CompactDigestTest, ContainersCanBeUsedWithProtoDigests)
+{
+    const proto::Digest a = DigestGenerator::make_digest("a");
+    const proto::Digest b = DigestGenerator::make_digest("b");
+
+    digest_string_umap blobs;
+    blobs[a] = "a";
+    blobs[b] = "b";
+    EXPECT_EQ(blobs.at(a), "a");
+    EXPECT_EQ(blobs.count(b), 1);
+    EXPECT_EQ(blobs.count(DigestGenerator::make_digest("c")), 0);
+
+    const digest_uset digests = {a, b, a};
+    EXPECT_EQ(digests.size(), 2);
+}
@@ -18,8 +18,12 @@
 #include <parsedcommand.h>
 
 #include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_temporarydirectory.h>
 
 #include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
 
 using namespace BloombergLP::recc;
 
@@ -177,6 +181,20 @@ TEST(DepsTest, InputInSubdirectory)
               normalize_all(Deps::get_file_info(command).d_dependencies));
 }
 
+TEST(DepsTest, WorkingDirectory)
+{
+    Env::parse_config_variables();
+    RECC_DEPS_GLOBAL_PATHS = 0;
+    const std::string cwd = FileUtils::getCurrentWorkingDirectory();
+    const auto command = ParsedCommandFactory::createParsedCommand(
+        {RECC_PLATFORM_COMPILER, "-c", "empty.c"}, cwd + "/subdirectory");
+    std::set<std::string> expected = {"empty.c"};
+    EXPECT_EQ(expected, normalize_all(Deps::get_file_info(
+                            command, cwd + "/subdirectory")
+                                          .d_dependencies));
+    EXPECT_EQ(cwd, FileUtils::getCurrentWorkingDirectory());
+}
+
 TEST(DepsTest, SubprocessFailure)
 {
     Env::parse_config_variables();
@@ -355,3 +373,290 @@ TEST(DepsFromMakeRulesTest, LargeMakeOutput)
 
     EXPECT_EQ(expected, dependencies);
 }
+
+// The parser as originally written, one character at a time
+static std::set<std::string>
+referenceDependenciesFromMakeRules(const std::string &rules,
+                                   bool is_sun_format,
+                                   bool include_global_paths)
+{
+    std::set<std::string> result;
+    bool saw_colon_on_line = false;
+    bool saw_backslash = false;
+    bool ignoring_file = false;
+
+    std::string current_filename;
+    for (const char &character : rules) {
+        if (saw_backslash) {
+            saw_backslash = false;
+            if (character != '\n' && !ignoring_file && saw_colon_on_line) {
+                current_filename += character;
+            }
+        }
+        else if (character == '\\') {
+            saw_backslash = true;
+        }
+        else if (character == ':' && !saw_colon_on_line) {
+            saw_colon_on_line = true;
+        }
+        else if (character == '\n') {
+            saw_colon_on_line = false;
+            ignoring_file = false;
+            if (!current_filename.empty()) {
+                result.insert(current_filename);
+            }
+            current_filename.clear();
+        }
+        else if (character == ' ') {
+            if (is_sun_format) {
+                if (!current_filename.empty() && !ignoring_file &&
+                    saw_colon_on_line) {
+                    current_filename += character;
+                }
+            }
+            else {
+                ignoring_file = false;
+                if (!current_filename.empty()) {
+                    result.insert(current_filename);
+                }
+                current_filename.clear();
+            }
+        }
+        else if (character == '/' && current_filename.empty() &&
+                 !include_global_paths) {
+            ignoring_file = true;
+        }
+        else if (!ignoring_file && saw_colon_on_line) {
+            current_filename += character;
+        }
+    }
+
+    if (!current_filename.empty()) {
+        result.insert(current_filename);
+    }
+
+    return result;
+}
+
+TEST(DepsFromMakeRulesTest, MatchesCharacterByCharacterParser)
+{
+    // Long runs of ordinary characters, so that both the vectorised and the
+    // scalar scans are exercised
+    const std::vector<std::string> pieces = {
+        "a",  "b",   "/",  "\\", ":",         " ",
+        "\n", "\t", ".h", "\\\n", "abcdefghijklmnopqrstuvwxyz",
+        "/usr/include/stdio.h", "dir/file.h", "\\ ", "\\:", "obj.o: "};
+    srand(42);
+    for (int i = 0; i < 2000; ++i) {
+        std::string rules;
+        const int length = rand() % 64;
+        for (int j = 0; j < length; ++j) {
+            rules += pieces[static_cast<size_t>(rand()) % pieces.size()];
+        }
+        for (const bool sun : {false, true}) {
+            for (const bool global : {false, true}) {
+                EXPECT_EQ(
+                    referenceDependenciesFromMakeRules(rules, sun, global),
+                    Deps::dependencies_from_make_rules(rules, sun, global))
+                    << "rules: \"" << rules << "\", sun: " << sun
+                    << ", global: " << global;
+            }
+        }
+    }
+}
+
+static void setModificationTime(const std::string &path, time_t mtime)
+{
+    struct utimbuf times;
+    times.actime = mtime;
+    times.modtime = mtime;
+    ASSERT_EQ(0, utime(path.c_str(), &times));
+}
+
+class DependModeTest : public ::testing::Test {
+  protected:
+    void SetUp() override
+    {
+        RECC_DEPS_GLOBAL_PATHS = 1;
+        RECC_DEPS_DEPEND_MODE = 1;
+        RECC_PROJECT_ROOT = d_tmpdir.name();
+        d_previousCacheDir = RECC_CACHE_DIR;
+        RECC_CACHE_DIR = std::string(d_tmpdir.name()) + "/cache";
+
+        // Fails if the dependency command is run
+        d_compiler = std::string(d_tmpdir.name()) + "/gcc";
+        FileUtils::writeFile(d_compiler, "#!/bin/sh\nexit 1\n");
+        ASSERT_EQ(0, chmod(d_compiler.c_str(), 0755));
+
+        d_source = std::string(d_tmpdir.name()) + "/hello.c";
+        d_header = std::string(d_tmpdir.name()) + "/hello.h";
+        d_depfile = std::string(d_tmpdir.name()) + "/hello.d";
+
+        FileUtils::writeFile(d_source, "#include \"hello.h\"\n");
+        FileUtils::writeFile(d_header, "");
+        FileUtils::writeFile(d_depfile,
+                             "hello.o: " + d_source + " \\\n " + d_header);
+
+        setModificationTime(d_source, 1000);
+        setModificationTime(d_header, 1000);
+        setModificationTime(d_depfile, 2000);
+
+        // As if recc had run the compile that wrote the dependency file
+        Deps::record_depfile(parse("-MD"),
+                             FileUtils::getCurrentWorkingDirectory());
+    }
+
+    void TearDown() override
+    {
+        RECC_DEPS_GLOBAL_PATHS = 0;
+        RECC_DEPS_DEPEND_MODE = 0;
+        RECC_PROJECT_ROOT = "";
+        RECC_CACHE_DIR = d_previousCacheDir;
+    }
+
+    ParsedCommand
+    parse(const std::string &dependencyOption,
+          const std::vector<std::string> &includeOptions = {})
+    {
+        std::vector<std::string> command = {d_compiler, "-c", d_source};
+        command.insert(command.end(), includeOptions.begin(),
+                       includeOptions.end());
+        command.insert(command.end(), {dependencyOption, "-MF", d_depfile,
+                                       "-o", "hello.o"});
+        return ParsedCommandFactory::createParsedCommand(command,
+                                                         d_tmpdir.name());
+    }
+
+    buildboxcommon::TemporaryDirectory d_tmpdir;
+    std::string d_previousCacheDir;
+    std::string d_compiler;
+    std::string d_source;
+    std::string d_header;
+    std::string d_depfile;
+};
+
+TEST_F(DependModeTest, FreshDependencyFile)
+{
+    std::set<std::string> dependencies;
+    ASSERT_TRUE(Deps::dependencies_from_depfile(parse("-MD"), &dependencies));
+
+    const std::set<std::string> expected = {d_source, d_header};
+    EXPECT_EQ(expected, dependencies);
+}
+
+TEST_F(DependModeTest, GlobalPathsFiltered)
+{
+    RECC_DEPS_GLOBAL_PATHS = 0;
+
+    std::set<std::string> dependencies = {"unchanged"};
+    ASSERT_TRUE(Deps::dependencies_from_depfile(parse("-MD"), &dependencies));
+    EXPECT_TRUE(dependencies.empty());
+}
+
+TEST_F(DependModeTest, StaleDependencyFile)
+{
+    setModificationTime(d_header, 3000);
+
+    std::set<std::string> dependencies = {"unchanged"};
+    EXPECT_FALSE(Deps::dependencies_from_depfile(parse("-MD"), &dependencies));
+    EXPECT_EQ(std::set<std::string>({"unchanged"}), dependencies);
+}
+
+TEST_F(DependModeTest, DependencyFileOfOtherCommand)
+{
+    Deps::record_depfile(parse("-MD", {"-Ia", "-Ib"}),
+                         FileUtils::getCurrentWorkingDirectory());
+    std::set<std::string> dependencies;
+    ASSERT_TRUE(Deps::dependencies_from_depfile(parse("-MD", {"-Ia", "-Ib"}),
+                                                &dependencies));
+
+    // With the include directories swapped, a different "hello.h" could
+    // be found, so the dependency file can't be trusted
+    EXPECT_FALSE(Deps::dependencies_from_depfile(
+        parse("-MD", {"-Ib", "-Ia"}), &dependencies));
+    EXPECT_FALSE(Deps::dependencies_from_depfile(
+        parse("-MD", {"-Ia", "-Ib", "-DHELLO"}), &dependencies));
+}
+
+TEST_F(DependModeTest, DependencyFileRewritten)
+{
+    // Written by something other than recc after the recorded compile
+    FileUtils::writeFile(d_depfile, "hello.o: " + d_source);
+    setModificationTime(d_depfile, 2000);
+
+    std::set<std::string> dependencies;
+    EXPECT_FALSE(Deps::dependencies_from_depfile(parse("-MD"), &dependencies));
+}
+
+TEST_F(DependModeTest, NoCacheDirectory)
+{
+    RECC_CACHE_DIR = "";
+
+    std::set<std::string> dependencies;
+    EXPECT_FALSE(Deps::dependencies_from_depfile(parse("-MD"), &dependencies));
+}
+
+TEST_F(DependModeTest, MissingDependency)
+{
+    ASSERT_EQ(0, unlink(d_header.c_str()));
+
+    std::set<std::string> dependencies;
+    EXPECT_FALSE(Deps::dependencies_from_depfile(parse("-MD"), &dependencies));
+}
+
+TEST_F(DependModeTest, MissingDependencyFile)
+{
+    ASSERT_EQ(0, unlink(d_depfile.c_str()));
+
+    std::set<std::string> dependencies;
+    EXPECT_FALSE(Deps::dependencies_from_depfile(parse("-MD"), &dependencies));
+}
+
+TEST_F(DependModeTest, OmittedSystemHeaders)
+{
+    std::set<std::string> dependencies;
+    EXPECT_FALSE(
+        Deps::dependencies_from_depfile(parse("-MMD"), &dependencies));
+}
+
+TEST_F(DependModeTest, GetFileInfoSkipsDependencyCommand)
+{
+    // The compiler fails, so this would throw if the dependency command
+    // was run.
+    const auto fileInfo = Deps::get_file_info(parse("-MD"));
+
+    const std::set<std::string> expectedDependencies = {d_source, d_header};
+    const std::set<std::string> expectedProducts = {"hello.o", "hello.d"};
+    EXPECT_EQ(expectedDependencies, fileInfo.d_dependencies);
+    EXPECT_EQ(expectedProducts, fileInfo.d_possibleProducts);
+}
+
+TEST(DepsTest, ResponseFilePassedToDependencyCommand)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    const std::string compiler = std::string(directory.name()) + "/gcc";
+    const std::string responseFile =
+        std::string(directory.name()) + "/args.rsp";
+    FileUtils::writeFile(responseFile, "-c hello.c -o hello.o\n");
+
+    // Only succeeds if all the arguments are in a response file
+    FileUtils::writeFile(compiler, "#!/bin/sh\n"
+                                   "test $# = 1 || exit 1\n"
+                                   "grep -q hello.c \"${1#@}\" || exit 1\n"
+                                   "echo 'hello.o: hello.c'\n");
+    ASSERT_EQ(0, chmod(compiler.c_str(), 0755));
+
+    const auto command = ParsedCommandFactory::createParsedCommand(
+        {compiler, "@" + responseFile}, directory.name());
+    ASSERT_TRUE(command.uses_response_files());
+
+    const std::set<std::string> expected = {"hello.c"};
+    EXPECT_EQ(expected, Deps::get_file_info(command).d_dependencies);
+}
+
+TEST_F(DependModeTest, GetFileInfoFallsBackWhenStale)
+{
+    setModificationTime(d_source, 3000);
+
+    EXPECT_THROW(Deps::get_file_info(parse("-MD")), subprocess_failed_error);
+}
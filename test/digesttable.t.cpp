@@ -0,0 +1,190 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <digestgenerator.h>
+#include <digesttable.h>
+#include <fileutils.h>
+
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <fcntl.h>
+#include <limits>
+#include <unistd.h>
+
+using namespace BloombergLP::recc;
+
+namespace {
+
+FileIdentity makeIdentity(uint64_t inode, uint64_t size = 5)
+{
+    FileIdentity identity;
+    identity.d_device = 2049;
+    identity.d_inode = inode;
+    identity.d_size = size;
+    identity.d_mtime = 1600000000123456789ULL;
+    identity.d_ctime = 1600000000123456789ULL;
+    return identity;
+}
+
+proto::Digest makeDigest(const std::string &hash, int64_t size = 5)
+{
+    proto::Digest digest;
+    digest.set_hash(hash);
+    digest.set_size_bytes(size);
+    return digest;
+}
+
+// The first fields of a slot
+void setSlotWriter(const std::string &path, uint64_t sequence,
+                   int64_t writeStartedAt)
+{
+    const int fd = open(path.c_str(), O_RDWR);
+    ASSERT_NE(fd, -1);
+    ASSERT_EQ(pwrite(fd, &sequence, sizeof(sequence), 0), 8);
+    ASSERT_EQ(pwrite(fd, &writeStartedAt, sizeof(writeStartedAt), 8), 8);
+    close(fd);
+}
+
+} // namespace
+
+TEST(DigestTableTest, FileIdentityFromStat)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    const std::string path = std::string(directory.name()) + "/file";
+    FileUtils::writeFile(path, "hello");
+
+    struct stat statResult;
+    ASSERT_EQ(stat(path.c_str(), &statResult), 0);
+    const FileIdentity identity = FileIdentity::fromStat(statResult);
+    EXPECT_EQ(identity.d_inode, statResult.st_ino);
+    EXPECT_EQ(identity.d_size, 5);
+    EXPECT_EQ(identity.d_mtime / 1000000000, statResult.st_mtime);
+    EXPECT_EQ(identity, FileIdentity::fromStat(statResult));
+
+    FileUtils::writeFile(path, "hello, world");
+    ASSERT_EQ(stat(path.c_str(), &statResult), 0);
+    EXPECT_NE(identity, FileIdentity::fromStat(statResult));
+}
+
+TEST(DigestTableTest, PublishAndLookup)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    DigestTable table(std::string(directory.name()) + "/table", 64);
+
+    const proto::Digest digest = DigestGenerator::make_digest("hello");
+    proto::Digest result;
+    EXPECT_FALSE(table.lookup(makeIdentity(1), &result));
+
+    table.publish(makeIdentity(1), digest);
+    ASSERT_TRUE(table.lookup(makeIdentity(1), &result));
+    EXPECT_EQ(result, digest);
+
+    // Any change to the identity is a miss
+    EXPECT_FALSE(table.lookup(makeIdentity(2), &result));
+    FileIdentity modified = makeIdentity(1);
+    modified.d_mtime++;
+    EXPECT_FALSE(table.lookup(modified, &result));
+
+    // And a new version of the file replaces the old one
+    const proto::Digest newDigest = makeDigest(std::string(128, 'f'));
+    table.publish(modified, newDigest);
+    ASSERT_TRUE(table.lookup(modified, &result));
+    EXPECT_EQ(result, newDigest);
+}
+
+TEST(DigestTableTest, IgnoresInvalidDigests)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    DigestTable table(std::string(directory.name()) + "/table", 64);
+    proto::Digest result;
+
+    // Size that doesn't match the file's
+    table.publish(makeIdentity(1), makeDigest("abcd", 4));
+    EXPECT_FALSE(table.lookup(makeIdentity(1), &result));
+    // Not hex
+    table.publish(makeIdentity(1), makeDigest("xyz0"));
+    EXPECT_FALSE(table.lookup(makeIdentity(1), &result));
+    // Longer than any supported hash
+    table.publish(makeIdentity(1), makeDigest(std::string(130, 'a')));
+    EXPECT_FALSE(table.lookup(makeIdentity(1), &result));
+}
+
+TEST(DigestTableTest, SharedBetweenMappings)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    const std::string path = std::string(directory.name()) + "/table";
+    DigestTable table1(path, 64);
+    DigestTable table2(path, 64);
+
+    const proto::Digest digest = DigestGenerator::make_digest("hello");
+    table1.publish(makeIdentity(1), digest);
+    proto::Digest result;
+    ASSERT_TRUE(table2.lookup(makeIdentity(1), &result));
+    EXPECT_EQ(result, digest);
+}
+
+TEST(DigestTableTest, EvictsWhenFull)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    DigestTable table(std::string(directory.name()) + "/table", 1);
+
+    table.publish(makeIdentity(1), makeDigest("aa"));
+    table.publish(makeIdentity(2), makeDigest("bb"));
+    proto::Digest result;
+    EXPECT_FALSE(table.lookup(makeIdentity(1), &result));
+    ASSERT_TRUE(table.lookup(makeIdentity(2), &result));
+    EXPECT_EQ(result.hash(), "bb");
+}
+
+TEST(DigestTableTest, CorruptedSlotIsIgnored)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    const std::string path = std::string(directory.name()) + "/table";
+    DigestTable table(path, 1);
+    table.publish(makeIdentity(1), makeDigest("aa"));
+
+    // Overwrite the first byte of the hash
+    const int fd = open(path.c_str(), O_RDWR);
+    ASSERT_NE(fd, -1);
+    const char byte = 0x55;
+    ASSERT_EQ(pwrite(fd, &byte, 1, 8 * 8), 1);
+    close(fd);
+
+    proto::Digest result;
+    EXPECT_FALSE(table.lookup(makeIdentity(1), &result));
+}
+
+TEST(DigestTableTest, SlotOfDeadWriterIsTakenOver)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    const std::string path = std::string(directory.name()) + "/table";
+    DigestTable table(path, 1);
+    table.publish(makeIdentity(1), makeDigest("aa"));
+
+    // A writer is in the middle of writing the slot
+    setSlotWriter(path, 3, std::numeric_limits<int64_t>::max());
+    proto::Digest result;
+    EXPECT_FALSE(table.lookup(makeIdentity(1), &result));
+    table.publish(makeIdentity(2), makeDigest("bb"));
+    EXPECT_FALSE(table.lookup(makeIdentity(2), &result));
+
+    // It started long ago, so it must have died
+    setSlotWriter(path, 3, 0);
+    table.publish(makeIdentity(2), makeDigest("bb"));
+    ASSERT_TRUE(table.lookup(makeIdentity(2), &result));
+    EXPECT_EQ(result.hash(), "bb");
+}
@@ -0,0 +1,173 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <directoryencoder.h>
+#include <merklize.h>
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace BloombergLP::recc;
+
+namespace {
+
+std::string randomString(std::mt19937 *random, size_t maxLength)
+{
+    // Mostly short names, sometimes long enough to need a multi-byte
+    // length prefix, sometimes empty
+    std::uniform_int_distribution<size_t> lengthDistribution(0, maxLength);
+    std::uniform_int_distribution<int> shortDistribution(0, 3);
+    const size_t length = shortDistribution(*random) == 0
+                              ? lengthDistribution(*random)
+                              : lengthDistribution(*random) % 16;
+
+    // Protobuf expects strings to be valid UTF-8
+    const std::vector<std::string> characters = {
+        "a", "Z", "0", ".", "/", " ", "\\", "\xc3\xa9", "\xe6\x97\xa5"};
+    std::uniform_int_distribution<size_t> characterDistribution(
+        0, characters.size() - 1);
+    std::string result;
+    for (size_t i = 0; i < length; ++i) {
+        result += characters[characterDistribution(*random)];
+    }
+    return result;
+}
+
+proto::Digest randomDigest(std::mt19937 *random)
+{
+    proto::Digest result;
+    result.set_hash(randomString(random, 130));
+    switch (std::uniform_int_distribution<int>(0, 3)(*random)) {
+        case 0:
+            break;
+        case 1:
+            result.set_size_bytes(
+                std::uniform_int_distribution<int64_t>(1, 127)(*random));
+            break;
+        case 2:
+            result.set_size_bytes(
+                std::uniform_int_distribution<int64_t>()(*random));
+            break;
+        default:
+            result.set_size_bytes(-std::uniform_int_distribution<int64_t>(
+                1, 1000)(*random));
+            break;
+    }
+    return result;
+}
+
+} // namespace
+
+TEST(DirectoryEncoderTest, EmptyDirectory)
+{
+    std::string buffer = "leftover";
+    DirectoryEncoder encoder(&buffer);
+    EXPECT_EQ(buffer, proto::Directory().SerializeAsString());
+}
+
+TEST(DirectoryEncoderTest, MatchesProtobufOnRandomDirectories)
+{
+    std::mt19937 random(4242);
+    std::uniform_int_distribution<int> countDistribution(0, 20);
+    std::string buffer;
+
+    for (int iteration = 0; iteration < 2000; ++iteration) {
+        proto::Directory expected;
+        DirectoryEncoder encoder(&buffer);
+
+        for (int i = countDistribution(random); i > 0; --i) {
+            auto file = expected.add_files();
+            file->set_name(randomString(&random, 300));
+            *file->mutable_digest() = randomDigest(&random);
+            file->set_is_executable(random() % 2 == 0);
+            encoder.addFile(file->name(), file->digest(),
+                            file->is_executable());
+        }
+        for (int i = countDistribution(random); i > 0; --i) {
+            auto directory = expected.add_directories();
+            directory->set_name(randomString(&random, 300));
+            *directory->mutable_digest() = randomDigest(&random);
+            encoder.addDirectory(directory->name(), directory->digest());
+        }
+        for (int i = countDistribution(random); i > 0; --i) {
+            auto symlink = expected.add_symlinks();
+            symlink->set_name(randomString(&random, 300));
+            symlink->set_target(randomString(&random, 300));
+            encoder.addSymlink(symlink->name(), symlink->target());
+        }
+
+        ASSERT_EQ(buffer, expected.SerializeAsString())
+            << "iteration " << iteration;
+    }
+}
+
+TEST(DirectoryEncoderTest, EntriesOutOfOrderThrow)
+{
+    std::string buffer;
+    DirectoryEncoder encoder(&buffer);
+    encoder.addFile("a", proto::Digest(), false);
+    encoder.addSymlink("b", "a");
+    EXPECT_THROW(encoder.addDirectory("c", proto::Digest()),
+                 std::logic_error);
+    EXPECT_THROW(encoder.addFile("d", proto::Digest(), false),
+                 std::logic_error);
+}
+
+TEST(DirectoryEncoderTest, NestedDirectoryBlobsMatchProtobuf)
+{
+    std::mt19937 random(1234);
+    NestedDirectory nestedDirectory;
+    const std::vector<std::string> components = {"a", "bb", "c.h", "dir",
+                                                 "B", "_", "z z"};
+    auto randomComponent = [&]() {
+        return components[random() % components.size()];
+    };
+
+    for (int i = 0; i < 300; ++i) {
+        std::string path = randomComponent();
+        for (int depth = random() % 4; depth > 0; --depth) {
+            path = randomComponent() + "/" + path;
+        }
+        path += std::to_string(i);
+
+        switch (random() % 3) {
+            case 0:
+                nestedDirectory.addSymlink(randomComponent(), path.c_str());
+                break;
+            case 1:
+                nestedDirectory.addDirectory(path.c_str());
+                break;
+            default:
+                nestedDirectory.add(
+                    std::make_shared<ReccFile>(path, "", "",
+                                               randomDigest(&random),
+                                               random() % 2 == 0),
+                    path.c_str());
+                break;
+        }
+    }
+
+    digest_string_umap blobs;
+    nestedDirectory.to_digest(&blobs);
+    EXPECT_GT(blobs.size(), 1);
+    for (const auto &blobIter : blobs) {
+        proto::Directory directory;
+        ASSERT_TRUE(directory.ParseFromString(blobIter.second));
+        EXPECT_EQ(directory.SerializeAsString(), blobIter.second);
+    }
+}
@@ -0,0 +1,151 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <configsnapshot.h>
+#include <env.h>
+#include <fileutils.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace BloombergLP::recc;
+
+TEST(ConfigSnapshotTest, RoundTrip)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    const std::string path = std::string(directory.name()) + "/snapshot";
+
+    const std::set<std::string> set = {"a", "b,c", ""};
+    const std::map<std::string, std::string> map = {{"key", "value"},
+                                                    {"empty", ""}};
+    ConfigSnapshotWriter writer("key");
+    writer.write(std::string("string"));
+    writer.write(true);
+    writer.write(-42);
+    writer.write(set);
+    writer.write(map);
+    FileUtils::writeFile(path, writer.data());
+
+    ConfigSnapshotReader reader(path, "key");
+    ASSERT_TRUE(reader.valid());
+    std::string stringValue;
+    bool boolValue = false;
+    int intValue = 0;
+    std::set<std::string> setValue;
+    std::map<std::string, std::string> mapValue;
+    EXPECT_TRUE(reader.read(&stringValue));
+    EXPECT_TRUE(reader.read(&boolValue));
+    EXPECT_TRUE(reader.read(&intValue));
+    EXPECT_TRUE(reader.read(&setValue));
+    EXPECT_TRUE(reader.read(&mapValue));
+    EXPECT_TRUE(reader.atEnd());
+    EXPECT_TRUE(reader.valid());
+
+    EXPECT_EQ("string", stringValue);
+    EXPECT_TRUE(boolValue);
+    EXPECT_EQ(-42, intValue);
+    EXPECT_EQ(set, setValue);
+    EXPECT_EQ(map, mapValue);
+}
+
+TEST(ConfigSnapshotTest, DifferentKeyOrTruncated)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    const std::string path = std::string(directory.name()) + "/snapshot";
+
+    ConfigSnapshotWriter writer("key");
+    writer.write(std::string("string"));
+    FileUtils::writeFile(path, writer.data());
+
+    EXPECT_FALSE(ConfigSnapshotReader(path, "other key").valid());
+    EXPECT_FALSE(ConfigSnapshotReader(path + "-missing", "key").valid());
+
+    const std::string &data = writer.data();
+    FileUtils::writeFile(path, data.substr(0, data.size() - 1));
+    ConfigSnapshotReader reader(path, "key");
+    std::string value;
+    EXPECT_FALSE(reader.read(&value));
+    EXPECT_FALSE(reader.valid());
+}
+
+/*
+ * WARNING: Test will fail if not invoked by "make test".
+ */
+TEST(EnvTest, EnvConfigSnapshot)
+{
+    unsetenv("RECC_SERVER");
+    unsetenv("RECC_INSTANCE");
+
+    buildboxcommon::TemporaryDirectory cacheDirectory;
+    setenv("RECC_CACHE_DIR", cacheDirectory.name(), 1);
+    RECC_CONFIG_LOCATIONS = {"./recc"};
+
+    std::string path;
+    std::string key;
+    ASSERT_TRUE(Env::config_snapshot_location(::environ, &path, &key));
+    EXPECT_EQ(0, path.find(std::string(cacheDirectory.name()) + "/config/"));
+
+    // The first run parses data/recc/recc.conf and writes a snapshot
+    Env::parse_config_variables();
+    EXPECT_EQ("http://localhost:99999", RECC_SERVER);
+    ASSERT_TRUE(buildboxcommon::FileUtils::isRegularFile(path.c_str()));
+
+    // Later runs read it instead
+    RECC_INSTANCE = "from snapshot";
+    Env::save_config_snapshot(path, key);
+    RECC_INSTANCE = "";
+    Env::parse_config_variables();
+    EXPECT_EQ("from snapshot", RECC_INSTANCE);
+
+    // Unless the environment changes
+    setenv("RECC_INSTANCE", "from environment", 1);
+    std::string newPath;
+    std::string newKey;
+    ASSERT_TRUE(Env::config_snapshot_location(::environ, &newPath, &newKey));
+    EXPECT_NE(path, newPath);
+    Env::parse_config_variables();
+    EXPECT_EQ("from environment", RECC_INSTANCE);
+
+    // Per-invocation variables don't change the snapshot, but still apply
+    setenv("RECC_CORRELATED_INVOCATIONS_ID", "first", 1);
+    ASSERT_TRUE(Env::config_snapshot_location(::environ, &newPath, &newKey));
+    Env::parse_config_variables();
+    EXPECT_EQ("first", RECC_CORRELATED_INVOCATIONS_ID);
+    setenv("RECC_CORRELATED_INVOCATIONS_ID", "second", 1);
+    std::string invocationPath;
+    std::string invocationKey;
+    ASSERT_TRUE(Env::config_snapshot_location(::environ, &invocationPath,
+                                              &invocationKey));
+    EXPECT_EQ(newPath, invocationPath);
+    Env::parse_config_variables();
+    EXPECT_EQ("second", RECC_CORRELATED_INVOCATIONS_ID);
+    EXPECT_EQ("from environment", RECC_INSTANCE);
+    unsetenv("RECC_CORRELATED_INVOCATIONS_ID");
+
+    // A damaged snapshot is ignored
+    FileUtils::writeFile(newPath, "damaged");
+    RECC_INSTANCE = "unchanged";
+    EXPECT_FALSE(Env::load_config_snapshot(newPath, newKey));
+    EXPECT_EQ("unchanged", RECC_INSTANCE);
+
+    // Without RECC_CACHE_DIR, there is no snapshot
+    unsetenv("RECC_CACHE_DIR");
+    EXPECT_FALSE(Env::config_snapshot_location(::environ, &path, &key));
+    unsetenv("RECC_INSTANCE");
+}
@@ -0,0 +1,142 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <env.h>
+#include <executionhistory.h>
+
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <gtest/gtest.h>
+
+using namespace BloombergLP::recc;
+
+TEST(RunningAverageTest, FollowsRecentValues)
+{
+    RunningAverage average;
+    average.add(10);
+    EXPECT_EQ(1, average.d_count);
+    EXPECT_DOUBLE_EQ(10, average.d_mean);
+    average.add(20);
+    EXPECT_DOUBLE_EQ(15, average.d_mean);
+
+    for (int i = 0; i < 100; ++i) {
+        average.add(100);
+    }
+    EXPECT_EQ(8, average.d_count);
+    EXPECT_NEAR(100, average.d_mean, 0.01);
+}
+
+TEST(ExecutionHistoryTest, SerializeRoundTrip)
+{
+    ExecutionHistory history;
+    history.d_workingDirectory = "/src";
+    history.d_command = "gcc -c hello.c -o hello.o";
+    history.d_localExecution.add(1500);
+    history.d_uploadBytes.add(4096);
+    history.d_remoteExecution.add(800);
+    history.d_lastDecision = "remote: no local timings yet";
+
+    ExecutionHistory result;
+    ASSERT_TRUE(ExecutionHistory::deserialize(
+        ExecutionHistory::serialize(history), &result));
+    EXPECT_EQ(history.d_workingDirectory, result.d_workingDirectory);
+    EXPECT_EQ(history.d_command, result.d_command);
+    EXPECT_EQ(1, result.d_localExecution.d_count);
+    EXPECT_DOUBLE_EQ(1500, result.d_localExecution.d_mean);
+    EXPECT_DOUBLE_EQ(4096, result.d_uploadBytes.d_mean);
+    EXPECT_DOUBLE_EQ(800, result.d_remoteExecution.d_mean);
+    EXPECT_EQ(0, result.d_download.d_count);
+    EXPECT_EQ(history.d_lastDecision, result.d_lastDecision);
+}
+
+TEST(ExecutionHistoryTest, DeserializeInvalid)
+{
+    ExecutionHistory result;
+    EXPECT_FALSE(ExecutionHistory::deserialize("", &result));
+    EXPECT_FALSE(ExecutionHistory::deserialize("recc-history 0\n", &result));
+    EXPECT_FALSE(ExecutionHistory::deserialize(
+        "recc-history 1\nupload nonsense\n", &result));
+    EXPECT_FALSE(ExecutionHistory::deserialize(
+        "recc-history 1\nunknown 1 2\n", &result));
+}
+
+TEST(ExecutionHistoryTest, RemoteTimings)
+{
+    proto::ExecutedActionMetadata metadata;
+    metadata.mutable_queued_timestamp()->set_seconds(100);
+    metadata.mutable_worker_start_timestamp()->set_seconds(102);
+    metadata.mutable_execution_start_timestamp()->set_seconds(103);
+    metadata.mutable_execution_completed_timestamp()->set_seconds(104);
+    metadata.mutable_execution_completed_timestamp()->set_nanos(500000000);
+
+    ExecutionHistory history;
+    history.addRemoteTimings(metadata, 10000);
+    EXPECT_DOUBLE_EQ(2000, history.d_remoteQueue.d_mean);
+    EXPECT_DOUBLE_EQ(1500, history.d_remoteExecution.d_mean);
+
+    // Without timestamps, the duration of the call is used
+    history = ExecutionHistory();
+    history.addRemoteTimings(proto::ExecutedActionMetadata(), 10000);
+    EXPECT_EQ(0, history.d_remoteQueue.d_count);
+    EXPECT_DOUBLE_EQ(10000, history.d_remoteExecution.d_mean);
+}
+
+TEST(ExecutionHistoryTest, ExecuteTimePercentile)
+{
+    ExecutionHistory history;
+    for (int i = 1; i <= 4; ++i) {
+        history.addRemoteTimings(proto::ExecutedActionMetadata(), i * 1000);
+    }
+    // Not enough samples yet
+    EXPECT_EQ(0, history.executeTimePercentile(95));
+
+    for (int i = 5; i <= 20; ++i) {
+        history.addRemoteTimings(proto::ExecutedActionMetadata(), i * 1000);
+    }
+    // Only the 16 most recent are kept: 5000 to 20000
+    ASSERT_EQ(16, history.d_recentExecuteTimes.size());
+    EXPECT_DOUBLE_EQ(12000, history.executeTimePercentile(50));
+    EXPECT_DOUBLE_EQ(20000, history.executeTimePercentile(95));
+    EXPECT_DOUBLE_EQ(5000, history.executeTimePercentile(0));
+
+    ExecutionHistory result;
+    ASSERT_TRUE(ExecutionHistory::deserialize(
+        ExecutionHistory::serialize(history), &result));
+    EXPECT_EQ(history.d_recentExecuteTimes, result.d_recentExecuteTimes);
+}
+
+TEST(ExecutionHistoryTest, SaveAndLoad)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    const auto previousCacheDir = RECC_CACHE_DIR;
+    RECC_CACHE_DIR = directory.name();
+
+    const std::vector<std::string> command = {"gcc", "-c", "hello.c"};
+    const std::string path = ExecutionHistory::path(command, "/src");
+    EXPECT_NE(path, ExecutionHistory::path(command, "/other"));
+    EXPECT_EQ(0, ExecutionHistory::load(path).d_localExecution.d_count);
+
+    ExecutionHistory history;
+    history.d_command = "gcc -c hello.c";
+    history.d_localExecution.add(1000);
+    history.save(path);
+
+    EXPECT_EQ(1, ExecutionHistory::load(path).d_localExecution.d_count);
+    const auto all = ExecutionHistory::loadAll();
+    ASSERT_EQ(1, all.size());
+    EXPECT_EQ("gcc -c hello.c", all[0].d_command);
+
+    RECC_CACHE_DIR = previousCacheDir;
+}
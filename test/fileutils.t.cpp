@@ -397,6 +397,22 @@ TEST(PathRewriteTest, SimpleRewriting)
     ASSERT_EQ(test_path, FileUtils::resolvePathFromPrefixMap(test_path));
 }
 
+// The map can be changed between calls
+TEST(PathRewriteTest, ChangedMap)
+{
+    RECC_PREFIX_REPLACEMENT = {{"/hello/hi", "/hello"}};
+    ASSERT_EQ("/hello/file.txt",
+              FileUtils::resolvePathFromPrefixMap("/hello/hi/file.txt"));
+
+    RECC_PREFIX_REPLACEMENT = {{"/hello", "/bye"}};
+    ASSERT_EQ("/bye/hi/file.txt",
+              FileUtils::resolvePathFromPrefixMap("/hello/hi/file.txt"));
+
+    RECC_PREFIX_REPLACEMENT = {};
+    ASSERT_EQ("/hello/hi/file.txt",
+              FileUtils::resolvePathFromPrefixMap("/hello/hi/file.txt"));
+}
+
 // Test more complicated paths
 TEST(PathRewriteTest, ComplicatedPathRewriting)
 {
@@ -0,0 +1,172 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <jobserver.h>
+
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+
+using namespace BloombergLP::recc;
+
+TEST(JobServerTest, ParseMakeflagsFds)
+{
+    int readFd = -1, writeFd = -1;
+    std::string fifoPath;
+    EXPECT_TRUE(JobServer::parseMakeflags(" -j8 --jobserver-auth=3,4", &readFd,
+                                          &writeFd, &fifoPath));
+    EXPECT_EQ(readFd, 3);
+    EXPECT_EQ(writeFd, 4);
+    EXPECT_EQ(fifoPath, "");
+
+    // Before make 4.2
+    EXPECT_TRUE(JobServer::parseMakeflags("s -j --jobserver-fds=5,6", &readFd,
+                                          &writeFd, &fifoPath));
+    EXPECT_EQ(readFd, 5);
+    EXPECT_EQ(writeFd, 6);
+}
+
+TEST(JobServerTest, ParseMakeflagsFifo)
+{
+    int readFd = -1, writeFd = -1;
+    std::string fifoPath;
+    EXPECT_TRUE(JobServer::parseMakeflags(
+        "-j16 --jobserver-auth=fifo:/tmp/GMfifo1234 -- CC=gcc", &readFd,
+        &writeFd, &fifoPath));
+    EXPECT_EQ(fifoPath, "/tmp/GMfifo1234");
+}
+
+TEST(JobServerTest, ParseMakeflagsLastOptionWins)
+{
+    int readFd = -1, writeFd = -1;
+    std::string fifoPath;
+    EXPECT_TRUE(JobServer::parseMakeflags(
+        "--jobserver-auth=fifo:/tmp/a --jobserver-auth=7,8", &readFd,
+        &writeFd, &fifoPath));
+    EXPECT_EQ(fifoPath, "");
+    EXPECT_EQ(readFd, 7);
+    EXPECT_EQ(writeFd, 8);
+}
+
+TEST(JobServerTest, ParseMakeflagsWithoutJobserver)
+{
+    int readFd = -1, writeFd = -1;
+    std::string fifoPath;
+    EXPECT_FALSE(
+        JobServer::parseMakeflags("-k -j1", &readFd, &writeFd, &fifoPath));
+    EXPECT_FALSE(JobServer::parseMakeflags("--jobserver-auth=3", &readFd,
+                                           &writeFd, &fifoPath));
+    EXPECT_FALSE(JobServer::parseMakeflags("--jobserver-auth=fifo:", &readFd,
+                                           &writeFd, &fifoPath));
+    // Only a variable definition
+    EXPECT_FALSE(JobServer::parseMakeflags("-- X=--jobserver-auth=3,4",
+                                           &readFd, &writeFd, &fifoPath));
+}
+
+TEST(JobServerTest, ReleaseAndAcquireWithPipe)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    // make leaves a token in the pipe for every free slot
+    ASSERT_EQ(write(fds[1], "x", 1), 1);
+
+    {
+        JobServer jobServer(fds[0], fds[1]);
+        EXPECT_TRUE(jobServer.holdsSlot());
+
+        // Lending the slot adds a token
+        jobServer.releaseSlot();
+        jobServer.releaseSlot();
+        EXPECT_FALSE(jobServer.holdsSlot());
+
+        char tokens[2];
+        ASSERT_EQ(read(fds[0], tokens, 2), 2);
+        EXPECT_EQ(std::string(tokens, 2), "x+");
+        ASSERT_EQ(write(fds[1], "y", 1), 1);
+
+        jobServer.acquireSlot();
+        jobServer.acquireSlot();
+        EXPECT_TRUE(jobServer.holdsSlot());
+
+        // The token taken is the one given back
+        jobServer.releaseSlot();
+        char token;
+        ASSERT_EQ(read(fds[0], &token, 1), 1);
+        EXPECT_EQ(token, 'y');
+    }
+
+    // The file descriptors belong to make
+    EXPECT_NE(fcntl(fds[0], F_GETFD), -1);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(JobServerTest, AcquireBeforeExit)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+
+    {
+        JobServer jobServer(fds[0], fds[1]);
+        jobServer.acquireSlotBeforeExit(-1);
+        EXPECT_TRUE(jobServer.holdsSlot());
+
+        jobServer.releaseSlot();
+        jobServer.acquireSlotBeforeExit(-1);
+        EXPECT_TRUE(jobServer.holdsSlot());
+
+        // Another job holds the slot, so it is only waited for as long as
+        // asked to
+        jobServer.releaseSlot();
+        char token;
+        ASSERT_EQ(read(fds[0], &token, 1), 1);
+        jobServer.acquireSlotBeforeExit(0);
+        EXPECT_FALSE(jobServer.holdsSlot());
+
+        // Without a limit, until the other job is done
+        std::thread otherJob([&]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            EXPECT_EQ(write(fds[1], &token, 1), 1);
+        });
+        jobServer.acquireSlotBeforeExit(-1);
+        otherJob.join();
+        EXPECT_TRUE(jobServer.holdsSlot());
+    }
+
+    // make's own descriptor is left blocking
+    EXPECT_EQ(fcntl(fds[0], F_GETFL) & O_NONBLOCK, 0);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(JobServerTest, ReleaseAndAcquireWithFifo)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    const std::string path = std::string(directory.name()) + "/fifo";
+    ASSERT_EQ(mkfifo(path.c_str(), 0600), 0);
+
+    JobServer jobServer(path);
+    jobServer.releaseSlot();
+    jobServer.acquireSlot();
+    EXPECT_TRUE(jobServer.holdsSlot());
+
+    EXPECT_THROW(JobServer(path + "-missing"), std::system_error);
+}
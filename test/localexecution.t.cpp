@@ -0,0 +1,111 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <digestgenerator.h>
+#include <fileutils.h>
+#include <localexecution.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <gtest/gtest.h>
+
+using namespace BloombergLP::recc;
+
+TEST(LocalExecutionTest, BuildActionResult)
+{
+    buildboxcommon::TemporaryDirectory root;
+    const std::string rootPath = root.name();
+    FileUtils::writeFile(rootPath + "/out/hello.o", "object");
+    FileUtils::writeFile(rootPath + "/hello", "executable");
+    buildboxcommon::FileUtils::makeExecutable(
+        (rootPath + "/hello").c_str());
+
+    proto::Command command;
+    command.add_output_files("out/hello.o");
+    command.add_output_files("hello");
+    // Declared but not produced
+    command.add_output_files("hello.d");
+
+    proto::ActionResult result;
+    digest_string_umap blobs;
+    EXPECT_TRUE(LocalExecution::buildActionResult(
+        command, 0, "output", "warning", rootPath, &result, &blobs));
+
+    EXPECT_EQ(0, result.exit_code());
+    EXPECT_EQ("output", blobs.at(result.stdout_digest()));
+    EXPECT_EQ("warning", blobs.at(result.stderr_digest()));
+
+    ASSERT_EQ(2, result.output_files_size());
+    EXPECT_EQ("out/hello.o", result.output_files(0).path());
+    EXPECT_EQ(DigestGenerator::make_digest("object"),
+              result.output_files(0).digest());
+    EXPECT_FALSE(result.output_files(0).is_executable());
+    EXPECT_EQ("hello", result.output_files(1).path());
+    EXPECT_TRUE(result.output_files(1).is_executable());
+    EXPECT_EQ("executable", blobs.at(result.output_files(1).digest()));
+}
+
+TEST(LocalExecutionTest, BuildActionResultWithOutputPaths)
+{
+    buildboxcommon::TemporaryDirectory root;
+    const std::string rootPath = root.name();
+    FileUtils::writeFile(rootPath + "/hello.o", "object");
+
+    proto::Command command;
+    command.add_output_paths("hello.o");
+
+    proto::ActionResult result;
+    digest_string_umap blobs;
+    EXPECT_TRUE(LocalExecution::buildActionResult(command, 1, "", "error",
+                                                  rootPath, &result, &blobs));
+    EXPECT_EQ(1, result.exit_code());
+    ASSERT_EQ(1, result.output_files_size());
+    EXPECT_EQ("object", blobs.at(result.output_files(0).digest()));
+}
+
+TEST(LocalExecutionTest, OutputDirectoriesAreIncomplete)
+{
+    buildboxcommon::TemporaryDirectory root;
+    const std::string rootPath = root.name();
+    FileUtils::writeFile(rootPath + "/out/hello.o", "object");
+
+    proto::Command command;
+    command.add_output_paths("out");
+
+    proto::ActionResult result;
+    digest_string_umap blobs;
+    EXPECT_FALSE(LocalExecution::buildActionResult(
+        command, 0, "", "", rootPath, &result, &blobs));
+
+    proto::Command directoryCommand;
+    directoryCommand.add_output_directories("out");
+    EXPECT_FALSE(LocalExecution::buildActionResult(
+        directoryCommand, 0, "", "", rootPath, &result, &blobs));
+}
+
+TEST(LocalExecutionTest, Execute)
+{
+    proto::ActionResult result;
+    digest_string_umap blobs;
+    EXPECT_TRUE(LocalExecution::execute(
+        {"sh", "-c", "echo hello; echo world >&2; exit 3"}, proto::Command(),
+        &result, &blobs));
+
+    EXPECT_EQ(3, result.exit_code());
+    EXPECT_EQ("hello\n", blobs.at(result.stdout_digest()));
+    EXPECT_EQ("world\n", blobs.at(result.stderr_digest()));
+    EXPECT_EQ(0, result.output_files_size());
+}
@@ -0,0 +1,145 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <env.h>
+#include <localpreprocessor.h>
+#include <parsedcommandfactory.h>
+
+#include <gtest/gtest.h>
+
+using namespace BloombergLP::recc;
+
+TEST(LocalPreprocessorTest, Supports)
+{
+    EXPECT_TRUE(LocalPreprocessor::supports(
+        ParsedCommandFactory::createParsedCommand(
+            {"gcc", "-c", "hello.c", "-o", "hello.o"})));
+
+    // Not a compile command
+    EXPECT_FALSE(LocalPreprocessor::supports(
+        ParsedCommandFactory::createParsedCommand(
+            {"gcc", "hello.c", "-o", "hello"})));
+    // Explicit language
+    EXPECT_FALSE(LocalPreprocessor::supports(
+        ParsedCommandFactory::createParsedCommand(
+            {"gcc", "-c", "-x", "c", "hello.c", "-o", "hello.o"})));
+    // More than one source file
+    EXPECT_FALSE(LocalPreprocessor::supports(
+        ParsedCommandFactory::createParsedCommand(
+            {"gcc", "-c", "hello.c", "world.c"})));
+    // Unsupported compiler
+    EXPECT_FALSE(LocalPreprocessor::supports(
+        ParsedCommandFactory::createParsedCommand(
+            {"CC", "-c", "hello.c", "-o", "hello.o"})));
+}
+
+TEST(LocalPreprocessorTest, PreprocessedFileName)
+{
+    EXPECT_EQ("hello.i", LocalPreprocessor::preprocessedFileName(
+                             ParsedCommandFactory::createParsedCommand(
+                                 {"gcc", "-c", "src/hello.c"})));
+    EXPECT_EQ("hello.ii", LocalPreprocessor::preprocessedFileName(
+                              ParsedCommandFactory::createParsedCommand(
+                                  {"gcc", "-c", "src/hello.cpp"})));
+    // g++ compiles .c files as C++
+    EXPECT_EQ("hello.ii", LocalPreprocessor::preprocessedFileName(
+                              ParsedCommandFactory::createParsedCommand(
+                                  {"g++", "-c", "src/hello.c"})));
+}
+
+TEST(LocalPreprocessorTest, PreprocessCommand)
+{
+    const auto command = ParsedCommandFactory::createParsedCommand(
+        {"gcc", "-c", "-I", "include", "-DFOO=1", "hello.c", "-o",
+         "out/hello.o", "-MD"});
+
+    const std::vector<std::string> expected = {
+        "gcc", "-I",  "include",     "-DFOO=1", "hello.c", "-MD",
+        "-E",  "-MF", "out/hello.d", "-MT",     "out/hello.o"};
+    EXPECT_EQ(expected, LocalPreprocessor::preprocessCommand(command));
+}
+
+TEST(LocalPreprocessorTest, PreprocessCommandKeepsDependencyOptions)
+{
+    const auto command = ParsedCommandFactory::createParsedCommand(
+        {"gcc", "-c", "hello.c", "-MMD", "-MF", "hello.d", "-MT", "target",
+         "-ohello.o"});
+
+    const std::vector<std::string> expected = {
+        "gcc", "hello.c", "-MMD", "-MF", "hello.d", "-MT", "target", "-E"};
+    EXPECT_EQ(expected, LocalPreprocessor::preprocessCommand(command));
+}
+
+TEST(LocalPreprocessorTest, CompileCommand)
+{
+    const auto command = ParsedCommandFactory::createParsedCommand(
+        {"gcc", "-c", "-I", "include", "-Iinclude2", "-DFOO=1", "-UBAR",
+         "-include", "config.h", "-isystem", "/opt/include", "-Wp,-DBAZ",
+         "-Wall", "-O2", "-MD", "-MF", "hello.d", "hello.c", "-o",
+         "hello.o"});
+
+    const std::vector<std::string> expected = {
+        "gcc", "-c", "-Wall", "-O2", "hello.i", "-o", "hello.o"};
+    EXPECT_EQ(expected, LocalPreprocessor::compileCommand(command, "hello.i"));
+}
+
+TEST(LocalPreprocessorTest, CompileCommandDirectivesOnly)
+{
+    const auto gccCommand = ParsedCommandFactory::createParsedCommand(
+        {"gcc", "-c", "-fdirectives-only", "hello.c", "-o", "hello.o"});
+    const std::vector<std::string> expectedGcc = {
+        "gcc",     "-c",           "hello.i",
+        "-o",      "hello.o",      "-fpreprocessed",
+        "-fdirectives-only"};
+    EXPECT_EQ(expectedGcc,
+              LocalPreprocessor::compileCommand(gccCommand, "hello.i"));
+
+    const auto clangCommand = ParsedCommandFactory::createParsedCommand(
+        {"clang", "-c", "-fdirectives-only", "hello.c", "-o", "hello.o"});
+    const std::vector<std::string> expectedClang = {"clang", "-c", "hello.i",
+                                                    "-o", "hello.o"};
+    EXPECT_EQ(expectedClang,
+              LocalPreprocessor::compileCommand(clangCommand, "hello.i"));
+}
+
+TEST(LocalPreprocessorTest, NormalizeLineMarkers)
+{
+    const auto previousProjectRoot = RECC_PROJECT_ROOT;
+    const auto previousPrefixReplacement = RECC_PREFIX_REPLACEMENT;
+    RECC_PROJECT_ROOT = "/home/nobody/";
+    RECC_PREFIX_REPLACEMENT = {{"/opt/sdk", "/sdk"}};
+
+    const std::string source =
+        "# 1 \"/home/nobody/project/src/hello.c\"\n"
+        "# 1 \"<built-in>\"\n"
+        "#line 7 \"/home/nobody/project/include/hello.h\"\n"
+        "# 1 \"/opt/sdk/include/stdio.h\" 1 3 4\n"
+        "# 3 \"/usr/include/weird\\\\name.h\" 2\n"
+        "const char *s = \"# 1 \\\"/home/nobody/project/src/hello.c\\\"\";\n"
+        "int main() { return 0; }";
+    const std::string expected =
+        "# 1 \"src/hello.c\"\n"
+        "# 1 \"<built-in>\"\n"
+        "#line 7 \"include/hello.h\"\n"
+        "# 1 \"/sdk/include/stdio.h\" 1 3 4\n"
+        "# 3 \"/usr/include/weird\\\\name.h\" 2\n"
+        "const char *s = \"# 1 \\\"/home/nobody/project/src/hello.c\\\"\";\n"
+        "int main() { return 0; }";
+
+    EXPECT_EQ(expected, LocalPreprocessor::normalizeLineMarkers(
+                            source, "/home/nobody/project"));
+
+    RECC_PROJECT_ROOT = previousProjectRoot;
+    RECC_PREFIX_REPLACEMENT = previousPrefixReplacement;
+}
@@ -615,3 +615,28 @@ TEST(NestedDirectoryTest, EmptyDirTest)
     const std::vector<std::string> rmCommand = {"rm", "-rf", dirPath};
     Subprocess::execute(rmCommand);
 }
+
+TEST(NestedDirectoryTest, AddFromPathTable)
+{
+    proto::Digest digest;
+    digest.set_hash("HASH HERE");
+    digest.set_size_bytes(1);
+    const auto file = std::make_shared<ReccFile>("", "", "", digest, false);
+
+    const std::vector<std::string> filePaths = {
+        "/usr/include/stdio.h", "/usr/include/sys/types.h", "src/main.cpp",
+        "../sibling/header.h", "/usr/include/../lib/crt1.o"};
+
+    PathTable paths;
+    NestedDirectory fromTable;
+    NestedDirectory fromStrings;
+    for (const auto &filePath : filePaths) {
+        const auto path = paths.add(filePath, "/build");
+        fromTable.add(file, paths, path);
+        fromStrings.add(file, paths.toString(path).c_str(), true);
+    }
+
+    EXPECT_EQ(fromTable.to_digest(), fromStrings.to_digest());
+    EXPECT_EQ(fromTable.d_subdirs->count("usr"), 1);
+    EXPECT_EQ(fromTable.d_subdirs->count("build"), 1);
+}
@@ -0,0 +1,227 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <digestgenerator.h>
+#include <outputwriter.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <set>
+#include <string>
+#include <sys/stat.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace BloombergLP::recc;
+
+namespace {
+
+std::set<std::string> directoryEntries(const std::string &path)
+{
+    std::set<std::string> result;
+    DIR *dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        return result;
+    }
+    while (const struct dirent *entry = readdir(dir)) {
+        const std::string name = entry->d_name;
+        if (name != "." && name != "..") {
+            result.insert(name);
+        }
+    }
+    closedir(dir);
+    return result;
+}
+
+// Set the modification time of the given file to an hour ago and return it
+time_t makeOld(const std::string &path)
+{
+    const time_t old = time(nullptr) - 3600;
+    const struct timespec times[2] = {{old, 0}, {old, 0}};
+    EXPECT_EQ(utimensat(AT_FDCWD, path.c_str(), times, 0), 0);
+    return old;
+}
+
+time_t modificationTime(const std::string &path)
+{
+    struct stat statResult;
+    EXPECT_EQ(stat(path.c_str(), &statResult), 0);
+    return statResult.st_mtime;
+}
+
+} // namespace
+
+TEST(OutputWriterTest, WritesFilesAndCreatesDirectories)
+{
+    buildboxcommon::TemporaryDirectory tempDir;
+    const std::string root = tempDir.name();
+    OutputWriter writer(root);
+
+    writer.write("hello.o", "object", false);
+    writer.write("a/b/c/hello.d", "dependencies", false);
+    writer.write("a/b/other.d", "", false);
+
+    EXPECT_EQ(buildboxcommon::FileUtils::getFileContents(
+                  (root + "/hello.o").c_str()),
+              "object");
+    EXPECT_EQ(buildboxcommon::FileUtils::getFileContents(
+                  (root + "/a/b/c/hello.d").c_str()),
+              "dependencies");
+    EXPECT_EQ(buildboxcommon::FileUtils::getFileContents(
+                  (root + "/a/b/other.d").c_str()),
+              "");
+    EXPECT_EQ(directoryEntries(root),
+              std::set<std::string>({"hello.o", "a"}));
+}
+
+TEST(OutputWriterTest, SetsExecutableBit)
+{
+    buildboxcommon::TemporaryDirectory tempDir;
+    const std::string root = tempDir.name();
+    OutputWriter writer(root);
+
+    writer.write("a.out", "program", true);
+    writer.write("hello.o", "object", false);
+
+    EXPECT_TRUE(
+        buildboxcommon::FileUtils::isExecutable((root + "/a.out").c_str()));
+    EXPECT_FALSE(
+        buildboxcommon::FileUtils::isExecutable((root + "/hello.o").c_str()));
+}
+
+TEST(OutputWriterTest, ReplacesExistingFile)
+{
+    buildboxcommon::TemporaryDirectory tempDir;
+    const std::string root = tempDir.name();
+    const std::string path = root + "/hello.o";
+    OutputWriter writer(root);
+
+    writer.write("hello.o", "a longer old object", false);
+    struct stat oldStat;
+    ASSERT_EQ(stat(path.c_str(), &oldStat), 0);
+
+    writer.write("hello.o", "new object", false);
+    struct stat newStat;
+    ASSERT_EQ(stat(path.c_str(), &newStat), 0);
+
+    // Replaced, rather than written in place
+    EXPECT_NE(oldStat.st_ino, newStat.st_ino);
+    EXPECT_EQ(buildboxcommon::FileUtils::getFileContents(path.c_str()),
+              "new object");
+    EXPECT_EQ(directoryEntries(root), std::set<std::string>({"hello.o"}));
+}
+
+TEST(OutputWriterTest, FailureLeavesNoTemporaryFile)
+{
+    buildboxcommon::TemporaryDirectory tempDir;
+    const std::string root = tempDir.name();
+    OutputWriter writer(root);
+
+    // A directory can't be replaced by a file
+    writer.write("out/hello.o", "object", false);
+    EXPECT_THROW(writer.write("out", "object", false), std::system_error);
+    EXPECT_EQ(directoryEntries(root), std::set<std::string>({"out"}));
+
+    // Nor can a file be used as a directory
+    EXPECT_THROW(writer.write("out/hello.o/hello.d", "", false),
+                 std::system_error);
+    EXPECT_EQ(directoryEntries(root + "/out"),
+              std::set<std::string>({"hello.o"}));
+}
+
+TEST(OutputWriterTest, WritesFromSeveralThreads)
+{
+    buildboxcommon::TemporaryDirectory tempDir;
+    const std::string root = tempDir.name();
+    OutputWriter writer(root);
+
+    const int threadCount = 8;
+    const int filesPerThread = 50;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threadCount; ++i) {
+        threads.emplace_back([&writer, i]() {
+            for (int j = 0; j < filesPerThread; ++j) {
+                // Every thread creates the same directories
+                const std::string name = "d" + std::to_string(j % 5) +
+                                         "/e/f" + std::to_string(i) + "-" +
+                                         std::to_string(j);
+                writer.write(name, name, j % 2 == 0);
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    size_t files = 0;
+    for (int d = 0; d < 5; ++d) {
+        const std::string directory = "d" + std::to_string(d) + "/e";
+        for (const auto &name : directoryEntries(root + "/" + directory)) {
+            EXPECT_EQ(buildboxcommon::FileUtils::getFileContents(
+                          (root + "/" + directory + "/" + name).c_str()),
+                      directory + "/" + name);
+            ++files;
+        }
+    }
+    EXPECT_EQ(files, threadCount * filesPerThread);
+}
+
+TEST(OutputWriterTest, IsUpToDateComparesDigests)
+{
+    buildboxcommon::TemporaryDirectory tempDir;
+    const std::string root = tempDir.name();
+    OutputWriter writer(root);
+
+    const auto digest = DigestGenerator::make_digest("object");
+    EXPECT_FALSE(writer.isUpToDate("hello.o", digest, false, false));
+
+    writer.write("hello.o", "object", false);
+    EXPECT_TRUE(writer.isUpToDate("hello.o", digest, false, false));
+    // Different executable bit
+    EXPECT_FALSE(writer.isUpToDate("hello.o", digest, true, false));
+
+    // Same size, different contents
+    writer.write("hello.o", "objecT", false);
+    EXPECT_FALSE(writer.isUpToDate("hello.o", digest, false, false));
+
+    // Not a regular file
+    writer.write("target.o", "object", false);
+    ASSERT_EQ(symlink("target.o", (root + "/link.o").c_str()), 0);
+    EXPECT_FALSE(writer.isUpToDate("link.o", digest, false, false));
+    EXPECT_FALSE(writer.isUpToDate(".", digest, false, false));
+}
+
+TEST(OutputWriterTest, IsUpToDateTouchesIfRequested)
+{
+    buildboxcommon::TemporaryDirectory tempDir;
+    const std::string root = tempDir.name();
+    const std::string path = root + "/hello.o";
+    OutputWriter writer(root);
+    const auto digest = DigestGenerator::make_digest("object");
+
+    writer.write("hello.o", "object", false);
+    const time_t old = makeOld(path);
+    EXPECT_TRUE(writer.isUpToDate("hello.o", digest, false, false));
+    EXPECT_EQ(modificationTime(path), old);
+
+    EXPECT_TRUE(writer.isUpToDate("hello.o", digest, false, true));
+    EXPECT_GT(modificationTime(path), old);
+}
@@ -14,10 +14,17 @@
 
 #include <compilerdefaults.h>
 #include <env.h>
+#include <fileutils.h>
 #include <gtest/gtest.h>
 #include <parsedcommand.h>
 #include <parsedcommandfactory.h>
 
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
 using namespace BloombergLP::recc;
 
 TEST(VectorFromArgvTest, EmptyArgv)
@@ -184,6 +191,149 @@ TEST(TestParsedCommandFactory, testPreprocessor)
     EXPECT_EQ(true, parsedCommand.is_compiler_command());
 }
 
+TEST(TestParsedCommandFactory, testDependencyFileFromOutput)
+{
+    RECC_PROJECT_ROOT = "/home/nobody/";
+
+    const std::vector<std::string> command = {
+        "gcc", "-c", "hello.c", "-MD", "-o", "/home/nobody/test/out/hello.o"};
+
+    auto parsedCommand = ParsedCommandFactory::createParsedCommand(
+        command, "/home/nobody/test");
+
+    const std::set<std::string> expectedProducts = {"out/hello.o",
+                                                    "out/hello.d"};
+
+    EXPECT_EQ(parsedCommand.get_dependency_file(),
+              "/home/nobody/test/out/hello.d");
+    EXPECT_FALSE(parsedCommand.dependency_file_omits_system_headers());
+    EXPECT_EQ(parsedCommand.get_products(), expectedProducts);
+}
+
+TEST(TestParsedCommandFactory, testDependencyFileFromOption)
+{
+    const std::vector<std::string> command = {
+        "gcc", "-c", "hello.c", "-MMD", "-MF", "deps/hello.d",
+        "-o",  "hello.o"};
+
+    auto parsedCommand =
+        ParsedCommandFactory::createParsedCommand(command, "/home/nobody");
+
+    const std::set<std::string> expectedProducts = {"hello.o",
+                                                    "deps/hello.d"};
+
+    EXPECT_EQ(parsedCommand.get_dependency_file(), "deps/hello.d");
+    EXPECT_TRUE(parsedCommand.dependency_file_omits_system_headers());
+    EXPECT_EQ(parsedCommand.get_products(), expectedProducts);
+}
+
+TEST(TestParsedCommandFactory, testDependencyFileFromPreprocessorOption)
+{
+    const std::vector<std::string> command = {
+        "gcc", "-c", "hello.c", "-Wp,-MD,'hello.d'", "-o", "hello.o"};
+
+    auto parsedCommand =
+        ParsedCommandFactory::createParsedCommand(command, "/home/nobody");
+
+    EXPECT_EQ(parsedCommand.get_dependency_file(), "hello.d");
+    EXPECT_FALSE(parsedCommand.dependency_file_omits_system_headers());
+}
+
+TEST(TestParsedCommandFactory, testNoDependencyFile)
+{
+    // -MF alone doesn't make the compiler write a dependency file.
+    const std::vector<std::string> command = {
+        "gcc", "-c", "hello.c", "-MF", "hello.d", "-o", "hello.o"};
+
+    auto parsedCommand =
+        ParsedCommandFactory::createParsedCommand(command, "/home/nobody");
+
+    EXPECT_EQ(parsedCommand.get_dependency_file(), "");
+}
+
+TEST(TestParsedCommandFactory, testOriginalCommandKept)
+{
+    const std::vector<std::string> command = {"gcc", "-c", "hello.c", "-o",
+                                              "hello.o"};
+
+    const auto parsedCommand =
+        ParsedCommandFactory::createParsedCommand(command, "/home/nobody");
+
+    EXPECT_EQ(command, parsedCommand.d_originalCommand);
+}
+
+TEST(TestParsedCommandFactory, testMissingOptionArguments)
+{
+    // Options that expect another argument at the end of the command
+    const std::vector<std::string> outputCommand = {"gcc", "-c", "hello.c",
+                                                    "-o"};
+    const auto parsedOutputCommand = ParsedCommandFactory::createParsedCommand(
+        outputCommand, "/home/nobody");
+    EXPECT_EQ(outputCommand, parsedOutputCommand.get_command());
+    EXPECT_TRUE(parsedOutputCommand.get_products().empty());
+
+    const std::vector<std::string> preprocessorCommand = {
+        "gcc", "-c", "hello.c", "-Xpreprocessor"};
+    const auto parsedPreprocessorCommand =
+        ParsedCommandFactory::createParsedCommand(preprocessorCommand,
+                                                  "/home/nobody");
+    EXPECT_TRUE(parsedPreprocessorCommand.d_preProcessorOptions.empty());
+}
+
+TEST(TestParsedCommandFactory, testResponseFile)
+{
+    RECC_PROJECT_ROOT = "/home/nobody/";
+
+    buildboxcommon::TemporaryDirectory directory;
+    const std::string responseFile =
+        std::string(directory.name()) + "/args.rsp";
+    FileUtils::writeFile(responseFile,
+                         "-c hello.c -MD\n"
+                         "-I/home/nobody/headers\n"
+                         "-o '/home/nobody/test/out dir/hello.o'\n");
+
+    const std::vector<std::string> command = {"gcc", "@" + responseFile};
+    auto parsedCommand = ParsedCommandFactory::createParsedCommand(
+        command, "/home/nobody/test");
+
+    const std::vector<std::string> expectedCommand = {
+        "gcc", "-c", "hello.c", "-MD", "-I../headers", "-o",
+        "out dir/hello.o"};
+    const std::set<std::string> expectedProducts = {"out dir/hello.o",
+                                                    "out dir/hello.d"};
+
+    ASSERT_TRUE(parsedCommand.is_compiler_command());
+    EXPECT_TRUE(parsedCommand.uses_response_files());
+    EXPECT_EQ(expectedCommand, parsedCommand.get_command());
+    EXPECT_EQ(expectedProducts, parsedCommand.get_products());
+    // The dependencies command is run locally, with the local paths
+    const auto dependenciesCommand = parsedCommand.get_dependencies_command();
+    EXPECT_NE(dependenciesCommand.end(),
+              std::find(dependenciesCommand.begin(), dependenciesCommand.end(),
+                        "-I/home/nobody/headers"));
+}
+
+TEST(TestParsedCommandFactory, testResponseFileOnlyForGccAndClang)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    FileUtils::writeFile(std::string(directory.name()) + "/args.rsp",
+                         "-c hello.c\n");
+
+    // Sun's compiler doesn't read response files
+    const std::vector<std::string> command = {"CC", "@args.rsp"};
+    const auto parsedCommand =
+        ParsedCommandFactory::createParsedCommand(command, directory.name());
+    EXPECT_FALSE(parsedCommand.uses_response_files());
+    EXPECT_EQ(command, parsedCommand.d_originalCommand);
+
+    // A relative response file is found in the working directory
+    const auto gccCommand = ParsedCommandFactory::createParsedCommand(
+        {"gcc", "@args.rsp"}, directory.name());
+    EXPECT_TRUE(gccCommand.uses_response_files());
+    const std::vector<std::string> expected = {"gcc", "-c", "hello.c"};
+    EXPECT_EQ(expected, gccCommand.d_originalCommand);
+}
+
 TEST(PathReplacement, modifyRemotePathUnmodified)
 {
     // If a given path doesn't match any PREFIX_REPLACEMENT
@@ -266,46 +416,108 @@ size_t getAddress(std::function<T(U...)> f)
     return (size_t)*fnPointer;
 }
 
+static const CompilerOptionMatcher testMatcher(testRules);
+
 TEST(CompilerOptionMatch, simpleMatches)
 {
     auto flag = "-B";
-    auto funcPtr =
-        ParsedCommandModifiers::matchCompilerOptions(flag, testRules);
+    auto match =
+        ParsedCommandModifiers::matchCompilerOptions(flag, testMatcher);
 
-    ASSERT_NE(funcPtr.second, nullptr);
-    EXPECT_EQ(getAddress(funcPtr.second), getAddress(testRules.at(flag)));
+    ASSERT_NE(nullptr, match);
+    EXPECT_EQ(getAddress(match->d_function), getAddress(testRules.at(flag)));
 
     auto equalFlag = "-B=";
-    funcPtr =
-        ParsedCommandModifiers::matchCompilerOptions(equalFlag, testRules);
-    ASSERT_NE(funcPtr.second, nullptr);
-    EXPECT_EQ(getAddress(funcPtr.second), getAddress(testRules.at(flag)));
+    match =
+        ParsedCommandModifiers::matchCompilerOptions(equalFlag, testMatcher);
+    ASSERT_NE(nullptr, match);
+    EXPECT_EQ(getAddress(match->d_function), getAddress(testRules.at(flag)));
 
     // Make sure the function pointer is unique, and doesn't match the other
     // flags.
-    EXPECT_NE(getAddress(funcPtr.second), getAddress(testRules.at("-BBB")));
+    EXPECT_NE(getAddress(match->d_function),
+              getAddress(testRules.at("-BBB")));
 }
 
 TEST(CompilerOptionMatch, moreComplexMatches)
 {
     auto flag = "-B hello -C";
-    auto funcPtr =
-        ParsedCommandModifiers::matchCompilerOptions(flag, testRules);
+    auto match =
+        ParsedCommandModifiers::matchCompilerOptions(flag, testMatcher);
 
-    ASSERT_NE(funcPtr.second, nullptr);
-    EXPECT_EQ(getAddress(funcPtr.second), getAddress(testRules.at("-B")));
+    ASSERT_NE(nullptr, match);
+    EXPECT_EQ(getAddress(match->d_function), getAddress(testRules.at("-B")));
 
     flag = "-B.../usr/bin";
-    funcPtr = ParsedCommandModifiers::matchCompilerOptions(flag, testRules);
+    match = ParsedCommandModifiers::matchCompilerOptions(flag, testMatcher);
 
-    ASSERT_NE(funcPtr.second, nullptr);
-    EXPECT_EQ(getAddress(funcPtr.second), getAddress(testRules.at("-B")));
+    ASSERT_NE(nullptr, match);
+    EXPECT_EQ(getAddress(match->d_function), getAddress(testRules.at("-B")));
 
-    funcPtr = ParsedCommandModifiers::matchCompilerOptions("B", testRules);
-    EXPECT_EQ(funcPtr.second, nullptr);
+    match = ParsedCommandModifiers::matchCompilerOptions("B", testMatcher);
+    EXPECT_EQ(nullptr, match);
 
     flag = "-B = hi ";
-    funcPtr = ParsedCommandModifiers::matchCompilerOptions(flag, testRules);
-    EXPECT_EQ(getAddress(funcPtr.second), getAddress(testRules.at("-B")));
-    EXPECT_EQ(funcPtr.first, "-B");
+    match = ParsedCommandModifiers::matchCompilerOptions(flag, testMatcher);
+    ASSERT_NE(nullptr, match);
+    EXPECT_EQ(getAddress(match->d_function), getAddress(testRules.at("-B")));
+    EXPECT_EQ(match->d_option, "-B");
+}
+
+// The matching as originally written, with a copy and a scan of every rule
+static std::string
+referenceMatch(const std::string &option,
+               const ParsedCommandFactory::CompilerOptionToFuncMapType &rules)
+{
+    auto tempOption = option;
+    if (!tempOption.empty() && tempOption.front() == '-') {
+        tempOption = tempOption.substr(0, tempOption.find("="));
+        tempOption.erase(
+            std::remove_if(tempOption.begin(), tempOption.end(), ::isspace),
+            tempOption.end());
+        if (rules.count(tempOption) > 0) {
+            return tempOption;
+        }
+        for (const auto &rule : rules) {
+            if (option.substr(0, rule.first.length()) == rule.first) {
+                return rule.first;
+            }
+        }
+    }
+    return "<none>";
+}
+
+TEST(CompilerOptionMatch, MatchesScanOfAllRules)
+{
+    const ParsedCommandFactory::CompilerOptionToFuncMapType rules = {
+        {"-M", ParsedCommandModifiers::parseInterfersWithDepsOption},
+        {"-MM", ParsedCommandModifiers::parseInterfersWithDepsOption},
+        {"-MMD", ParsedCommandModifiers::parseInterfersWithDepsOption},
+        {"-MD", ParsedCommandModifiers::parseInterfersWithDepsOption},
+        {"-I", ParsedCommandModifiers::parseIsInputPathOption},
+        {"-include", ParsedCommandModifiers::parseIsInputPathOption},
+        {"-qmakedep", ParsedCommandModifiers::parseInterfersWithDepsOption},
+        {"-qmakedep=gcc",
+         ParsedCommandModifiers::parseInterfersWithDepsOption},
+        {"--sysroot", ParsedCommandModifiers::parseIsEqualInputPathOption},
+        {"-Wp,", ParsedCommandModifiers::parseIsPreprocessorArgOption},
+    };
+    const CompilerOptionMatcher matcher(rules);
+
+    const std::vector<std::string> pieces = {
+        "-", "M", "D", "I", "=", " ", "\t", "i", "nclude", "qmakedep",
+        "gcc", "-sysroot", "Wp", ",", "x", "/usr/include"};
+    srand(42);
+    for (int i = 0; i < 20000; ++i) {
+        std::string option = rand() % 8 == 0 ? "" : "-";
+        const int length = rand() % 6;
+        for (int j = 0; j < length; ++j) {
+            option += pieces[static_cast<size_t>(rand()) % pieces.size()];
+        }
+
+        const auto match = matcher.match(option);
+        EXPECT_EQ(referenceMatch(option, rules),
+                  match == nullptr ? "<none>" : match->d_option)
+            << "option: \"" << option << "\"";
+    }
 }
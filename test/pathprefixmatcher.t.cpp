@@ -0,0 +1,120 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <fileutils.h>
+#include <pathprefixmatcher.h>
+
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace BloombergLP::recc;
+
+TEST(PathPrefixMatcherTest, Empty)
+{
+    PathPrefixMatcher matcher;
+    EXPECT_EQ(matcher.size(), 0);
+    EXPECT_FALSE(matcher.matches("/"));
+    EXPECT_FALSE(matcher.matches(""));
+
+    matcher.add("");
+    EXPECT_EQ(matcher.size(), 1);
+    EXPECT_FALSE(matcher.matches("/"));
+    EXPECT_FALSE(matcher.matches(""));
+}
+
+TEST(PathPrefixMatcherTest, MatchesWholeSegments)
+{
+    PathPrefixMatcher matcher;
+    matcher.add("/usr/include");
+    matcher.add("/opt/");
+
+    EXPECT_TRUE(matcher.matches("/usr/include"));
+    EXPECT_TRUE(matcher.matches("/usr/include/"));
+    EXPECT_TRUE(matcher.matches("/usr/include/stdio.h"));
+    EXPECT_TRUE(matcher.matches("/usr/include/../lib"));
+    EXPECT_FALSE(matcher.matches("/usr/include2/stdio.h"));
+    EXPECT_FALSE(matcher.matches("/usr/inc"));
+    EXPECT_FALSE(matcher.matches("/usr"));
+
+    EXPECT_TRUE(matcher.matches("/opt/"));
+    EXPECT_TRUE(matcher.matches("/opt/bin"));
+    EXPECT_FALSE(matcher.matches("/opt"));
+}
+
+TEST(PathPrefixMatcherTest, FirstAddedWins)
+{
+    PathPrefixMatcher matcher;
+    matcher.add("/a/b/c");
+    matcher.add("/a");
+    matcher.add("/a/b");
+    matcher.add("/");
+
+    EXPECT_EQ(matcher.firstMatch("/a/b/c/d"), 0);
+    EXPECT_EQ(matcher.firstMatch("/a/b/d"), 1);
+    EXPECT_EQ(matcher.firstMatch("/b"), 3);
+    EXPECT_EQ(matcher.firstMatch("b"), -1);
+
+    matcher.clear();
+    EXPECT_EQ(matcher.size(), 0);
+    EXPECT_EQ(matcher.firstMatch("/a/b/c/d"), -1);
+}
+
+TEST(PathPrefixMatcherTest, RelativePrefixes)
+{
+    PathPrefixMatcher matcher;
+    matcher.add("src");
+    EXPECT_TRUE(matcher.matches("src"));
+    EXPECT_TRUE(matcher.matches("src/main.cpp"));
+    EXPECT_FALSE(matcher.matches("/src/main.cpp"));
+    EXPECT_FALSE(matcher.matches("srcs/main.cpp"));
+}
+
+TEST(PathPrefixMatcherTest, AgreesWithHasPathPrefix)
+{
+    // Small alphabet so that random prefixes and paths often overlap
+    const std::vector<std::string> pieces = {"/", "//", "a", "b", "ab",
+                                             ".", ".."};
+    std::mt19937 random(2024);
+    auto randomPath = [&]() {
+        std::string result;
+        for (int i = random() % 6; i > 0; --i) {
+            result += pieces[random() % pieces.size()];
+        }
+        return result;
+    };
+
+    for (int iteration = 0; iteration < 200; ++iteration) {
+        std::vector<std::string> prefixes;
+        PathPrefixMatcher matcher;
+        for (int i = random() % 10; i > 0; --i) {
+            prefixes.push_back(randomPath());
+            matcher.add(prefixes.back());
+        }
+
+        for (int i = 0; i < 100; ++i) {
+            const std::string path = randomPath();
+            int expected = -1;
+            for (size_t j = 0; j < prefixes.size(); ++j) {
+                if (FileUtils::hasPathPrefix(path, prefixes[j])) {
+                    expected = static_cast<int>(j);
+                    break;
+                }
+            }
+            ASSERT_EQ(matcher.firstMatch(path), expected)
+                << "path \"" << path << "\"";
+        }
+    }
+}
@@ -0,0 +1,98 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <pathtable.h>
+
+#include <buildboxcommon_fileutils.h>
+
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace BloombergLP::recc;
+
+TEST(PathTableTest, NormalizesPaths)
+{
+    PathTable paths;
+    EXPECT_EQ(paths.toString(paths.add("/a/./b//c/../d/")), "/a/b/d");
+    EXPECT_EQ(paths.toString(paths.add("/../a")), "/a");
+    EXPECT_EQ(paths.toString(paths.add("../a/../../b")), "../../b");
+    EXPECT_EQ(paths.toString(paths.add("a/..")), ".");
+    EXPECT_EQ(paths.toString(paths.add("")), ".");
+    EXPECT_EQ(paths.toString(paths.add("/")), "/");
+    EXPECT_EQ(paths.size(), 6);
+}
+
+TEST(PathTableTest, RelativePathsUseBase)
+{
+    PathTable paths;
+    const auto relative = paths.add("../include/a.h", "/src/project");
+    EXPECT_TRUE(paths.isAbsolute(relative));
+    EXPECT_EQ(paths.toString(relative), "/src/include/a.h");
+
+    const auto absolute = paths.add("/usr/include/b.h", "/src/project");
+    EXPECT_EQ(paths.toString(absolute), "/usr/include/b.h");
+
+    const auto relativeBase = paths.add("../../c.h", "build");
+    EXPECT_FALSE(paths.isAbsolute(relativeBase));
+    EXPECT_EQ(paths.toString(relativeBase), "../c.h");
+}
+
+TEST(PathTableTest, SegmentsAreShared)
+{
+    PathTable paths;
+    const auto first = paths.add("/usr/include/stdio.h");
+    const auto second = paths.add("/usr/include/sys/../stdlib.h");
+    const size_t segmentCount = paths.segmentCount();
+    paths.add("/usr/include/stdio.h");
+    EXPECT_EQ(paths.segmentCount(), segmentCount);
+
+    const auto firstSegments = paths.segments(first);
+    const auto secondSegments = paths.segments(second);
+    ASSERT_EQ(firstSegments.second - firstSegments.first, 3);
+    ASSERT_EQ(secondSegments.second - secondSegments.first, 3);
+    EXPECT_EQ(firstSegments.first[0], secondSegments.first[0]);
+    EXPECT_EQ(firstSegments.first[1], secondSegments.first[1]);
+    EXPECT_NE(firstSegments.first[2], secondSegments.first[2]);
+    EXPECT_EQ(paths.segment(firstSegments.first[1]), "include");
+    EXPECT_EQ(paths.segment(secondSegments.first[2]), "stdlib.h");
+}
+
+TEST(PathTableTest, AgreesWithNormalizePath)
+{
+    const std::vector<std::string> pieces = {"/", "//", "a", "bb", ".",
+                                             "..", "./", "../"};
+    std::mt19937 random(31337);
+    auto randomPath = [&]() {
+        std::string result;
+        for (int i = random() % 8; i > 0; --i) {
+            result += pieces[random() % pieces.size()];
+        }
+        return result;
+    };
+
+    PathTable paths;
+    for (int i = 0; i < 5000; ++i) {
+        const std::string path = randomPath();
+        const std::string base = random() % 2 ? randomPath() : "";
+        const std::string joined =
+            (path.empty() || path[0] != '/') && !base.empty()
+                ? base + "/" + path
+                : path;
+        ASSERT_EQ(paths.toString(paths.add(path, base)),
+                  buildboxcommon::FileUtils::normalizePath(joined.c_str()))
+            << "path \"" << path << "\", base \"" << base << "\"";
+    }
+}
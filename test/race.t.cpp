@@ -0,0 +1,141 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <parsedcommandfactory.h>
+#include <race.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace BloombergLP::recc;
+
+TEST(RaceTest, SupportsCompileWithOutput)
+{
+    EXPECT_TRUE(Race::supports(ParsedCommandFactory::createParsedCommand(
+        {"gcc", "-c", "hello.c", "-o", "hello.o"})));
+    EXPECT_TRUE(Race::supports(ParsedCommandFactory::createParsedCommand(
+        {"gcc", "-c", "hello.c", "-o", "hello.o", "-MD", "-MF", "hello.d"})));
+}
+
+TEST(RaceTest, DoesNotSupportOtherCommands)
+{
+    // Not a compile command
+    EXPECT_FALSE(Race::supports(
+        ParsedCommandFactory::createParsedCommand({"cat", "hello.c"})));
+    // No explicit output
+    EXPECT_FALSE(Race::supports(
+        ParsedCommandFactory::createParsedCommand({"gcc", "-c", "hello.c"})));
+    // Dependency file written by the preprocessor
+    EXPECT_FALSE(Race::supports(ParsedCommandFactory::createParsedCommand(
+        {"gcc", "-c", "hello.c", "-o", "hello.o", "-Wp,-MD,hello.d"})));
+}
+
+TEST(RaceTest, PrivateOutputCommand)
+{
+    const auto command = ParsedCommandFactory::createParsedCommand(
+        {"gcc", "-c", "hello.c", "-o", "out/hello.o", "-MD", "-MFhello.d",
+         "-MT", "hello.o"});
+    const auto result = Race::privateOutputCommand(command, "/private");
+
+    const std::vector<std::string> expectedCommand = {
+        "gcc", "-c", "hello.c", "-o", "/private/0-hello.o", "-MD",
+        "-MF/private/1-hello.d", "-MT", "hello.o"};
+    EXPECT_EQ(expectedCommand, result.d_command);
+
+    const std::map<std::string, std::string> expectedOutputs = {
+        {"/private/0-hello.o", "out/hello.o"},
+        {"/private/1-hello.d", "hello.d"}};
+    EXPECT_EQ(expectedOutputs, result.d_outputs);
+}
+
+TEST(RaceTest, PrivateOutputCommandKeepsDependencyFile)
+{
+    // Without -MF and -MT, gcc would derive the name of the dependency file
+    // and the target of its rule from the private output path.
+    const auto command = ParsedCommandFactory::createParsedCommand(
+        {"gcc", "-c", "hello.c", "-ohello.o", "-MMD"});
+    const auto result = Race::privateOutputCommand(command, "/private");
+
+    const std::vector<std::string> expectedCommand = {
+        "gcc", "-c", "hello.c", "-o/private/0-hello.o", "-MMD",
+        "-MF", "/private/1-hello.d", "-MT", "hello.o"};
+    EXPECT_EQ(expectedCommand, result.d_command);
+    EXPECT_EQ("hello.d", result.d_outputs.at("/private/1-hello.d"));
+}
+
+TEST(RaceTest, RemoveOrphanedDirectories)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    const std::string path = directory.name();
+
+    // A pid that is no longer running
+    const pid_t deadPid = fork();
+    if (deadPid == 0) {
+        _exit(0);
+    }
+    waitpid(deadPid, nullptr, 0);
+
+    const std::string orphan =
+        path + "/.recc-race-" + std::to_string(deadPid) + "-abcdef";
+    const std::string ours =
+        path + "/.recc-race-" + std::to_string(getpid()) + "-abcdef";
+    const std::string other = path + "/other";
+    for (const auto &subdirectory : {orphan, ours, other}) {
+        ASSERT_EQ(0, mkdir(subdirectory.c_str(), 0700));
+    }
+    std::ofstream(orphan + "/0-hello.o") << "output";
+
+    Race::removeOrphanedDirectories(path);
+    EXPECT_FALSE(buildboxcommon::FileUtils::isDirectory(orphan.c_str()));
+    EXPECT_TRUE(buildboxcommon::FileUtils::isDirectory(ours.c_str()));
+    EXPECT_TRUE(buildboxcommon::FileUtils::isDirectory(other.c_str()));
+}
+
+TEST(LocalSlotTest, LimitsConcurrentSlots)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    const std::string slotDirectory = std::string(directory.name()) + "/slots";
+
+    auto slot = LocalSlot::tryAcquire(slotDirectory, 1);
+    ASSERT_NE(nullptr, slot);
+
+    // fcntl() locks are per process, so check the slot from a child.
+    const auto acquiredInChild = [&]() {
+        const pid_t pid = fork();
+        if (pid == 0) {
+            _exit(LocalSlot::tryAcquire(slotDirectory, 1) ? 0 : 1);
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    };
+    EXPECT_FALSE(acquiredInChild());
+
+    slot.reset();
+    EXPECT_TRUE(acquiredInChild());
+}
+
+TEST(LocalSlotTest, NoSlots)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    EXPECT_EQ(nullptr, LocalSlot::tryAcquire(directory.name(), 0));
+}
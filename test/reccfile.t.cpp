@@ -0,0 +1,74 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <digestgenerator.h>
+#include <fileutils.h>
+#include <reccfile.h>
+
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+using namespace BloombergLP::recc;
+
+TEST(ReccFileTest, CreateFile)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    const std::string path = std::string(directory.name()) + "/hello.h";
+    FileUtils::writeFile(path, "#define HELLO 1\n");
+
+    const auto file = ReccFileFactory::createFile(path.c_str());
+    ASSERT_NE(file, nullptr);
+    EXPECT_EQ(file->getFileName(), "hello.h");
+    EXPECT_EQ(file->getFilePath(), path);
+    EXPECT_EQ(file->getFileContents(), "#define HELLO 1\n");
+    EXPECT_EQ(file->getDigest(),
+              DigestGenerator::make_digest("#define HELLO 1\n"));
+    EXPECT_FALSE(file->isExecutable());
+
+    EXPECT_EQ(ReccFileFactory::createFile(directory.name()), nullptr);
+}
+
+TEST(ReccFileTest, CachedFiles)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    const std::string path = std::string(directory.name()) + "/hello.h";
+    FileUtils::writeFile(path, "#define HELLO 1\n");
+
+    ReccFileFactory::setCacheEnabled(true);
+    const auto file = ReccFileFactory::createFile(path.c_str());
+    ASSERT_NE(file, nullptr);
+
+    // The same file, found through a relative path
+    const std::string cwd = FileUtils::getCurrentWorkingDirectory();
+    ASSERT_EQ(chdir(directory.name()), 0);
+    const auto relativeFile = ReccFileFactory::createFile("hello.h");
+    ASSERT_EQ(chdir(cwd.c_str()), 0);
+    ASSERT_NE(relativeFile, nullptr);
+    EXPECT_EQ(relativeFile->getFilePath(), "hello.h");
+    EXPECT_EQ(relativeFile->getFileContents(), file->getFileContents());
+    EXPECT_EQ(relativeFile->getDigest(), file->getDigest());
+
+    // Changes are noticed
+    FileUtils::writeFile(path, "#define HELLO 22\n");
+    const auto changedFile = ReccFileFactory::createFile(path.c_str());
+    ASSERT_NE(changedFile, nullptr);
+    EXPECT_EQ(changedFile->getFileContents(), "#define HELLO 22\n");
+    EXPECT_EQ(changedFile->getDigest(),
+              DigestGenerator::make_digest("#define HELLO 22\n"));
+
+    ReccFileFactory::setCacheEnabled(false);
+}
@@ -32,10 +32,13 @@
 #include <gtest/gtest.h>
 #include <unistd.h>
 
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
 #include <set>
 #include <signal.h>
+#include <sys/stat.h>
+#include <thread>
 #include <unistd.h>
 
 #define TIMER_NAME_FETCH_WRITE_RESULTS "recc.fetch_write_results"
@@ -319,6 +322,64 @@ TEST_F(RemoteExecutionClientTestFixture, VerifyMetricsWriteFilesToDisk)
         collectedByName<DurationMetricValue>(TIMER_NAME_FETCH_WRITE_RESULTS));
 }
 
+TEST_F(RemoteExecutionClientTestFixture, WriteManyFilesToDisk)
+{
+    buildboxcommon::TemporaryDirectory tempDir;
+
+    // Enough inlined outputs to be written by several threads
+    ActionResult testResult;
+    for (int i = 0; i < 200; ++i) {
+        const std::string path =
+            "dir" + std::to_string(i % 7) + "/file" + std::to_string(i);
+        testResult.d_outputFiles[path] =
+            OutputBlob(path, DigestGenerator::make_digest(path), i % 2 == 0);
+    }
+
+    client.write_files_to_disk(testResult, tempDir.name());
+
+    for (const auto &output : testResult.d_outputFiles) {
+        const std::string path =
+            std::string(tempDir.name()) + "/" + output.first;
+        EXPECT_EQ(buildboxcommon::FileUtils::getFileContents(path.c_str()),
+                  output.first);
+        EXPECT_EQ(buildboxcommon::FileUtils::isExecutable(path.c_str()),
+                  output.second.d_executable);
+    }
+}
+
+TEST_F(RemoteExecutionClientTestFixture, WriteFilesToDiskSkipsUnchanged)
+{
+    buildboxcommon::TemporaryDirectory tempDir;
+    const std::string path = std::string(tempDir.name()) + "/test.txt";
+    FileUtils::writeFile(path, "Test file content!");
+    const time_t old = time(nullptr) - 3600;
+    const struct timespec times[2] = {{old, 0}, {old, 0}};
+    ASSERT_EQ(utimensat(AT_FDCWD, path.c_str(), times, 0), 0);
+
+    ActionResult testResult;
+    testResult.d_outputFiles["test.txt"] = OutputBlob(
+        std::string(), DigestGenerator::make_digest("Test file content!"));
+
+    // Neither fetched nor written
+    EXPECT_CALL(*byteStreamStub, ReadRaw(_, _)).Times(0);
+    const bool previousPreserve = RECC_PRESERVE_UNCHANGED_MTIME;
+    RECC_PRESERVE_UNCHANGED_MTIME = true;
+    client.write_files_to_disk(testResult, tempDir.name());
+    RECC_PRESERVE_UNCHANGED_MTIME = previousPreserve;
+
+    struct stat statResult;
+    ASSERT_EQ(stat(path.c_str(), &statResult), 0);
+    EXPECT_EQ(statResult.st_mtime, old);
+
+    // Touched by default
+    client.write_files_to_disk(testResult, tempDir.name());
+
+    ASSERT_EQ(stat(path.c_str(), &statResult), 0);
+    EXPECT_GT(statResult.st_mtime, old);
+    EXPECT_EQ(buildboxcommon::FileUtils::getFileContents(path.c_str()),
+              "Test file content!");
+}
+
 TEST_F(RemoteExecutionClientTestFixture, CancelOperation)
 {
     /**
@@ -426,6 +487,178 @@ TEST_F(RemoteExecutionClientTestFixture, CancelOperation)
     waitpid(pid, nullptr, 0);
 }
 
+TEST_F(RemoteExecutionClientTestFixture, CancelExecution)
+{
+    operation.set_done(false);
+    operation.set_name("fake-operation");
+
+    EXPECT_CALL(*executionStub,
+                ExecuteRaw(_, MessageEq(expectedExecuteRequest)))
+        .WillOnce(Return(operationReader));
+    // Cancel while the Operation is being read, as another thread would
+    EXPECT_CALL(*operationReader, Read(_))
+        .WillOnce(DoAll(
+            InvokeWithoutArgs([this]() { client.cancel_execution(); }),
+            SetArgPointee<0>(operation), Return(true)))
+        .WillOnce(Return(false));
+    EXPECT_CALL(*operationReader, Finish())
+        .WillOnce(Return(grpc::Status(grpc::CANCELLED, "Cancelled")));
+
+    proto::CancelOperationRequest expectedCancelRequest;
+    expectedCancelRequest.set_name("fake-operation");
+    EXPECT_CALL(*operationsStub,
+                CancelOperation(_, MessageEq(expectedCancelRequest), _))
+        .WillOnce(Return(grpc::Status::OK));
+
+    EXPECT_THROW(client.execute_action(actionDigest), ExecutionCancelled);
+}
+
+TEST_F(RemoteExecutionClientTestFixture, ExecuteAfterCancelExecution)
+{
+    EXPECT_CALL(*executionStub, ExecuteRaw(_, _)).Times(0);
+
+    client.cancel_execution();
+    EXPECT_THROW(client.execute_action(actionDigest), ExecutionCancelled);
+}
+
+TEST_F(RemoteExecutionClientTestFixture, HedgedExecutionNotNeeded)
+{
+    proto::ExecuteResponse executeResponse;
+    executeResponse.mutable_result()->set_exit_code(7);
+    operation.mutable_response()->PackFrom(executeResponse);
+
+    EXPECT_CALL(*executionStub,
+                ExecuteRaw(_, MessageEq(expectedExecuteRequest)))
+        .WillOnce(Return(operationReader));
+    EXPECT_CALL(*operationReader, Read(_))
+        .WillOnce(DoAll(SetArgPointee<0>(operation), Return(true)));
+    EXPECT_CALL(*operationReader, Finish()).WillOnce(Return(grpc::Status::OK));
+
+    proto::Digest hedgeActionDigest;
+    hedgeActionDigest.set_hash("Hedge action digest hash here");
+    const auto result = client.execute_action_hedged(
+        actionDigest, hedgeActionDigest, std::chrono::seconds(10));
+    EXPECT_EQ(7, result.d_exitCode);
+}
+
+TEST_F(RemoteExecutionClientTestFixture, HedgedExecutionWinsOverStraggler)
+{
+    // The original execution is slow...
+    google::longrunning::Operation slowOperation;
+    slowOperation.set_done(false);
+    slowOperation.set_name("slow-operation");
+    EXPECT_CALL(*executionStub,
+                ExecuteRaw(_, MessageEq(expectedExecuteRequest)))
+        .WillOnce(Return(operationReader));
+    EXPECT_CALL(*operationReader, Read(_))
+        .WillOnce(DoAll(InvokeWithoutArgs([]() {
+                            std::this_thread::sleep_for(
+                                std::chrono::milliseconds(300));
+                        }),
+                        SetArgPointee<0>(slowOperation), Return(true)))
+        .WillOnce(Return(false));
+    EXPECT_CALL(*operationReader, Finish())
+        .WillOnce(Return(grpc::Status(grpc::CANCELLED, "Cancelled")));
+
+    // ...so the hedge is executed, finishes first, and the original
+    // operation is cancelled.
+    proto::Digest hedgeActionDigest;
+    hedgeActionDigest.set_hash("Hedge action digest hash here");
+    proto::ExecuteRequest expectedHedgeRequest;
+    *expectedHedgeRequest.mutable_action_digest() = hedgeActionDigest;
+
+    proto::ExecuteResponse executeResponse;
+    executeResponse.mutable_result()->set_exit_code(0);
+    executeResponse.mutable_result()->mutable_stdout_digest()->set_hash(
+        "Hedge stdout");
+    operation.set_done(true);
+    operation.mutable_response()->PackFrom(executeResponse);
+    auto hedgeOperationReader = new grpc::testing::MockClientReader<
+        google::longrunning::Operation>();
+    EXPECT_CALL(*executionStub,
+                ExecuteRaw(_, MessageEq(expectedHedgeRequest)))
+        .WillOnce(Return(hedgeOperationReader));
+    EXPECT_CALL(*hedgeOperationReader, Read(_))
+        .WillOnce(DoAll(SetArgPointee<0>(operation), Return(true)));
+    EXPECT_CALL(*hedgeOperationReader, Finish())
+        .WillOnce(Return(grpc::Status::OK));
+
+    proto::CancelOperationRequest expectedCancelRequest;
+    expectedCancelRequest.set_name("slow-operation");
+    EXPECT_CALL(*operationsStub,
+                CancelOperation(_, MessageEq(expectedCancelRequest), _))
+        .WillOnce(Return(grpc::Status::OK));
+
+    // The result is stored as that of the original action for the next
+    // build to find
+    proto::UpdateActionResultRequest expectedUpdateRequest;
+    *expectedUpdateRequest.mutable_action_digest() = actionDigest;
+    *expectedUpdateRequest.mutable_action_result() = executeResponse.result();
+    EXPECT_CALL(*actionCacheStub,
+                UpdateActionResult(_, MessageEq(expectedUpdateRequest), _))
+        .WillOnce(Return(grpc::Status::OK));
+
+    const auto result = client.execute_action_hedged(
+        actionDigest, hedgeActionDigest, std::chrono::milliseconds(50));
+    EXPECT_EQ(0, result.d_exitCode);
+    EXPECT_EQ("Hedge stdout", result.d_stdOut.d_digest.hash());
+}
+
+TEST_F(RemoteExecutionClientTestFixture, HedgedExecutionLosesToOriginal)
+{
+    // The original execution is slow, but still finishes first...
+    proto::ExecuteResponse executeResponse;
+    executeResponse.mutable_result()->set_exit_code(0);
+    operation.set_done(true);
+    operation.mutable_response()->PackFrom(executeResponse);
+    EXPECT_CALL(*executionStub,
+                ExecuteRaw(_, MessageEq(expectedExecuteRequest)))
+        .WillOnce(Return(operationReader));
+    EXPECT_CALL(*operationReader, Read(_))
+        .WillOnce(DoAll(InvokeWithoutArgs([]() {
+                            std::this_thread::sleep_for(
+                                std::chrono::milliseconds(100));
+                        }),
+                        SetArgPointee<0>(operation), Return(true)));
+    EXPECT_CALL(*operationReader, Finish()).WillOnce(Return(grpc::Status::OK));
+
+    // ...so the hedge's operation is cancelled, and nothing needs to be
+    // added to the action cache.
+    proto::Digest hedgeActionDigest;
+    hedgeActionDigest.set_hash("Hedge action digest hash here");
+    proto::ExecuteRequest expectedHedgeRequest;
+    *expectedHedgeRequest.mutable_action_digest() = hedgeActionDigest;
+
+    google::longrunning::Operation slowOperation;
+    slowOperation.set_done(false);
+    slowOperation.set_name("hedge-operation");
+    auto hedgeOperationReader = new grpc::testing::MockClientReader<
+        google::longrunning::Operation>();
+    EXPECT_CALL(*executionStub,
+                ExecuteRaw(_, MessageEq(expectedHedgeRequest)))
+        .WillOnce(Return(hedgeOperationReader));
+    EXPECT_CALL(*hedgeOperationReader, Read(_))
+        .WillOnce(DoAll(SetArgPointee<0>(slowOperation), Return(true)))
+        .WillOnce(DoAll(InvokeWithoutArgs([]() {
+                            std::this_thread::sleep_for(
+                                std::chrono::milliseconds(300));
+                        }),
+                        Return(false)));
+    EXPECT_CALL(*hedgeOperationReader, Finish())
+        .WillOnce(Return(grpc::Status(grpc::CANCELLED, "Cancelled")));
+
+    proto::CancelOperationRequest expectedCancelRequest;
+    expectedCancelRequest.set_name("hedge-operation");
+    EXPECT_CALL(*operationsStub,
+                CancelOperation(_, MessageEq(expectedCancelRequest), _))
+        .WillOnce(Return(grpc::Status::OK));
+    EXPECT_CALL(*actionCacheStub, UpdateActionResult(_, _, _)).Times(0);
+
+    const auto result = client.execute_action_hedged(
+        actionDigest, hedgeActionDigest, std::chrono::milliseconds(20));
+    EXPECT_EQ(0, result.d_exitCode);
+}
+
 TEST_F(RemoteExecutionClientTestFixture, ActionCacheTestMiss)
 {
     EXPECT_CALL(*actionCacheStub, GetActionResult(_, _, _))
@@ -503,3 +736,30 @@ TEST_F(RemoteExecutionClientTestFixture, ActionCacheHitNoActionResult)
 
     EXPECT_TRUE(in_cache);
 }
+
+TEST_F(RemoteExecutionClientTestFixture, UpdateActionCache)
+{
+    proto::ActionResult actionResult;
+    actionResult.set_exit_code(0);
+    *actionResult.mutable_stdout_digest() = DigestGenerator::make_digest("");
+
+    proto::UpdateActionResultRequest expectedRequest;
+    *expectedRequest.mutable_action_digest() = actionDigest;
+    *expectedRequest.mutable_action_result() = actionResult;
+
+    EXPECT_CALL(*actionCacheStub,
+                UpdateActionResult(_, MessageEq(expectedRequest), _))
+        .WillOnce(Return(grpc::Status::OK));
+
+    client.update_action_cache(actionDigest, actionResult);
+}
+
+TEST_F(RemoteExecutionClientTestFixture, UpdateActionCacheServerError)
+{
+    EXPECT_CALL(*actionCacheStub, UpdateActionResult(_, _, _))
+        .WillOnce(Return(grpc::Status(grpc::PERMISSION_DENIED, "read-only")));
+
+    EXPECT_THROW(
+        client.update_action_cache(actionDigest, proto::ActionResult()),
+        std::runtime_error);
+}
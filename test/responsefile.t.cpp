@@ -0,0 +1,158 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <fileutils.h>
+#include <responsefile.h>
+
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <unistd.h>
+
+using namespace BloombergLP::recc;
+
+TEST(ResponseFileTest, ParseSplitsOnWhitespace)
+{
+    const std::vector<std::string> expected = {"-c", "hello.c", "-o",
+                                               "hello.o"};
+    EXPECT_EQ(expected,
+              ResponseFile::parse("  -c\thello.c\n-o \r\n hello.o\n\n"));
+    EXPECT_TRUE(ResponseFile::parse("").empty());
+    EXPECT_TRUE(ResponseFile::parse(" \n\t").empty());
+}
+
+TEST(ResponseFileTest, ParseQuotes)
+{
+    const std::vector<std::string> expected = {
+        "-I/path with spaces", "-DNAME=\"value\"", "it's", "", "a\\b"};
+    EXPECT_EQ(expected,
+              ResponseFile::parse("'-I/path with spaces' "
+                                  "-DNAME='\"value\"' "
+                                  "\"it's\" \"\" "
+                                  "a\\\\b"));
+}
+
+TEST(ResponseFileTest, ParseBackslashEscapesEverywhere)
+{
+    const std::vector<std::string> expected = {"a b", "c'd", "e\"f", "g\\",
+                                               "h\ni"};
+    EXPECT_EQ(expected,
+              ResponseFile::parse("a\\ b 'c\\'d' \"e\\\"f\" g\\\\ h\\\ni"));
+
+    // A trailing backslash escapes nothing
+    const std::vector<std::string> trailing = {"x"};
+    EXPECT_EQ(trailing, ResponseFile::parse("x\\"));
+}
+
+TEST(ResponseFileTest, SerializeRoundTrips)
+{
+    const std::string characters = "ab -\t\n'\"\\=@/";
+    srand(42);
+    for (int i = 0; i < 1000; ++i) {
+        std::vector<std::string> arguments(static_cast<size_t>(rand() % 5));
+        for (auto &argument : arguments) {
+            const int length = rand() % 8;
+            for (int j = 0; j < length; ++j) {
+                argument.push_back(
+                    characters[static_cast<size_t>(rand()) %
+                               characters.size()]);
+            }
+        }
+        EXPECT_EQ(arguments,
+                  ResponseFile::parse(ResponseFile::serialize(arguments)));
+    }
+}
+
+TEST(ResponseFileTest, ExpandReplacesArgumentsWithFileContents)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    const std::string outer = std::string(directory.name()) + "/outer.rsp";
+    const std::string inner = std::string(directory.name()) + "/inner.rsp";
+    FileUtils::writeFile(outer, "-c '@" + inner + "' -o hello.o\n");
+    FileUtils::writeFile(inner, "-Iinclude \"-DX=a b\"\n");
+
+    bool expanded = false;
+    const std::vector<std::string> expected = {
+        "gcc", "-c", "-Iinclude", "-DX=a b", "-o", "hello.o", "hello.c"};
+    EXPECT_EQ(expected,
+              ResponseFile::expand({"gcc", "@" + outer, "hello.c"}, "",
+                                   false, &expanded));
+    EXPECT_TRUE(expanded);
+}
+
+TEST(ResponseFileTest, ExpandKeepsUnreadableArguments)
+{
+    bool expanded = true;
+    const std::vector<std::string> command = {
+        "gcc", "@/nonexistent/args.rsp", "@", "-c", "hello.c"};
+    EXPECT_EQ(command, ResponseFile::expand(command, "", false, &expanded));
+    EXPECT_FALSE(expanded);
+
+    // The first argument is the compiler, never a response file
+    const std::vector<std::string> compiler = {"@/nonexistent/args.rsp"};
+    EXPECT_EQ(compiler, ResponseFile::expand(compiler));
+}
+
+TEST(ResponseFileTest, ExpandStopsAtRecursion)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    const std::string path = std::string(directory.name()) + "/self.rsp";
+    FileUtils::writeFile(path, "-c @" + path + "\n");
+
+    const auto result = ResponseFile::expand({"gcc", "@" + path});
+    ASSERT_EQ(ResponseFile::MaxDepth + 2, static_cast<int>(result.size()));
+    EXPECT_EQ("@" + path, result.back());
+}
+
+TEST(ResponseFileTest, ExpandRelativePaths)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    const std::string subdirectory = std::string(directory.name()) + "/sub";
+    FileUtils::writeFile(subdirectory + "/outer.rsp", "-c @inner.rsp\n");
+    FileUtils::writeFile(subdirectory + "/inner.rsp", "-DINNER\n");
+    FileUtils::writeFile(std::string(directory.name()) + "/inner.rsp",
+                         "-DOUTER\n");
+
+    // As GCC does, relative to the working directory...
+    const std::vector<std::string> fromWorkingDirectory = {"gcc", "-c",
+                                                           "-DOUTER"};
+    EXPECT_EQ(fromWorkingDirectory,
+              ResponseFile::expand({"gcc", "@sub/outer.rsp"},
+                                   directory.name(), false));
+
+    // ...or, as clang does, relative to the response file
+    const std::vector<std::string> fromContainingFile = {"gcc", "-c",
+                                                         "-DINNER"};
+    EXPECT_EQ(fromContainingFile,
+              ResponseFile::expand({"gcc", "@sub/outer.rsp"},
+                                   directory.name(), true));
+}
+
+TEST(ResponseFileTest, TemporaryResponseFile)
+{
+    const std::vector<std::string> command = {"gcc", "-c", "a b.c", "-o",
+                                              "a.o"};
+    std::string path;
+    {
+        const TemporaryResponseFile responseFile(command);
+        ASSERT_EQ(2, responseFile.command().size());
+        EXPECT_EQ("gcc", responseFile.command()[0]);
+        path = responseFile.command()[1].substr(1);
+        EXPECT_EQ(command, ResponseFile::expand(responseFile.command()));
+    }
+    EXPECT_NE(0, access(path.c_str(), F_OK));
+}
@@ -0,0 +1,82 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <scheduler.h>
+
+#include <gtest/gtest.h>
+
+using namespace BloombergLP::recc;
+
+namespace {
+
+ExecutionHistory historyWithTimings(double local, double remote)
+{
+    ExecutionHistory history;
+    if (local > 0) {
+        history.d_localExecution.add(local);
+    }
+    history.d_upload.add(100);
+    history.d_remoteQueue.add(200);
+    history.d_remoteExecution.add(remote);
+    history.d_download.add(100);
+    return history;
+}
+
+} // namespace
+
+TEST(SchedulerTest, RemoteWithoutHistory)
+{
+    const auto decision = Scheduler::decide(ExecutionHistory(), 0, true);
+    EXPECT_FALSE(decision.d_runLocally);
+    EXPECT_EQ("no remote timings yet", decision.d_reason);
+}
+
+TEST(SchedulerTest, SamplesLocalWhenIdle)
+{
+    EXPECT_TRUE(
+        Scheduler::decide(historyWithTimings(0, 1000), 0.5, true)
+            .d_runLocally);
+    EXPECT_FALSE(
+        Scheduler::decide(historyWithTimings(0, 1000), 2, true).d_runLocally);
+}
+
+TEST(SchedulerTest, PicksFasterSide)
+{
+    // 1000 ms locally vs 100 + 200 + 2000 + 100 ms remotely
+    EXPECT_TRUE(Scheduler::decide(historyWithTimings(1000, 2000), 0, true)
+                    .d_runLocally);
+    EXPECT_FALSE(Scheduler::decide(historyWithTimings(3000, 2000), 0, true)
+                     .d_runLocally);
+}
+
+TEST(SchedulerTest, LoadSlowsLocal)
+{
+    // 1000 ms locally, but the host is three times oversubscribed
+    const auto decision =
+        Scheduler::decide(historyWithTimings(1000, 2000), 3, true);
+    EXPECT_FALSE(decision.d_runLocally);
+    EXPECT_EQ("estimated 3000 ms locally (load 3 per CPU) vs 2400 ms "
+              "remotely (upload 100, queue 200, execution 2000, download "
+              "100)",
+              decision.d_reason);
+}
+
+TEST(SchedulerTest, LocalWhenRemoteUnhealthy)
+{
+    EXPECT_TRUE(Scheduler::decide(historyWithTimings(3000, 2000), 0, false)
+                    .d_runLocally);
+}
+
+TEST(SchedulerTest, CurrentLoad) { EXPECT_GE(Scheduler::currentLoad(), 0); }
@@ -12,9 +12,15 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <fileutils.h>
 #include <subprocess.h>
 
+#include <climits>
+#include <csignal>
+#include <cstdlib>
 #include <fstream>
+#include <sys/resource.h>
+#include <sys/stat.h>
 
 #include <buildboxcommon_temporarydirectory.h>
 
@@ -76,3 +82,125 @@ TEST(SubprocessTest, Environment)
                 std::string::npos);
     EXPECT_EQ(result.d_exitCode, 0);
 }
+
+TEST(SubprocessTest, EnvironmentReplacesVariables)
+{
+    setenv("RECC_SUBPROCESS_TEST_VAR", "old", 1);
+    std::vector<std::string> command = {"env"};
+    std::map<std::string, std::string> env = {
+        {"RECC_SUBPROCESS_TEST_VAR", "new"}};
+    auto result = Subprocess::execute(command, true, true, env);
+    unsetenv("RECC_SUBPROCESS_TEST_VAR");
+
+    EXPECT_NE(result.d_stdOut.find("RECC_SUBPROCESS_TEST_VAR=new"),
+              std::string::npos);
+    EXPECT_EQ(result.d_stdOut.find("RECC_SUBPROCESS_TEST_VAR=old"),
+              std::string::npos);
+    // The rest of the environment is passed on
+    EXPECT_NE(result.d_stdOut.find("PATH="), std::string::npos);
+}
+
+TEST(SubprocessTest, CommandIsSearchedInGivenPath)
+{
+    buildboxcommon::TemporaryDirectory temp_dir;
+    const std::string script =
+        std::string(temp_dir.name()) + "/recc-subprocess-test-command";
+    std::ofstream file(script);
+    file << "#!/bin/sh\necho found\n";
+    file.close();
+    chmod(script.c_str(), 0755);
+
+    std::vector<std::string> command = {"recc-subprocess-test-command"};
+    auto result = Subprocess::execute(
+        command, true, true,
+        {{"PATH", std::string(temp_dir.name()) + ":/bin:/usr/bin"}});
+    EXPECT_EQ(result.d_exitCode, 0);
+    EXPECT_EQ(result.d_stdOut, "found\n");
+
+    result = Subprocess::execute(command, true, true);
+    EXPECT_EQ(result.d_exitCode, 127);
+}
+
+TEST(SubprocessTest, LargeOutputOnBothPipes)
+{
+    // More than a pipe buffer on each stream, so that the child blocks
+    // unless both are drained
+    std::vector<std::string> command = {
+        "sh", "-c",
+        "head -c 3000000 /dev/zero; head -c 2000000 /dev/zero >&2; "
+        "head -c 1000000 /dev/zero"};
+    auto result = Subprocess::execute(command, true, true);
+    EXPECT_EQ(result.d_exitCode, 0);
+    EXPECT_EQ(result.d_stdOut.size(), 4000000);
+    EXPECT_EQ(result.d_stdErr.size(), 2000000);
+}
+
+TEST(SubprocessTest, KilledBySignal)
+{
+    std::vector<std::string> command = {"sh", "-c", "kill -TERM $$"};
+    auto result = Subprocess::execute(command);
+    EXPECT_EQ(result.d_exitCode, 128 + SIGTERM);
+}
+
+TEST(SubprocessTest, ExecuteAll)
+{
+    buildboxcommon::TemporaryDirectory temp_dir;
+    char resolved[PATH_MAX];
+    ASSERT_NE(realpath(temp_dir.name(), resolved), nullptr);
+    const std::string directory = resolved;
+    const std::string startDirectory = FileUtils::getCurrentWorkingDirectory();
+
+    std::vector<std::vector<std::string>> commands;
+    std::vector<std::string> directories;
+    for (int i = 0; i < 10; ++i) {
+        commands.push_back({"sh", "-c",
+                            "sleep 0.0" + std::to_string(9 - i) +
+                                "; pwd -P; echo " + std::to_string(i) +
+                                " >&2; exit " + std::to_string(i)});
+        directories.push_back(i % 2 ? directory : "");
+    }
+    commands.push_back({"true"});
+    directories.push_back(directory + "/does-not-exist");
+    commands.push_back({"this-command-does-not-exist-1234"});
+    directories.push_back("");
+
+    const auto results = Subprocess::executeAll(commands, directories, 4);
+    ASSERT_EQ(results.size(), 12);
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_EQ(results[i].d_exitCode, i);
+        EXPECT_EQ(results[i].d_stdErr, std::to_string(i) + "\n");
+        const std::string expectedDirectory =
+            i % 2 ? directory : startDirectory;
+        EXPECT_EQ(results[i].d_stdOut, expectedDirectory + "\n");
+    }
+    EXPECT_EQ(results[10].d_exitCode, 1);
+    EXPECT_EQ(results[11].d_exitCode, 127);
+    EXPECT_EQ(FileUtils::getCurrentWorkingDirectory(), startDirectory);
+}
+
+static double cpuSeconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+           static_cast<double>(usage.ru_utime.tv_usec +
+                               usage.ru_stime.tv_usec) /
+               1e6;
+}
+
+TEST(SubprocessTest, ExecuteAllWaitsForClosedChildren)
+{
+    // Children that close their output well before exiting
+    const std::vector<std::vector<std::string>> commands(
+        3, {"sh", "-c", "exec >&- 2>&-; sleep 0.5"});
+
+    const double start = cpuSeconds();
+    const auto results = Subprocess::executeAll(commands, {}, 3);
+    ASSERT_EQ(results.size(), 3);
+    for (const auto &result : results) {
+        EXPECT_EQ(result.d_exitCode, 0);
+    }
+
+    // Rather than spinning until they exit
+    EXPECT_LT(cpuSeconds() - start, 0.25);
+}
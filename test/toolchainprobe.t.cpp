@@ -0,0 +1,192 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <env.h>
+#include <fileutils.h>
+#include <parsedcommandfactory.h>
+#include <toolchainprobe.h>
+
+#include <buildboxcommon_fileutils.h>
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+
+using namespace BloombergLP::recc;
+
+TEST(ToolchainProbeTest, TargetOptions)
+{
+    const auto command = ParsedCommandFactory::createParsedCommand(
+        {"clang", "-c", "-O2", "-target", "aarch64-linux-gnu", "-m64",
+         "--sysroot=/opt/sysroot", "-std=c++14", "-Iinclude", "hello.cpp",
+         "-o", "hello.o"});
+
+    const std::vector<std::string> expected = {
+        "-target", "aarch64-linux-gnu", "-m64", "--sysroot=/opt/sysroot",
+        "-std=c++14"};
+    EXPECT_EQ(expected, ToolchainProbe::targetOptions(command));
+}
+
+TEST(ToolchainProbeTest, ParseProbeOutput)
+{
+    const std::string stdOut = "#define __GNUC__ 9\n"
+                               "#define __x86_64__ 1\n";
+    const std::string stdErr =
+        "clang version 10.0.0\n"
+        "Found candidate GCC installation: /usr/lib/gcc/x86_64-linux-gnu/9\n"
+        "Selected GCC installation: /usr/lib/gcc/x86_64-linux-gnu/9\n"
+        "Candidate multilib: .;@m64\n"
+        "Selected multilib: .;@m64\n"
+        "#include \"...\" search starts here:\n"
+        "#include <...> search starts here:\n"
+        " /usr/local/include\n"
+        " /usr/lib/llvm-10/lib/clang/10.0.0/include\n"
+        " /System/Library/Frameworks (framework directory)\n"
+        " /usr/include\n"
+        "End of search list.\n";
+
+    const auto info = ToolchainProbe::parseProbeOutput(stdOut, stdErr);
+
+    EXPECT_EQ("/usr/lib/gcc/x86_64-linux-gnu/9/crtbegin.o", info.d_crtbegin);
+    const std::vector<std::string> expectedDirectories = {
+        "/usr/local/include", "/usr/lib/llvm-10/lib/clang/10.0.0/include",
+        "/System/Library/Frameworks", "/usr/include"};
+    EXPECT_EQ(expectedDirectories, info.d_systemIncludeDirectories);
+    const std::vector<std::string> expectedMacros = {"__GNUC__ 9",
+                                                     "__x86_64__ 1"};
+    EXPECT_EQ(expectedMacros, info.d_predefinedMacros);
+}
+
+TEST(ToolchainProbeTest, SerializeRoundTrip)
+{
+    ToolchainInfo info;
+    info.d_crtbegin = "/usr/lib/gcc/x86_64-linux-gnu/9/crtbegin.o";
+    info.d_systemIncludeDirectories = {"/usr/local/include", "/usr/include"};
+    info.d_predefinedMacros = {"__GNUC__ 9", "__VERSION__ \"9.3.0\""};
+
+    ToolchainInfo result;
+    ASSERT_TRUE(
+        ToolchainProbe::deserialize(ToolchainProbe::serialize(info), &result));
+    EXPECT_EQ(info.d_crtbegin, result.d_crtbegin);
+    EXPECT_EQ(info.d_systemIncludeDirectories,
+              result.d_systemIncludeDirectories);
+    EXPECT_EQ(info.d_predefinedMacros, result.d_predefinedMacros);
+
+    EXPECT_FALSE(ToolchainProbe::deserialize("garbage\n", &result));
+    EXPECT_FALSE(ToolchainProbe::deserialize("", &result));
+}
+
+TEST(ToolchainProbeTest, CacheKeyChangesWithOptions)
+{
+    buildboxcommon::TemporaryDirectory tmpdir;
+    const std::string compiler = std::string(tmpdir.name()) + "/gcc";
+    FileUtils::writeFile(compiler, "#!/bin/sh\n");
+    ASSERT_EQ(0, chmod(compiler.c_str(), 0755));
+
+    const auto key = ToolchainProbe::cacheKey(compiler, {"-m32"});
+    EXPECT_FALSE(key.empty());
+    EXPECT_EQ(key, ToolchainProbe::cacheKey(compiler, {"-m32"}));
+    EXPECT_NE(key, ToolchainProbe::cacheKey(compiler, {"-m64"}));
+
+    FileUtils::writeFile(compiler, "#!/bin/sh\nexit 0\n");
+    EXPECT_NE(key, ToolchainProbe::cacheKey(compiler, {"-m32"}));
+
+    EXPECT_EQ("", ToolchainProbe::cacheKey(compiler + "-missing", {}));
+}
+
+TEST(ToolchainProbeTest, ProbeIsCached)
+{
+    buildboxcommon::TemporaryDirectory tmpdir;
+    const std::string directory = tmpdir.name();
+    const std::string compiler = directory + "/gcc";
+    const std::string counter = directory + "/count";
+    // Pretend to be a compiler, and count how many times we're run.
+    FileUtils::writeFile(
+        compiler,
+        "#!/bin/sh\n"
+        "echo run >> \"" + counter + "\"\n"
+        "echo '#define __FAKE__ 1'\n"
+        "echo '#include <...> search starts here:' >&2\n"
+        "echo ' /opt/fake/include' >&2\n"
+        "echo 'End of search list.' >&2\n");
+    ASSERT_EQ(0, chmod(compiler.c_str(), 0755));
+
+    const auto previousCacheDir = RECC_CACHE_DIR;
+    const auto previousCacheToolchains = RECC_CACHE_TOOLCHAINS;
+    RECC_CACHE_DIR = directory + "/cache";
+    RECC_CACHE_TOOLCHAINS = true;
+
+    const auto command =
+        ParsedCommandFactory::createParsedCommand({compiler, "-c", "hello.c"});
+    for (int i = 0; i < 3; ++i) {
+        const auto info = ToolchainProbe::get(command);
+        EXPECT_EQ(std::vector<std::string>({"/opt/fake/include"}),
+                  info.d_systemIncludeDirectories);
+        EXPECT_EQ(std::vector<std::string>({"__FAKE__ 1"}),
+                  info.d_predefinedMacros);
+    }
+
+    EXPECT_EQ("run\n",
+              buildboxcommon::FileUtils::getFileContents(counter.c_str()));
+
+    // Not cached unless asked for, even with a cache directory
+    RECC_CACHE_TOOLCHAINS = false;
+    ToolchainProbe::get(command);
+    EXPECT_EQ("run\nrun\n",
+              buildboxcommon::FileUtils::getFileContents(counter.c_str()));
+
+    RECC_CACHE_DIR = previousCacheDir;
+    RECC_CACHE_TOOLCHAINS = previousCacheToolchains;
+}
+
+TEST(ToolchainProbeTest, FailedProbeIsCached)
+{
+    buildboxcommon::TemporaryDirectory tmpdir;
+    const std::string directory = tmpdir.name();
+    const std::string compiler = directory + "/gcc";
+    const std::string counter = directory + "/count";
+    FileUtils::writeFile(compiler, "#!/bin/sh\n"
+                                   "echo run >> \"" +
+                                       counter +
+                                       "\"\n"
+                                       "exit 1\n");
+    ASSERT_EQ(0, chmod(compiler.c_str(), 0755));
+
+    const auto previousCacheDir = RECC_CACHE_DIR;
+    const auto previousCacheToolchains = RECC_CACHE_TOOLCHAINS;
+    RECC_CACHE_DIR = directory + "/cache";
+    RECC_CACHE_TOOLCHAINS = true;
+
+    const auto command =
+        ParsedCommandFactory::createParsedCommand({compiler, "-c", "hello.c"});
+    for (int i = 0; i < 3; ++i) {
+        const auto info = ToolchainProbe::get(command);
+        EXPECT_TRUE(info.d_systemIncludeDirectories.empty());
+        EXPECT_TRUE(info.d_predefinedMacros.empty());
+    }
+    EXPECT_EQ("run\n",
+              buildboxcommon::FileUtils::getFileContents(counter.c_str()));
+
+    // Probed again once the compiler changes
+    FileUtils::writeFile(compiler, "#!/bin/sh\n"
+                                   "echo run >> \"" +
+                                       counter +
+                                       "\"\n"
+                                       "echo '#define __FIXED__ 1'\n");
+    EXPECT_EQ(std::vector<std::string>({"__FIXED__ 1"}),
+              ToolchainProbe::get(command).d_predefinedMacros);
+
+    RECC_CACHE_DIR = previousCacheDir;
+    RECC_CACHE_TOOLCHAINS = previousCacheToolchains;
+}
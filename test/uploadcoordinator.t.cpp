@@ -0,0 +1,132 @@
+// Copyright 2020 Bloomberg Finance L.P
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <digestgenerator.h>
+#include <uploadcoordinator.h>
+
+#include <buildboxcommon_temporarydirectory.h>
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <sys/stat.h>
+
+using namespace BloombergLP::recc;
+
+namespace {
+
+const std::chrono::milliseconds Timeout(200);
+
+} // namespace
+
+TEST(UploadCoordinatorTest, ClaimsUnlockedDigests)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    const UploadCoordinator coordinator(directory.name(), Timeout);
+
+    const auto a = DigestGenerator::make_digest("a");
+    const auto b = DigestGenerator::make_digest("b");
+    const auto claims = coordinator.claim({a, b});
+    EXPECT_EQ(claims->claimed(), digest_uset({a, b}));
+    EXPECT_TRUE(claims->inFlight().empty());
+}
+
+TEST(UploadCoordinatorTest, DigestsLockedElsewhereAreInFlight)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    // Locks taken through different coordinators conflict like those of
+    // different processes
+    const UploadCoordinator coordinator1(directory.name(), Timeout);
+    const UploadCoordinator coordinator2(directory.name(), Timeout);
+
+    const auto a = DigestGenerator::make_digest("a");
+    const auto b = DigestGenerator::make_digest("b");
+    const auto c = DigestGenerator::make_digest("c");
+    auto claims1 = coordinator1.claim({a, b});
+
+    const auto claims2 = coordinator2.claim({b, c});
+    EXPECT_EQ(claims2->claimed(), digest_uset({c}));
+    EXPECT_EQ(claims2->inFlight(), digest_uset({b}));
+
+    // Once released, the digests can be claimed again
+    claims1.reset();
+    const auto claims3 = coordinator2.claim({a, b});
+    EXPECT_EQ(claims3->claimed(), digest_uset({a, b}));
+}
+
+TEST(UploadCoordinatorTest, WaitForReleasedLocks)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    const UploadCoordinator coordinator1(directory.name(), Timeout);
+    const UploadCoordinator coordinator2(directory.name(), Timeout);
+
+    const auto a = DigestGenerator::make_digest("a");
+    auto claims = coordinator1.claim({a});
+    claims.reset();
+
+    const auto start = std::chrono::steady_clock::now();
+    coordinator2.waitFor({a});
+    EXPECT_LT(std::chrono::steady_clock::now() - start, Timeout);
+}
+
+TEST(UploadCoordinatorTest, WaitForHeldLocksTimesOut)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    const UploadCoordinator coordinator1(directory.name(), Timeout);
+    const UploadCoordinator coordinator2(directory.name(), Timeout);
+
+    const auto a = DigestGenerator::make_digest("a");
+    const auto claims = coordinator1.claim({a});
+
+    const auto start = std::chrono::steady_clock::now();
+    coordinator2.waitFor({a});
+    EXPECT_GE(std::chrono::steady_clock::now() - start, Timeout);
+}
+
+TEST(UploadCoordinatorTest, LockFilesAreRemoved)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    const UploadCoordinator coordinator(directory.name(), Timeout);
+
+    const auto a = DigestGenerator::make_digest("a");
+    const std::string lockFile = std::string(directory.name()) + "/" +
+                                 a.hash() + "_" +
+                                 std::to_string(a.size_bytes());
+    struct stat statResult;
+    {
+        const auto claims = coordinator.claim({a});
+        EXPECT_EQ(stat(lockFile.c_str(), &statResult), 0);
+    }
+    EXPECT_NE(stat(lockFile.c_str(), &statResult), 0);
+}
+
+TEST(UploadCoordinatorTest, LimitsLocksToLargestBlobs)
+{
+    buildboxcommon::TemporaryDirectory directory;
+    const UploadCoordinator coordinator1(directory.name(), Timeout);
+    const UploadCoordinator coordinator2(directory.name(), Timeout);
+
+    digest_uset digests;
+    for (size_t i = 0; i <= UploadCoordinator::s_maxLocks; ++i) {
+        digests.insert(
+            DigestGenerator::make_digest(std::string(i + 1, 'x')));
+    }
+    const auto claims1 = coordinator1.claim(digests);
+    EXPECT_EQ(claims1->claimed().size(), digests.size());
+
+    // Only the smallest one wasn't locked
+    const auto claims2 = coordinator2.claim(digests);
+    ASSERT_EQ(claims2->claimed().size(), 1);
+    EXPECT_EQ(claims2->claimed().begin()->size_bytes(), 1);
+}